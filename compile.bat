@@ -1,3 +1,3 @@
 @echo off
-"gcc.exe" -Iinclude -std=gnu11 -Wall -Wextra "src/DSConv.c" "src/lexer.c" "src/parser.c" "src/generator.c" -o "dsconv.exe"
+"gcc.exe" -Iinclude -std=gnu11 -Wall -Wextra "src/DSConv.c" "src/lexer.c" "src/parser.c" "src/generator.c" "src/memstat.c" "src/report.c" "src/preproc.c" "src/ast.c" "src/thread.c" "src/intern.c" "src/depgraph.c" "src/prefetch.c" "src/layout.c" "src/gen_hash.c" "src/gen_pool.c" "src/gen_enum.c" "src/symindex.c" "src/lazy.c" "src/flatast.c" "src/gen_reflect.c" "src/gen_cpp.c" "src/gen_handle.c" "src/gen_map.c" "src/gen_sort.c" -o "dsconv.exe"
 pause
\ No newline at end of file
@@ -0,0 +1,6 @@
+@echo off
+rem Builds libdsconv.a (public header: include/libdsconv.h) for in-process use.
+"gcc.exe" -Iinclude -std=gnu11 -Wall -Wextra -O2 -c "src/libdsconv.c" "src/lexer.c" "src/parser.c" "src/generator.c" "src/memstat.c" "src/report.c" "src/preproc.c" "src/ast.c" "src/thread.c" "src/intern.c" "src/depgraph.c" "src/layout.c" "src/gen_hash.c" "src/gen_pool.c" "src/gen_enum.c" "src/flatast.c" "src/gen_reflect.c" "src/gen_cpp.c" "src/gen_handle.c" "src/gen_map.c" "src/gen_sort.c"
+"ar.exe" rcs "libdsconv.a" libdsconv.o lexer.o parser.o generator.o memstat.o report.o preproc.o ast.o thread.o intern.o depgraph.o layout.o gen_hash.o gen_pool.o gen_enum.o flatast.o gen_reflect.o gen_cpp.o gen_handle.o gen_map.o gen_sort.o
+del libdsconv.o lexer.o parser.o generator.o memstat.o report.o preproc.o ast.o thread.o intern.o depgraph.o layout.o gen_hash.o gen_pool.o gen_enum.o flatast.o gen_reflect.o gen_cpp.o gen_handle.o gen_map.o gen_sort.o
+pause
@@ -3,6 +3,7 @@
 
 /* AST declarations for C-like type system */
 
+#include <stddef.h>
 #include <stdint.h>
 
 typedef enum {
@@ -18,9 +19,16 @@ typedef enum {
 
 typedef struct Type Type;
 
+/* Type qualifiers (Type.quals). */
+enum {
+    QUAL_CONST = 1,
+    QUAL_VOLATILE = 2
+};
+
 typedef struct Member {
     char *name; /* may be NULL for anonymous members */
     Type *type;
+    int bits; /* bit-field width, 0 if not a bit-field */
     struct Member *next;
 } Member;
 
@@ -33,21 +41,36 @@ typedef struct StructInfo {
 typedef struct EnumValue {
     char *name;
     int64_t value;
+    char *spelling; /* the literal as written ("0x10u"), or NULL */
+    /* expr: a value that could not be evaluated, as written (value is then
+     * 0), and the line it was on; an enumerator after one has "prev + 1"
+     * and line 0 */
+    char *expr;
+    int line;
     struct EnumValue *next;
 } EnumValue;
 
+typedef struct EnumInfo {
+    char *tag; /* may be NULL for anonymous */
+    EnumValue *values; /* NULL for a reference to a tag */
+} EnumInfo;
+
 struct Type {
     TypeKind kind;
     union {
         char *builtin_name; /* e.g., "int", "char" */
         struct { Type *base; } ptr;
-        struct { Type *base; int length; } array;
+        /* expr: a size that could not be evaluated, as written (length
+         * is then 0), and the line it was on */
+        struct { Type *base; int length; int line; char *expr; } array;
         struct { Type *ret; Type *params; /* params as linked list via Member.name holding param name */ } func;
         StructInfo s;
-        EnumValue *e;
+        EnumInfo en;
         char *alias_to; /* name of the aliased type */
     } u;
     Type *next; /* for lists */
+    int quals;    /* QUAL_CONST | QUAL_VOLATILE */
+    int interned; /* owned by a TypeTable and shared; see intern.h */
 };
 
 typedef struct ASTNode {
@@ -57,8 +80,50 @@ typedef struct ASTNode {
     struct ASTNode *next;
 } ASTNode;
 
+/* Counters collected while building one ASTRoot (reported with -p). */
+typedef struct ParseStats {
+    size_t source_bytes;
+    size_t tokens;
+    size_t decls;
+    double read_wall, read_cpu;   /* loading the source */
+    double pp_wall, pp_cpu;       /* preprocessing, excluding reads */
+    size_t pp_files, pp_cache_hits, pp_guard_skips; /* PPStats counters */
+    double lex_wall, lex_cpu;     /* inside lexer_next */
+    double parse_wall, parse_cpu; /* parsing, excluding lexing */
+} ParseStats;
+
+/* Counters from merging inputs through a TypeTable (reported with -p). */
+typedef struct MergeStats {
+    size_t types;           /* type nodes looked up */
+    size_t unique_types;    /* distinct type nodes kept */
+    size_t duplicate_decls; /* identical declarations dropped */
+    size_t conflicts;       /* same name or tag with a different definition */
+} MergeStats;
+
+/* Sizes of the AST handed to generation, as linked nodes and as the
+ * index-based copy built from them (flatast.h); reported with -p. */
+typedef struct FlatStats {
+    size_t types, members, values, decls, strings;
+    size_t linked_bytes; /* nodes plus the strings they own */
+    size_t flat_bytes;   /* arrays plus the string pool */
+} FlatStats;
+
 typedef struct ASTRoot {
     ASTNode *first;
+    ASTNode *last; /* nodes are kept in source order */
+    ParseStats stats;
 } ASTRoot;
 
+/* Ownership helpers (ast.c). Every node owns its type tree, except for
+ * interned types which belong to their TypeTable; type_free leaves those
+ * alone, type_release frees the node itself but still not its children. */
+void type_free(Type *t);
+void type_release(Type *t);
+/* Deep copy (interned types are shared, not copied). */
+Type *type_copy(const Type *t);
+void ast_node_free(ASTNode *n);
+void ast_free(ASTRoot *root);
+/* Moves all nodes of src to the end of dst, leaving src empty. */
+void ast_append(ASTRoot *dst, ASTRoot *src);
+
 #endif /* DSCONV_AST_H */
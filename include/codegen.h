@@ -0,0 +1,82 @@
+#ifndef DSCONV_CODEGEN_H
+#define DSCONV_CODEGEN_H
+
+/* Companion code generated next to the declarations (gen_*.c).
+ *
+ * The generator calls codegen_prologue once at the top of every output
+ * file and codegen_emit after each declaration n of fa it writes. scope
+ * holds the declarations written so far to that file, n included, so
+ * member types can be resolved. Each generator checks its own option and
+ * does nothing when it is off. */
+
+#include "dsconv.h"
+#include "emitter.h"
+#include "flatast.h"
+#include "layout.h"
+
+/* Whether opts turn on any companion generator. */
+int codegen_enabled(const Options *opts);
+void codegen_prologue(Emitter *out, const Options *opts);
+void codegen_emit(Emitter *out, const TypeScope *scope, const FlatAST *fa, const FlatDecl *n, const Options *opts);
+
+/* The record a declaration defines, as generated code refers to it. */
+typedef struct {
+    const FlatType *type; /* the struct or union with its members */
+    const char *tag;      /* its tag, or NULL */
+    char spelled[256];    /* "T" for typedef names, else "struct T" */
+    const char *prefix;   /* identifier prefix for generated functions */
+} RecordName;
+
+/* Fills out when n defines a struct or union body that has a name to call
+ * it by (a typedef name or a tag); returns 0 otherwise. */
+int codegen_record(const FlatAST *fa, const FlatDecl *n, RecordName *out);
+
+/* The record names given to -pool, -handles, -hashmap and -sort, and
+ * whether a declaration written to the output matched each. NULL when no
+ * names were given. */
+typedef struct CodegenMatches CodegenMatches;
+CodegenMatches *codegen_matches_create(const Options *opts);
+void codegen_matches_destroy(CodegenMatches *m);
+/* Notes the requested names n defines; scope is as for codegen_emit. */
+void codegen_matches_add(CodegenMatches *m, const TypeScope *scope, const FlatAST *fa, const FlatDecl *n);
+/* Reports on stderr every name no declaration matched, or matched with a
+ * key that cannot be used; returns how many. */
+int codegen_matches_report(const CodegenMatches *m);
+
+/* -hash: T_hash and T_equal for every struct (gen_hash.c). */
+void gen_hash_prologue(Emitter *out, const Options *opts);
+void gen_hash_emit(Emitter *out, const TypeScope *scope, const FlatAST *fa, const FlatDecl *n, const Options *opts);
+
+/* -pool: typed slab allocators for the selected structs (gen_pool.c). */
+void gen_pool_prologue(Emitter *out, const Options *opts);
+void gen_pool_emit(Emitter *out, const TypeScope *scope, const FlatAST *fa, const FlatDecl *n, const Options *opts);
+
+/* -enumstr: E_to_string and E_from_string for every enum (gen_enum.c). */
+void gen_enum_prologue(Emitter *out, const Options *opts);
+void gen_enum_emit(Emitter *out, const TypeScope *scope, const FlatAST *fa, const FlatDecl *n, const Options *opts);
+
+/* -reflect: R_fields/R_reflect descriptor tables for every record (gen_reflect.c). */
+void gen_reflect_prologue(Emitter *out, const Options *opts);
+void gen_reflect_emit(Emitter *out, const TypeScope *scope, const FlatAST *fa, const FlatDecl *n, const Options *opts);
+
+/* -handles: P_ix variants with indices for pointers, and conversions (gen_handle.c). */
+void gen_handle_prologue(Emitter *out, const Options *opts);
+void gen_handle_emit(Emitter *out, const TypeScope *scope, const FlatAST *fa, const FlatDecl *n, const Options *opts);
+
+/* -hashmap T:key: P_map open-addressing maps of T keyed by a member (gen_map.c). */
+void gen_map_prologue(Emitter *out, const Options *opts);
+void gen_map_emit(Emitter *out, const TypeScope *scope, const FlatAST *fa, const FlatDecl *n, const Options *opts);
+/* Why rec cannot be keyed by its member key, or NULL if it can. */
+const char *gen_map_check(const TypeScope *scope, const FlatAST *fa, const RecordName *rec, const char *key);
+
+/* -sort T:key: P_sort_by_key radix/merge sorts of T arrays (gen_sort.c). */
+void gen_sort_prologue(Emitter *out, const Options *opts);
+void gen_sort_emit(Emitter *out, const TypeScope *scope, const FlatAST *fa, const FlatDecl *n, const Options *opts);
+/* Why rec cannot be sorted by its member key, or NULL if it can. */
+const char *gen_sort_check(const TypeScope *scope, const FlatAST *fa, const RecordName *rec, const char *key);
+
+/* -olang cpp: dsconv::fields<T> and dsconv::enum_names<E> (gen_cpp.c). */
+void gen_cpp_prologue(Emitter *out, const Options *opts);
+void gen_cpp_emit(Emitter *out, const TypeScope *scope, const FlatAST *fa, const FlatDecl *n, const Options *opts);
+
+#endif /* DSCONV_CODEGEN_H */
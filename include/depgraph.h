@@ -0,0 +1,61 @@
+#ifndef DSCONV_DEPGRAPH_H
+#define DSCONV_DEPGRAPH_H
+
+/* Declaration dependency graph and emission order.
+ *
+ * Declarations depend on the typedef names and struct/union tags their
+ * types mention: through struct members, pointer bases, array elements,
+ * aliases and function return types. A use by value needs the complete
+ * definition first; a use through a pointer only needs the tag, so the
+ * definition may come later and a forward declaration is placed before
+ * the first use instead. The graph is built over a FlatAST; declarations
+ * are numbered as its decls are (source order for flat_build). */
+
+#include <stddef.h>
+#include "ast.h"
+#include "flatast.h"
+
+typedef struct {
+    size_t index;    /* declaration to emit (position in the FlatAST) */
+    FlatRef forward; /* or, when not FLAT_NONE, the struct/union type to
+                      * forward-declare instead */
+} PlanItem;
+
+typedef struct {
+    PlanItem *items;
+    size_t count, cap;
+    size_t missing; /* roots that matched no declaration */
+} EmitPlan;
+
+/* Orders the declarations reachable from roots (typedef, variable or
+ * function names, or tags written as "struct T"/"union T"/"T") so every
+ * declaration follows what it needs. Unreachable declarations are left
+ * out. Roots that match nothing are reported on stderr. */
+void depgraph_plan(const FlatAST *fa, const char *const *roots, int root_count, EmitPlan *plan);
+/* Marks in selected[i] whether the i-th declaration is reachable from
+ * roots, without ordering. Returns the number of unmatched roots. */
+size_t depgraph_select(const FlatAST *fa, const char *const *roots, int root_count, unsigned char *selected);
+/* Same ordering for a set of declarations: selected[i] marks the i-th
+ * declaration of fa. What they need is pulled in as well. */
+void depgraph_plan_set(const FlatAST *fa, const unsigned char *selected, EmitPlan *plan);
+void emit_plan_free(EmitPlan *plan);
+
+/* Splits the declarations into groups that never mention each other
+ * (connected components of the graph, edge direction ignored). Writes the
+ * group of the i-th declaration to component[i], groups numbered in order
+ * of first appearance, and returns the number of groups. */
+size_t depgraph_components(const FlatAST *fa, size_t *component);
+
+/* The tagged struct or union a declaration's type defines (possibly under
+ * pointers, arrays or a function), or NULL / FLAT_NONE. */
+const Type *depgraph_defined_record(const Type *t);
+FlatRef depgraph_flat_record(const FlatAST *fa, FlatRef t);
+
+/* Calls fn for every typedef name (kind TYPE_ALIAS) and every struct,
+ * union or enum tag referenced without a body that t mentions, through the
+ * same edges the graph follows (enum tags included). Used to find what a
+ * declaration needs before the rest of the input is parsed. */
+typedef void (*MentionFn)(TypeKind kind, const char *name, void *user);
+void depgraph_mentions(const Type *t, MentionFn fn, void *user);
+
+#endif /* DSCONV_DEPGRAPH_H */
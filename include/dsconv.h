@@ -7,6 +7,13 @@ extern "C" {
 
 #include <stddef.h>
 
+/* Per-token/per-declaration tracing on stderr; build with -DDSCONV_TRACE. */
+#ifdef DSCONV_TRACE
+#define DS_TRACE(...) fprintf(stderr, __VA_ARGS__)
+#else
+#define DS_TRACE(...) ((void)0)
+#endif
+
 typedef enum {
     NAME_POLICY_PRESERVE = 0,
     NAME_POLICY_AUTO,
@@ -24,11 +31,27 @@ typedef enum {
     WRAP_AS_ARRAY
 } ExpandMode;
 
+/* How generated hash/equality code treats pointer members (-hashptr). */
+typedef enum {
+    POINTER_STRINGS = 0, /* char pointers as strings, others by address */
+    POINTER_ADDRESS,
+    POINTER_SKIP
+} PointerPolicy;
+
+/* Language of the generated output (-olang). */
+typedef enum {
+    OUTPUT_C = 0,
+    OUTPUT_CPP /* C++17: the C declarations plus constexpr field and enum tables */
+} OutputLang;
+
+struct PPContext;
+
 typedef struct {
     const char *input_file;
     const char *input_string;
     const char *src_lang; /* "c", "fb", "fp" */
     const char *targets;  /* comma-separated targets or "all" */
+    OutputLang output_lang; /* what targets selects */
     const char *output_file;
     const char *metadata_file;
     const char *instance_name;
@@ -47,6 +70,30 @@ typedef struct {
     int global_scope;
     int local_scope;
     char *local_function;
+    int preprocess; /* run the built-in preprocessor (default on, -nopp) */
+    struct PPContext *pp; /* preprocessor state for this run (preproc.h) */
+    int streaming;  /* parse and emit one declaration at a time (-stream) */
+    int jobs;       /* worker threads, 0 = one per CPU (-j) */
+    const char **roots; /* emit only what these names need (-root) */
+    int root_count;
+    int shards;     /* split the output into this many files (-shards) */
+    int hash_functions; /* T_hash/T_equal for every struct (-hash) */
+    PointerPolicy pointer_policy; /* pointers in generated hashes (-hashptr) */
+    const char **pool_types; /* structs to generate pool allocators for (-pool) */
+    int pool_type_count;
+    int pool_thread_cache; /* per-thread pools as well (-pooltls) */
+    int enum_strings; /* E_to_string/E_from_string for every enum (-enumstr) */
+    int reflect_tables; /* field descriptor tables for every record (-reflect) */
+    const char **handle_types; /* structs to generate index-linked variants for (-handles) */
+    int handle_type_count;
+    const char **map_specs; /* "T:key" hash maps to generate (-hashmap) */
+    int map_spec_count;
+    const char **sort_specs; /* "T:key" sort routines to generate (-sort) */
+    int sort_spec_count;
+    const char *index_file; /* persistent symbol index (-index, symindex.h) */
+    const char **query_names; /* names to extract through the index (-query) */
+    int query_count;
+    const char *manifest_file; /* generation jobs over one parse (-manifest) */
 } Options;
 
 #ifdef __cplusplus
@@ -0,0 +1,31 @@
+#ifndef DSCONV_EMITTER_H
+#define DSCONV_EMITTER_H
+
+/* Output sink shared by the C printer (generator.c) and the generators of
+ * companion code written after a declaration (gen_*.c). */
+
+#include <stdio.h>
+#include "ast.h"
+#include "flatast.h"
+#include "generator.h"
+
+/* A FILE, a caller's write callback or (neither set) a memory buffer.
+ * Counts bytes so the -p report can show output size. */
+typedef struct Emitter {
+    FILE *f;
+    GenWriteFn write;
+    void *user;
+    char *buf;
+    size_t len, cap;
+    size_t bytes;
+    int literals; /* enumerator values as written in the source (-sf) */
+} Emitter;
+
+void emit(Emitter *e, const char *fmt, ...);
+/* Writes data verbatim, e.g. text rendered into another Emitter. */
+void emit_bytes(Emitter *e, const char *data, size_t len);
+/* Full C declaration of name with type t of fa, e.g. "int (*cb)()" or
+ * "char *argv[4]"; record bodies are indented by indent levels. */
+void emit_decl(Emitter *f, const FlatAST *fa, FlatRef t, const char *name, int indent);
+
+#endif /* DSCONV_EMITTER_H */
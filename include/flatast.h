@@ -0,0 +1,92 @@
+#ifndef DSCONV_FLATAST_H
+#define DSCONV_FLATAST_H
+
+/* Compact, index-based copy of an ASTRoot that generation works from
+ * (the C printer, the dependency graph, the type scope and the companion
+ * generators), so the linked nodes can be freed once it is built.
+ *
+ * Types, record members, enumerators and declarations each live in one
+ * contiguous array and refer to each other by 32-bit index instead of
+ * pointer. The members of a record and the values of an enum are a range
+ * (first, count) of their array rather than a next chain, and every name
+ * is an offset into a single string pool that holds each distinct string
+ * once. Types shared in the source AST (interned by a TypeTable) are
+ * stored once as well. A FlatAST does not refer back to the AST it was
+ * built from and is read-only once built, so several threads may use it. */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "ast.h"
+
+typedef uint32_t FlatRef;
+#define FLAT_NONE UINT32_MAX
+
+typedef struct {
+    uint8_t kind;    /* TypeKind */
+    uint8_t forward; /* StructInfo.is_forward */
+    uint8_t quals;   /* Type.quals */
+    FlatRef name;    /* builtin name, tag, aliased name or an array size kept
+                      * as written; FLAT_NONE if none */
+    FlatRef base;    /* pointer base, array element, function return type;
+                      * first member or enumerator of a record or enum;
+                      * for a standard typedef name (size_t, uint32_t, ...)
+                      * a builtin type of the same name it stands for */
+    int32_t count;   /* members or enumerators (0: no body); array length */
+} FlatType;
+
+typedef struct {
+    FlatRef name; /* FLAT_NONE for anonymous members */
+    FlatRef type;
+    int32_t bits;
+} FlatMember;
+
+typedef struct {
+    FlatRef name;
+    FlatRef spelling; /* FLAT_NONE if not kept */
+    FlatRef expr;     /* value kept as written (EnumValue.expr), or FLAT_NONE */
+    int64_t value;
+} FlatEnumValue;
+
+typedef struct {
+    FlatRef type;
+    FlatRef name;
+    int32_t is_typedef;
+} FlatDecl;
+
+typedef struct FlatBuilder FlatBuilder;
+
+typedef struct FlatAST {
+    FlatType *types;
+    size_t type_count;
+    FlatMember *members;
+    size_t member_count;
+    FlatEnumValue *values;
+    size_t value_count;
+    FlatDecl *decls; /* in the order added (source order for flat_build) */
+    size_t decl_count;
+    char *strings;
+    size_t strings_len;
+    FlatStats stats;
+    FlatBuilder *builder; /* capacities and the pointer/string maps */
+} FlatAST;
+
+FlatAST *flat_create(void);
+void flat_destroy(FlatAST *fa);
+/* Empties fa, keeping its storage for reuse. */
+void flat_clear(FlatAST *fa);
+/* Appends n with everything its type mentions not stored yet; returns the
+ * index of its FlatDecl. */
+FlatRef flat_add(FlatAST *fa, const ASTNode *n);
+/* Forgets which type nodes were stored, keeping what was added, before the
+ * nodes are freed: types added later at a reused address are new ones. */
+void flat_forget_types(FlatAST *fa);
+/* All nodes of ast in source order: the i-th node is decls[i]. Nothing
+ * is added to the result afterwards. */
+FlatAST *flat_build(const ASTRoot *ast);
+
+/* The string at offset s of the pool, or NULL for FLAT_NONE. */
+const char *flat_str(const FlatAST *fa, FlatRef s);
+/* The type at index t, or NULL for FLAT_NONE. */
+const FlatType *flat_type(const FlatAST *fa, FlatRef t);
+
+#endif /* DSCONV_FLATAST_H */
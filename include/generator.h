@@ -3,8 +3,39 @@
 
 #include "ast.h"
 #include "dsconv.h"
+#include "flatast.h"
+#include "report.h"
 
-/* Generate target code for given AST and options. */
-int generate_for_targets(const ASTRoot *ast, const Options *opts);
+/* The flat copy of ast that generation reads (flatast.h); its sizes are
+ * recorded in report when it is non-NULL. Nothing generated refers back to
+ * ast, which may be freed (with its TypeTable) once this returns. NULL for
+ * a NULL ast. */
+FlatAST *generate_prepare(const ASTRoot *ast, Report *report);
+
+/* Generate target code for the declarations of flat and given options.
+ * Output sizes are recorded in report when it is non-NULL. */
+int generate_for_targets(const FlatAST *flat, const Options *opts, Report *report);
+
+/* Runs count option sets (manifest jobs) over the same flat AST on up to
+ * workers threads (0 = one per CPU). Each job writes its own outputs,
+ * which are recorded in report in job order. Returns the number of jobs
+ * that failed. */
+int generate_jobs(const FlatAST *flat, const Options *jobs, int count, int workers, Report *report);
+
+/* Receives generated text in pieces (not NUL-terminated). */
+typedef void (*GenWriteFn)(const char *data, size_t len, void *user);
+
+/* Same as generate_for_targets but hands the output to write instead of a
+ * file; -shards is not available here. */
+int generate_to_sink(const FlatAST *flat, const Options *opts, GenWriteFn write, void *user, Report *report);
+
+/* Incremental interface used by the streaming pipeline: declarations are
+ * emitted one at a time as they are parsed, and may be freed as soon as
+ * generator_emit returns. */
+typedef struct Generator Generator;
+Generator *generator_open(const Options *opts);
+Generator *generator_open_sink(const Options *opts, GenWriteFn write, void *user);
+void generator_emit(Generator *g, const ASTNode *n);
+int generator_close(Generator *g, Report *report);
 
 #endif /* DSCONV_GENERATOR_H */
@@ -0,0 +1,33 @@
+#ifndef DSCONV_INTERN_H
+#define DSCONV_INTERN_H
+
+/* Structural hash-consing of types and deduplicating merge of inputs.
+ *
+ * A TypeTable keeps one canonical node per distinct type tree: children are
+ * interned first, so two trees are equal exactly when their kinds, names and
+ * (canonical) child pointers are equal, and hashing is shallow. Interned
+ * nodes are flagged and owned by the table; they live until
+ * type_table_destroy. */
+
+#include "ast.h"
+
+typedef struct TypeTable TypeTable;
+
+TypeTable *type_table_create(void);
+/* Frees every canonical type. ASTs merged through the table must not be
+ * used afterwards. */
+void type_table_destroy(TypeTable *tt);
+
+/* Interns t (consuming it) and returns the canonical node. */
+Type *type_intern(TypeTable *tt, Type *t);
+
+/* Moves the nodes of src to the end of dst, interning their types. A node
+ * whose name was already merged with the same definition is dropped; one
+ * with a different definition, or one that redefines a struct/union tag
+ * with a different body, is reported on stderr and dropped as well, so the
+ * first definition wins. origin names src in messages (may be NULL). */
+void type_table_merge(TypeTable *tt, ASTRoot *dst, ASTRoot *src, const char *origin);
+
+const MergeStats *type_table_stats(const TypeTable *tt);
+
+#endif /* DSCONV_INTERN_H */
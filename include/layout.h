@@ -0,0 +1,67 @@
+#ifndef DSCONV_LAYOUT_H
+#define DSCONV_LAYOUT_H
+
+/* Type resolution and memory layout for generated code.
+ *
+ * A TypeScope maps typedef names and struct/union tags to the declarations
+ * of a FlatAST seen so far, so aliases and tag references can be followed
+ * to what they stand for. Layouts follow the data model of the compiler dsconv was
+ * built with (sizes and alignments of the builtin types, members at their
+ * natural alignment); generated code that depends on a computed size
+ * checks it with a static assertion. */
+
+#include <stddef.h>
+#include "ast.h"
+#include "flatast.h"
+
+typedef struct TypeScope TypeScope;
+
+/* A scope over the declarations of fa, which must outlive it. fa may grow
+ * (flat_add) while the scope is in use. */
+TypeScope *scope_create(const FlatAST *fa);
+void scope_destroy(TypeScope *s);
+/* Records the typedef name and the struct/union tags n (a declaration of
+ * the scope's FlatAST) defines. */
+void scope_add(TypeScope *s, const FlatDecl *n);
+/* Follows typedef names and tag references to the defining type. Standard
+ * typedefs (uint32_t, size_t, ...) resolve to builtins; names nothing is
+ * known about are returned unchanged as TYPE_ALIAS. */
+const FlatType *scope_resolve(const TypeScope *s, const FlatType *t);
+/* Follows t as scope_resolve does; when it ends at a struct or union with
+ * members, sets *record to it and returns the name the record is known by:
+ * its tag, or for an anonymous record the typedef name that stands for it
+ * (NULL if it has neither). Otherwise *record is NULL. */
+const char *scope_record_name(const TypeScope *s, const FlatType *t, const FlatType **record);
+/* Whether objects of type t cannot be assigned as a whole: t, its element
+ * type or a typedef it goes through is const, or it is a record with such
+ * a member. */
+int scope_read_only(const TypeScope *s, const FlatType *t);
+/* A read-only view of s for generating declarations out of order (on
+ * several threads): it shares s's entries but only sees what the first
+ * `declarations` scope_add calls recorded, as s did at that point. s must
+ * not change while views exist; destroy views with scope_destroy. */
+TypeScope *scope_view(const TypeScope *s);
+/* Number of scope_add calls so far. */
+size_t scope_declarations(const TypeScope *s);
+void scope_view_limit(TypeScope *view, size_t declarations);
+
+typedef struct {
+    size_t size, align;
+    int padded;   /* has bytes no member covers (between, after, in unions) */
+    int pointers; /* has pointer members, directly or in nested members */
+} Layout;
+
+/* Computes the layout of t. Returns 0 when it cannot be known: unresolved
+ * names, bit-fields, arrays without a length, functions, void. */
+int layout_of(const TypeScope *s, const FlatType *t, Layout *out);
+
+/* Whether a builtin type name is floating point (float, double, ...). */
+int builtin_is_floating(const char *name);
+/* Whether a builtin or standard type name is unsigned (unsigned ...,
+ * uintN_t, size_t, _Bool). */
+int builtin_is_unsigned(const char *name);
+/* Whether name is a standard typedef scope_resolve knows (size_t,
+ * uint32_t, ...). */
+int builtin_is_standard(const char *name);
+
+#endif /* DSCONV_LAYOUT_H */
@@ -0,0 +1,32 @@
+#ifndef DSCONV_LAZY_H
+#define DSCONV_LAZY_H
+
+/* Skim-then-parse for runs that only emit part of their input (-root).
+ *
+ * Each input is preprocessed as usual and skimmed (parse_skim): only the
+ * extent of every top-level declaration and the names and tags it defines
+ * are recorded, no types are built. lazy_materialize then parses just the
+ * declarations the roots reach, following the names and tags each parsed
+ * declaration mentions, and merges them in source order, so generation
+ * sees the same declarations it would after a full parse. */
+
+#include <stddef.h>
+#include "ast.h"
+#include "dsconv.h"
+#include "intern.h"
+
+typedef struct LazySet LazySet;
+
+LazySet *lazy_create(const Options *opts);
+void lazy_destroy(LazySet *ls);
+
+/* Preprocesses and skims the contents of path already read into data
+ * (ds_malloc'd, ownership taken); with data NULL, path is taken as code.
+ * stats gets read, preprocess and skim times. Returns 0 on failure. */
+int lazy_add(LazySet *ls, const char *path, char *data, size_t len, ParseStats *stats);
+
+/* Parses what roots (as for depgraph_plan) need and merges it into out
+ * through types. Returns the number of declarations parsed. */
+size_t lazy_materialize(LazySet *ls, const char *const *roots, int root_count, TypeTable *types, ASTRoot *out);
+
+#endif /* DSCONV_LAZY_H */
@@ -2,6 +2,7 @@
 #define DSCONV_LEXER_H
 
 #include <stddef.h>
+#include <stdio.h>
 
 typedef enum {
     TOK_EOF = 0,
@@ -38,20 +39,90 @@ typedef enum {
     TOK_DOUBLE
 } TokenKind;
 
+/* Value of a numeric literal or character constant ('a', '\n'),
+ * computed once while lexing. */
+typedef struct {
+    unsigned long long value; /* integer literals, modulo 2^64 */
+    double fvalue;            /* floating literals */
+    unsigned char is_float;
+    unsigned char overflow;    /* integer does not fit in 64 bits */
+    unsigned char valid;       /* 0 for malformed literals (09, 0x, 1q), and
+                                * character constants of several or non-ASCII
+                                * characters */
+} NumLit;
+
+/* Two-character operators in Token.op, e.g. LEX_OP2('<', '<'). */
+#define LEX_OP2(a, b) (((a) << 8) | (b))
+
 typedef struct {
     TokenKind kind;
     char *text; /* allocated; NULL for simple tokens */
     int line;
+    int op;     /* TOK_OTHER: the punctuator ('-', LEX_OP2('<', '<'), ...) */
+    NumLit num; /* TOK_NUMBER (also character constants): the literal's
+                 * value (text keeps its spelling) */
 } Token;
 
 typedef struct Lexer Lexer;
 
+typedef struct {
+    size_t bytes;               /* source bytes loaded */
+    size_t tokens;              /* tokens produced */
+    double read_wall, read_cpu; /* loading the file */
+    double lex_wall, lex_cpu;   /* inside lexer_next, only with timing on */
+} LexStats;
+
 Lexer *lexer_create_from_file(const char *path);
 Lexer *lexer_create_from_string(const char *str);
+/* Takes ownership of buf, which must be NUL-terminated at buf[len]. */
+Lexer *lexer_create_from_buffer(char *buf, size_t len);
+/* Lexes buf[0..len) in place without taking ownership; first_line is the
+ * line number of buf[0]. Used for chunks of a larger buffer. */
+Lexer *lexer_create_from_range(const char *buf, size_t len, int first_line);
+/* Loads a whole file into a NUL-terminated ds_malloc'd buffer. */
+char *lexer_load_file(const char *path, size_t *len_out);
+/* Streaming lexer: reads f through a small refillable window instead of
+ * loading it whole. Closes f on destroy when owns is set. */
+Lexer *lexer_create_from_stream(FILE *f, int owns);
 void lexer_destroy(Lexer *lx);
 Token lexer_next(Lexer *lx);
 Token lexer_peek(Lexer *lx);
 
+/* Position after the last token taken with lexer_next (a peeked token not
+ * counted): the byte offset in the buffer and the line there. Not for
+ * streaming lexers. */
+size_t lexer_offset(const Lexer *lx);
+int lexer_line(const Lexer *lx);
+
+/* Per-token timing costs two clock reads, so it is off unless a report was
+ * requested (-p). */
+void lexer_set_timing(Lexer *lx, int on);
+void lexer_get_stats(const Lexer *lx, LexStats *out);
+
+/* Skips a brace-enclosed block (function body, initializer) without
+ * tokenizing it. The next token must be '{'; strings, character literals
+ * and comments are honoured. Returns 1 when the matching '}' was consumed. */
+int lexer_skip_block(Lexer *lx);
+
+/* Pre-scan for chunked parsing: finds offsets that are safe places to cut
+ * buf (right after a top-level ';' or function body, outside comments,
+ * literals and directives), at most one per chunk_bytes. Returns the number
+ * of chunks; (*out)[k] is the start offset and line number of chunk k, the
+ * first one always being {0, 1}. Line markers are honoured. */
+typedef struct {
+    size_t offset;
+    int line;
+} LexSplit;
+size_t lexer_find_splits(const char *buf, size_t len, size_t chunk_bytes, LexSplit **out);
+
+/* Converts the C numeric literal s[0..n) (a whole pp-number: prefix,
+ * digits, ' separators, exponent and suffix). Returns out->valid. */
+int lexer_parse_number(const char *s, size_t n, NumLit *out);
+
+/* Converts the character constant s ('a', '\n', '\x41'), quotes included.
+ * Returns out->valid. */
+int lexer_parse_char(const char *s, NumLit *out);
+
 /* helpers */
 int token_is_ident(const Token *t, const char *s);
 
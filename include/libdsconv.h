@@ -0,0 +1,61 @@
+#ifndef LIBDSCONV_H
+#define LIBDSCONV_H
+
+/* Embeddable DSConv: parse, merge and generate in-process.
+ *
+ * A DSConvContext owns everything a conversion needs (options,
+ * preprocessor state, type table and the merged AST). Nothing is shared
+ * between contexts, so different threads may each use their own context
+ * at the same time; a single context must not be used from two threads at
+ * once. Build with compile_lib.bat to get libdsconv.a. */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include "dsconv.h"
+#include "ast.h"
+
+typedef struct DSConvContext DSConvContext;
+
+/* Receives generated text in pieces (not NUL-terminated). */
+typedef void (*DSConvWriteFn)(const char *data, size_t len, void *user);
+
+DSConvContext *dsconv_create(void);
+void dsconv_destroy(DSConvContext *ctx);
+
+/* Options used for parsing and generation; adjust before use. Defaults
+ * match the command line (preprocessing on, one job). */
+Options *dsconv_options(DSConvContext *ctx);
+void dsconv_add_include_path(DSConvContext *ctx, const char *dir);
+/* Predefines a macro: "NAME", "NAME=value" or "NAME(a,b)=body". */
+void dsconv_define(DSConvContext *ctx, const char *def);
+/* Restricts generation to what name needs (see -root). */
+void dsconv_add_root(DSConvContext *ctx, const char *name);
+
+/* Parses a buffer or file into a new AST owned by the caller: merge it
+ * with dsconv_merge or release it with ast_free. NULL on error. */
+ASTRoot *dsconv_parse(DSConvContext *ctx, const char *data, size_t len);
+ASTRoot *dsconv_parse_file(DSConvContext *ctx, const char *path);
+
+/* Moves the declarations of ast into the context's merged AST, sharing
+ * identical types and dropping duplicates (conflicts are reported on
+ * stderr). ast is consumed. origin names it in messages and may be NULL. */
+void dsconv_merge(DSConvContext *ctx, ASTRoot *ast, const char *origin);
+const ASTRoot *dsconv_ast(const DSConvContext *ctx);
+const MergeStats *dsconv_merge_stats(const DSConvContext *ctx);
+
+/* Generates code for the merged AST. Returns 0 on success. */
+int dsconv_generate(DSConvContext *ctx, DSConvWriteFn write, void *user);
+/* Writes up to cap - 1 bytes and a terminating NUL into buf (when cap > 0)
+ * and returns the full output length, like snprintf. */
+size_t dsconv_generate_into(DSConvContext *ctx, char *buf, size_t cap);
+/* Returns the output in a malloc'd NUL-terminated buffer (free it). */
+char *dsconv_generate_alloc(DSConvContext *ctx, size_t *len_out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBDSCONV_H */
@@ -0,0 +1,18 @@
+#ifndef DSCONV_MEMSTAT_H
+#define DSCONV_MEMSTAT_H
+
+/* Counting allocation wrappers used by the lexer and parser so the -p report
+ * can show how much heap traffic a conversion causes. */
+
+#include <stddef.h>
+
+void *ds_malloc(size_t n);
+void *ds_calloc(size_t count, size_t size);
+void *ds_realloc(void *p, size_t n);
+char *ds_strdup(const char *s);
+
+/* Totals since program start (process wide, safe to call from any thread). */
+size_t memstat_alloc_count(void);
+size_t memstat_alloc_bytes(void);
+
+#endif /* DSCONV_MEMSTAT_H */
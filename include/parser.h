@@ -3,6 +3,7 @@
 
 #include "ast.h"
 #include "dsconv.h"
+#include <stdio.h>
 
 /* Parse an input file into an ASTRoot. Returns NULL on error. */
 ASTRoot *parse_file(const char *path, const Options *opts);
@@ -10,4 +11,52 @@ ASTRoot *parse_file(const char *path, const Options *opts);
 /* Parse a string into an ASTRoot. Returns NULL on error. */
 ASTRoot *parse_string(const char *code, const Options *opts);
 
+/* Parse len bytes of data (need not be NUL-terminated). */
+ASTRoot *parse_memory(const char *data, size_t len, const Options *opts);
+
+/* Parse the contents of path already read into data (ds_malloc'd and
+ * NUL-terminated, e.g. by the prefetcher). Takes ownership of data. */
+ASTRoot *parse_loaded(const char *path, char *data, size_t len, const Options *opts);
+
+/* Runs the built-in preprocessor (when enabled) over the contents of path
+ * already read into data, as parse_loaded does, and returns the text to
+ * parse (ds_malloc'd, NUL-terminated) or NULL. Takes ownership of data;
+ * with data NULL, path is parsed as code. stats gets read/preprocess times. */
+char *parse_prepare(const char *path, char *data, size_t len, const Options *opts, size_t *len_out, ParseStats *stats);
+
+/* What one top-level declaration defines, as a parse would record it: the
+ * declarator name (typedef, object or function) and the tag of a struct,
+ * union or enum it defines with a body. Either may be NULL. The extent is
+ * exactly what parse_top_level consumes, so parse_range over it yields the
+ * same nodes as the whole buffer would. */
+typedef struct {
+    char *name;
+    char *tag;
+    TypeKind tag_kind; /* TYPE_STRUCT, TYPE_UNION or TYPE_ENUM */
+    size_t offset, length;
+    int line;
+} SkimDecl;
+typedef void (*SkimSink)(const SkimDecl *decl, void *user);
+
+/* Skims buf[0..len) declaration by declaration without building types
+ * (bodies and initializers are skipped unparsed) and hands every
+ * declaration that defines a name or tag to sink. Returns the number of
+ * tokens read. */
+size_t parse_skim(const char *buf, size_t len, SkimSink sink, void *user);
+
+/* Parse buf[0..len) in place, without preprocessing: a region cut out of
+ * a larger source (see symindex.h). first_line is the line of buf[0].
+ * quiet leaves array sizes and enumerator values that are not understood
+ * unreported. */
+ASTRoot *parse_range(const char *buf, size_t len, int first_line, const Options *opts, int quiet);
+
+/* Receives each top-level declaration as soon as it is parsed; the sink owns
+ * the node (release it with ast_node_free). */
+typedef void (*DeclSink)(ASTNode *node, void *user);
+
+/* Streaming parse of f (not preprocessed): the input is read through a
+ * bounded window and every declaration is handed to sink immediately.
+ * Returns 0 on success. */
+int parse_stream(FILE *f, const Options *opts, DeclSink sink, void *user, ParseStats *stats);
+
 #endif /* DSCONV_PARSER_H */
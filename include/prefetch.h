@@ -0,0 +1,25 @@
+#ifndef DSCONV_PREFETCH_H
+#define DSCONV_PREFETCH_H
+
+/* Read-ahead for a list of input files.
+ *
+ * A loader thread reads the inputs in list order into memory and stays at
+ * most `ahead` files in front of the consumer, so loading file N+1 overlaps
+ * parsing file N. When I/O latency dominates (network mounts, cold caches)
+ * the parser then rarely waits on a read. */
+
+#include <stddef.h>
+
+typedef struct Prefetcher Prefetcher;
+
+/* Starts loading paths (borrowed; they must outlive the prefetcher). */
+Prefetcher *prefetch_start(const char *const *paths, int count, int ahead);
+/* Waits for the index-th file and hands over its contents, NUL-terminated
+ * and allocated with ds_malloc (caller frees). Returns NULL if the file
+ * could not be read. Files must be taken in order. wait_wall, when not
+ * NULL, receives the time spent blocked. */
+char *prefetch_take(Prefetcher *p, int index, size_t *len, double *wait_wall);
+/* Stops the loader and frees files that were never taken. */
+void prefetch_stop(Prefetcher *p);
+
+#endif /* DSCONV_PREFETCH_H */
@@ -0,0 +1,48 @@
+#ifndef DSCONV_PREPROC_H
+#define DSCONV_PREPROC_H
+
+/* Minimal built-in C preprocessor.
+ *
+ * Handles #include with search paths, object-like and function-like macros
+ * (including # and ##), #if/#ifdef/#ifndef/#elif/#else/#endif, #undef and
+ * #pragma once. All state lives in a PPContext, and one context is treated
+ * as one translation unit: macros persist across inputs, so a header
+ * protected by an include guard or #pragma once is expanded only once no
+ * matter how many inputs include it, and file contents are cached. Contexts
+ * share nothing, so separate threads may use separate contexts.
+ *
+ * The result is a single buffer where included files are delimited by line
+ * markers of the form `# <line> "<file>"` that the lexer understands. */
+
+#include <stddef.h>
+
+typedef struct {
+    double read_wall, read_cpu; /* time spent loading files from disk */
+    size_t files_read;          /* files loaded from disk */
+    size_t cache_hits;          /* includes served from the content cache */
+    size_t guard_skips;         /* includes skipped by guard or #pragma once */
+} PPStats;
+
+typedef struct PPContext PPContext;
+
+PPContext *pp_create(void);
+/* A new context with ctx's include paths and macros but none of its files,
+ * for preprocessing a file as if it were the first input. */
+PPContext *pp_copy(const PPContext *ctx);
+/* Drops all macros, cached files and include paths. */
+void pp_destroy(PPContext *ctx);
+
+void pp_add_include_path(PPContext *ctx, const char *dir);
+/* Defines a macro from "NAME", "NAME=value" or "NAME(a,b)=body". */
+void pp_define(PPContext *ctx, const char *def);
+
+/* Preprocess a file or string. Returns a NUL-terminated buffer allocated with
+ * ds_malloc (caller frees), or NULL if the file cannot be read. stats may be
+ * NULL; otherwise its counters are incremented. */
+char *pp_process_file(PPContext *ctx, const char *path, size_t *len_out, PPStats *stats);
+char *pp_process_string(PPContext *ctx, const char *code, size_t *len_out, PPStats *stats);
+/* Preprocesses path from contents already read into data (ds_malloc'd,
+ * NUL-terminated), which the context takes over as its cached copy. */
+char *pp_process_buffer(PPContext *ctx, const char *path, char *data, size_t len, size_t *len_out, PPStats *stats);
+
+#endif /* DSCONV_PREPROC_H */
@@ -0,0 +1,69 @@
+#ifndef DSCONV_REPORT_H
+#define DSCONV_REPORT_H
+
+/* Performance and statistics report written with -p <file> (JSON). */
+
+#include <stddef.h>
+#include "ast.h"
+
+typedef enum {
+    PHASE_READ = 0,
+    PHASE_PREPROCESS,
+    PHASE_LEX,
+    PHASE_PARSE,
+    PHASE_MERGE,
+    PHASE_GENERATE,
+    PHASE_COUNT
+} Phase;
+
+typedef struct {
+    double wall; /* seconds */
+    double cpu;  /* seconds */
+} PhaseTime;
+
+typedef struct InputReport {
+    char *name;
+    ParseStats stats;
+    struct InputReport *next;
+} InputReport;
+
+typedef struct OutputReport {
+    char *target;
+    char *path; /* NULL for stdout */
+    size_t bytes;
+    int changed; /* 1 rewritten, 0 left as it was, -1 not a file */
+    struct OutputReport *next;
+} OutputReport;
+
+typedef struct Report {
+    PhaseTime phases[PHASE_COUNT];
+    double total_wall, total_cpu;
+    InputReport *inputs, *inputs_last;
+    OutputReport *outputs, *outputs_last;
+    MergeStats merge;
+    FlatStats flat;
+} Report;
+
+/* Clocks: monotonic wall time, CPU time of the whole process and of the
+ * calling thread, all in seconds. */
+double clock_wall(void);
+double clock_cpu(void);
+double clock_thread_cpu(void);
+
+/* Peak resident set size of the process in bytes (0 if unknown). */
+size_t report_peak_rss(void);
+
+Report *report_create(void);
+void report_destroy(Report *r);
+void report_phase_add(Report *r, Phase p, double wall, double cpu);
+/* Records one parsed input and folds its read/lex/parse times into the
+ * phase totals. */
+void report_add_input(Report *r, const char *name, const ParseStats *stats);
+/* changed: 1 if the file was rewritten, 0 if it already held the same
+ * output and was left alone, -1 for stdout and callbacks. */
+void report_add_output(Report *r, const char *target, const char *path, size_t bytes, int changed);
+/* Moves the outputs recorded in from to the end of r's list. */
+void report_take_outputs(Report *r, Report *from);
+int report_write_json(const Report *r, const char *path);
+
+#endif /* DSCONV_REPORT_H */
@@ -0,0 +1,72 @@
+#ifndef DSCONV_SYMINDEX_H
+#define DSCONV_SYMINDEX_H
+
+/* Persistent symbol index for pulling single types out of large header sets
+ * (-index, -query).
+ *
+ * Every input file is cut into top-level declaration regions (the split
+ * points of lexer_find_splits) and each region is parsed once to learn the
+ * struct, union and enum tags and typedef names it defines. The index maps
+ * those names to (file, byte offset, length, content hash) and is kept in a
+ * text file between runs:
+ *
+ *   dsconv-index 1
+ *   P
+ *   F <size> <mtime> <hash> <path>
+ *   D <offset> <length> <line> <hash> <kind> <name>
+ *
+ * D lines belong to the F line above them; kind is t (typedef name), s, u
+ * or e (struct, union, enum tag) and hashes are 64-bit FNV-1a in hex.
+ * A query reads and parses only the regions that define the requested
+ * names and, transitively, the names and tags those mention.
+ *
+ * With the preprocessor on, the P line is written and regions are cut from
+ * each file preprocessed on its own, so includes and macros are followed;
+ * a query preprocesses the files it reads again. Without it (-nopp)
+ * regions are the raw bytes of the file. The file hash is always of the
+ * raw bytes. */
+
+#include <stddef.h>
+#include "ast.h"
+#include "dsconv.h"
+#include "intern.h"
+
+typedef struct SymIndex SymIndex;
+
+typedef struct {
+    size_t files_indexed; /* files (re)parsed by symindex_update */
+    size_t files_kept;    /* files found unchanged */
+    size_t files_dropped; /* files that no longer exist */
+    size_t files_read;    /* files opened by symindex_query */
+    size_t regions;       /* regions parsed by symindex_query */
+    size_t bytes;         /* bytes read by symindex_query */
+} SymIndexStats;
+
+/* Loads an index written by symindex_save. A missing file gives an empty
+ * index; a malformed one is reported on stderr and gives NULL. */
+SymIndex *symindex_load(const char *path);
+void symindex_destroy(SymIndex *ix);
+/* Writes the index (through a temporary file renamed over path). Returns 0
+ * on success. */
+int symindex_save(const SymIndex *ix, const char *path);
+
+/* Brings the index up to date with files: new files are indexed, files
+ * whose size or modification time changed are re-indexed when their
+ * content hash differs, and, when files are given, indexed files that no
+ * longer exist are dropped. Files indexed earlier but not listed are kept.
+ * Returns 0 on success. */
+int symindex_update(SymIndex *ix, const char *const *files, int count, const Options *opts);
+/* Whether the last update or query changed the index (it should be saved). */
+int symindex_dirty(const SymIndex *ix);
+
+/* Parses the declarations of names (typedef names or tags, optionally
+ * written "struct T"/"union T"/"enum T") and everything they mention, and
+ * merges them into out through types. A file changed since it was indexed
+ * is re-indexed before its regions are read. Names that are not indexed
+ * are reported on stderr; returns their number. Names the declarations
+ * mention that no indexed file defines are left out with a warning. */
+size_t symindex_query(SymIndex *ix, const char *const *names, int count, const Options *opts, TypeTable *types, ASTRoot *out);
+
+const SymIndexStats *symindex_stats(const SymIndex *ix);
+
+#endif /* DSCONV_SYMINDEX_H */
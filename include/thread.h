@@ -0,0 +1,33 @@
+#ifndef DSCONV_THREAD_H
+#define DSCONV_THREAD_H
+
+/* Minimal portable threads (Win32 threads or pthreads). */
+
+typedef struct DsThread DsThread;
+typedef void (*ThreadFn)(void *arg);
+
+/* Returns NULL if the thread could not be started. */
+DsThread *thread_start(ThreadFn fn, void *arg);
+void thread_join(DsThread *t);
+
+/* Number of online processors (at least 1). */
+int cpu_count(void);
+
+/* Runs fn(arg, i) for i in [0, count) on up to `workers` threads, the calling
+ * thread included. Items are handed out dynamically, so uneven items balance
+ * across workers. */
+typedef void (*ParallelFn)(void *arg, int index);
+void parallel_for(int count, int workers, ParallelFn fn, void *arg);
+
+/* A mutex with one condition variable, for producer/consumer hand-offs.
+ * monitor_wait must be called with the lock held; it releases the lock
+ * while sleeping and may return spuriously, so wait in a loop. */
+typedef struct DsMonitor DsMonitor;
+DsMonitor *monitor_create(void);
+void monitor_destroy(DsMonitor *m);
+void monitor_lock(DsMonitor *m);
+void monitor_unlock(DsMonitor *m);
+void monitor_wait(DsMonitor *m);
+void monitor_broadcast(DsMonitor *m);
+
+#endif /* DSCONV_THREAD_H */
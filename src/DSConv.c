@@ -4,6 +4,25 @@
 #include "dsconv.h"
 #include "parser.h"
 #include "generator.h"
+#include "report.h"
+#include "preproc.h"
+#include "intern.h"
+#include "lexer.h"
+#include "prefetch.h"
+#include "symindex.h"
+#include "lazy.h"
+#include "memstat.h"
+
+#ifdef _WIN32
+#include <io.h>
+#define stdin_is_tty() _isatty(_fileno(stdin))
+#else
+#include <unistd.h>
+#define stdin_is_tty() isatty(fileno(stdin))
+#endif
+
+// Inputs read ahead of the one being parsed
+#define PREFETCH_AHEAD 4
 
 static char *strip_brackets(const char *s) {
     char *dup = strdup(s);
@@ -13,50 +32,182 @@ static char *strip_brackets(const char *s) {
     return dup;
 }
 
-static char **read_file_list(const char *filename, int *count) {
-    FILE *f = fopen(filename, "r");
-    if (!f) return NULL;
-    char **list = NULL;
-    *count = 0;
-    // Get directory of filename
-    char *dir = NULL;
-    const char *last_slash = strrchr(filename, '\\');
-    if (!last_slash) last_slash = strrchr(filename, '/');
-    if (last_slash) {
-        size_t dir_len = last_slash - filename + 1;
-        dir = (char*)malloc(dir_len + 1);
-        memcpy(dir, filename, dir_len);
-        dir[dir_len] = '\0';
+/* Appends s to the input list, growing it geometrically. */
+static void add_input(const char ***list, int *count, int *cap, const char *s) {
+    if (*count == *cap) {
+        *cap = *cap ? *cap * 2 : 16;
+        *list = (const char**)realloc((void*)*list, (size_t)*cap * sizeof(const char*));
+    }
+    (*list)[(*count)++] = s;
+}
+
+/* Expands a .txt file list in one pass: the list is read whole and every
+ * space-separated entry of every line (brackets stripped) is appended to the
+ * inputs, relative to the list's directory. Returns 0 if it can't be read. */
+static int read_file_list(const char *filename, const char ***list, int *count, int *cap) {
+    size_t len;
+    char *text = lexer_load_file(filename, &len);
+    if (!text) return 0;
+    // Entries are relative to the directory of filename
+    size_t dir_len = 0;
+    for (const char *c = filename; *c; ++c) {
+        if (*c == '\\' || *c == '/') dir_len = (size_t)(c - filename) + 1;
+    }
+    const char *p = text, *end = text + len;
+    while (p < end) {
+        const char *eol = (const char*)memchr(p, '\n', (size_t)(end - p));
+        if (!eol) eol = end;
+        const char *line_end = eol;
+        if (line_end > p && line_end[-1] == '\r') line_end--;
+        if (p < line_end && *p == '[') p++;
+        if (line_end > p && line_end[-1] == ']') line_end--;
+        // Split by spaces
+        while (p < line_end) {
+            while (p < line_end && *p == ' ') p++;
+            const char *token = p;
+            while (p < line_end && *p != ' ') p++;
+            if (p == token) continue;
+            size_t n = (size_t)(p - token);
+            char *full_path = (char*)malloc(dir_len + n + 1);
+            memcpy(full_path, filename, dir_len);
+            memcpy(full_path + dir_len, token, n);
+            full_path[dir_len + n] = '\0';
+            add_input(list, count, cap, full_path);
+        }
+        p = eol + 1;
+    }
+    free(text);
+    return 1;
+}
+
+/* Appends the comma-separated names in arg to a name list (-root, -pool). */
+static void add_names(const char ***list, int *count, const char *arg) {
+    char *names = strdup(arg);
+    for (char *name = strtok(names, ","); name; name = strtok(NULL, ",")) {
+        *list = (const char**)realloc((void*)*list, (*count + 1) * sizeof(char*));
+        (*list)[(*count)++] = name;
     }
-    char line[1024];
-    while (fgets(line, sizeof(line), f)) {
-        // remove newline
-        line[strcspn(line, "\n")] = 0;
-        char *stripped = strip_brackets(line);
-        if (strlen(stripped) > 0) {
-            // Split by spaces
-            char *token = strtok(stripped, " ");
-            while (token) {
-                char *full_path = NULL;
-                if (dir) {
-                    full_path = (char*)malloc(strlen(dir) + strlen(token) + 1);
-                    strcpy(full_path, dir);
-                    strcat(full_path, token);
-                } else {
-                    full_path = strdup(token);
-                }
-                list = (char**)realloc(list, (*count + 1) * sizeof(char*));
-                list[(*count)++] = full_path;
-                token = strtok(NULL, " ");
-            }
-            free(stripped);
-        } else {
-            free(stripped);
+}
+
+/* Sets the output language from -olang (comma-separated, one language per
+ * run). Returns 0, or 1 after reporting a problem. */
+static int parse_targets(Options *opts) {
+    char *list = strdup(opts->targets);
+    int c = 0, cpp = 0, rc = 0;
+    for (char *t = strtok(list, ","); t; t = strtok(NULL, ",")) {
+        if (strcmp(t, "c") == 0 || strcmp(t, "all") == 0) c = 1;
+        else if (strcmp(t, "cpp") == 0 || strcmp(t, "c++") == 0) cpp = 1;
+        else {
+            fprintf(stderr, "Unknown output language: %s (use c or cpp)\n", t);
+            rc = 1;
         }
     }
-    if (dir) free(dir);
-    fclose(f);
-    return list;
+    free(list);
+    if (rc) return rc;
+    if (c && cpp) {
+        fprintf(stderr, "-olang: one output language per run.\n");
+        return 1;
+    }
+    opts->output_lang = cpp ? OUTPUT_CPP : OUTPUT_C;
+    if (cpp && (opts->hash_functions || opts->pool_type_count || opts->enum_strings || opts->reflect_tables
+                || opts->handle_type_count || opts->map_spec_count || opts->sort_spec_count)) {
+        fprintf(stderr, "The C companion generators (-hash, -pool, -enumstr, -reflect, -handles,\n"
+            "-hashmap, -sort) cannot be combined with -olang cpp.\n");
+        return 1;
+    }
+    return 0;
+}
+
+/* Streaming pipeline: each declaration goes to the generator as soon as it
+ * is parsed and is released right after, so memory stays bounded. */
+typedef struct {
+	Generator *gen;
+	double wall, cpu; /* time spent generating */
+} StreamSink;
+
+static void stream_emit(ASTNode *n, void *user) {
+	StreamSink *sink = (StreamSink*)user;
+	double wall = clock_wall(), cpu = clock_cpu();
+	generator_emit(sink->gen, n);
+	ast_node_free(n);
+	sink->wall += clock_wall() - wall;
+	sink->cpu += clock_cpu() - cpu;
+}
+
+static int run_streaming(const char **inputs, int count, const Options *opts, Report *report) {
+	StreamSink sink;
+	memset(&sink, 0, sizeof(sink));
+	sink.gen = generator_open(opts);
+	if (!sink.gen) return 1;
+	int rc = 0;
+	for (int i = 0; i < count && rc == 0; ++i) {
+		int from_stdin = strcmp(inputs[i], "-") == 0;
+		FILE *f = from_stdin ? stdin : fopen(inputs[i], "rb");
+		if (!f) {
+			fprintf(stderr, "failed to open: %s\n", inputs[i]);
+			rc = 1;
+			break;
+		}
+		ParseStats stats;
+		double gen_wall = sink.wall, gen_cpu = sink.cpu;
+		rc = parse_stream(f, opts, stream_emit, &sink, &stats);
+		if (!from_stdin) fclose(f);
+		/* generation happens inside the parse loop; keep it out of parse time */
+		stats.parse_wall -= sink.wall - gen_wall;
+		stats.parse_cpu -= sink.cpu - gen_cpu;
+		report_add_input(report, from_stdin ? "<stdin>" : inputs[i], &stats);
+	}
+	report_phase_add(report, PHASE_GENERATE, sink.wall, sink.cpu);
+	if (generator_close(sink.gen, report)) rc = 1;
+	return rc;
+}
+
+/* Symbol index (-index): brings the index up to date with the inputs and,
+ * with -query, generates what the queried names need from just the
+ * regions that define it. */
+static int run_index(const char **inputs, int count, Options *opts, Report *report) {
+	SymIndex *ix = symindex_load(opts->index_file);
+	if (!ix) return 1;
+	const SymIndexStats *stats = symindex_stats(ix);
+	double wall = clock_wall(), cpu = clock_cpu();
+	int rc = symindex_update(ix, inputs, count, opts);
+	report_phase_add(report, PHASE_PARSE, clock_wall() - wall, clock_cpu() - cpu);
+	if (rc == 0 && count > 0 && !opts->silent) {
+		printf("DSConv: index %s: %zu files indexed, %zu unchanged, %zu dropped\n",
+			opts->index_file, stats->files_indexed, stats->files_kept, stats->files_dropped);
+	}
+	if (rc == 0 && opts->query_count > 0) {
+		TypeTable *types = type_table_create();
+		ASTRoot *ast = (ASTRoot*)ds_calloc(1, sizeof(ASTRoot));
+		wall = clock_wall();
+		cpu = clock_cpu();
+		symindex_query(ix, opts->query_names, opts->query_count, opts, types, ast);
+		report_phase_add(report, PHASE_PARSE, clock_wall() - wall, clock_cpu() - cpu);
+		if (!opts->silent) {
+			printf("DSConv: query parsed %zu regions (%zu bytes) from %zu files\n",
+				stats->regions, stats->bytes, stats->files_read);
+			if (!opts->output_file || strcmp(opts->output_file, "CON") == 0) {
+				printf("---------------------------------------\n");
+			}
+		}
+		// Emit the queried names and what they need, in dependency order
+		if (opts->root_count == 0) {
+			opts->roots = opts->query_names;
+			opts->root_count = opts->query_count;
+		}
+		wall = clock_wall();
+		cpu = clock_cpu();
+		FlatAST *flat = generate_prepare(ast, report);
+		if (report) report->merge = *type_table_stats(types);
+		ast_free(ast);
+		type_table_destroy(types);
+		rc = generate_for_targets(flat, opts, report);
+		report_phase_add(report, PHASE_GENERATE, clock_wall() - wall, clock_cpu() - cpu);
+		flat_destroy(flat);
+	}
+	if (rc == 0 && symindex_dirty(ix)) rc = symindex_save(ix, opts->index_file);
+	symindex_destroy(ix);
+	return rc;
 }
 
 static void print_usage(const char *prog) {
@@ -71,18 +222,66 @@ static void print_usage(const char *prog) {
 		"  -esm / -ism       External/Internal struct members.\n"
 		"  -em / -im         External/Internal all members.\n"
 		"  -eu / -iu         External/Internal union members.\n"
-		"  -sf               Type suffixes in output (f, LL, ULL, etc.).\n"
+		"  -sf               Enumerator values as written (0x10u, 1ULL) instead of decimal.\n"
 		"  -sn [name]        Instance name (auto-detected if flag is omitted).\n"
-		"  -olang [lang]     Output language(s).\n"
+		"  -olang [lang]     Output language: c (default) or cpp (C++17, adds\n"
+		"                    constexpr dsconv::fields<T> member lists for\n"
+		"                    for_each_field and dsconv::enum_names<E> tables).\n"
 		"  -i [string]       Input code string (alternative to file).\n"
 		"  -o [file]         Output file (default: stdout).\n"
-		"  -p [file]         Log metadata file.\n"
+		"  -p [file]         Write a JSON performance/statistics report to file.\n"
 		"  -a                Output as array.\n"
 		"  -s                Output as struct.\n"
 		"  -u                Output as union.\n"
 		"  -e                Output as enum.\n"
 		"  -etc              Explicit type casting.\n"
 		"  -itc              Implicit type casting.\n"
+		"  -I [dir]          Add a directory to the #include search path.\n"
+		"  -D [name[=value]] Predefine a macro for the built-in preprocessor.\n"
+		"  -nopp             Disable the built-in preprocessor.\n"
+		"  -stream           Stream declarations to the output as they are parsed\n"
+		"                    (bounded memory, no preprocessing). Used for stdin.\n"
+		"  -                 Read input from stdin.\n"
+		"  -j [n]            Worker threads (0 = one per CPU, default 1). Large\n"
+		"                    single inputs are split and parsed in parallel, and\n"
+		"                    long outputs are generated in parallel chunks.\n"
+		"  -root [names]     Emit only the declarations the given comma-separated\n"
+		"                    names need, in dependency order (repeatable). Inputs\n"
+		"                    are skimmed and only those declarations parsed.\n"
+		"  -shards [n]       Split the output into n files of independent\n"
+		"                    declarations plus a forward-declaration header;\n"
+		"                    the -o file becomes an umbrella header.\n"
+		"  -hash             Generate T_hash and T_equal functions for every struct.\n"
+		"  -hashptr [policy] Pointer members in -hash code: str (char pointers as\n"
+		"                    strings, others by address; default), addr or skip.\n"
+		"  -pool [names]     Generate a typed pool allocator (T_pool_*) for the given\n"
+		"                    comma-separated structs, or * for all (repeatable).\n"
+		"  -pooltls          Also generate per-thread pools (T_alloc/T_release).\n"
+		"  -enumstr          Generate E_to_string and E_from_string for every enum.\n"
+		"  -reflect          Generate a field descriptor table (R_fields, R_reflect)\n"
+		"                    for every struct and union.\n"
+		"  -handles [names]  Generate an index-linked variant (T_ix, with uint32_t\n"
+		"                    indices for pointers to the selected structs), a T_ix\n"
+		"                    array and T_to_ix/T_from_ix for the given comma-separated\n"
+		"                    structs, or * for all (repeatable).\n"
+		"  -hashmap [T:key]  Generate an open-addressing hash map (T_map_*) of the\n"
+		"                    struct T keyed by its member key; comma-separated,\n"
+		"                    repeatable.\n"
+		"  -sort [T:key]     Generate T_sort_by_key (LSD radix sort for integer and\n"
+		"                    enum keys, else a stable merge sort) and\n"
+		"                    T_merge_sort_by_key for arrays of struct T;\n"
+		"                    comma-separated, repeatable.\n"
+		"  -index [file]     Symbol index of the inputs' tags and typedef names, kept\n"
+		"                    in file across runs and updated for changed inputs.\n"
+		"  -query [names]    With -index: generate only the given comma-separated\n"
+		"                    names and what they need, parsing just the regions of\n"
+		"                    the indexed files that define them.\n"
+		"  -manifest [file]  Parse the inputs once and run every job in file over\n"
+		"                    them: one line per job, holding generation flags as\n"
+		"                    on the command line (each job needs its own -o;\n"
+		"                    # starts a comment, \"quotes\" keep spaces). Jobs\n"
+		"                    start from the command line's flags and run on the\n"
+		"                    -j workers.\n"
 		"  -fwd              Forward declarations in output.\n"
 		"  -nrd              Normal declarations in output.\n"
 		"  -g                Globally declared data structure(s).\n"
@@ -98,30 +297,58 @@ static void print_usage(const char *prog) {
 		prog, prog);
 }
 
-int main(int argc, char **argv) {
-	Options opts;
-	memset(&opts, 0, sizeof(opts));
-	opts.name_policy = NAME_POLICY_PRESERVE;
-	opts.assign_style = ASSIGN_BOTH;
-	opts.expand_mode = EXPAND_MEMBERS;
-	opts.silent = 0;
-	opts.enable_suffixes = 0;
-
-	if (argc <= 1) {
-		print_usage(argv[0]);
-		return 1;
+/* Checks the struct:member specs added to a list from index first on:
+ * the form, and that no struct is named twice (one_key) or no spec
+ * repeats. */
+static int check_specs(const char *flag, const char **specs, int first, int count, int one_key) {
+	for (int k = first; k < count; ++k) {
+		const char *colon = strchr(specs[k], ':');
+		if (!colon || colon == specs[k] || !colon[1]) {
+			fprintf(stderr, "%s: expected struct:member, got %s\n", flag, specs[k]);
+			return 1;
+		}
+		size_t len = (size_t)(colon - specs[k]) + 1;
+		for (int j = 0; j < k; ++j) {
+			if (one_key && strncmp(specs[j], specs[k], len) == 0) {
+				fprintf(stderr, "%s: one key per struct (%s, %s)\n", flag, specs[j], specs[k]);
+				return 1;
+			}
+			if (strcmp(specs[j], specs[k]) == 0) {
+				fprintf(stderr, "%s: %s given twice\n", flag, specs[k]);
+				return 1;
+			}
+		}
 	}
+	return 0;
+}
 
-	// Collect input files (for grouped [] support) and parse flags
-	const char **input_files = NULL;
-	int input_count = 0;
+/* Flags that decide how inputs are read and parsed; a manifest job only
+ * chooses what is generated from them. */
+static int is_parse_flag(const char *arg) {
+	static const char *const flags[] = {
+		"-i", "-I", "-D", "-nopp", "-stream", "-index", "-query", "-manifest", "-p", NULL
+	};
+	for (int i = 0; flags[i]; ++i) {
+		if (strcmp(arg, flags[i]) == 0) return 1;
+	}
+	return 0;
+}
 
-	// Parse flags and arguments
-	for (int i = 1; i < argc; ++i) {
+/* Parses the flags and inputs in argv[first..argc) into opts; inputs are
+ * appended to the input list. job is set for manifest lines, which may
+ * only hold generation flags. Returns 0, 1 on errors or 2 after -h. */
+static int parse_args(int argc, char **argv, int first, Options *opts,
+		const char ***inputs, int *count, int *cap, int job) {
+	for (int i = first; i < argc; ++i) {
 		if (argv[i][0] == '/' && strcmp(argv[i], "/s") == 0) {
-			opts.silent = 1;
+			opts->silent = 1;
 			continue;
 		}
+		if (job && (is_parse_flag(argv[i]) || argv[i][0] != '-' || argv[i][1] == '\0')) {
+			fprintf(stderr, "%s: inputs and parsing flags (-i, -I, -D, -nopp, -stream, -index, -query, -p)\n"
+				"go on the command line, not in manifest jobs.\n", argv[i]);
+			return 1;
+		}
 		int flag_type = 0;
 		if (strcmp(argv[i], "-esm") == 0) flag_type = 1;
 		else if (strcmp(argv[i], "-ism") == 0) flag_type = 2;
@@ -151,6 +378,25 @@ int main(int argc, char **argv) {
 		else if (strcmp(argv[i], "-l") == 0) flag_type = 26;
 		else if (strcmp(argv[i], "-?") == 0) flag_type = 27;
 		else if (strcmp(argv[i], "-h") == 0) flag_type = 28;
+		else if (strcmp(argv[i], "-I") == 0) flag_type = 29;
+		else if (strcmp(argv[i], "-D") == 0) flag_type = 30;
+		else if (strcmp(argv[i], "-nopp") == 0) flag_type = 31;
+		else if (strcmp(argv[i], "-stream") == 0) flag_type = 32;
+		else if (strcmp(argv[i], "-j") == 0) flag_type = 33;
+		else if (strcmp(argv[i], "-root") == 0) flag_type = 34;
+		else if (strcmp(argv[i], "-shards") == 0) flag_type = 35;
+		else if (strcmp(argv[i], "-hash") == 0) flag_type = 36;
+		else if (strcmp(argv[i], "-hashptr") == 0) flag_type = 37;
+		else if (strcmp(argv[i], "-pool") == 0) flag_type = 38;
+		else if (strcmp(argv[i], "-pooltls") == 0) flag_type = 39;
+		else if (strcmp(argv[i], "-enumstr") == 0) flag_type = 40;
+		else if (strcmp(argv[i], "-index") == 0) flag_type = 41;
+		else if (strcmp(argv[i], "-query") == 0) flag_type = 42;
+		else if (strcmp(argv[i], "-reflect") == 0) flag_type = 43;
+		else if (strcmp(argv[i], "-handles") == 0) flag_type = 44;
+		else if (strcmp(argv[i], "-manifest") == 0) flag_type = 45;
+		else if (strcmp(argv[i], "-hashmap") == 0) flag_type = 46;
+		else if (strcmp(argv[i], "-sort") == 0) flag_type = 47;
 		if (flag_type > 0) {
 			switch (flag_type) {
 				case 1: // -esm
@@ -172,83 +418,180 @@ int main(int argc, char **argv) {
 					// internal union members
 					break;
 				case 7: // -st
-					opts.expand_mode = EXPAND_MEMBERS;
+					opts->expand_mode = EXPAND_MEMBERS;
 					break;
 				case 8: // -stw
-					opts.expand_mode = WRAP_AS_ARRAY;
+					opts->expand_mode = WRAP_AS_ARRAY;
 					break;
 				case 9: // -iv
-					opts.assign_style = ASSIGN_INTERNAL;
+					opts->assign_style = ASSIGN_INTERNAL;
 					break;
 				case 10: // -ev
-					opts.assign_style = ASSIGN_EXTERNAL;
+					opts->assign_style = ASSIGN_EXTERNAL;
 					break;
 				case 11: // -sf
-					opts.enable_suffixes = 1;
+					opts->enable_suffixes = 1;
 					break;
 				case 12: // -sn
 					if (i + 1 < argc) {
-						opts.instance_name = argv[++i];
+						opts->instance_name = argv[++i];
 					}
 					break;
 				case 13: // -olang
 					if (i + 1 < argc) {
-						opts.targets = argv[++i];
+						opts->targets = argv[++i];
 					}
 					break;
 				case 14: // -i
 					if (i + 1 < argc) {
-						opts.input_string = argv[++i];
+						opts->input_string = argv[++i];
 					}
 					break;
 				case 15: // -o
 					if (i + 1 < argc) {
-						opts.output_file = argv[++i];
+						opts->output_file = argv[++i];
 					}
 					break;
 				case 16: // -p
 					if (i + 1 < argc) {
-						opts.metadata_file = argv[++i];
+						opts->metadata_file = argv[++i];
 					}
 					break;
 				case 17: // -s
-					opts.output_as_struct = 1;
+					opts->output_as_struct = 1;
 					break;
 				case 18: // -a
-					opts.array_output = 1;
+					opts->array_output = 1;
 					break;
 				case 19: // -etc
-					opts.explicit_cast = 1;
+					opts->explicit_cast = 1;
 					break;
 				case 20: // -itc
-					opts.explicit_cast = 0;
+					opts->explicit_cast = 0;
 					break;
 				case 21: // -u
-					opts.output_as_union = 1;
+					opts->output_as_union = 1;
 					break;
 				case 22: // -e
-					opts.output_as_enum = 1;
+					opts->output_as_enum = 1;
 					break;
 				case 23: // -fwd
-					opts.forward_declarations = 1;
+					opts->forward_declarations = 1;
 					break;
 				case 24: // -nrd
-					opts.normal_declarations = 1;
+					opts->normal_declarations = 1;
 					break;
 				case 25: // -g
-					opts.global_scope = 1;
+					opts->global_scope = 1;
 					break;
 				case 26: // -l
-					opts.local_scope = 1;
+					opts->local_scope = 1;
 					if (i + 1 < argc && argv[i+1][0] == ':') {
-						opts.local_function = argv[++i] + 1;
+						opts->local_function = argv[++i] + 1;
 					}
 					break;
 				case 27: // -?
 				case 28: // -h
 					print_usage(argv[0]);
-					return 0;
+					return 2;
+				case 29: // -I
+					if (i + 1 < argc) {
+						pp_add_include_path(opts->pp, argv[++i]);
+					}
+					break;
+				case 30: // -D
+					if (i + 1 < argc) {
+						pp_define(opts->pp, argv[++i]);
+					}
+					break;
+				case 31: // -nopp
+					opts->preprocess = 0;
+					break;
+				case 32: // -stream
+					opts->streaming = 1;
+					break;
+				case 33: // -j
+					if (i + 1 < argc) {
+						opts->jobs = atoi(argv[++i]);
+					}
+					break;
+				case 34: // -root
+					if (i + 1 < argc) {
+						add_names(&opts->roots, &opts->root_count, argv[++i]);
+					}
+					break;
+				case 35: // -shards
+					if (i + 1 < argc) {
+						opts->shards = atoi(argv[++i]);
+					}
+					break;
+				case 36: // -hash
+					opts->hash_functions = 1;
+					break;
+				case 37: // -hashptr
+					if (i + 1 < argc) {
+						const char *policy = argv[++i];
+						if (strcmp(policy, "str") == 0) opts->pointer_policy = POINTER_STRINGS;
+						else if (strcmp(policy, "addr") == 0) opts->pointer_policy = POINTER_ADDRESS;
+						else if (strcmp(policy, "skip") == 0) opts->pointer_policy = POINTER_SKIP;
+						else {
+							fprintf(stderr, "Unknown pointer policy: %s (use str, addr or skip)\n", policy);
+							return 1;
+						}
+					}
+					break;
+				case 38: // -pool
+					if (i + 1 < argc) {
+						add_names(&opts->pool_types, &opts->pool_type_count, argv[++i]);
+					}
+					break;
+				case 39: // -pooltls
+					opts->pool_thread_cache = 1;
+					break;
+				case 40: // -enumstr
+					opts->enum_strings = 1;
+					break;
+				case 41: // -index
+					if (i + 1 < argc) {
+						opts->index_file = argv[++i];
+					}
+					break;
+				case 42: // -query
+					if (i + 1 < argc) {
+						add_names(&opts->query_names, &opts->query_count, argv[++i]);
+					}
+					break;
+				case 43: // -reflect
+					opts->reflect_tables = 1;
+					break;
+				case 44: // -handles
+					if (i + 1 < argc) {
+						add_names(&opts->handle_types, &opts->handle_type_count, argv[++i]);
+					}
+					break;
+				case 45: // -manifest
+					if (i + 1 < argc) {
+						opts->manifest_file = argv[++i];
+					}
+					break;
+				case 46: // -hashmap
+					if (i + 1 < argc) {
+						int first = opts->map_spec_count;
+						add_names(&opts->map_specs, &opts->map_spec_count, argv[++i]);
+						if (check_specs("-hashmap", opts->map_specs, first, opts->map_spec_count, 1) != 0) return 1;
+					}
+					break;
+				case 47: // -sort
+					if (i + 1 < argc) {
+						int first = opts->sort_spec_count;
+						add_names(&opts->sort_specs, &opts->sort_spec_count, argv[++i]);
+						if (check_specs("-sort", opts->sort_specs, first, opts->sort_spec_count, 0) != 0) return 1;
+					}
+					break;
 			}
+		} else if (strcmp(argv[i], "-") == 0) {
+			add_input(inputs, count, cap, strdup("-"));
+			opts->streaming = 1;
 		} else if (argv[i][0] == '-') {
 			fprintf(stderr, "Unknown flag: %s\n", argv[i]);
 			print_usage(argv[0]);
@@ -259,28 +602,162 @@ int main(int argc, char **argv) {
 			if (strlen(stripped) > 0) {
 				// Check if it's a .txt file containing a list of files
 				if (strstr(stripped, ".txt")) {
-					int sub_count;
-					char **sub_list = read_file_list(stripped, &sub_count);
-					if (sub_list) {
-						for (int j = 0; j < sub_count; ++j) {
-							input_files = (const char**)realloc((void*)input_files, (input_count + 1) * sizeof(const char*));
-							input_files[input_count++] = sub_list[j];
-						}
-						free(sub_list);
+					if (read_file_list(stripped, inputs, count, cap)) {
+						free(stripped);
 					} else {
 						fprintf(stderr, "Failed to read file list: %s\n", stripped);
 						free(stripped);
 						return 1;
 					}
 				} else {
-					input_files = (const char**)realloc((void*)input_files, (input_count + 1) * sizeof(const char*));
-					input_files[input_count++] = stripped;
+					add_input(inputs, count, cap, stripped);
 				}
 			} else {
 				free(stripped);
 			}
 		}
 	}
+	return 0;
+}
+
+/* Manifest (-manifest): one generation job per line, written as its flags
+ * would be on the command line. The inputs are parsed once and every job
+ * runs over the same AST. */
+typedef struct {
+	Options *jobs;
+	int count;
+	char ***argvs; /* per job; the jobs' option strings point into text */
+	char *text;
+} Manifest;
+
+static const char **dup_names(const char **list, int count) {
+	if (!list) return NULL;
+	const char **copy = (const char**)malloc((size_t)count * sizeof(char*));
+	memcpy((void*)copy, (const void*)list, (size_t)count * sizeof(char*));
+	return copy;
+}
+
+/* Splits a line into arguments in place: whitespace separates them,
+ * double quotes keep spaces. Returns the number stored in argv. */
+static int split_args(char *line, char **argv, int max) {
+	int argc = 0;
+	char *r = line;
+	while (*r) {
+		while (*r == ' ' || *r == '\t') r++;
+		if (!*r) break;
+		char *w = r;
+		if (argc < max) argv[argc++] = w;
+		int quoted = 0;
+		while (*r && (quoted || (*r != ' ' && *r != '\t'))) {
+			if (*r == '"') { quoted = !quoted; r++; continue; }
+			*w++ = *r++;
+		}
+		if (*r) r++;
+		*w = '\0';
+	}
+	return argc;
+}
+
+static void manifest_free(Manifest *m) {
+	for (int i = 0; i < m->count; ++i) {
+		free((void*)m->jobs[i].roots);
+		free((void*)m->jobs[i].pool_types);
+		free((void*)m->jobs[i].handle_types);
+		free((void*)m->jobs[i].map_specs);
+		free((void*)m->jobs[i].sort_specs);
+		free(m->argvs[i]);
+	}
+	free(m->jobs);
+	free(m->argvs);
+	free(m->text);
+}
+
+/* Reads the jobs of path; each starts from base (single-threaded unless
+ * the line gives -j) and must write its own -o file. */
+static int load_manifest(const char *path, const Options *base, char *prog, Manifest *m) {
+	memset(m, 0, sizeof(*m));
+	size_t len;
+	m->text = lexer_load_file(path, &len);
+	if (!m->text) {
+		fprintf(stderr, "Failed to read manifest: %s\n", path);
+		return 1;
+	}
+	int cap = 0, line_no = 0;
+	char *p = m->text, *end = m->text + len;
+	while (p < end) {
+		char *eol = (char*)memchr(p, '\n', (size_t)(end - p));
+		if (!eol) eol = end;
+		*eol = '\0';
+		if (eol > p && eol[-1] == '\r') eol[-1] = '\0';
+		char *line = p;
+		p = eol + 1;
+		line_no++;
+		while (*line == ' ' || *line == '\t') line++;
+		if (!*line || *line == '#') continue;
+		size_t max = strlen(line) / 2 + 2;
+		char **argv = (char**)malloc((max + 1) * sizeof(char*));
+		argv[0] = prog;
+		int argc = 1 + split_args(line, argv + 1, (int)max);
+		Options job = *base;
+		job.jobs = 1;
+		job.roots = dup_names(base->roots, base->root_count);
+		job.pool_types = dup_names(base->pool_types, base->pool_type_count);
+		job.handle_types = dup_names(base->handle_types, base->handle_type_count);
+		job.map_specs = dup_names(base->map_specs, base->map_spec_count);
+		job.sort_specs = dup_names(base->sort_specs, base->sort_spec_count);
+		if (m->count == cap) {
+			cap = cap ? cap * 2 : 16;
+			m->jobs = (Options*)realloc(m->jobs, (size_t)cap * sizeof(Options));
+			m->argvs = (char***)realloc(m->argvs, (size_t)cap * sizeof(char**));
+		}
+		m->jobs[m->count] = job;
+		m->argvs[m->count] = argv;
+		Options *o = &m->jobs[m->count++];
+		if (parse_args(argc, argv, 1, o, NULL, NULL, NULL, 1) != 0 || parse_targets(o) != 0) {
+			fprintf(stderr, "%s:%d: invalid job.\n", path, line_no);
+			return 1;
+		}
+		if (!o->output_file || strcmp(o->output_file, "CON") == 0) {
+			fprintf(stderr, "%s:%d: every job needs its own output file (-o).\n", path, line_no);
+			return 1;
+		}
+		for (int i = 0; i < m->count - 1; ++i) {
+			if (strcmp(m->jobs[i].output_file, o->output_file) == 0) {
+				fprintf(stderr, "%s:%d: %s is already written by another job.\n", path, line_no, o->output_file);
+				return 1;
+			}
+		}
+	}
+	if (m->count == 0) {
+		fprintf(stderr, "Manifest %s has no jobs.\n", path);
+		return 1;
+	}
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	Options opts;
+	memset(&opts, 0, sizeof(opts));
+	opts.name_policy = NAME_POLICY_PRESERVE;
+	opts.assign_style = ASSIGN_BOTH;
+	opts.expand_mode = EXPAND_MEMBERS;
+	opts.silent = 0;
+	opts.enable_suffixes = 0;
+	opts.preprocess = 1;
+	opts.pp = pp_create();
+	opts.jobs = 1;
+
+	if (argc <= 1 && stdin_is_tty()) {
+		print_usage(argv[0]);
+		return 1;
+	}
+
+	// Collect input files (for grouped [] support) and parse flags
+	const char **input_files = NULL;
+	int input_count = 0, input_cap = 0;
+
+	int args = parse_args(argc, argv, 1, &opts, &input_files, &input_count, &input_cap, 0);
+	if (args) return args == 2 ? 0 : 1;
 
 	// Check for CON with multiple inputs
 	if (opts.output_file && strcmp(opts.output_file, "CON") == 0 && input_count > 1) {
@@ -290,12 +767,25 @@ int main(int argc, char **argv) {
 		return 1;
 	}
 
+	if (opts.query_count > 0 && !opts.index_file) {
+		fprintf(stderr, "-query needs an index (-index file).\n");
+		free(input_files);
+		return 1;
+	}
+
+	// No inputs at all: read redirected stdin (dsconv < input.txt)
+	if (!opts.input_string && !opts.index_file && input_count == 0 && !stdin_is_tty()) {
+		add_input(&input_files, &input_count, &input_cap, strdup("-"));
+		opts.streaming = 1;
+	}
+
 	// Use first input file if no -i string provided
 	if (!opts.input_string && input_count > 0) {
 		opts.input_file = input_files[0];
 	}
 
-	if (!opts.input_file && !opts.input_string) {
+	// A query may run on an existing index alone
+	if (!opts.input_file && !opts.input_string && !(opts.index_file && opts.query_count > 0)) {
 		fprintf(stderr, "Missing target file or -i string.\n");
 		print_usage(argv[0]);
 		free(input_files);
@@ -319,6 +809,26 @@ int main(int argc, char **argv) {
 	}
 	// Targets default to "c" if not set
 	if (!opts.targets) opts.targets = "c";
+	if (parse_targets(&opts) != 0) {
+		free(input_files);
+		return 1;
+	}
+
+	// Manifest jobs are read before any input is parsed
+	Manifest manifest;
+	memset(&manifest, 0, sizeof(manifest));
+	if (opts.manifest_file) {
+		if (opts.index_file || opts.streaming) {
+			fprintf(stderr, "-manifest needs the whole input and cannot be combined with -index or -stream.\n");
+			free(input_files);
+			return 1;
+		}
+		if (load_manifest(opts.manifest_file, &opts, argv[0], &manifest) != 0) {
+			manifest_free(&manifest);
+			free(input_files);
+			return 1;
+		}
+	}
 
 	// Validation: output file cannot be same as input file
 	if (opts.output_file && opts.input_file && strcmp(opts.output_file, opts.input_file) == 0) {
@@ -327,67 +837,172 @@ int main(int argc, char **argv) {
 		return 1;
 	}
 
-	// Parse input(s) and merge ASTs
+	// Performance report (-p)
+	Report *report = opts.metadata_file ? report_create() : NULL;
+	double run_wall = clock_wall(), run_cpu = clock_cpu();
+
+	if (opts.index_file) {
+		int rc = run_index(input_files, input_count, &opts, report);
+		if (report) {
+			report->total_wall = clock_wall() - run_wall;
+			report->total_cpu = clock_cpu() - run_cpu;
+			report_write_json(report, opts.metadata_file);
+			report_destroy(report);
+		}
+		pp_destroy(opts.pp);
+		for (int i = 0; i < input_count; ++i) free((char*)input_files[i]);
+		free(input_files);
+		return rc;
+	}
+
+	if (opts.streaming && !opts.input_string) {
+		if (opts.root_count > 0 || opts.forward_declarations || opts.shards > 1) {
+			fprintf(stderr, "Warning: -root, -fwd and -shards need the whole input and are ignored when streaming.\n");
+		}
+		if (!opts.silent && opts.output_file) {
+			printf("DSConv: streaming %d inputs\n", input_count);
+		}
+		int rc = run_streaming(input_files, input_count, &opts, report);
+		if (report) {
+			report->total_wall = clock_wall() - run_wall;
+			report->total_cpu = clock_cpu() - run_cpu;
+			report_write_json(report, opts.metadata_file);
+			report_destroy(report);
+		}
+		for (int i = 0; i < input_count; ++i) free((char*)input_files[i]);
+		free(input_files);
+		return rc;
+	}
+
+	// Parse input(s) and merge ASTs; identical types are shared and repeated
+	// declarations dropped through the type table
 	ASTRoot *ast = NULL;
+	TypeTable *types = type_table_create();
 	if (opts.input_string) {
 		if (!opts.silent) {
 			printf("DSConv: parsing input string\n");
 		}
-		ast = parse_string(opts.input_string, &opts);
-		if (!ast) {
+		ASTRoot *parsed = parse_string(opts.input_string, &opts);
+		if (!parsed) {
 			fprintf(stderr, "Parsing failed.\n");
 			for (int i = 0; i < input_count; ++i) free((char*)input_files[i]);
 			free(input_files);
+			type_table_destroy(types);
+			report_destroy(report);
+			manifest_free(&manifest);
 			return 1;
 		}
+		report_add_input(report, NULL, &parsed->stats);
+		ast = (ASTRoot*)calloc(1, sizeof(ASTRoot));
+		type_table_merge(types, ast, parsed, NULL);
+		free(parsed);
 	} else if (input_count >= 1) {
 		// Multiple files/strings - merge ASTs
 		if (!opts.silent) {
 			printf("DSConv: parsing and merging %d inputs\n", input_count);
 		}
 		ast = (ASTRoot*)calloc(1, sizeof(ASTRoot));
-		ast->first = NULL;
+		// Upcoming inputs are read ahead on a loader thread while the
+		// current one is parsed
+		Prefetcher *prefetch = prefetch_start(input_files, input_count, PREFETCH_AHEAD);
+		// With -root only what the roots reach is emitted: inputs are
+		// skimmed and just those declarations parsed afterwards
+		LazySet *lazy = opts.root_count > 0 && !opts.manifest_file ? lazy_create(&opts) : NULL;
 		for (int i = 0; i < input_count; ++i) {
 			if (!opts.silent) {
 				printf("  [%d/%d] %s\n", i + 1, input_count, input_files[i]);
 			}
 			ASTRoot *partial = NULL;
-			// Check if it's a file or string
-			FILE *f = fopen(input_files[i], "r");
-			if (f) {
-				fclose(f);
-				partial = parse_file(input_files[i], &opts);
+			// Inputs that can't be read as files are parsed as code
+			size_t len;
+			double wait_wall;
+			char *data = prefetch_take(prefetch, i, &len, &wait_wall);
+			if (lazy) {
+				ParseStats skimmed;
+				if (lazy_add(lazy, input_files[i], data, len, &skimmed)) {
+					if (data) skimmed.read_wall += wait_wall;
+					report_add_input(report, input_files[i], &skimmed);
+					continue;
+				}
+			} else if (data) {
+				partial = parse_loaded(input_files[i], data, len, &opts);
 			} else {
 				partial = parse_string(input_files[i], &opts);
 			}
 			if (!partial) {
 				fprintf(stderr, "Parsing failed for %s.\n", input_files[i]);
+				lazy_destroy(lazy);
+				prefetch_stop(prefetch);
 				for (int j = 0; j < input_count; ++j) free((char*)input_files[j]);
 				free(input_files);
+				ast_free(ast);
+				type_table_destroy(types);
+				report_destroy(report);
+				manifest_free(&manifest);
 				return 1;
 			}
-			// Merge: append partial->first to ast
-			if (!ast->first) {
-				ast->first = partial->first;
-			} else {
-				ASTNode *last = ast->first;
-				while (last->next) last = last->next;
-				last->next = partial->first;
-			}
+			// Only the time spent waiting on the loader counts as reading
+			if (data) partial->stats.read_wall += wait_wall;
+			report_add_input(report, input_files[i], &partial->stats);
+			// Merge: append partial to ast
+			double merge_wall = clock_wall(), merge_cpu = clock_cpu();
+			type_table_merge(types, ast, partial, input_files[i]);
 			free(partial);
+			report_phase_add(report, PHASE_MERGE, clock_wall() - merge_wall, clock_cpu() - merge_cpu);
+		}
+		prefetch_stop(prefetch);
+		if (lazy) {
+			double wall = clock_wall(), cpu = clock_cpu();
+			size_t parsed = lazy_materialize(lazy, opts.roots, opts.root_count, types, ast);
+			report_phase_add(report, PHASE_PARSE, clock_wall() - wall, clock_cpu() - cpu);
+			if (!opts.silent) {
+				printf("  parsed %zu declarations needed by -root\n", parsed);
+			}
+			lazy_destroy(lazy);
 		}
 	} else {
 		fprintf(stderr, "No input files provided.\n");
 		for (int i = 0; i < input_count; ++i) free((char*)input_files[i]);
 		free(input_files);
+		type_table_destroy(types);
+		report_destroy(report);
+		manifest_free(&manifest);
 		return 1;
 	}
-	if (!opts.silent && (!opts.output_file || strcmp(opts.output_file, "CON") == 0)) {
+	if (!opts.silent && !opts.manifest_file && (!opts.output_file || strcmp(opts.output_file, "CON") == 0)) {
 		printf("---------------------------------------\n");
 	}
-	int rc = generate_for_targets(ast, &opts);
-	(void)rc;
+	double gen_wall = clock_wall(), gen_cpu = clock_cpu();
+	// Generation reads a flat copy of the AST; the linked nodes and the
+	// types they share are released before any output is written
+	FlatAST *flat = generate_prepare(ast, report);
+	if (report) report->merge = *type_table_stats(types);
+	ast_free(ast);
+	type_table_destroy(types);
+	int rc = 0;
+	if (opts.manifest_file) {
+		if (!opts.silent) {
+			printf("DSConv: running %d jobs from %s\n", manifest.count, opts.manifest_file);
+		}
+		int failed = generate_jobs(flat, manifest.jobs, manifest.count, opts.jobs, report);
+		if (failed) {
+			fprintf(stderr, "%d of %d jobs failed.\n", failed, manifest.count);
+			rc = 1;
+		}
+		manifest_free(&manifest);
+	} else {
+		rc = generate_for_targets(flat, &opts, report);
+	}
+	report_phase_add(report, PHASE_GENERATE, clock_wall() - gen_wall, clock_cpu() - gen_cpu);
+	flat_destroy(flat);
+	if (report) {
+		report->total_wall = clock_wall() - run_wall;
+		report->total_cpu = clock_cpu() - run_cpu;
+		report_write_json(report, opts.metadata_file);
+		report_destroy(report);
+	}
+	pp_destroy(opts.pp);
 	for (int i = 0; i < input_count; ++i) free((char*)input_files[i]);
 	free(input_files);
-	return 0;
+	return rc;
 }
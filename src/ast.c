@@ -0,0 +1,142 @@
+#include <stdlib.h>
+#include "ast.h"
+#include "memstat.h"
+
+static void members_free(Member *m) {
+    while (m) {
+        Member *next = m->next;
+        free(m->name);
+        type_free(m->type);
+        free(m);
+        m = next;
+    }
+}
+
+void type_free(Type *t) {
+    if (!t || t->interned) return;
+    type_release(t);
+}
+
+void type_release(Type *t) {
+    if (!t) return;
+    switch (t->kind) {
+        case TYPE_BUILTIN: free(t->u.builtin_name); break;
+        case TYPE_POINTER: type_free(t->u.ptr.base); break;
+        case TYPE_ARRAY:
+            type_free(t->u.array.base);
+            free(t->u.array.expr);
+            break;
+        case TYPE_FUNCTION:
+            type_free(t->u.func.ret);
+            type_free(t->u.func.params);
+            break;
+        case TYPE_STRUCT:
+        case TYPE_UNION:
+            free(t->u.s.tag);
+            members_free(t->u.s.members);
+            break;
+        case TYPE_ENUM: {
+            free(t->u.en.tag);
+            EnumValue *e = t->u.en.values;
+            while (e) {
+                EnumValue *next = e->next;
+                free(e->name);
+                free(e->spelling);
+                free(e->expr);
+                free(e);
+                e = next;
+            }
+            break;
+        }
+        case TYPE_ALIAS: free(t->u.alias_to); break;
+    }
+    free(t);
+}
+
+static char *str_copy(const char *s) {
+    return s ? ds_strdup(s) : NULL;
+}
+
+Type *type_copy(const Type *t) {
+    if (!t) return NULL;
+    if (t->interned) return (Type*)t;
+    Type *c = (Type*)ds_calloc(1, sizeof(Type));
+    c->kind = t->kind;
+    c->quals = t->quals;
+    switch (t->kind) {
+        case TYPE_BUILTIN: c->u.builtin_name = str_copy(t->u.builtin_name); break;
+        case TYPE_POINTER: c->u.ptr.base = type_copy(t->u.ptr.base); break;
+        case TYPE_ARRAY:
+            c->u.array.base = type_copy(t->u.array.base);
+            c->u.array.length = t->u.array.length;
+            c->u.array.line = t->u.array.line;
+            c->u.array.expr = str_copy(t->u.array.expr);
+            break;
+        case TYPE_FUNCTION: {
+            c->u.func.ret = type_copy(t->u.func.ret);
+            Type **tail = &c->u.func.params;
+            for (const Type *p = t->u.func.params; p; p = p->next) {
+                *tail = type_copy(p);
+                tail = &(*tail)->next;
+            }
+            break;
+        }
+        case TYPE_STRUCT:
+        case TYPE_UNION: {
+            c->u.s.tag = str_copy(t->u.s.tag);
+            c->u.s.is_forward = t->u.s.is_forward;
+            Member **tail = &c->u.s.members;
+            for (const Member *m = t->u.s.members; m; m = m->next) {
+                Member *cm = (Member*)ds_calloc(1, sizeof(Member));
+                cm->name = str_copy(m->name);
+                cm->type = type_copy(m->type);
+                cm->bits = m->bits;
+                *tail = cm;
+                tail = &cm->next;
+            }
+            break;
+        }
+        case TYPE_ENUM: {
+            c->u.en.tag = str_copy(t->u.en.tag);
+            EnumValue **tail = &c->u.en.values;
+            for (const EnumValue *e = t->u.en.values; e; e = e->next) {
+                EnumValue *ce = (EnumValue*)ds_calloc(1, sizeof(EnumValue));
+                ce->name = str_copy(e->name);
+                ce->value = e->value;
+                ce->spelling = str_copy(e->spelling);
+                ce->expr = str_copy(e->expr);
+                ce->line = e->line;
+                *tail = ce;
+                tail = &ce->next;
+            }
+            break;
+        }
+        case TYPE_ALIAS: c->u.alias_to = str_copy(t->u.alias_to); break;
+    }
+    return c;
+}
+
+void ast_node_free(ASTNode *n) {
+    if (!n) return;
+    type_free(n->type);
+    free(n->name);
+    free(n);
+}
+
+void ast_free(ASTRoot *root) {
+    if (!root) return;
+    ASTNode *n = root->first;
+    while (n) {
+        ASTNode *next = n->next;
+        ast_node_free(n);
+        n = next;
+    }
+    free(root);
+}
+
+void ast_append(ASTRoot *dst, ASTRoot *src) {
+    if (!src->first) return;
+    if (dst->last) dst->last->next = src->first; else dst->first = src->first;
+    dst->last = src->last;
+    src->first = src->last = NULL;
+}
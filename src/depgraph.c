@@ -0,0 +1,417 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "depgraph.h"
+#include "memstat.h"
+
+enum { STATE_NEW = 0, STATE_VISITING, STATE_DONE };
+
+/* Name -> declaration index, open addressing. */
+typedef struct {
+    const char *name; /* borrowed from the string pool, or owned for tag keys */
+    int owned;
+    size_t index;
+} Slot;
+
+typedef struct {
+    const FlatAST *fa;
+    size_t count; /* declarations */
+    unsigned char *state;
+    unsigned char *queued;    /* already in queue */
+    Slot *names;  /* typedef, variable and function names */
+    Slot *tags;   /* "struct T" / "union T" / "enum T" */
+    size_t cap;   /* capacity of both maps */
+    size_t *queue; /* records reached through pointers, emitted later */
+    size_t queue_head, queue_count;
+    EmitPlan *plan;
+} Graph;
+
+static uint64_t hash_name(const char *s) {
+    uint64_t h = 1469598103934665603ull;
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+static Slot *slot_find(Slot *map, size_t cap, const char *name) {
+    size_t i = hash_name(name) & (cap - 1);
+    while (map[i].name) {
+        if (strcmp(map[i].name, name) == 0) return &map[i];
+        i = (i + 1) & (cap - 1);
+    }
+    return &map[i];
+}
+
+/* First definition wins, like the merge in intern.c. */
+static void slot_put(Slot *map, size_t cap, const char *name, int owned, size_t index) {
+    Slot *s = slot_find(map, cap, name);
+    if (s->name) {
+        if (owned) free((char*)name);
+        return;
+    }
+    s->name = name;
+    s->owned = owned;
+    s->index = index;
+}
+
+static char *tag_key(TypeKind kind, const char *tag) {
+    size_t n = strlen(tag) + 7;
+    char *key = (char*)ds_malloc(n + 1);
+    snprintf(key, n + 1, "%s %s", kind == TYPE_UNION ? "union" : kind == TYPE_ENUM ? "enum" : "struct", tag);
+    return key;
+}
+
+/* The tagged record or enum with a body that t is or points to; records
+ * and enums are declared by tag, so this is what a declaration defines. */
+static FlatRef defined_tag(const FlatAST *fa, FlatRef t) {
+    while (t != FLAT_NONE) {
+        const FlatType *ft = &fa->types[t];
+        switch (ft->kind) {
+            case TYPE_POINTER:
+            case TYPE_ARRAY:
+            case TYPE_FUNCTION:
+                t = ft->base;
+                break;
+            case TYPE_STRUCT:
+            case TYPE_UNION:
+            case TYPE_ENUM:
+                return (ft->name != FLAT_NONE && ft->count) ? t : FLAT_NONE;
+            default:
+                return FLAT_NONE;
+        }
+    }
+    return FLAT_NONE;
+}
+
+FlatRef depgraph_flat_record(const FlatAST *fa, FlatRef t) {
+    FlatRef rec = defined_tag(fa, t);
+    return (rec != FLAT_NONE && fa->types[rec].kind != TYPE_ENUM) ? rec : FLAT_NONE;
+}
+
+const Type *depgraph_defined_record(const Type *t) {
+    while (t) {
+        switch (t->kind) {
+            case TYPE_POINTER: t = t->u.ptr.base; break;
+            case TYPE_ARRAY: t = t->u.array.base; break;
+            case TYPE_FUNCTION: t = t->u.func.ret; break;
+            case TYPE_STRUCT:
+            case TYPE_UNION:
+                return (t->u.s.tag && t->u.s.members) ? t : NULL;
+            default:
+                return NULL;
+        }
+    }
+    return NULL;
+}
+
+static void plan_push(EmitPlan *plan, size_t index, FlatRef forward) {
+    if (!plan) return;
+    if (plan->count == plan->cap) {
+        plan->cap = plan->cap ? plan->cap * 2 : 64;
+        plan->items = (PlanItem*)ds_realloc(plan->items, plan->cap * sizeof(PlanItem));
+    }
+    plan->items[plan->count].index = index;
+    plan->items[plan->count].forward = forward;
+    plan->count++;
+}
+
+static void visit(Graph *g, size_t index);
+
+static const Slot *lookup(const Slot *map, size_t cap, const char *name) {
+    const Slot *s = slot_find((Slot*)map, cap, name);
+    return s->name ? s : NULL;
+}
+
+static void require_name(Graph *g, const char *name, int complete);
+
+/* A tag mentioned outside a pointer (typedef struct T T;) declares itself;
+ * one behind a pointer gets a forward declaration when its definition has
+ * not been emitted yet. */
+static void require_tag(Graph *g, const FlatType *ref, int complete, int via_ptr) {
+    char *key = tag_key(ref->kind, flat_str(g->fa, ref->name));
+    const Slot *s = lookup(g->tags, g->cap, key);
+    free(key);
+    if (!s) return; /* defined outside the parsed inputs */
+    size_t i = s->index;
+    if (complete) {
+        visit(g, i);
+        return;
+    }
+    if (g->state[i] != STATE_NEW || g->queued[i]) return;
+    g->queued[i] = 1;
+    if (via_ptr) plan_push(g->plan, 0, depgraph_flat_record(g->fa, g->fa->decls[i].type));
+    g->queue[g->queue_count++] = i;
+}
+
+/* Walks a type and requires what it mentions. complete is set where the
+ * type is used by value (members, arrays, object declarations). */
+static void walk_type(Graph *g, FlatRef ref, int complete) {
+    const FlatAST *fa = g->fa;
+    int via_ptr = 0;
+    while (ref != FLAT_NONE) {
+        const FlatType *t = &fa->types[ref];
+        switch (t->kind) {
+            case TYPE_POINTER:
+                ref = t->base;
+                complete = 0;
+                via_ptr = 1;
+                continue;
+            case TYPE_ARRAY:
+                ref = t->base;
+                continue;
+            case TYPE_FUNCTION:
+                ref = t->base;
+                complete = 0;
+                continue;
+            case TYPE_STRUCT:
+            case TYPE_UNION:
+                if (t->count) {
+                    for (int32_t i = 0; i < t->count; ++i) walk_type(g, fa->members[t->base + (FlatRef)i].type, 1);
+                } else if (t->name != FLAT_NONE) {
+                    require_tag(g, t, complete, via_ptr);
+                }
+                return;
+            case TYPE_ENUM:
+                /* an enum cannot be declared ahead of its definition */
+                if (!t->count && t->name != FLAT_NONE) require_tag(g, t, 1, via_ptr);
+                return;
+            case TYPE_ALIAS:
+                require_name(g, flat_str(fa, t->name), complete);
+                return;
+            default:
+                return;
+        }
+    }
+}
+
+/* A typedef name must always be declared first; when it is used by value
+ * the record it stands for must be complete as well. */
+static void require_name(Graph *g, const char *name, int complete) {
+    const Slot *s = lookup(g->names, g->cap, name);
+    if (!s) return;
+    visit(g, s->index);
+    const FlatDecl *n = &g->fa->decls[s->index];
+    if (complete && n->is_typedef) walk_type(g, n->type, 1);
+}
+
+static void visit(Graph *g, size_t index) {
+    if (g->state[index] != STATE_NEW) return;
+    g->state[index] = STATE_VISITING;
+    const FlatDecl *n = &g->fa->decls[index];
+    const FlatType *t = &g->fa->types[n->type];
+    int defines = (t->kind == TYPE_STRUCT || t->kind == TYPE_UNION) && t->count;
+    /* a typedef only needs the names it mentions; objects and record
+     * definitions need their member types complete */
+    walk_type(g, n->type, !n->is_typedef || defines);
+    g->state[index] = STATE_DONE;
+    plan_push(g->plan, index, FLAT_NONE);
+}
+
+static int find_root(const Graph *g, const char *root, size_t *index) {
+    const Slot *s = lookup(g->names, g->cap, root);
+    if (!s) s = lookup(g->tags, g->cap, root);
+    if (!s) {
+        char key[256];
+        snprintf(key, sizeof(key), "struct %s", root);
+        s = lookup(g->tags, g->cap, key);
+        if (!s) {
+            snprintf(key, sizeof(key), "union %s", root);
+            s = lookup(g->tags, g->cap, key);
+        }
+        if (!s) {
+            snprintf(key, sizeof(key), "enum %s", root);
+            s = lookup(g->tags, g->cap, key);
+        }
+    }
+    if (!s) return 0;
+    *index = s->index;
+    return 1;
+}
+
+static void graph_init(Graph *g, const FlatAST *fa, EmitPlan *plan) {
+    memset(g, 0, sizeof(*g));
+    if (plan) memset(plan, 0, sizeof(*plan));
+    g->plan = plan;
+    g->fa = fa;
+    g->count = fa->decl_count;
+    g->state = (unsigned char*)ds_calloc(g->count + 1, 1);
+    g->queued = (unsigned char*)ds_calloc(g->count + 1, 1);
+    g->queue = (size_t*)ds_malloc((g->count + 1) * sizeof(size_t));
+    g->cap = 64;
+    while (g->cap < g->count * 2) g->cap *= 2;
+    g->names = (Slot*)ds_calloc(g->cap, sizeof(Slot));
+    g->tags = (Slot*)ds_calloc(g->cap, sizeof(Slot));
+    for (size_t i = 0; i < g->count; ++i) {
+        const FlatDecl *n = &fa->decls[i];
+        if (n->name != FLAT_NONE) slot_put(g->names, g->cap, flat_str(fa, n->name), 0, i);
+        FlatRef rec = defined_tag(fa, n->type);
+        if (rec != FLAT_NONE) {
+            const FlatType *r = &fa->types[rec];
+            slot_put(g->tags, g->cap, tag_key(r->kind, flat_str(fa, r->name)), 1, i);
+        }
+    }
+}
+
+static void graph_free(Graph *g) {
+    for (size_t k = 0; k < g->cap; ++k) {
+        if (g->tags[k].owned) free((char*)g->tags[k].name);
+    }
+    free(g->names);
+    free(g->tags);
+    free(g->queue);
+    free(g->queued);
+    free(g->state);
+}
+
+/* Records only reached through pointers come after everything the roots
+ * need by value, in the order they were first reached. */
+static void drain_queue(Graph *g) {
+    while (g->queue_head < g->queue_count) visit(g, g->queue[g->queue_head++]);
+}
+
+void depgraph_plan(const FlatAST *fa, const char *const *roots, int root_count, EmitPlan *plan) {
+    Graph g;
+    graph_init(&g, fa, plan);
+    for (int r = 0; r < root_count; ++r) {
+        size_t index;
+        if (!find_root(&g, roots[r], &index)) {
+            fprintf(stderr, "root '%s' matches no declaration\n", roots[r]);
+            plan->missing++;
+            continue;
+        }
+        visit(&g, index);
+    }
+    drain_queue(&g);
+    graph_free(&g);
+}
+
+size_t depgraph_select(const FlatAST *fa, const char *const *roots, int root_count, unsigned char *selected) {
+    Graph g;
+    graph_init(&g, fa, NULL);
+    size_t missing = 0;
+    for (int r = 0; r < root_count; ++r) {
+        size_t index;
+        if (!find_root(&g, roots[r], &index)) {
+            fprintf(stderr, "root '%s' matches no declaration\n", roots[r]);
+            missing++;
+            continue;
+        }
+        visit(&g, index);
+    }
+    drain_queue(&g);
+    for (size_t i = 0; i < g.count; ++i) selected[i] = (g.state[i] == STATE_DONE);
+    graph_free(&g);
+    return missing;
+}
+
+void depgraph_plan_set(const FlatAST *fa, const unsigned char *selected, EmitPlan *plan) {
+    Graph g;
+    graph_init(&g, fa, plan);
+    for (size_t i = 0; i < g.count; ++i) {
+        if (selected[i]) visit(&g, i);
+    }
+    drain_queue(&g);
+    graph_free(&g);
+}
+
+static size_t uf_find(size_t *parent, size_t i) {
+    while (parent[i] != i) {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+static void uf_link(size_t *parent, size_t i, const Slot *target) {
+    if (!target) return;
+    size_t a = uf_find(parent, i), b = uf_find(parent, target->index);
+    if (a != b) parent[a < b ? b : a] = a < b ? a : b;
+}
+
+/* Links declaration i with every name and tag its type mentions. */
+static void link_type(Graph *g, size_t *parent, size_t i, FlatRef ref) {
+    const FlatAST *fa = g->fa;
+    while (ref != FLAT_NONE) {
+        const FlatType *t = &fa->types[ref];
+        switch (t->kind) {
+            case TYPE_POINTER:
+            case TYPE_ARRAY:
+            case TYPE_FUNCTION:
+                ref = t->base;
+                continue;
+            case TYPE_STRUCT:
+            case TYPE_UNION:
+                if (t->count) {
+                    for (int32_t k = 0; k < t->count; ++k) link_type(g, parent, i, fa->members[t->base + (FlatRef)k].type);
+                } else if (t->name != FLAT_NONE) {
+                    char *key = tag_key(t->kind, flat_str(fa, t->name));
+                    uf_link(parent, i, lookup(g->tags, g->cap, key));
+                    free(key);
+                }
+                return;
+            case TYPE_ENUM:
+                if (!t->count && t->name != FLAT_NONE) {
+                    char *key = tag_key(t->kind, flat_str(fa, t->name));
+                    uf_link(parent, i, lookup(g->tags, g->cap, key));
+                    free(key);
+                }
+                return;
+            case TYPE_ALIAS:
+                uf_link(parent, i, lookup(g->names, g->cap, flat_str(fa, t->name)));
+                return;
+            default:
+                return;
+        }
+    }
+}
+
+size_t depgraph_components(const FlatAST *fa, size_t *component) {
+    Graph g;
+    graph_init(&g, fa, NULL);
+    size_t *parent = (size_t*)ds_malloc((g.count + 1) * sizeof(size_t));
+    for (size_t i = 0; i < g.count; ++i) parent[i] = i;
+    for (size_t i = 0; i < g.count; ++i) link_type(&g, parent, i, fa->decls[i].type);
+    /* number components by first appearance */
+    size_t count = 0;
+    for (size_t i = 0; i < g.count; ++i) {
+        size_t r = uf_find(parent, i);
+        component[i] = (r == i) ? count++ : component[r];
+    }
+    free(parent);
+    graph_free(&g);
+    return count;
+}
+
+void depgraph_mentions(const Type *t, MentionFn fn, void *user) {
+    while (t) {
+        switch (t->kind) {
+            case TYPE_POINTER: t = t->u.ptr.base; continue;
+            case TYPE_ARRAY: t = t->u.array.base; continue;
+            case TYPE_FUNCTION: t = t->u.func.ret; continue;
+            case TYPE_STRUCT:
+            case TYPE_UNION:
+                if (t->u.s.members) {
+                    for (const Member *m = t->u.s.members; m; m = m->next) depgraph_mentions(m->type, fn, user);
+                } else if (t->u.s.tag) {
+                    fn(t->kind, t->u.s.tag, user);
+                }
+                return;
+            case TYPE_ENUM:
+                if (!t->u.en.values && t->u.en.tag) fn(TYPE_ENUM, t->u.en.tag, user);
+                return;
+            case TYPE_ALIAS:
+                fn(TYPE_ALIAS, t->u.alias_to, user);
+                return;
+            default:
+                return;
+        }
+    }
+}
+
+void emit_plan_free(EmitPlan *plan) {
+    free(plan->items);
+    memset(plan, 0, sizeof(*plan));
+}
@@ -0,0 +1,298 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "flatast.h"
+#include "layout.h"
+#include "dsconv.h"
+#include "memstat.h"
+
+/* Type node -> index, so shared (interned) types are stored once. Slots
+ * of an earlier epoch (before flat_forget_types) never match. */
+typedef struct {
+    const Type *type;
+    FlatRef index;
+    uint32_t epoch;
+} TypeSlot;
+
+/* Pooled string, by hash and offset. */
+typedef struct {
+    uint32_t hash;
+    FlatRef offset; /* FLAT_NONE for an empty slot */
+} StringSlot;
+
+struct FlatBuilder {
+    size_t type_cap, member_cap, value_cap, decl_cap, strings_cap;
+    TypeSlot *type_map;
+    size_t type_map_cap;
+    uint32_t epoch;
+    StringSlot *string_map;
+    size_t string_map_cap;
+};
+
+#define GROW(arr, count, cap, extra, T) do { \
+        if ((count) + (extra) > (cap)) { \
+            while ((count) + (extra) > (cap)) (cap) = (cap) ? (cap) * 2 : 256; \
+            (arr) = (T*)ds_realloc((arr), (cap) * sizeof(T)); \
+        } \
+    } while (0)
+
+static uint64_t hash_ptr(const void *p) {
+    uint64_t h = (uint64_t)(uintptr_t)p;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    return h;
+}
+
+static uint32_t hash_str(const char *s, size_t *len) {
+    uint32_t h = 2166136261u;
+    const char *p = s;
+    while (*p) {
+        h ^= (unsigned char)*p++;
+        h *= 16777619u;
+    }
+    *len = (size_t)(p - s);
+    return h;
+}
+
+FlatAST *flat_create(void) {
+    FlatAST *fa = (FlatAST*)ds_calloc(1, sizeof(FlatAST));
+    fa->builder = (FlatBuilder*)ds_calloc(1, sizeof(FlatBuilder));
+    return fa;
+}
+
+void flat_destroy(FlatAST *fa) {
+    if (!fa) return;
+    free(fa->types);
+    free(fa->members);
+    free(fa->values);
+    free(fa->decls);
+    free(fa->strings);
+    free(fa->builder->type_map);
+    free(fa->builder->string_map);
+    free(fa->builder);
+    free(fa);
+}
+
+void flat_clear(FlatAST *fa) {
+    FlatBuilder *b = fa->builder;
+    fa->type_count = fa->member_count = fa->value_count = fa->decl_count = 0;
+    fa->strings_len = 0;
+    memset(&fa->stats, 0, sizeof(fa->stats));
+    if (b->type_map) memset(b->type_map, 0, b->type_map_cap * sizeof(TypeSlot));
+    if (b->string_map) memset(b->string_map, 0xff, b->string_map_cap * sizeof(StringSlot));
+}
+
+const char *flat_str(const FlatAST *fa, FlatRef s) {
+    return s == FLAT_NONE ? NULL : fa->strings + s;
+}
+
+const FlatType *flat_type(const FlatAST *fa, FlatRef t) {
+    return t == FLAT_NONE ? NULL : &fa->types[t];
+}
+
+void flat_forget_types(FlatAST *fa) {
+    fa->builder->epoch++;
+}
+
+/* ---- maps ---- */
+
+static TypeSlot *type_slot(TypeSlot *map, size_t cap, const Type *t, uint32_t epoch) {
+    size_t i = hash_ptr(t) & (cap - 1);
+    while (map[i].type && (map[i].type != t || map[i].epoch != epoch)) i = (i + 1) & (cap - 1);
+    return &map[i];
+}
+
+static void type_map_put(FlatAST *fa, const Type *t, FlatRef index) {
+    FlatBuilder *b = fa->builder;
+    if ((fa->type_count + 1) * 4 > b->type_map_cap * 3) {
+        size_t old_cap = b->type_map_cap;
+        TypeSlot *old = b->type_map;
+        b->type_map_cap = old_cap ? old_cap * 2 : 1024;
+        b->type_map = (TypeSlot*)ds_calloc(b->type_map_cap, sizeof(TypeSlot));
+        for (size_t i = 0; i < old_cap; ++i) {
+            if (old[i].type && old[i].epoch == b->epoch) *type_slot(b->type_map, b->type_map_cap, old[i].type, b->epoch) = old[i];
+        }
+        free(old);
+    }
+    TypeSlot *s = type_slot(b->type_map, b->type_map_cap, t, b->epoch);
+    s->type = t;
+    s->index = index;
+    s->epoch = b->epoch;
+}
+
+static FlatRef type_map_get(const FlatAST *fa, const Type *t) {
+    const FlatBuilder *b = fa->builder;
+    if (!b->type_map) return FLAT_NONE;
+    const TypeSlot *s = type_slot(b->type_map, b->type_map_cap, t, b->epoch);
+    return s->type ? s->index : FLAT_NONE;
+}
+
+static StringSlot *string_slot(const FlatAST *fa, StringSlot *map, size_t cap, uint32_t hash, const char *s) {
+    size_t i = hash & (cap - 1);
+    while (map[i].offset != FLAT_NONE && (map[i].hash != hash || strcmp(fa->strings + map[i].offset, s) != 0)) {
+        i = (i + 1) & (cap - 1);
+    }
+    return &map[i];
+}
+
+/* Pools s (once per distinct string); stats count what the linked AST
+ * spends on its own copy. */
+static FlatRef intern_str(FlatAST *fa, const char *s) {
+    if (!s) return FLAT_NONE;
+    FlatBuilder *b = fa->builder;
+    size_t len;
+    uint32_t hash = hash_str(s, &len);
+    fa->stats.linked_bytes += len + 1;
+    if ((fa->stats.strings + 1) * 4 > b->string_map_cap * 3) {
+        size_t old_cap = b->string_map_cap;
+        StringSlot *old = b->string_map;
+        b->string_map_cap = old_cap ? old_cap * 2 : 1024;
+        b->string_map = (StringSlot*)ds_malloc(b->string_map_cap * sizeof(StringSlot));
+        memset(b->string_map, 0xff, b->string_map_cap * sizeof(StringSlot));
+        for (size_t i = 0; i < old_cap; ++i) {
+            if (old[i].offset == FLAT_NONE) continue;
+            *string_slot(fa, b->string_map, b->string_map_cap, old[i].hash, fa->strings + old[i].offset) = old[i];
+        }
+        free(old);
+    }
+    StringSlot *slot = string_slot(fa, b->string_map, b->string_map_cap, hash, s);
+    if (slot->offset != FLAT_NONE) return slot->offset;
+    GROW(fa->strings, fa->strings_len, b->strings_cap, len + 1, char);
+    memcpy(fa->strings + fa->strings_len, s, len + 1);
+    slot->hash = hash;
+    slot->offset = (FlatRef)fa->strings_len;
+    fa->strings_len += len + 1;
+    fa->stats.strings++;
+    return slot->offset;
+}
+
+/* ---- building ---- */
+
+/* A builtin named by pooled string name, for the standard typedef names
+ * that stand for one (layout.h). */
+static FlatRef add_builtin(FlatAST *fa, FlatRef name) {
+    GROW(fa->types, fa->type_count, fa->builder->type_cap, 1, FlatType);
+    FlatType *ft = &fa->types[fa->type_count];
+    memset(ft, 0, sizeof(*ft));
+    ft->kind = TYPE_BUILTIN;
+    ft->name = name;
+    ft->base = FLAT_NONE;
+    return (FlatRef)fa->type_count++;
+}
+
+/* Children are stored before their parent; the members of a record (and
+ * the values of an enum) are reserved as one range before their types are
+ * added, so nested records land after the range instead of inside it. */
+static FlatRef flatten_type(FlatAST *fa, const Type *t) {
+    if (!t) return FLAT_NONE;
+    FlatRef known = type_map_get(fa, t);
+    if (known != FLAT_NONE) return known;
+    FlatBuilder *b = fa->builder;
+    FlatType ft;
+    ft.kind = (uint8_t)t->kind;
+    ft.forward = 0;
+    ft.quals = (uint8_t)t->quals;
+    ft.name = FLAT_NONE;
+    ft.base = FLAT_NONE;
+    ft.count = 0;
+    fa->stats.linked_bytes += sizeof(Type);
+    switch (t->kind) {
+        case TYPE_BUILTIN: ft.name = intern_str(fa, t->u.builtin_name); break;
+        case TYPE_POINTER: ft.base = flatten_type(fa, t->u.ptr.base); break;
+        case TYPE_ARRAY:
+            ft.base = flatten_type(fa, t->u.array.base);
+            ft.count = t->u.array.length;
+            ft.name = intern_str(fa, t->u.array.expr);
+            break;
+        case TYPE_FUNCTION: ft.base = flatten_type(fa, t->u.func.ret); break;
+        case TYPE_STRUCT:
+        case TYPE_UNION: {
+            ft.name = intern_str(fa, t->u.s.tag);
+            ft.forward = (uint8_t)(t->u.s.is_forward != 0);
+            for (const Member *m = t->u.s.members; m; m = m->next) ft.count++;
+            if (!ft.count) break;
+            GROW(fa->members, fa->member_count, b->member_cap, (size_t)ft.count, FlatMember);
+            ft.base = (FlatRef)fa->member_count;
+            fa->member_count += (size_t)ft.count;
+            FlatRef i = ft.base;
+            for (const Member *m = t->u.s.members; m; m = m->next, ++i) {
+                FlatRef name = intern_str(fa, m->name);
+                FlatRef type = flatten_type(fa, m->type);
+                fa->members[i].name = name;
+                fa->members[i].type = type;
+                fa->members[i].bits = m->bits;
+                fa->stats.linked_bytes += sizeof(Member);
+            }
+            break;
+        }
+        case TYPE_ENUM: {
+            ft.name = intern_str(fa, t->u.en.tag);
+            for (const EnumValue *e = t->u.en.values; e; e = e->next) ft.count++;
+            if (!ft.count) break;
+            GROW(fa->values, fa->value_count, b->value_cap, (size_t)ft.count, FlatEnumValue);
+            ft.base = (FlatRef)fa->value_count;
+            FlatEnumValue *v = &fa->values[fa->value_count];
+            fa->value_count += (size_t)ft.count;
+            for (const EnumValue *e = t->u.en.values; e; e = e->next, ++v) {
+                v->name = intern_str(fa, e->name);
+                v->spelling = intern_str(fa, e->spelling);
+                v->expr = intern_str(fa, e->expr);
+                v->value = e->value;
+                fa->stats.linked_bytes += sizeof(EnumValue);
+            }
+            break;
+        }
+        case TYPE_ALIAS:
+            ft.name = intern_str(fa, t->u.alias_to);
+            if (builtin_is_standard(t->u.alias_to)) ft.base = add_builtin(fa, ft.name);
+            break;
+    }
+    GROW(fa->types, fa->type_count, b->type_cap, 1, FlatType);
+    FlatRef index = (FlatRef)fa->type_count;
+    type_map_put(fa, t, index);
+    fa->types[fa->type_count++] = ft;
+    return index;
+}
+
+static void update_stats(FlatAST *fa) {
+    FlatStats *st = &fa->stats;
+    st->types = fa->type_count;
+    st->members = fa->member_count;
+    st->values = fa->value_count;
+    st->decls = fa->decl_count;
+    st->flat_bytes = fa->type_count * sizeof(FlatType) + fa->member_count * sizeof(FlatMember)
+                   + fa->value_count * sizeof(FlatEnumValue) + fa->decl_count * sizeof(FlatDecl)
+                   + fa->strings_len;
+}
+
+FlatRef flat_add(FlatAST *fa, const ASTNode *n) {
+    FlatDecl d;
+    d.type = flatten_type(fa, n->type);
+    d.name = intern_str(fa, n->name);
+    d.is_typedef = n->is_typedef;
+    fa->stats.linked_bytes += sizeof(ASTNode);
+    GROW(fa->decls, fa->decl_count, fa->builder->decl_cap, 1, FlatDecl);
+    fa->decls[fa->decl_count] = d;
+    fa->decl_count++;
+    update_stats(fa);
+    return (FlatRef)(fa->decl_count - 1);
+}
+
+/* A built copy takes no more declarations, so the maps that deduplicate
+ * them are dropped as soon as it is complete. */
+FlatAST *flat_build(const ASTRoot *ast) {
+    FlatAST *fa = flat_create();
+    for (const ASTNode *n = ast->first; n; n = n->next) flat_add(fa, n);
+    FlatBuilder *b = fa->builder;
+    free(b->type_map);
+    free(b->string_map);
+    b->type_map = NULL;
+    b->string_map = NULL;
+    b->type_map_cap = b->string_map_cap = 0;
+    DS_TRACE("flatten: %zu types, %zu members, %zu values, %zu decls; %zu bytes linked, %zu flat\n",
+             fa->type_count, fa->member_count, fa->value_count, fa->decl_count,
+             fa->stats.linked_bytes, fa->stats.flat_bytes);
+    return fa;
+}
@@ -0,0 +1,137 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "codegen.h"
+#include "memstat.h"
+
+/* -olang cpp: compile-time reflection for C++17.
+ *
+ * The declarations themselves are the C ones, which are valid C++. Every
+ * named struct additionally gets a specialization of dsconv::fields<T>
+ * whose list is a constexpr tuple of (name, member pointer) pairs, so
+ * dsconv::for_each_field expands into one call per member that the
+ * compiler can inline completely. Bit-fields (no member pointers) and
+ * flexible array members are left out; members of anonymous struct/union
+ * members are listed as the enclosing type's own. Unions get no list, as a
+ * visitor cannot tell which member is active. Every named enum gets a
+ * constexpr table of its enumerators and their names in
+ * dsconv::enum_names<E>, used by dsconv::enum_name and
+ * dsconv::enum_from_name. */
+
+void gen_cpp_prologue(Emitter *out, const Options *opts) {
+    if (opts->output_lang != OUTPUT_CPP) return;
+    emit(out,
+        "#include <cstddef>\n"
+        "#include <cstdint>\n"
+        "#include <string_view>\n"
+        "#include <tuple>\n"
+        "#include <type_traits>\n"
+        "#include <utility>\n"
+        "\n"
+        "#ifndef DSCONV_CPP_HELPERS\n"
+        "#define DSCONV_CPP_HELPERS\n"
+        "namespace dsconv {\n"
+        "template <class C, class M>\n"
+        "struct field {\n"
+        "    std::string_view name;\n"
+        "    M C::*ptr;\n"
+        "};\n"
+        "template <class C, class M>\n"
+        "constexpr field<C, M> make_field(std::string_view name, M C::*ptr) { return { name, ptr }; }\n"
+        "\n"
+        "/* Specialized for every struct: static constexpr tuple `list` of fields. */\n"
+        "template <class T> struct fields;\n"
+        "template <class T>\n"
+        "constexpr std::size_t field_count = std::tuple_size_v<decltype(fields<T>::list)>;\n"
+        "\n"
+        "/* Calls f(name, member) for every field of obj, in declaration order. */\n"
+        "template <class T, class F>\n"
+        "constexpr void for_each_field(T &&obj, F &&f) {\n"
+        "    using R = std::remove_cv_t<std::remove_reference_t<T>>;\n"
+        "    std::apply([&](const auto &... m) { (f(m.name, obj.*(m.ptr)), ...); }, fields<R>::list);\n"
+        "}\n"
+        "/* Calls f(name, a_member, b_member) for every field, e.g. to compare. */\n"
+        "template <class T, class F>\n"
+        "constexpr void for_each_field(T &&a, T &&b, F &&f) {\n"
+        "    using R = std::remove_cv_t<std::remove_reference_t<T>>;\n"
+        "    std::apply([&](const auto &... m) { (f(m.name, a.*(m.ptr), b.*(m.ptr)), ...); }, fields<R>::list);\n"
+        "}\n"
+        "\n"
+        "/* Specialized for every enum: static constexpr array `list` of\n"
+        " * (value, name) pairs in declaration order. */\n"
+        "template <class E> struct enum_names;\n"
+        "template <class E>\n"
+        "constexpr std::string_view enum_name(E v) {\n"
+        "    for (const auto &e : enum_names<E>::list) {\n"
+        "        if (e.first == v) return e.second;\n"
+        "    }\n"
+        "    return {};\n"
+        "}\n"
+        "template <class E>\n"
+        "constexpr bool enum_from_name(std::string_view name, E &out) {\n"
+        "    for (const auto &e : enum_names<E>::list) {\n"
+        "        if (e.second == name) { out = e.first; return true; }\n"
+        "    }\n"
+        "    return false;\n"
+        "}\n"
+        "} // namespace dsconv\n"
+        "#endif\n"
+        "\n");
+}
+
+static int is_anonymous(const FlatAST *fa, const FlatMember *m) {
+    const FlatType *t = flat_type(fa, m->type);
+    return m->name == FLAT_NONE && !m->bits && t && (t->kind == TYPE_STRUCT || t->kind == TYPE_UNION) && t->name == FLAT_NONE;
+}
+
+static int is_flexible(const FlatAST *fa, const FlatMember *m, int last) {
+    const FlatType *t = flat_type(fa, m->type);
+    return last && t && t->kind == TYPE_ARRAY && t->count <= 0 && t->name == FLAT_NONE;
+}
+
+static void emit_field_list(Emitter *out, const FlatAST *fa, const char *T, const FlatType *record, int *count) {
+    for (int32_t i = 0; i < record->count; ++i) {
+        const FlatMember *m = &fa->members[record->base + (FlatRef)i];
+        if (is_anonymous(fa, m)) {
+            emit_field_list(out, fa, T, &fa->types[m->type], count);
+            continue;
+        }
+        if (m->name == FLAT_NONE || m->bits || is_flexible(fa, m, i + 1 == record->count)) continue;
+        const char *name = flat_str(fa, m->name);
+        emit(out, "%s\n        make_field(\"%s\", &%s::%s)", *count ? "," : "", name, T, name);
+        (*count)++;
+    }
+}
+
+static void emit_fields(Emitter *out, const FlatAST *fa, const FlatDecl *n) {
+    RecordName rec;
+    if (!codegen_record(fa, n, &rec) || rec.type->kind != TYPE_STRUCT) return;
+    /* "struct T" names the same type as T in C++ */
+    const char *T = rec.prefix;
+    int count = 0;
+    emit(out, "namespace dsconv {\ntemplate <> struct fields<%s> {\n", T);
+    emit(out, "    static constexpr auto list = std::make_tuple(");
+    emit_field_list(out, fa, T, rec.type, &count);
+    emit(out, ");\n};\n} // namespace dsconv\n");
+}
+
+static void emit_enum_names(Emitter *out, const FlatAST *fa, const FlatDecl *n) {
+    const FlatType *t = &fa->types[n->type];
+    if (t->kind != TYPE_ENUM || !t->count) return;
+    const char *E = n->is_typedef && n->name != FLAT_NONE ? flat_str(fa, n->name) : flat_str(fa, t->name);
+    if (!E) return;
+    emit(out, "namespace dsconv {\ntemplate <> struct enum_names<%s> {\n", E);
+    emit(out, "    static constexpr std::pair<%s, std::string_view> list[%zu] = {\n", E, (size_t)t->count);
+    for (int32_t i = 0; i < t->count; ++i) {
+        const char *name = flat_str(fa, fa->values[t->base + (FlatRef)i].name);
+        emit(out, "        { %s, \"%s\" },\n", name, name);
+    }
+    emit(out, "    };\n};\n} // namespace dsconv\n");
+}
+
+void gen_cpp_emit(Emitter *out, const TypeScope *scope, const FlatAST *fa, const FlatDecl *n, const Options *opts) {
+    (void)scope;
+    if (opts->output_lang != OUTPUT_CPP) return;
+    emit_fields(out, fa, n);
+    emit_enum_names(out, fa, n);
+}
@@ -0,0 +1,274 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "codegen.h"
+#include "memstat.h"
+
+/* -enumstr: E_to_string and E_from_string for every named enum.
+ *
+ * to_string indexes a table directly when the values are dense (the range
+ * is at most twice the number of distinct values) and otherwise binary
+ * searches a table sorted by value; values shared by several enumerators
+ * give the first name. from_string scans small enums linearly and looks
+ * larger ones up in a perfect hash table computed here, at generation time
+ * (hash and displace: the first hash picks a bucket, the bucket's
+ * displacement seeds a second hash that gives every name its own slot), so
+ * a lookup costs two hashes and one strcmp. An enum with values kept as
+ * written (not known here) is left to the compiler: to_string compares
+ * with each enumerator in turn and the tables hold the names themselves. */
+
+#define DENSE_MAX_RANGE 65536
+#define LINEAR_MAX_NAMES 8
+#define KEYS_PER_BUCKET 4
+#define MAX_DISPLACEMENT 100000
+
+/* Must match dsconv_name_hash in the generated code. */
+static uint32_t name_hash(const char *s, uint32_t seed) {
+    uint32_t h = 2166136261u ^ (seed * 0x9e3779b9u);
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 16777619u;
+    }
+    h ^= h >> 15;
+    h *= 0x2c1b3c6du;
+    h ^= h >> 12;
+    return h;
+}
+
+typedef struct {
+    const char *name;
+    int64_t value;
+    int known; /* value evaluated; otherwise the name stands for it */
+} Entry;
+
+static int by_value(const void *a, const void *b) {
+    int64_t x = ((const Entry*)a)->value, y = ((const Entry*)b)->value;
+    return x < y ? -1 : x > y;
+}
+
+/* Prints v as a long long literal (the most negative value has none). */
+static void emit_value(Emitter *out, int64_t v) {
+    if (v == INT64_MIN) emit(out, "(-9223372036854775807LL - 1)");
+    else emit(out, "%lldLL", (long long)v);
+}
+
+static void emit_entry_value(Emitter *out, const Entry *e) {
+    if (e->known) emit_value(out, e->value);
+    else emit(out, "(long long)%s", e->name);
+}
+
+static void emit_to_string(Emitter *out, const char *T, const char *P, Entry *entries, size_t count) {
+    int known = 1;
+    for (size_t i = 0; i < count; ++i) known = known && entries[i].known;
+    if (!known) {
+        /* the first name wins, as with the tables */
+        emit(out, "static inline const char *%s_to_string(%s v) {\n", P, T);
+        for (size_t i = 0; i < count; ++i) emit(out, "    if (v == %s) return \"%s\";\n", entries[i].name, entries[i].name);
+        emit(out, "    return NULL;\n}\n");
+        return;
+    }
+    /* distinct values, first name wins (qsort is not stable: keep order) */
+    Entry *sorted = (Entry*)ds_malloc((count + 1) * sizeof(Entry));
+    size_t unique = 0;
+    for (size_t i = 0; i < count; ++i) {
+        int seen = 0;
+        for (size_t j = 0; j < unique && !seen; ++j) seen = sorted[j].value == entries[i].value;
+        if (!seen) sorted[unique++] = entries[i];
+    }
+    qsort(sorted, unique, sizeof(Entry), by_value);
+    uint64_t range = (uint64_t)sorted[unique - 1].value - (uint64_t)sorted[0].value + 1;
+    emit(out, "static inline const char *%s_to_string(%s v) {\n", P, T);
+    if (range != 0 && range <= DENSE_MAX_RANGE && range <= 2 * (uint64_t)unique) {
+        emit(out, "    static const char *const names[%llu] = {", (unsigned long long)range);
+        size_t k = 0;
+        for (uint64_t i = 0; i < range; ++i) {
+            emit(out, i % 8 == 0 ? "\n        " : " ");
+            if ((uint64_t)sorted[k].value - (uint64_t)sorted[0].value == i) emit(out, "\"%s\",", sorted[k++].name);
+            else emit(out, "NULL,");
+        }
+        emit(out, "\n    };\n");
+        emit(out, "    unsigned long long i = (unsigned long long)(long long)v - (unsigned long long)");
+        emit_value(out, sorted[0].value);
+        emit(out, ";\n    return i < %lluu ? names[i] : NULL;\n}\n", (unsigned long long)range);
+    } else {
+        emit(out, "    static const struct { long long value; const char *name; } table[%zu] = {\n", unique);
+        for (size_t i = 0; i < unique; ++i) {
+            emit(out, "        { ");
+            emit_value(out, sorted[i].value);
+            emit(out, ", \"%s\" },\n", sorted[i].name);
+        }
+        emit(out,
+            "    };\n"
+            "    size_t lo = 0, hi = %zu;\n"
+            "    while (lo < hi) {\n"
+            "        size_t mid = lo + (hi - lo) / 2;\n"
+            "        if (table[mid].value < (long long)v) lo = mid + 1; else hi = mid;\n"
+            "    }\n"
+            "    return lo < %zu && table[lo].value == (long long)v ? table[lo].name : NULL;\n"
+            "}\n", unique, unique);
+    }
+    free(sorted);
+}
+
+/* Finds displacements that give every name its own slot among slots.
+ * Returns 0 if some bucket found none (try more slots). */
+static int build_perfect_hash(const Entry *entries, size_t count, size_t slots, size_t buckets,
+                              uint32_t *disp, int *slot_of) {
+    size_t *bucket_of = (size_t*)ds_malloc(count * sizeof(size_t));
+    size_t *order = (size_t*)ds_malloc(buckets * sizeof(size_t));
+    size_t *size = (size_t*)ds_calloc(buckets, sizeof(size_t));
+    unsigned char *used = (unsigned char*)ds_calloc(slots, 1);
+    size_t *tried = (size_t*)ds_malloc(KEYS_PER_BUCKET * 4 * sizeof(size_t) + count * sizeof(size_t));
+    for (size_t i = 0; i < count; ++i) {
+        bucket_of[i] = name_hash(entries[i].name, 0) % buckets;
+        size[bucket_of[i]]++;
+    }
+    /* largest buckets first: they are the hardest to place */
+    for (size_t b = 0; b < buckets; ++b) order[b] = b;
+    for (size_t i = 1; i < buckets; ++i) {
+        size_t b = order[i], j = i;
+        while (j > 0 && size[order[j - 1]] < size[b]) { order[j] = order[j - 1]; j--; }
+        order[j] = b;
+    }
+    memset(disp, 0, buckets * sizeof(uint32_t));
+    int ok = 1;
+    for (size_t o = 0; o < buckets && ok; ++o) {
+        size_t b = order[o];
+        if (!size[b]) break;
+        ok = 0;
+        for (uint32_t d = 1; d <= MAX_DISPLACEMENT && !ok; ++d) {
+            size_t n = 0;
+            ok = 1;
+            for (size_t i = 0; i < count && ok; ++i) {
+                if (bucket_of[i] != b) continue;
+                size_t slot = name_hash(entries[i].name, d) % slots;
+                if (used[slot]) ok = 0;
+                for (size_t k = 0; k < n && ok; ++k) ok = tried[k] != slot;
+                tried[n++] = slot;
+            }
+            if (!ok) continue;
+            disp[b] = d;
+            for (size_t i = 0; i < count; ++i) {
+                if (bucket_of[i] != b) continue;
+                size_t slot = name_hash(entries[i].name, d) % slots;
+                used[slot] = 1;
+                slot_of[slot] = (int)i;
+            }
+        }
+    }
+    free(tried);
+    free(used);
+    free(size);
+    free(order);
+    free(bucket_of);
+    return ok;
+}
+
+static void emit_from_string(Emitter *out, const char *T, const char *P, const Entry *entries, size_t count) {
+    emit(out, "static inline int %s_from_string(const char *s, %s *out) {\n", P, T);
+    if (count < LINEAR_MAX_NAMES) {
+        emit(out, "    static const struct { const char *name; long long value; } table[%zu] = {\n", count);
+        for (size_t i = 0; i < count; ++i) {
+            emit(out, "        { \"%s\", ", entries[i].name);
+            emit_entry_value(out, &entries[i]);
+            emit(out, " },\n");
+        }
+        emit(out,
+            "    };\n"
+            "    for (size_t i = 0; i < %zu; ++i) {\n"
+            "        if (strcmp(table[i].name, s) == 0) {\n"
+            "            *out = (%s)table[i].value;\n"
+            "            return 1;\n"
+            "        }\n"
+            "    }\n"
+            "    return 0;\n"
+            "}\n", count, T);
+        return;
+    }
+    size_t buckets = (count + KEYS_PER_BUCKET - 1) / KEYS_PER_BUCKET;
+    size_t slots = count + count / 4;
+    uint32_t *disp = (uint32_t*)ds_malloc(buckets * sizeof(uint32_t));
+    int *slot_of = NULL;
+    while (1) {
+        slot_of = (int*)ds_realloc(slot_of, slots * sizeof(int));
+        for (size_t i = 0; i < slots; ++i) slot_of[i] = -1;
+        if (build_perfect_hash(entries, count, slots, buckets, disp, slot_of)) break;
+        slots *= 2;
+    }
+    emit(out, "    static const uint32_t disp[%zu] = {", buckets);
+    for (size_t b = 0; b < buckets; ++b) emit(out, "%s%lu,", b % 12 == 0 ? "\n        " : " ", (unsigned long)disp[b]);
+    emit(out, "\n    };\n");
+    emit(out, "    static const struct { const char *name; long long value; } slots[%zu] = {\n", slots);
+    for (size_t i = 0; i < slots; ++i) {
+        if (slot_of[i] < 0) {
+            emit(out, "        { NULL, 0 },\n");
+            continue;
+        }
+        emit(out, "        { \"%s\", ", entries[slot_of[i]].name);
+        emit_entry_value(out, &entries[slot_of[i]]);
+        emit(out, " },\n");
+    }
+    emit(out,
+        "    };\n"
+        "    uint32_t slot = dsconv_name_hash(s, disp[dsconv_name_hash(s, 0) %% %zuu]) %% %zuu;\n"
+        "    if (!slots[slot].name || strcmp(slots[slot].name, s) != 0) return 0;\n"
+        "    *out = (%s)slots[slot].value;\n"
+        "    return 1;\n"
+        "}\n", buckets, slots, T);
+    free(slot_of);
+    free(disp);
+}
+
+void gen_enum_prologue(Emitter *out, const Options *opts) {
+    if (!opts->enum_strings) return;
+    emit(out,
+        "#include <stddef.h>\n"
+        "#include <stdint.h>\n"
+        "#include <string.h>\n"
+        "\n"
+        "#ifndef DSCONV_ENUM_HELPERS\n"
+        "#define DSCONV_ENUM_HELPERS\n"
+        "static inline uint32_t dsconv_name_hash(const char *s, uint32_t seed) {\n"
+        "    uint32_t h = 2166136261u ^ (seed * 0x9e3779b9u);\n"
+        "    while (*s) {\n"
+        "        h ^= (unsigned char)*s++;\n"
+        "        h *= 16777619u;\n"
+        "    }\n"
+        "    h ^= h >> 15;\n"
+        "    h *= 0x2c1b3c6du;\n"
+        "    h ^= h >> 12;\n"
+        "    return h;\n"
+        "}\n"
+        "#endif\n"
+        "\n");
+}
+
+void gen_enum_emit(Emitter *out, const TypeScope *scope, const FlatAST *fa, const FlatDecl *n, const Options *opts) {
+    (void)scope;
+    const FlatType *t = &fa->types[n->type];
+    if (!opts->enum_strings || t->kind != TYPE_ENUM || !t->count) return;
+    const char *name = flat_str(fa, n->name), *tag = flat_str(fa, t->name);
+    char spelled[256];
+    const char *prefix;
+    if (n->is_typedef && name) {
+        snprintf(spelled, sizeof(spelled), "%s", name);
+        prefix = name;
+    } else if (tag) {
+        snprintf(spelled, sizeof(spelled), "enum %s", tag);
+        prefix = tag;
+    } else {
+        return;
+    }
+    size_t count = (size_t)t->count;
+    Entry *entries = (Entry*)ds_malloc(count * sizeof(Entry));
+    for (size_t i = 0; i < count; ++i) {
+        const FlatEnumValue *e = &fa->values[t->base + (FlatRef)i];
+        entries[i].name = flat_str(fa, e->name);
+        entries[i].value = e->value;
+        entries[i].known = e->expr == FLAT_NONE;
+    }
+    emit_to_string(out, spelled, prefix, entries, count);
+    emit_from_string(out, spelled, prefix, entries, count);
+    free(entries);
+}
@@ -0,0 +1,402 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include "codegen.h"
+#include "flatast.h"
+#include "memstat.h"
+
+/* -handles: an index-linked variant of the selected structs.
+ *
+ * In P_ix, every member that points to a selected struct declared before
+ * (or to the struct itself) becomes a uint32_t index into an array of that
+ * struct, arrays of such pointers an array of indices; DSCONV_IX_NULL
+ * stands for NULL. Everything else keeps its type (members whose type
+ * defines a record or enum inline are declared with __typeof__ so the
+ * definition is not repeated). P_ix_array is a growable array of P_ix.
+ * P_to_ix converts one object, looking pointers up in an address -> index
+ * map (dsconv_ptrmap) per pointed-to type; P_from_ix turns indices back
+ * into pointers into one base array per type. */
+
+#define MAX_TARGETS 16
+
+typedef struct {
+    const char *name;    /* pointee tag or typedef name, for parameter names */
+    char spelled[256];   /* pointee type in C */
+} Target;
+
+typedef struct {
+    Emitter *out;
+    const TypeScope *scope;
+    const FlatAST *fa;
+    const Options *opts;
+    const RecordName *rec;
+    Target targets[MAX_TARGETS];
+    int target_count;
+} Handles;
+
+/* Whether -handles names the record (or takes every struct, with
+ * wildcard set and "*" given). */
+static int handle_selected(const Options *opts, const char *name, const char *alias, const char *tag, int wildcard) {
+    for (int i = 0; i < opts->handle_type_count; ++i) {
+        const char *want = opts->handle_types[i];
+        if (strcmp(want, "*") == 0) {
+            if (wildcard) return 1;
+            continue;
+        }
+        if (name && strcmp(want, name) == 0) return 1;
+        if (alias && strcmp(want, alias) == 0) return 1;
+        if (tag && strcmp(want, tag) == 0) return 1;
+    }
+    return 0;
+}
+
+/* The array dimensions of a member and the type below them. */
+static const FlatType *strip_arrays(const FlatAST *fa, FlatRef ref, int *dims) {
+    const FlatType *t = flat_type(fa, ref);
+    *dims = 0;
+    while (t && t->kind == TYPE_ARRAY) {
+        t = flat_type(fa, t->base);
+        (*dims)++;
+    }
+    return t;
+}
+
+static int is_anonymous(const FlatAST *fa, const FlatMember *m) {
+    const FlatType *t = flat_type(fa, m->type);
+    return m->name == FLAT_NONE && !m->bits && t && (t->kind == TYPE_STRUCT || t->kind == TYPE_UNION) && t->name == FLAT_NONE;
+}
+
+static int is_flexible(const FlatAST *fa, const FlatMember *m, int last) {
+    const FlatType *t = flat_type(fa, m->type);
+    return last && t && t->kind == TYPE_ARRAY && t->count <= 0 && t->name == FLAT_NONE;
+}
+
+/* Index of the pointee record a member converts to, or -1 when it stays as
+ * it is. last: m ends its member list. */
+static int member_target(Handles *h, const FlatMember *m, int last) {
+    const FlatAST *fa = h->fa;
+    int dims;
+    if (m->name == FLAT_NONE || m->bits) return -1;
+    const FlatType *t = strip_arrays(fa, m->type, &dims);
+    if (is_flexible(fa, m, last)) return -1;
+    if (!t || t->kind != TYPE_POINTER || t->base == FLAT_NONE) return -1;
+    const FlatType *base = &fa->types[t->base], *record;
+    const char *name = scope_record_name(h->scope, base, &record);
+    if (!record || record->kind != TYPE_STRUCT || !name) return -1;
+    const char *alias = base->kind == TYPE_ALIAS ? flat_str(fa, base->name) : NULL;
+    const char *tag = flat_str(fa, record->name);
+    if (record != h->rec->type && !handle_selected(h->opts, name, alias, tag, 1)) return -1;
+    for (int i = 0; i < h->target_count; ++i) {
+        if (strcmp(h->targets[i].name, name) == 0) return i;
+    }
+    if (h->target_count == MAX_TARGETS) return -1;
+    Target *tg = &h->targets[h->target_count];
+    tg->name = name;
+    if (tag) snprintf(tg->spelled, sizeof(tg->spelled), "struct %s", tag);
+    else snprintf(tg->spelled, sizeof(tg->spelled), "%s", name);
+    return h->target_count++;
+}
+
+/* Whether any member of the record converts to an index (P_ix would be
+ * the record itself otherwise). */
+static int has_targets(Handles *h, const FlatType *record, int in_union) {
+    const FlatAST *fa = h->fa;
+    for (int32_t i = 0; i < record->count; ++i) {
+        const FlatMember *m = &fa->members[record->base + (FlatRef)i];
+        if (is_anonymous(fa, m)) {
+            const FlatType *inner = &fa->types[m->type];
+            if (has_targets(h, inner, in_union || inner->kind == TYPE_UNION)) return 1;
+        } else if (!in_union && member_target(h, m, i + 1 == record->count) >= 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Whether t defines a record or enum body somewhere (under pointers and
+ * arrays too), which may not be repeated in another struct. */
+static int defines_type(const FlatAST *fa, FlatRef ref) {
+    while (ref != FLAT_NONE) {
+        const FlatType *t = &fa->types[ref];
+        switch (t->kind) {
+            case TYPE_POINTER:
+            case TYPE_ARRAY:
+            case TYPE_FUNCTION:
+                ref = t->base;
+                break;
+            case TYPE_STRUCT:
+            case TYPE_UNION:
+            case TYPE_ENUM:
+                return t->count != 0;
+            default: return 0;
+        }
+    }
+    return 0;
+}
+
+static void emit_dims(Emitter *out, const FlatAST *fa, FlatRef ref) {
+    for (const FlatType *t = flat_type(fa, ref); t && t->kind == TYPE_ARRAY; t = flat_type(fa, t->base)) {
+        if (t->count > 0) emit(out, "[%d]", (int)t->count);
+        else emit(out, "[%s]", t->name != FLAT_NONE ? flat_str(fa, t->name) : "");
+    }
+}
+
+static void indent(Emitter *out, int depth) {
+    for (int i = 0; i < depth; ++i) emit(out, "    ");
+}
+
+/* Member declarations of P_ix; pointers in anonymous unions are kept, as
+ * only one of the union's members is meaningful at a time. */
+static void emit_members(Handles *h, const FlatType *record, int depth, int in_union) {
+    Emitter *out = h->out;
+    const FlatAST *fa = h->fa;
+    for (int32_t i = 0; i < record->count; ++i) {
+        const FlatMember *m = &fa->members[record->base + (FlatRef)i];
+        const FlatType *t = flat_type(fa, m->type);
+        const char *name = flat_str(fa, m->name);
+        int last = i + 1 == record->count;
+        if (is_anonymous(fa, m)) {
+            indent(out, depth);
+            emit(out, "%s {\n", t->kind == TYPE_UNION ? "union" : "struct");
+            emit_members(h, t, depth + 1, in_union || t->kind == TYPE_UNION);
+            indent(out, depth);
+            emit(out, "};\n");
+            continue;
+        }
+        if (depth == 1 && is_flexible(fa, m, last)) {
+            indent(out, depth);
+            emit(out, "/* %s[]: flexible array member left out */\n", name);
+            continue;
+        }
+        indent(out, depth);
+        int target = in_union ? -1 : member_target(h, m, last);
+        if (target >= 0) {
+            emit(out, "uint32_t %s", name);
+            emit_dims(out, fa, m->type);
+            emit(out, "; /* %s %s */\n", h->targets[target].spelled, t->kind == TYPE_ARRAY ? "indices" : "index");
+        } else if (name && !m->bits && defines_type(fa, m->type)) {
+            emit(out, "__typeof__(((%s*)0)->%s) %s;\n", h->rec->spelled, name, name);
+        } else {
+            emit_decl(out, fa, m->type, name, depth);
+            if (m->bits) emit(out, " : %d", m->bits);
+            emit(out, ";\n");
+        }
+    }
+}
+
+static void emit_variant(Handles *h) {
+    emit(h->out, "typedef struct %s_ix {\n", h->rec->prefix);
+    emit_members(h, h->rec->type, 1, 0);
+    emit(h->out, "} %s_ix;\n", h->rec->prefix);
+}
+
+static void emit_array(Emitter *out, const char *P) {
+    emit(out,
+        "typedef struct {\n"
+        "    %s_ix *items;\n"
+        "    uint32_t count, cap;\n"
+        "} %s_ix_array;\n", P, P);
+    emit(out,
+        "/* Appends a copy of v; returns its index, or DSCONV_IX_NULL when out of memory. */\n"
+        "static inline uint32_t %s_ix_push(%s_ix_array *a, const %s_ix *v) {\n"
+        "    if (a->count == a->cap) {\n"
+        "        if (a->cap > UINT32_MAX / 4) return DSCONV_IX_NULL;\n"
+        "        uint32_t cap = a->cap ? a->cap * 2 : 16;\n"
+        "        %s_ix *items = (%s_ix*)realloc(a->items, (size_t)cap * sizeof(%s_ix));\n"
+        "        if (!items) return DSCONV_IX_NULL;\n"
+        "        a->items = items;\n"
+        "        a->cap = cap;\n"
+        "    }\n"
+        "    a->items[a->count] = *v;\n"
+        "    return a->count++;\n"
+        "}\n", P, P, P, P, P, P);
+    emit(out,
+        "static inline %s_ix *%s_ix_at(const %s_ix_array *a, uint32_t i) {\n"
+        "    return i < a->count ? &a->items[i] : NULL;\n"
+        "}\n", P, P, P);
+    emit(out,
+        "static inline void %s_ix_array_free(%s_ix_array *a) {\n"
+        "    free(a->items);\n"
+        "    a->items = NULL;\n"
+        "    a->count = a->cap = 0;\n"
+        "}\n", P, P);
+}
+
+/* Loops over every element of an array member (nested loops for several
+ * dimensions); returns the subscripts to apply, e.g. "[i0][i1]". */
+static void open_loops(Emitter *out, const char *path, int dims, char *subs, size_t cap) {
+    subs[0] = '\0';
+    for (int d = 0; d < dims; ++d) {
+        size_t len = strlen(subs);
+        indent(out, d + 1);
+        emit(out, "for (size_t i%d = 0; i%d < sizeof(src->%s%s) / sizeof(src->%s%s[0]); ++i%d) {\n", d, d, path, subs, path, subs, d);
+        snprintf(subs + len, cap - len, "[i%d]", d);
+    }
+}
+
+static void close_loops(Emitter *out, int dims) {
+    for (int d = dims; d > 0; --d) {
+        indent(out, d);
+        emit(out, "}\n");
+    }
+}
+
+/* An anonymous union is copied as bytes from its first member, which
+ * starts where the union does, for as long as its largest member. */
+static int emit_union_copy(Emitter *out, const FlatAST *fa, const FlatType *u) {
+    const FlatMember *m = &fa->members[u->base];
+    for (int32_t i = 0; i < u->count; ++i) {
+        if (m[i].name == FLAT_NONE || m[i].bits) return 0;
+    }
+    const char *first = flat_str(fa, m[0].name);
+    emit(out, "    {\n        size_t n = sizeof(src->%s);\n", first);
+    for (int32_t i = 1; i < u->count; ++i) {
+        const char *name = flat_str(fa, m[i].name);
+        emit(out, "        if (sizeof(src->%s) > n) n = sizeof(src->%s);\n", name, name);
+    }
+    emit(out, "        memcpy(&dst->%s, &src->%s, n);\n    }\n", first, first);
+    return 1;
+}
+
+/* Statements of P_to_ix (to_ix set) or P_from_ix for the members of record. */
+static void emit_copies(Handles *h, const FlatType *record, int to_ix, int depth, int in_union) {
+    Emitter *out = h->out;
+    const FlatAST *fa = h->fa;
+    for (int32_t i = 0; i < record->count; ++i) {
+        const FlatMember *m = &fa->members[record->base + (FlatRef)i];
+        const FlatType *t = flat_type(fa, m->type);
+        if (is_anonymous(fa, m)) {
+            if (t->kind != TYPE_UNION || !t->count || !emit_union_copy(out, fa, t)) {
+                emit_copies(h, t, to_ix, depth + 1, in_union || t->kind == TYPE_UNION);
+            }
+            continue;
+        }
+        if (m->name == FLAT_NONE) continue;
+        const char *name = flat_str(fa, m->name);
+        int last = i + 1 == record->count;
+        if (depth == 0 && is_flexible(fa, m, last)) {
+            emit(out, "    /* %s[]: flexible array member not copied */\n", name);
+            continue;
+        }
+        int dims;
+        strip_arrays(fa, m->type, &dims);
+        int target = in_union ? -1 : member_target(h, m, last);
+        if (target < 0) {
+            if (dims || (!m->bits && defines_type(fa, m->type) && t->kind != TYPE_POINTER)) {
+                emit(out, "    memcpy(&dst->%s, &src->%s, sizeof(dst->%s));\n", name, name, name);
+            } else {
+                emit(out, "    dst->%s = src->%s;\n", name, name);
+            }
+            continue;
+        }
+        const Target *tg = &h->targets[target];
+        char subs[128];
+        open_loops(out, name, dims, subs, sizeof(subs));
+        indent(out, dims + 1);
+        if (to_ix) {
+            emit(out, "dst->%s%s = dsconv_ptrmap_get(%s_map, src->%s%s);\n", name, subs, tg->name, name, subs);
+        } else {
+            emit(out, "dst->%s%s = src->%s%s == DSCONV_IX_NULL ? NULL : &%s_base[src->%s%s];\n",
+                 name, subs, name, subs, tg->name, name, subs);
+        }
+        close_loops(out, dims);
+    }
+}
+
+static void emit_conversions(Handles *h) {
+    Emitter *out = h->out;
+    const char *T = h->rec->spelled, *P = h->rec->prefix;
+    emit(out, "/* Pointers become the indices the maps give their targets (DSCONV_IX_NULL\n"
+              " * for NULL and for addresses not in the map). */\n");
+    emit(out, "static inline void %s_to_ix(const %s *src, %s_ix *dst", P, T, P);
+    for (int i = 0; i < h->target_count; ++i) emit(out, ", const dsconv_ptrmap *%s_map", h->targets[i].name);
+    emit(out, ") {\n");
+    emit_copies(h, h->rec->type, 1, 0, 0);
+    emit(out, "}\n");
+    emit(out, "/* Indices become pointers into the base arrays. */\n");
+    emit(out, "static inline void %s_from_ix(const %s_ix *src, %s *dst", P, P, T);
+    for (int i = 0; i < h->target_count; ++i) emit(out, ", %s *%s_base", h->targets[i].spelled, h->targets[i].name);
+    emit(out, ") {\n");
+    emit_copies(h, h->rec->type, 0, 0, 0);
+    emit(out, "}\n");
+}
+
+void gen_handle_prologue(Emitter *out, const Options *opts) {
+    if (opts->handle_type_count == 0) return;
+    emit(out,
+        "#include <stddef.h>\n"
+        "#include <stdint.h>\n"
+        "#include <stdlib.h>\n"
+        "#include <string.h>\n"
+        "\n"
+        "#ifndef DSCONV_HANDLE_HELPERS\n"
+        "#define DSCONV_HANDLE_HELPERS\n"
+        "#define DSCONV_IX_NULL UINT32_MAX\n"
+        "/* Object address -> index, open addressing, for at most the n objects\n"
+        " * given to dsconv_ptrmap_init. */\n"
+        "typedef struct {\n"
+        "    const void **keys;\n"
+        "    uint32_t *values;\n"
+        "    size_t mask;\n"
+        "} dsconv_ptrmap;\n"
+        "static inline int dsconv_ptrmap_init(dsconv_ptrmap *m, size_t n) {\n"
+        "    size_t cap = 16;\n"
+        "    while (cap < n * 2) cap *= 2;\n"
+        "    m->keys = (const void**)calloc(cap, sizeof(void*));\n"
+        "    m->values = (uint32_t*)malloc(cap * sizeof(uint32_t));\n"
+        "    m->mask = cap - 1;\n"
+        "    return m->keys && m->values;\n"
+        "}\n"
+        "static inline size_t dsconv_ptrmap_slot(const dsconv_ptrmap *m, const void *p) {\n"
+        "    uint64_t h = (uint64_t)(uintptr_t)p * 0x9e3779b97f4a7c15ull;\n"
+        "    size_t i = (size_t)(h >> 32) & m->mask;\n"
+        "    while (m->keys[i] && m->keys[i] != p) i = (i + 1) & m->mask;\n"
+        "    return i;\n"
+        "}\n"
+        "static inline void dsconv_ptrmap_put(dsconv_ptrmap *m, const void *p, uint32_t index) {\n"
+        "    size_t i = dsconv_ptrmap_slot(m, p);\n"
+        "    m->keys[i] = p;\n"
+        "    m->values[i] = index;\n"
+        "}\n"
+        "static inline uint32_t dsconv_ptrmap_get(const dsconv_ptrmap *m, const void *p) {\n"
+        "    if (!p) return DSCONV_IX_NULL;\n"
+        "    size_t i = dsconv_ptrmap_slot(m, p);\n"
+        "    return m->keys[i] ? m->values[i] : DSCONV_IX_NULL;\n"
+        "}\n"
+        "static inline void dsconv_ptrmap_free(dsconv_ptrmap *m) {\n"
+        "    free(m->keys);\n"
+        "    free(m->values);\n"
+        "}\n"
+        "#endif\n"
+        "\n");
+}
+
+void gen_handle_emit(Emitter *out, const TypeScope *scope, const FlatAST *fa, const FlatDecl *n, const Options *opts) {
+    RecordName rec;
+    if (opts->handle_type_count == 0 || !codegen_record(fa, n, &rec) || rec.type->kind != TYPE_STRUCT) return;
+    if (!handle_selected(opts, rec.prefix, rec.spelled, rec.tag, 1)) return;
+    Handles h;
+    memset(&h, 0, sizeof(h));
+    h.out = out;
+    h.scope = scope;
+    h.fa = fa;
+    h.opts = opts;
+    h.rec = &rec;
+    if (!has_targets(&h, rec.type, 0)) {
+        if (handle_selected(opts, rec.prefix, rec.spelled, rec.tag, 0)) {
+            fprintf(stderr, "-handles %s: no member points to a selected struct; nothing to generate.\n", rec.prefix);
+        }
+        return;
+    }
+    if (scope_read_only(scope, rec.type)) {
+        /* the conversions assign whole members */
+        if (handle_selected(opts, rec.prefix, rec.spelled, rec.tag, 0)) {
+            fprintf(stderr, "-handles %s: const members cannot be converted; nothing to generate.\n", rec.prefix);
+        }
+        return;
+    }
+    emit_variant(&h);
+    emit_array(out, rec.prefix);
+    emit_conversions(&h);
+}
@@ -0,0 +1,234 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include "codegen.h"
+#include "memstat.h"
+
+/* -hash: T_hash and T_equal for every struct.
+ *
+ * A struct whose layout has no padding and no pointers is compared with one
+ * memcmp and hashed a word at a time over its bytes; a static assertion
+ * checks that the compiler agrees on its size. Any other struct is walked
+ * field by field: integers and enums by value, floating-point members by
+ * their bytes (so equal values always hash alike), arrays of plain elements
+ * as one block, nested structs recursively, unions and types dsconv knows
+ * nothing about by their bytes. Pointers follow -hashptr: char pointers as
+ * NUL-terminated strings (default), every pointer by address, or skipped. */
+
+typedef enum { WALK_EQUAL, WALK_HASH } WalkMode;
+
+#define WALK_MAX_NESTING 32
+
+typedef struct {
+    Emitter *out;
+    const TypeScope *scope;
+    const FlatAST *fa;
+    const Options *opts;
+    WalkMode mode;
+    int loops;   /* nesting of array loops, names the index variables */
+    int emitted; /* statements written */
+    const FlatType *open[WALK_MAX_NESTING]; /* records being walked, outermost first */
+    int depth;
+} Walk;
+
+/* A record nested inside itself (invalid input) or too deeply is taken as
+ * bytes instead of being walked. */
+static int walk_enter(Walk *w, const FlatType *record) {
+    if (w->depth == WALK_MAX_NESTING) return 0;
+    for (int i = 0; i < w->depth; ++i) {
+        if (w->open[i] == record) return 0;
+    }
+    w->open[w->depth++] = record;
+    return 1;
+}
+
+static char *path_fmt(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    va_list again;
+    va_copy(again, ap);
+    int n = vsnprintf(NULL, 0, fmt, ap);
+    char *s = (char*)ds_malloc((size_t)n + 1);
+    vsnprintf(s, (size_t)n + 1, fmt, again);
+    va_end(again);
+    va_end(ap);
+    return s;
+}
+
+static void walk_indent(Walk *w) {
+    emit(w->out, "    ");
+    for (int i = 0; i < w->loops; ++i) emit(w->out, "    ");
+}
+
+/* Member at path (e.g. "->pos.x") compared or hashed by value. */
+static void walk_value(Walk *w, const char *path, const char *cast) {
+    walk_indent(w);
+    if (w->mode == WALK_EQUAL) emit(w->out, "if (a%s != b%s) return 0;\n", path, path);
+    else emit(w->out, "h = dsconv_mix(h, (uint64_t)%sp%s);\n", cast, path);
+    w->emitted++;
+}
+
+static void walk_bytes(Walk *w, const char *path) {
+    walk_indent(w);
+    if (w->mode == WALK_EQUAL) emit(w->out, "if (memcmp(&a%s, &b%s, sizeof(a%s)) != 0) return 0;\n", path, path, path);
+    else emit(w->out, "h = dsconv_hash_words(&p%s, sizeof(p%s), h);\n", path, path);
+    w->emitted++;
+}
+
+static int is_char(const Walk *w, FlatRef ref) {
+    const FlatType *t = scope_resolve(w->scope, flat_type(w->fa, ref));
+    return t && t->kind == TYPE_BUILTIN && strstr(flat_str(w->fa, t->name), "char") != NULL;
+}
+
+static void walk_pointer(Walk *w, const FlatType *t, const char *path) {
+    if (w->opts->pointer_policy == POINTER_SKIP) return;
+    if (w->opts->pointer_policy == POINTER_STRINGS && is_char(w, t->base)) {
+        walk_indent(w);
+        if (w->mode == WALK_EQUAL) emit(w->out, "if (!dsconv_str_equal((const char*)a%s, (const char*)b%s)) return 0;\n", path, path);
+        else emit(w->out, "h = dsconv_hash_str((const char*)p%s, h);\n", path);
+        w->emitted++;
+        return;
+    }
+    walk_value(w, path, "(uintptr_t)");
+}
+
+static void walk_type(Walk *w, FlatRef t, const char *path, int last);
+
+static void walk_members(Walk *w, const FlatType *record, const char *path) {
+    for (int32_t i = 0; i < record->count; ++i) {
+        const FlatMember *m = &w->fa->members[record->base + (FlatRef)i];
+        int last = i + 1 == record->count;
+        if (m->name == FLAT_NONE) {
+            /* anonymous struct/union: its members are reached directly */
+            if (!m->bits) walk_type(w, m->type, path, last);
+            continue;
+        }
+        char *sub = path_fmt("%s%s%s", path, path[0] ? "." : "->", flat_str(w->fa, m->name));
+        if (m->bits) walk_value(w, sub, ""); /* no address, no sizeof */
+        else walk_type(w, m->type, sub, last);
+        free(sub);
+    }
+}
+
+static void walk_array(Walk *w, const FlatType *t, const char *path, int last) {
+    if (t->count <= 0 && t->name == FLAT_NONE && last) {
+        walk_indent(w);
+        emit(w->out, "/* %s: flexible array member not compared */\n", path + 2);
+        return;
+    }
+    Layout l;
+    if (layout_of(w->scope, flat_type(w->fa, t->base), &l) && !l.padded && !l.pointers) {
+        walk_bytes(w, path);
+        return;
+    }
+    int level = w->loops;
+    char *var = path_fmt("i%d", level);
+    const char *obj = w->mode == WALK_EQUAL ? "a" : "p";
+    walk_indent(w);
+    emit(w->out, "for (size_t %s = 0; %s < sizeof(%s%s) / sizeof(%s%s[0]); ++%s) {\n", var, var, obj, path, obj, path, var);
+    w->loops++;
+    char *sub = path_fmt("%s[%s]", path, var);
+    walk_type(w, t->base, sub, 0);
+    free(sub);
+    w->loops--;
+    walk_indent(w);
+    emit(w->out, "}\n");
+    free(var);
+}
+
+static void walk_type(Walk *w, FlatRef t, const char *path, int last) {
+    const FlatType *r = scope_resolve(w->scope, flat_type(w->fa, t));
+    switch (r ? r->kind : TYPE_ALIAS) {
+        case TYPE_BUILTIN:
+            if (builtin_is_floating(flat_str(w->fa, r->name))) walk_bytes(w, path);
+            else walk_value(w, path, "");
+            break;
+        case TYPE_ENUM:
+            walk_value(w, path, "");
+            break;
+        case TYPE_POINTER:
+            walk_pointer(w, r, path);
+            break;
+        case TYPE_ARRAY:
+            walk_array(w, r, path, last);
+            break;
+        case TYPE_STRUCT:
+            if (r->count && walk_enter(w, r)) {
+                walk_members(w, r, path);
+                w->depth--;
+                break;
+            }
+            walk_bytes(w, path);
+            break;
+        default: /* unions, unknown names */
+            walk_bytes(w, path);
+            break;
+    }
+}
+
+void gen_hash_prologue(Emitter *out, const Options *opts) {
+    if (!opts->hash_functions) return;
+    emit(out,
+        "#include <stdint.h>\n"
+        "#include <string.h>\n"
+        "\n"
+        "#ifndef DSCONV_HASH_HELPERS\n"
+        "#define DSCONV_HASH_HELPERS\n"
+        "#define DSCONV_HASH_SEED 0x9e3779b97f4a7c15ull\n"
+        "static inline uint64_t dsconv_mix(uint64_t h, uint64_t v) {\n"
+        "    h ^= v;\n"
+        "    h *= 0xff51afd7ed558ccdull;\n"
+        "    return h ^ (h >> 32);\n"
+        "}\n"
+        "/* Hashes n bytes a word at a time. */\n"
+        "static inline uint64_t dsconv_hash_words(const void *data, size_t n, uint64_t h) {\n"
+        "    const unsigned char *s = (const unsigned char*)data;\n"
+        "    for (; n >= 8; s += 8, n -= 8) {\n"
+        "        uint64_t w;\n"
+        "        memcpy(&w, s, 8);\n"
+        "        h = dsconv_mix(h, w);\n"
+        "    }\n"
+        "    if (n) {\n"
+        "        uint64_t w = 0;\n"
+        "        memcpy(&w, s, n);\n"
+        "        h = dsconv_mix(h, w ^ ((uint64_t)n << 56));\n"
+        "    }\n"
+        "    return h;\n"
+        "}\n"
+        "static inline uint64_t dsconv_hash_str(const char *s, uint64_t h) {\n"
+        "    return s ? dsconv_hash_words(s, strlen(s), h) : dsconv_mix(h, 0);\n"
+        "}\n"
+        "static inline int dsconv_str_equal(const char *a, const char *b) {\n"
+        "    return a == b || (a && b && strcmp(a, b) == 0);\n"
+        "}\n"
+        "#endif\n"
+        "\n");
+}
+
+void gen_hash_emit(Emitter *out, const TypeScope *scope, const FlatAST *fa, const FlatDecl *n, const Options *opts) {
+    RecordName rec;
+    if (!opts->hash_functions || !codegen_record(fa, n, &rec) || rec.type->kind != TYPE_STRUCT) return;
+    const char *T = rec.spelled, *P = rec.prefix;
+    Layout l;
+    if (layout_of(scope, rec.type, &l) && !l.padded && !l.pointers) {
+        emit(out, "_Static_assert(sizeof(%s) == %zu, \"%s: layout differs from the one dsconv assumed\");\n", T, l.size, T);
+        emit(out, "static inline int %s_equal(const %s *a, const %s *b) {\n", P, T, T);
+        emit(out, "    return memcmp(a, b, sizeof(%s)) == 0;\n}\n", T);
+        emit(out, "static inline uint64_t %s_hash(const %s *p) {\n", P, T);
+        emit(out, "    return dsconv_hash_words(p, sizeof(%s), DSCONV_HASH_SEED);\n}\n", T);
+        return;
+    }
+    Walk w = { out, scope, fa, opts, WALK_EQUAL, 0, 0, { rec.type }, 1 };
+    emit(out, "static inline int %s_equal(const %s *a, const %s *b) {\n", P, T, T);
+    walk_members(&w, rec.type, "");
+    if (!w.emitted) emit(out, "    (void)a; (void)b;\n");
+    emit(out, "    return 1;\n}\n");
+    w.mode = WALK_HASH;
+    w.emitted = 0;
+    emit(out, "static inline uint64_t %s_hash(const %s *p) {\n", P, T);
+    emit(out, "    uint64_t h = DSCONV_HASH_SEED;\n");
+    walk_members(&w, rec.type, "");
+    if (!w.emitted) emit(out, "    (void)p;\n");
+    emit(out, "    return h;\n}\n");
+}
@@ -0,0 +1,374 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "codegen.h"
+#include "flatast.h"
+#include "memstat.h"
+
+/* -hashmap T:key: an open-addressing hash map of T keyed by one member.
+ *
+ * P_map stores the T entries themselves in a power-of-two table with Robin
+ * Hood linear probing: an entry that is further from its home slot takes
+ * the place of one that is closer, so probe lengths stay short and a lookup
+ * can stop at the first entry closer to home than the key would be. Erase
+ * shifts the following entries back instead of leaving tombstones. The key
+ * hash and comparison are chosen by the key's type: integers, enums and
+ * pointers by value, floating point by value (0.0 and -0.0 alike), char
+ * pointers and char arrays as strings, padding-free structs by their
+ * bytes. */
+
+typedef enum {
+    KEY_INT,
+    KEY_POINTER,
+    KEY_FLOAT,
+    KEY_STRING, /* char pointer */
+    KEY_CHARS,  /* char array */
+    KEY_BYTES   /* struct without padding */
+} KeyKind;
+
+typedef struct {
+    Emitter *out;
+    const RecordName *rec;
+    const char *member;
+    KeyKind kind;
+    const FlatAST *fa;
+    FlatRef type;  /* the key member's type in fa */
+    int inline_type; /* its type defines a record or enum in place */
+} MapKey;
+
+/* The key named in a -hashmap spec for this record, or NULL. */
+static const char *map_key(const Options *opts, const RecordName *rec) {
+    for (int i = 0; i < opts->map_spec_count; ++i) {
+        const char *spec = opts->map_specs[i];
+        const char *colon = strchr(spec, ':');
+        if (!colon) continue;
+        size_t len = (size_t)(colon - spec);
+        const char *names[3] = { rec->prefix, rec->spelled, rec->tag };
+        for (int k = 0; k < 3; ++k) {
+            if (names[k] && strlen(names[k]) == len && strncmp(spec, names[k], len) == 0) return colon + 1;
+        }
+    }
+    return NULL;
+}
+
+/* Finds the member called name, also inside anonymous struct/union
+ * members. */
+static const FlatMember *key_member(const FlatAST *fa, const FlatType *record, const char *name) {
+    for (int32_t i = 0; i < record->count; ++i) {
+        const FlatMember *m = &fa->members[record->base + (FlatRef)i];
+        if (m->name != FLAT_NONE && strcmp(flat_str(fa, m->name), name) == 0) return m;
+        const FlatType *t = flat_type(fa, m->type);
+        if (m->name == FLAT_NONE && !m->bits && t && (t->kind == TYPE_STRUCT || t->kind == TYPE_UNION) && t->name == FLAT_NONE) {
+            const FlatMember *found = key_member(fa, t, name);
+            if (found) return found;
+        }
+    }
+    return NULL;
+}
+
+static int is_char(const TypeScope *scope, const FlatAST *fa, FlatRef ref) {
+    const FlatType *t = scope_resolve(scope, flat_type(fa, ref));
+    return t && t->kind == TYPE_BUILTIN && strstr(flat_str(fa, t->name), "char") != NULL;
+}
+
+/* Picks how keys of type t are hashed and compared; returns 0 with a
+ * reason when they cannot be. */
+static int key_kind(const TypeScope *scope, const FlatAST *fa, const FlatType *t, KeyKind *kind, const char **why) {
+    if (t->kind == TYPE_ARRAY) {
+        if ((t->count > 0 || t->name != FLAT_NONE) && is_char(scope, fa, t->base)) {
+            *kind = KEY_CHARS;
+            return 1;
+        }
+        *why = "arrays other than char arrays cannot be keys";
+        return 0;
+    }
+    const FlatType *v = scope_resolve(scope, t);
+    switch (v ? v->kind : TYPE_ALIAS) {
+        case TYPE_BUILTIN: {
+            const char *name = flat_str(fa, v->name);
+            if (strcmp(name, "void") == 0) break;
+            *kind = builtin_is_floating(name) ? KEY_FLOAT : KEY_INT;
+            return 1;
+        }
+        case TYPE_ENUM:
+            *kind = KEY_INT;
+            return 1;
+        case TYPE_POINTER:
+            *kind = is_char(scope, fa, v->base) ? KEY_STRING : KEY_POINTER;
+            return 1;
+        case TYPE_STRUCT: {
+            Layout l;
+            if (layout_of(scope, v, &l) && !l.padded) {
+                *kind = KEY_BYTES;
+                return 1;
+            }
+            *why = "struct keys must have a known layout without padding";
+            return 0;
+        }
+        default:
+            break;
+    }
+    *why = "its type cannot be hashed";
+    return 0;
+}
+
+const char *gen_map_check(const TypeScope *scope, const FlatAST *fa, const RecordName *rec, const char *key) {
+    const FlatMember *m = key_member(fa, rec->type, key);
+    const char *why = NULL;
+    KeyKind kind;
+    if (!m) return "no such member";
+    if (m->bits) return "bit-fields cannot be keys";
+    if (scope_read_only(scope, rec->type)) return "entries with const members cannot be stored";
+    key_kind(scope, fa, &fa->types[m->type], &kind, &why);
+    return why;
+}
+
+static int defines_type(const FlatAST *fa, FlatRef ref) {
+    const FlatType *t = flat_type(fa, ref);
+    while (t && (t->kind == TYPE_POINTER || t->kind == TYPE_ARRAY)) t = flat_type(fa, t->base);
+    if (!t) return 0;
+    if (t->kind == TYPE_STRUCT || t->kind == TYPE_UNION || t->kind == TYPE_ENUM) return t->count != 0;
+    return 0;
+}
+
+/* A parameter holding a key, called name. */
+static void emit_key_param(const MapKey *k, const char *name) {
+    if (k->kind == KEY_STRING || k->kind == KEY_CHARS) {
+        emit(k->out, "const char *%s", name);
+    } else if (k->inline_type) {
+        emit(k->out, "__typeof__(((%s*)0)->%s) %s", k->rec->spelled, k->member, name);
+    } else {
+        emit_decl(k->out, k->fa, k->type, name, 0);
+    }
+}
+
+static void emit_key_functions(const MapKey *k) {
+    Emitter *out = k->out;
+    const char *P = k->rec->prefix, *T = k->rec->spelled, *M = k->member;
+    emit(out, "static inline uint64_t %s_map_hash_key(", P);
+    emit_key_param(k, "key");
+    emit(out, ") {\n    return ");
+    switch (k->kind) {
+        case KEY_INT: emit(out, "dsconv_map_int((uint64_t)key)"); break;
+        case KEY_POINTER: emit(out, "dsconv_map_int((uint64_t)(uintptr_t)key)"); break;
+        case KEY_FLOAT: emit(out, "dsconv_map_float((double)key)"); break;
+        case KEY_STRING: emit(out, "key ? dsconv_map_bytes(key, strlen(key)) : 0"); break;
+        case KEY_CHARS: emit(out, "dsconv_map_strn(key, sizeof(((%s*)0)->%s))", T, M); break;
+        case KEY_BYTES: emit(out, "dsconv_map_bytes(&key, sizeof(key))"); break;
+    }
+    emit(out, ";\n}\n");
+    emit(out, "static inline int %s_map_key_equal(", P);
+    emit_key_param(k, "a");
+    emit(out, ", ");
+    emit_key_param(k, "b");
+    emit(out, ") {\n    return ");
+    switch (k->kind) {
+        case KEY_INT:
+        case KEY_POINTER:
+        case KEY_FLOAT: emit(out, "a == b"); break;
+        case KEY_STRING: emit(out, "a == b || (a && b && strcmp(a, b) == 0)"); break;
+        case KEY_CHARS: emit(out, "strncmp(a, b, sizeof(((%s*)0)->%s)) == 0", T, M); break;
+        case KEY_BYTES: emit(out, "memcmp(&a, &b, sizeof(a)) == 0"); break;
+    }
+    emit(out, ";\n}\n");
+}
+
+static void emit_map(const MapKey *k) {
+    Emitter *out = k->out;
+    const char *P = k->rec->prefix, *T = k->rec->spelled, *M = k->member;
+    emit(out,
+        "/* %s_map: %s entries keyed by %s. */\n"
+        "typedef struct {\n"
+        "    %s *slots;\n"
+        "    uint32_t *dist; /* probe length + 1 of the entry in each slot, 0 = empty */\n"
+        "    size_t count, mask;\n"
+        "} %s_map;\n", P, T, M, T, P);
+    emit_key_functions(k);
+    emit(out,
+        "static inline void %s_map_init(%s_map *m) {\n"
+        "    m->slots = NULL;\n"
+        "    m->dist = NULL;\n"
+        "    m->count = 0;\n"
+        "    m->mask = 0;\n"
+        "}\n", P, P);
+    emit(out,
+        "static inline void %s_map_destroy(%s_map *m) {\n"
+        "    free(m->slots);\n"
+        "    free(m->dist);\n"
+        "    %s_map_init(m);\n"
+        "}\n", P, P, P);
+    emit(out,
+        "static inline void %s_map_clear(%s_map *m) {\n"
+        "    if (m->dist) memset(m->dist, 0, (m->mask + 1) * sizeof(uint32_t));\n"
+        "    m->count = 0;\n"
+        "}\n", P, P);
+    emit(out,
+        "/* Robin Hood placement of v (not in the map) from slot i at probe length d. */\n"
+        "static inline void %s_map_place(%s_map *m, size_t i, uint32_t d, %s v) {\n"
+        "    for (;; i = (i + 1) & m->mask, ++d) {\n"
+        "        if (m->dist[i] >= d) continue;\n"
+        "        if (!m->dist[i]) {\n"
+        "            m->slots[i] = v;\n"
+        "            m->dist[i] = d;\n"
+        "            return;\n"
+        "        }\n"
+        "        %s t = m->slots[i];\n"
+        "        uint32_t td = m->dist[i];\n"
+        "        m->slots[i] = v;\n"
+        "        m->dist[i] = d;\n"
+        "        v = t;\n"
+        "        d = td;\n"
+        "    }\n"
+        "}\n", P, P, T, T);
+    emit(out,
+        "/* Makes room for n entries without rehashing; returns 0 when out of memory. */\n"
+        "static inline int %s_map_reserve(%s_map *m, size_t n) {\n"
+        "    size_t cap = DSCONV_MAP_MIN_CAPACITY;\n"
+        "    while (cap / 8 * 7 < n) cap *= 2;\n"
+        "    if (m->dist && cap <= m->mask + 1) return 1;\n"
+        "    %s *slots = (%s*)malloc(cap * sizeof(%s));\n"
+        "    uint32_t *dist = (uint32_t*)calloc(cap, sizeof(uint32_t));\n"
+        "    if (!slots || !dist) {\n"
+        "        free(slots);\n"
+        "        free(dist);\n"
+        "        return 0;\n"
+        "    }\n"
+        "    %s *old = m->slots;\n"
+        "    uint32_t *old_dist = m->dist;\n"
+        "    size_t old_cap = m->dist ? m->mask + 1 : 0;\n"
+        "    m->slots = slots;\n"
+        "    m->dist = dist;\n"
+        "    m->mask = cap - 1;\n"
+        "    for (size_t i = 0; i < old_cap; ++i) {\n"
+        "        if (old_dist[i]) %s_map_place(m, (size_t)%s_map_hash_key(old[i].%s) & m->mask, 1, old[i]);\n"
+        "    }\n"
+        "    free(old);\n"
+        "    free(old_dist);\n"
+        "    return 1;\n"
+        "}\n", P, P, T, T, T, T, P, P, M);
+    emit(out, "static inline %s *%s_map_find(const %s_map *m, ", T, P, P);
+    emit_key_param(k, "key");
+    emit(out, ") {\n"
+        "    if (!m->count) return NULL;\n"
+        "    size_t i = (size_t)%s_map_hash_key(key) & m->mask;\n"
+        "    for (uint32_t d = 1; m->dist[i] >= d; i = (i + 1) & m->mask, ++d) {\n"
+        "        if (m->dist[i] == d && %s_map_key_equal(m->slots[i].%s, key)) return &m->slots[i];\n"
+        "    }\n"
+        "    return NULL;\n"
+        "}\n", P, P, M);
+    emit(out,
+        "/* Stores a copy of v, replacing the entry with the same key; returns the\n"
+        " * stored entry, or NULL when out of memory. Inserting and erasing move\n"
+        " * entries, so pointers into the map are only valid until then. */\n"
+        "static inline %s *%s_map_insert(%s_map *m, const %s *v) {\n"
+        "    if (!m->dist || m->count + 1 > (m->mask + 1) / 8 * 7) {\n"
+        "        if (!%s_map_reserve(m, m->count + 1)) return NULL;\n"
+        "    }\n"
+        "    size_t i = (size_t)%s_map_hash_key(v->%s) & m->mask;\n"
+        "    uint32_t d = 1;\n"
+        "    for (; m->dist[i] >= d; i = (i + 1) & m->mask, ++d) {\n"
+        "        if (m->dist[i] == d && %s_map_key_equal(m->slots[i].%s, v->%s)) {\n"
+        "            m->slots[i] = *v;\n"
+        "            return &m->slots[i];\n"
+        "        }\n"
+        "    }\n"
+        "    %s_map_place(m, i, d, *v);\n"
+        "    m->count++;\n"
+        "    return &m->slots[i];\n"
+        "}\n", T, P, P, T, P, P, M, P, M, M, P);
+    emit(out, "/* Removes the entry with this key; returns 0 if there was none. */\n");
+    emit(out, "static inline int %s_map_erase(%s_map *m, ", P, P);
+    emit_key_param(k, "key");
+    emit(out, ") {\n"
+        "    %s *e = %s_map_find(m, key);\n"
+        "    if (!e) return 0;\n"
+        "    size_t i = (size_t)(e - m->slots);\n"
+        "    for (;;) {\n"
+        "        size_t next = (i + 1) & m->mask;\n"
+        "        if (m->dist[next] <= 1) break;\n"
+        "        m->slots[i] = m->slots[next];\n"
+        "        m->dist[i] = m->dist[next] - 1;\n"
+        "        i = next;\n"
+        "    }\n"
+        "    m->dist[i] = 0;\n"
+        "    m->count--;\n"
+        "    return 1;\n"
+        "}\n", T, P);
+    emit(out,
+        "/* Inserts n entries, sizing the table once; returns 0 when out of memory. */\n"
+        "static inline int %s_map_build(%s_map *m, const %s *items, size_t n) {\n"
+        "    if (!%s_map_reserve(m, m->count + n)) return 0;\n"
+        "    for (size_t i = 0; i < n; ++i) {\n"
+        "        if (!%s_map_insert(m, &items[i])) return 0;\n"
+        "    }\n"
+        "    return 1;\n"
+        "}\n", P, P, T, P, P);
+}
+
+void gen_map_prologue(Emitter *out, const Options *opts) {
+    if (opts->map_spec_count == 0) return;
+    emit(out,
+        "#include <stddef.h>\n"
+        "#include <stdint.h>\n"
+        "#include <stdlib.h>\n"
+        "#include <string.h>\n"
+        "\n"
+        "#ifndef DSCONV_MAP_HELPERS\n"
+        "#define DSCONV_MAP_HELPERS\n"
+        "#ifndef DSCONV_MAP_MIN_CAPACITY\n"
+        "#define DSCONV_MAP_MIN_CAPACITY 16 /* a power of two */\n"
+        "#endif\n"
+        "/* Key hashes; slots are taken from the low bits, so every bit is mixed. */\n"
+        "static inline uint64_t dsconv_map_int(uint64_t k) {\n"
+        "    k ^= k >> 33;\n"
+        "    k *= 0xff51afd7ed558ccdull;\n"
+        "    k ^= k >> 33;\n"
+        "    k *= 0xc4ceb9fe1a85ec53ull;\n"
+        "    return k ^ (k >> 33);\n"
+        "}\n"
+        "static inline uint64_t dsconv_map_float(double d) {\n"
+        "    uint64_t u;\n"
+        "    if (d == 0) d = 0; /* -0.0 == 0.0 */\n"
+        "    memcpy(&u, &d, sizeof(u));\n"
+        "    return dsconv_map_int(u);\n"
+        "}\n"
+        "static inline uint64_t dsconv_map_bytes(const void *data, size_t n) {\n"
+        "    const unsigned char *s = (const unsigned char*)data;\n"
+        "    uint64_t h = 0xcbf29ce484222325ull;\n"
+        "    for (; n >= 8; s += 8, n -= 8) {\n"
+        "        uint64_t w;\n"
+        "        memcpy(&w, s, 8);\n"
+        "        h = (h ^ w) * 0x100000001b3ull;\n"
+        "        h ^= h >> 29;\n"
+        "    }\n"
+        "    for (; n; ++s, --n) h = (h ^ *s) * 0x100000001b3ull;\n"
+        "    return dsconv_map_int(h);\n"
+        "}\n"
+        "/* A char array key: up to its first NUL. */\n"
+        "static inline uint64_t dsconv_map_strn(const char *s, size_t n) {\n"
+        "    size_t len = 0;\n"
+        "    while (len < n && s[len]) len++;\n"
+        "    return dsconv_map_bytes(s, len);\n"
+        "}\n"
+        "#endif\n"
+        "\n");
+}
+
+void gen_map_emit(Emitter *out, const TypeScope *scope, const FlatAST *fa, const FlatDecl *n, const Options *opts) {
+    RecordName rec;
+    if (opts->map_spec_count == 0 || !codegen_record(fa, n, &rec) || rec.type->kind != TYPE_STRUCT) return;
+    const char *key = map_key(opts, &rec);
+    if (!key || gen_map_check(scope, fa, &rec, key)) return; /* reported by codegen_matches_report */
+    MapKey k;
+    memset(&k, 0, sizeof(k));
+    k.out = out;
+    k.rec = &rec;
+    k.member = key;
+    k.fa = fa;
+    const FlatMember *m = key_member(fa, rec.type, key);
+    const char *why;
+    k.type = m->type;
+    key_kind(scope, fa, &fa->types[m->type], &k.kind, &why);
+    k.inline_type = defines_type(fa, m->type);
+    emit_map(&k);
+}
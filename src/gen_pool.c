@@ -0,0 +1,212 @@
+#include <stdio.h>
+#include <string.h>
+#include "codegen.h"
+
+/* -pool: a typed slab allocator per selected struct.
+ *
+ * Objects live in fixed-size blocks (a union of the struct and the free
+ * list link, so a freed block needs no extra memory). Blocks are carved
+ * from slabs of about 64 KB whose first block is cache-line aligned; freed
+ * blocks go on an intrusive free list and are reused first. T_pool_reset
+ * releases every object at once but keeps the slabs. With -pooltls the pool
+ * gets a spinlock and a T_pool_cache type: a per-thread stash of blocks
+ * that refills from and spills to the shared pool in batches, so most
+ * allocations take no lock. The caller keeps one cache per thread. */
+
+static int pool_selected(const Options *opts, const RecordName *rec) {
+    for (int i = 0; i < opts->pool_type_count; ++i) {
+        const char *want = opts->pool_types[i];
+        if (strcmp(want, "*") == 0 || strcmp(want, rec->prefix) == 0 || strcmp(want, rec->spelled) == 0) return 1;
+        if (rec->tag && strcmp(want, rec->tag) == 0) return 1;
+    }
+    return 0;
+}
+
+void gen_pool_prologue(Emitter *out, const Options *opts) {
+    if (opts->pool_type_count == 0) return;
+    emit(out,
+        "#include <stddef.h>\n"
+        "#include <stdint.h>\n"
+        "#include <stdlib.h>\n"
+        "#include <string.h>\n");
+    if (opts->pool_thread_cache) emit(out, "#include <stdatomic.h>\n");
+    emit(out,
+        "\n"
+        "#ifndef DSCONV_CACHE_LINE\n"
+        "#define DSCONV_CACHE_LINE 64\n"
+        "#endif\n"
+        "#ifndef DSCONV_POOL_SLAB_BYTES\n"
+        "#define DSCONV_POOL_SLAB_BYTES 65536\n"
+        "#endif\n"
+        "\n");
+}
+
+static void emit_pool_types(Emitter *out, const char *T, const char *P, int tls) {
+    emit(out,
+        "typedef union %s_pool_block {\n"
+        "    %s value;\n"
+        "    union %s_pool_block *next;\n"
+        "} %s_pool_block;\n", P, T, P, P);
+    emit(out,
+        "typedef struct %s_pool_slab {\n"
+        "    struct %s_pool_slab *next;\n"
+        "    %s_pool_block *blocks;\n"
+        "} %s_pool_slab;\n", P, P, P, P);
+    emit(out,
+        "typedef struct {\n"
+        "    %s_pool_slab *slabs, *last, *current; /* current: slab being carved */\n"
+        "    %s_pool_block *free_list;\n"
+        "    %s_pool_block *bump, *bump_end; /* uncarved blocks of current */\n"
+        "    size_t per_slab;\n"
+        "    size_t live;\n", P, P, P);
+    if (tls) emit(out, "    atomic_flag lock; /* taken by %s_pool_cache_* */\n", P);
+    emit(out, "} %s_pool;\n", P);
+}
+
+static void emit_pool_functions(Emitter *out, const char *T, const char *P) {
+    emit(out,
+        "/* per_slab = 0 picks about DSCONV_POOL_SLAB_BYTES per slab. */\n"
+        "static inline void %s_pool_init(%s_pool *pool, size_t per_slab) {\n"
+        "    memset(pool, 0, sizeof(*pool));\n"
+        "    pool->per_slab = per_slab;\n"
+        "}\n", P, P);
+    emit(out,
+        "static inline %s_pool_slab *%s_pool_grow(%s_pool *pool) {\n"
+        "    size_t align = _Alignof(%s_pool_block) > DSCONV_CACHE_LINE ? _Alignof(%s_pool_block) : DSCONV_CACHE_LINE;\n"
+        "    if (!pool->per_slab) {\n"
+        "        pool->per_slab = (DSCONV_POOL_SLAB_BYTES - sizeof(%s_pool_slab) - align) / sizeof(%s_pool_block);\n"
+        "        if (!pool->per_slab) pool->per_slab = 1;\n"
+        "    }\n"
+        "    %s_pool_slab *slab = (%s_pool_slab*)malloc(sizeof(%s_pool_slab) + align + pool->per_slab * sizeof(%s_pool_block));\n"
+        "    if (!slab) return NULL;\n"
+        "    uintptr_t first = ((uintptr_t)(slab + 1) + align - 1) & ~(uintptr_t)(align - 1);\n"
+        "    slab->blocks = (%s_pool_block*)first;\n"
+        "    slab->next = NULL;\n"
+        "    if (pool->last) pool->last->next = slab; else pool->slabs = slab;\n"
+        "    pool->last = slab;\n"
+        "    return slab;\n"
+        "}\n", P, P, P, P, P, P, P, P, P, P, P, P);
+    emit(out,
+        "static inline %s *%s_pool_alloc(%s_pool *pool) {\n"
+        "    %s_pool_block *b = pool->free_list;\n"
+        "    if (b) {\n"
+        "        pool->free_list = b->next;\n"
+        "    } else {\n"
+        "        if (pool->bump == pool->bump_end) {\n"
+        "            %s_pool_slab *next = pool->current ? pool->current->next : pool->slabs;\n"
+        "            if (!next && !(next = %s_pool_grow(pool))) return NULL;\n"
+        "            pool->current = next;\n"
+        "            pool->bump = next->blocks;\n"
+        "            pool->bump_end = next->blocks + pool->per_slab;\n"
+        "        }\n"
+        "        b = pool->bump++;\n"
+        "    }\n"
+        "    pool->live++;\n"
+        "    return &b->value;\n"
+        "}\n", T, P, P, P, P, P);
+    emit(out,
+        "static inline void %s_pool_free(%s_pool *pool, %s *obj) {\n"
+        "    if (!obj) return;\n"
+        "    %s_pool_block *b = (%s_pool_block*)obj;\n"
+        "    b->next = pool->free_list;\n"
+        "    pool->free_list = b;\n"
+        "    pool->live--;\n"
+        "}\n", P, P, T, P, P);
+    emit(out,
+        "/* Releases every object at once; the slabs are kept for reuse. */\n"
+        "static inline void %s_pool_reset(%s_pool *pool) {\n"
+        "    pool->free_list = NULL;\n"
+        "    pool->current = NULL;\n"
+        "    pool->bump = pool->bump_end = NULL;\n"
+        "    pool->live = 0;\n"
+        "}\n", P, P);
+    emit(out,
+        "static inline void %s_pool_destroy(%s_pool *pool) {\n"
+        "    %s_pool_slab *slab = pool->slabs;\n"
+        "    while (slab) {\n"
+        "        %s_pool_slab *next = slab->next;\n"
+        "        free(slab);\n"
+        "        slab = next;\n"
+        "    }\n"
+        "    memset(pool, 0, sizeof(*pool));\n"
+        "}\n", P, P, P, P);
+}
+
+static void emit_pool_cache(Emitter *out, const char *T, const char *P) {
+    emit(out,
+        "#ifndef %s_POOL_CACHE_MAX\n"
+        "#define %s_POOL_CACHE_MAX 64\n"
+        "#endif\n"
+        "/* Per-thread stash in front of a shared pool; one per thread, flushed\n"
+        " * before the thread exits. Only the cache functions lock the pool. */\n"
+        "typedef struct {\n"
+        "    %s_pool *pool;\n"
+        "    %s_pool_block *blocks;\n"
+        "    size_t count;\n"
+        "} %s_pool_cache;\n", P, P, P, P, P);
+    emit(out,
+        "static inline void %s_pool_lock(%s_pool *pool) {\n"
+        "    while (atomic_flag_test_and_set_explicit(&pool->lock, memory_order_acquire)) {}\n"
+        "}\n"
+        "static inline void %s_pool_unlock(%s_pool *pool) {\n"
+        "    atomic_flag_clear_explicit(&pool->lock, memory_order_release);\n"
+        "}\n", P, P, P, P);
+    emit(out,
+        "static inline void %s_pool_cache_init(%s_pool_cache *cache, %s_pool *pool) {\n"
+        "    cache->pool = pool;\n"
+        "    cache->blocks = NULL;\n"
+        "    cache->count = 0;\n"
+        "}\n", P, P, P);
+    emit(out,
+        "static inline %s *%s_pool_cache_alloc(%s_pool_cache *cache) {\n"
+        "    if (!cache->count) {\n"
+        "        %s_pool_lock(cache->pool);\n"
+        "        while (cache->count < %s_POOL_CACHE_MAX / 2) {\n"
+        "            %s_pool_block *b = (%s_pool_block*)%s_pool_alloc(cache->pool);\n"
+        "            if (!b) break;\n"
+        "            b->next = cache->blocks;\n"
+        "            cache->blocks = b;\n"
+        "            cache->count++;\n"
+        "        }\n"
+        "        %s_pool_unlock(cache->pool);\n"
+        "        if (!cache->count) return NULL;\n"
+        "    }\n"
+        "    %s_pool_block *b = cache->blocks;\n"
+        "    cache->blocks = b->next;\n"
+        "    cache->count--;\n"
+        "    return &b->value;\n"
+        "}\n", T, P, P, P, P, P, P, P, P, P);
+    emit(out,
+        "/* Returns the cached blocks to the shared pool, keeping keep of them. */\n"
+        "static inline void %s_pool_cache_trim(%s_pool_cache *cache, size_t keep) {\n"
+        "    %s_pool_lock(cache->pool);\n"
+        "    while (cache->count > keep) {\n"
+        "        %s_pool_block *b = cache->blocks;\n"
+        "        cache->blocks = b->next;\n"
+        "        cache->count--;\n"
+        "        %s_pool_free(cache->pool, &b->value);\n"
+        "    }\n"
+        "    %s_pool_unlock(cache->pool);\n"
+        "}\n", P, P, P, P, P, P);
+    emit(out,
+        "static inline void %s_pool_cache_free(%s_pool_cache *cache, %s *obj) {\n"
+        "    if (!obj) return;\n"
+        "    %s_pool_block *b = (%s_pool_block*)obj;\n"
+        "    b->next = cache->blocks;\n"
+        "    cache->blocks = b;\n"
+        "    if (++cache->count > %s_POOL_CACHE_MAX) %s_pool_cache_trim(cache, %s_POOL_CACHE_MAX / 2);\n"
+        "}\n"
+        "static inline void %s_pool_cache_flush(%s_pool_cache *cache) {\n"
+        "    %s_pool_cache_trim(cache, 0);\n"
+        "}\n", P, P, T, P, P, P, P, P, P, P, P);
+}
+
+void gen_pool_emit(Emitter *out, const TypeScope *scope, const FlatAST *fa, const FlatDecl *n, const Options *opts) {
+    (void)scope;
+    RecordName rec;
+    if (opts->pool_type_count == 0 || !codegen_record(fa, n, &rec) || rec.type->kind != TYPE_STRUCT) return;
+    if (!pool_selected(opts, &rec)) return;
+    emit_pool_types(out, rec.spelled, rec.prefix, opts->pool_thread_cache);
+    emit_pool_functions(out, rec.spelled, rec.prefix);
+    if (opts->pool_thread_cache) emit_pool_cache(out, rec.spelled, rec.prefix);
+}
@@ -0,0 +1,266 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include "codegen.h"
+#include "memstat.h"
+
+/* -reflect: a field descriptor table for every struct and union.
+ *
+ * Each record gets R_fields, one dsconv_field per member (name, offset,
+ * element size, element count, kind, bit-field width and the descriptor of
+ * the record it holds or points to), and R_reflect, a dsconv_type with its
+ * name, size and fields. R is the record's tag, or the typedef name of an
+ * anonymous record. Offsets and sizes are offsetof and sizeof expressions,
+ * so the tables hold whatever layout the compiler chose. Members of
+ * anonymous struct/union members are listed in the enclosing table, as
+ * they are accessed; records defined inside a member get tables of their
+ * own, named after the member when they have no tag. A descriptor pointer
+ * is only filled in for records declared before the one being described
+ * (or the record itself). */
+
+typedef struct {
+    Emitter *out;
+    const TypeScope *scope;
+    const FlatAST *fa;
+    int define; /* 0: tentative declarations, 1: tables */
+} Reflect;
+
+/* A record to describe: the object is `base` itself, or the member at
+ * designator `path` inside it for records defined in a member. */
+typedef struct {
+    const FlatType *record;
+    const char *prefix; /* R in R_fields / R_reflect */
+    const char *base;   /* C spelling of the outermost type */
+    const char *path;   /* "" or a designator such as "pos" or "items[0]" */
+} Table;
+
+static char *str_fmt(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    va_list again;
+    va_copy(again, ap);
+    int n = vsnprintf(NULL, 0, fmt, ap);
+    char *s = (char*)ds_malloc((size_t)n + 1);
+    vsnprintf(s, (size_t)n + 1, fmt, again);
+    va_end(again);
+    va_end(ap);
+    return s;
+}
+
+static const char *builtin_kind(const char *name) {
+    if (builtin_is_floating(name)) return "DSCONV_FIELD_FLOAT";
+    if (strcmp(name, "_Bool") == 0 || strcmp(name, "bool") == 0) return "DSCONV_FIELD_BOOL";
+    return builtin_is_unsigned(name) ? "DSCONV_FIELD_UINT" : "DSCONV_FIELD_INT";
+}
+
+static int is_char(const Reflect *r, FlatRef ref) {
+    const FlatType *t = scope_resolve(r->scope, flat_type(r->fa, ref));
+    return t && t->kind == TYPE_BUILTIN && strstr(flat_str(r->fa, t->name), "char") != NULL;
+}
+
+/* Emits "&R_reflect" for a record t names that has a table, else "NULL". */
+static void emit_descriptor_ref(Reflect *r, const FlatType *t) {
+    const FlatType *record;
+    const char *name = scope_record_name(r->scope, t, &record);
+    if (name) emit(r->out, "&%s_reflect", name);
+    else emit(r->out, "NULL");
+}
+
+/* An unnamed member whose own members are reached directly (C11). */
+static int is_anonymous(const FlatAST *fa, const FlatMember *m) {
+    const FlatType *t = flat_type(fa, m->type);
+    return m->name == FLAT_NONE && !m->bits && t && (t->kind == TYPE_STRUCT || t->kind == TYPE_UNION) && t->name == FLAT_NONE;
+}
+
+static void visit_table(Reflect *r, const Table *tb);
+
+/* Tables for the records defined inside the members of a record, so they
+ * come before the table that points to them. */
+static void visit_nested(Reflect *r, const Table *tb, const FlatType *record) {
+    const FlatAST *fa = r->fa;
+    for (int32_t i = 0; i < record->count; ++i) {
+        const FlatMember *m = &fa->members[record->base + (FlatRef)i];
+        const FlatType *t = flat_type(fa, m->type);
+        int dims = 0;
+        while (t && t->kind == TYPE_ARRAY) { t = flat_type(fa, t->base); dims++; }
+        if (!t || (t->kind != TYPE_STRUCT && t->kind != TYPE_UNION) || !t->count) continue;
+        const char *tag = flat_str(fa, t->name), *name = flat_str(fa, m->name);
+        if (tag) {
+            char *base = str_fmt("%s %s", t->kind == TYPE_UNION ? "union" : "struct", tag);
+            Table sub = { t, tag, base, "" };
+            visit_table(r, &sub);
+            free(base);
+        } else if (is_anonymous(fa, m)) {
+            visit_nested(r, tb, t);
+        } else if (!m->bits) {
+            char *prefix = str_fmt("%s_%s", tb->prefix, name);
+            char *path = str_fmt("%s%s%s", tb->path, tb->path[0] ? "." : "", name);
+            for (int d = 0; d < dims; ++d) {
+                char *longer = str_fmt("%s[0]", path);
+                free(path);
+                path = longer;
+            }
+            Table sub = { t, prefix, tb->base, path };
+            visit_table(r, &sub);
+            free(path);
+            free(prefix);
+        }
+    }
+}
+
+static size_t count_fields(const FlatAST *fa, const FlatType *record) {
+    size_t n = 0;
+    for (int32_t i = 0; i < record->count; ++i) {
+        const FlatMember *m = &fa->members[record->base + (FlatRef)i];
+        if (m->name != FLAT_NONE) n++;
+        else if (is_anonymous(fa, m)) n += count_fields(fa, &fa->types[m->type]);
+    }
+    return n;
+}
+
+static void emit_field(Reflect *r, const Table *tb, const FlatMember *m, int last) {
+    const FlatAST *fa = r->fa;
+    const char *B = tb->base, *name = flat_str(fa, m->name);
+    char *desig = str_fmt("%s%s%s", tb->path, tb->path[0] ? "." : "", name);
+    const FlatType *t = flat_type(fa, m->type);
+    int dims = 0, flexible = 0;
+    while (t && t->kind == TYPE_ARRAY) {
+        if (dims == 0 && t->count <= 0 && t->name == FLAT_NONE && last) flexible = 1;
+        t = flat_type(fa, t->base);
+        dims++;
+    }
+    emit(r->out, "    { \"%s\", ", name);
+    if (m->bits) {
+        emit(r->out, "0, 0, 1, ");
+    } else {
+        if (tb->path[0]) emit(r->out, "offsetof(%s, %s) - offsetof(%s, %s), ", B, desig, B, tb->path);
+        else emit(r->out, "offsetof(%s, %s), ", B, desig);
+        emit(r->out, "sizeof(((%s*)0)->%s", B, desig);
+        for (int d = 0; d < dims; ++d) emit(r->out, "[0]");
+        emit(r->out, "), ");
+        if (flexible) {
+            emit(r->out, "0, ");
+        } else if (dims) {
+            emit(r->out, "sizeof(((%s*)0)->%s) / sizeof(((%s*)0)->%s", B, desig, B, desig);
+            for (int d = 0; d < dims; ++d) emit(r->out, "[0]");
+            emit(r->out, "), ");
+        } else {
+            emit(r->out, "1, ");
+        }
+    }
+    const FlatType *v = scope_resolve(r->scope, t);
+    switch (v ? v->kind : TYPE_ALIAS) {
+        case TYPE_BUILTIN:
+            emit(r->out, "%s, %d, NULL },\n", builtin_kind(flat_str(fa, v->name)), m->bits);
+            break;
+        case TYPE_ENUM:
+            emit(r->out, "DSCONV_FIELD_ENUM, %d, NULL },\n", m->bits);
+            break;
+        case TYPE_POINTER:
+            if (is_char(r, v->base)) {
+                emit(r->out, "DSCONV_FIELD_STRING, 0, NULL },\n");
+            } else {
+                emit(r->out, "DSCONV_FIELD_POINTER, 0, ");
+                emit_descriptor_ref(r, flat_type(fa, v->base));
+                emit(r->out, " },\n");
+            }
+            break;
+        case TYPE_STRUCT:
+        case TYPE_UNION:
+            emit(r->out, "%s, 0, ", v->kind == TYPE_UNION ? "DSCONV_FIELD_UNION" : "DSCONV_FIELD_STRUCT");
+            if (t == v && v->name == FLAT_NONE && v->count) emit(r->out, "&%s_%s_reflect", tb->prefix, name);
+            else emit_descriptor_ref(r, t);
+            emit(r->out, " },\n");
+            break;
+        default: /* functions, names dsconv knows nothing about */
+            emit(r->out, "DSCONV_FIELD_OPAQUE, %d, NULL },\n", m->bits);
+            break;
+    }
+    free(desig);
+}
+
+static void emit_fields(Reflect *r, const Table *tb, const FlatType *record) {
+    const FlatAST *fa = r->fa;
+    for (int32_t i = 0; i < record->count; ++i) {
+        const FlatMember *m = &fa->members[record->base + (FlatRef)i];
+        if (m->name != FLAT_NONE) emit_field(r, tb, m, i + 1 == record->count);
+        else if (is_anonymous(fa, m)) emit_fields(r, tb, &fa->types[m->type]);
+    }
+}
+
+static void visit_table(Reflect *r, const Table *tb) {
+    visit_nested(r, tb, tb->record);
+    const char *R = tb->prefix;
+    if (!r->define) {
+        emit(r->out, "static const dsconv_type %s_reflect;\n", R);
+        return;
+    }
+    size_t count = count_fields(r->fa, tb->record);
+    if (count) {
+        emit(r->out, "static const dsconv_field %s_fields[%zu] = {\n", R, count);
+        emit_fields(r, tb, tb->record);
+        emit(r->out, "};\n");
+    }
+    emit(r->out, "static const dsconv_type %s_reflect = { \"", R);
+    if (tb->path[0]) emit(r->out, "%s.%s\", sizeof(((%s*)0)->%s), ", tb->base, tb->path, tb->base, tb->path);
+    else emit(r->out, "%s\", sizeof(%s), ", tb->base, tb->base);
+    if (count) emit(r->out, "%zu, %s_fields };\n", count, R);
+    else emit(r->out, "0, NULL };\n");
+}
+
+void gen_reflect_prologue(Emitter *out, const Options *opts) {
+    if (!opts->reflect_tables) return;
+    emit(out,
+        "#include <stddef.h>\n"
+        "\n"
+        "#ifndef DSCONV_REFLECT_HELPERS\n"
+        "#define DSCONV_REFLECT_HELPERS\n"
+        "typedef enum {\n"
+        "    DSCONV_FIELD_INT, DSCONV_FIELD_UINT, DSCONV_FIELD_FLOAT, DSCONV_FIELD_BOOL,\n"
+        "    DSCONV_FIELD_ENUM, DSCONV_FIELD_STRING, DSCONV_FIELD_POINTER,\n"
+        "    DSCONV_FIELD_STRUCT, DSCONV_FIELD_UNION, DSCONV_FIELD_OPAQUE\n"
+        "} dsconv_field_kind;\n"
+        "struct dsconv_type;\n"
+        "typedef struct dsconv_field {\n"
+        "    const char *name;\n"
+        "    size_t offset; /* 0 for bit-fields */\n"
+        "    size_t size;   /* of one element; 0 for bit-fields */\n"
+        "    size_t count;  /* elements: 1, the array length, 0 for a flexible array */\n"
+        "    dsconv_field_kind kind; /* of the element (STRING: char pointer) */\n"
+        "    int bits;      /* bit-field width, else 0 */\n"
+        "    const struct dsconv_type *type; /* record held or pointed to, if described */\n"
+        "} dsconv_field;\n"
+        "typedef struct dsconv_type {\n"
+        "    const char *name;\n"
+        "    size_t size;\n"
+        "    size_t field_count;\n"
+        "    const dsconv_field *fields;\n"
+        "} dsconv_type;\n"
+        "/* Address of element i of field f of the record at obj. */\n"
+        "static inline void *dsconv_field_at(void *obj, const dsconv_field *f, size_t i) {\n"
+        "    return (char*)obj + f->offset + i * f->size;\n"
+        "}\n"
+        "#endif\n"
+        "\n");
+}
+
+void gen_reflect_emit(Emitter *out, const TypeScope *scope, const FlatAST *fa, const FlatDecl *n, const Options *opts) {
+    if (!opts->reflect_tables) return;
+    /* the record n defines, also under pointers and arrays (its tag is in
+     * the scope either way) */
+    const FlatType *t = flat_type(fa, n->type);
+    while (t && (t->kind == TYPE_POINTER || t->kind == TYPE_ARRAY || t->kind == TYPE_FUNCTION)) t = flat_type(fa, t->base);
+    if (!t || (t->kind != TYPE_STRUCT && t->kind != TYPE_UNION) || !t->count) return;
+    const char *tag = flat_str(fa, t->name);
+    const char *prefix = tag ? tag : (n->is_typedef && t == &fa->types[n->type]) ? flat_str(fa, n->name) : NULL;
+    if (!prefix) return;
+    char *base = tag ? str_fmt("%s %s", t->kind == TYPE_UNION ? "union" : "struct", tag) : str_fmt("%s", prefix);
+    Table tb = { t, prefix, base, "" };
+    /* declared up front so tables may point to each other and themselves */
+    Reflect r = { out, scope, fa, 0 };
+    visit_table(&r, &tb);
+    r.define = 1;
+    visit_table(&r, &tb);
+    free(base);
+}
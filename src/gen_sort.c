@@ -0,0 +1,299 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "codegen.h"
+#include "memstat.h"
+
+/* -sort T:key: sort routines for arrays of T ordered by one member.
+ *
+ * Every spec gets P_merge_sort_by_key, a stable bottom-up merge sort over
+ * insertion-sorted runs with the comparison inlined (no comparator
+ * pointer), and P_sort_by_key, the fastest stable sort for the key's type.
+ * For integer and enum keys that is an LSD radix sort, 8 bits per pass:
+ * one sweep builds the histograms of every digit, and digits all keys share
+ * are skipped. An integer key has as many digits as bytes; an enum key only
+ * as many as its enumerators' value range needs (keys outside that range
+ * make it fall back to the merge sort). For other keys (floating point,
+ * pointers, strings, char arrays) P_sort_by_key is the merge sort. */
+
+typedef enum {
+    SORT_UNSIGNED,
+    SORT_SIGNED,
+    SORT_CHAR,    /* plain char, signed or not */
+    SORT_ENUM,
+    SORT_FLOAT,
+    SORT_POINTER,
+    SORT_STRING,  /* char pointer */
+    SORT_CHARS    /* char array */
+} SortKind;
+
+typedef struct {
+    Emitter *out;
+    const RecordName *rec;
+    const char *member;
+    SortKind kind;
+    int64_t min;    /* SORT_ENUM: value range */
+    uint64_t range;
+    int digits;     /* SORT_ENUM: radix passes */
+} SortKey;
+
+static const FlatMember *find_member(const FlatAST *fa, const FlatType *record, const char *name) {
+    for (int32_t i = 0; i < record->count; ++i) {
+        const FlatMember *m = &fa->members[record->base + (FlatRef)i];
+        if (m->name != FLAT_NONE && strcmp(flat_str(fa, m->name), name) == 0) return m;
+        const FlatType *t = flat_type(fa, m->type);
+        if (m->name == FLAT_NONE && !m->bits && t && (t->kind == TYPE_STRUCT || t->kind == TYPE_UNION) && t->name == FLAT_NONE) {
+            const FlatMember *found = find_member(fa, t, name);
+            if (found) return found;
+        }
+    }
+    return NULL;
+}
+
+static int is_char(const TypeScope *scope, const FlatAST *fa, FlatRef ref) {
+    const FlatType *t = scope_resolve(scope, flat_type(fa, ref));
+    return t && t->kind == TYPE_BUILTIN && strstr(flat_str(fa, t->name), "char") != NULL;
+}
+
+/* Picks the sort for keys of type t; returns 0 with a reason when keys of
+ * that type have no order. */
+static int sort_kind(const TypeScope *scope, const FlatAST *fa, const FlatType *t, SortKey *k, const char **why) {
+    if (t->kind == TYPE_ARRAY) {
+        if ((t->count > 0 || t->name != FLAT_NONE) && is_char(scope, fa, t->base)) {
+            k->kind = SORT_CHARS;
+            return 1;
+        }
+        *why = "arrays other than char arrays cannot be keys";
+        return 0;
+    }
+    const FlatType *v = scope_resolve(scope, t);
+    switch (v ? v->kind : TYPE_ALIAS) {
+        case TYPE_BUILTIN: {
+            const char *name = flat_str(fa, v->name);
+            if (strcmp(name, "void") == 0) break;
+            if (builtin_is_floating(name)) k->kind = SORT_FLOAT;
+            else if (strcmp(name, "char") == 0) k->kind = SORT_CHAR;
+            else k->kind = builtin_is_unsigned(name) ? SORT_UNSIGNED : SORT_SIGNED;
+            return 1;
+        }
+        case TYPE_ENUM: {
+            if (!v->count) {
+                *why = "the enum's values are not known";
+                return 0;
+            }
+            const FlatEnumValue *e = &fa->values[v->base];
+            int64_t lo = e->value, hi = e->value;
+            for (int32_t i = 0; i < v->count; ++i) {
+                if (e[i].expr != FLAT_NONE) {
+                    *why = "the enum's values are not known";
+                    return 0;
+                }
+                if (e[i].value < lo) lo = e[i].value;
+                if (e[i].value > hi) hi = e[i].value;
+            }
+            k->kind = SORT_ENUM;
+            k->min = lo;
+            k->range = (uint64_t)hi - (uint64_t)lo;
+            k->digits = 1;
+            while (k->digits < 8 && (k->range >> (8 * k->digits)) != 0) k->digits++;
+            return 1;
+        }
+        case TYPE_POINTER:
+            k->kind = is_char(scope, fa, v->base) ? SORT_STRING : SORT_POINTER;
+            return 1;
+        default:
+            break;
+    }
+    *why = "its type has no order";
+    return 0;
+}
+
+const char *gen_sort_check(const TypeScope *scope, const FlatAST *fa, const RecordName *rec, const char *key) {
+    const FlatMember *m = find_member(fa, rec->type, key);
+    const char *why = NULL;
+    SortKey k;
+    if (!m) return "no such member";
+    if (m->bits) return "bit-fields cannot be keys";
+    if (scope_read_only(scope, rec->type)) return "records with const members cannot be moved";
+    sort_kind(scope, fa, &fa->types[m->type], &k, &why);
+    return why;
+}
+
+static void emit_less(const SortKey *k) {
+    Emitter *out = k->out;
+    const char *P = k->rec->prefix, *T = k->rec->spelled, *M = k->member;
+    emit(out, "static inline int %s_less_by_%s(const %s *a, const %s *b) {\n    return ", P, M, T, T);
+    switch (k->kind) {
+        case SORT_POINTER: emit(out, "(uintptr_t)a->%s < (uintptr_t)b->%s", M, M); break;
+        case SORT_STRING: emit(out, "strcmp(a->%s ? a->%s : \"\", b->%s ? b->%s : \"\") < 0", M, M, M, M); break;
+        case SORT_CHARS: emit(out, "strncmp(a->%s, b->%s, sizeof(a->%s)) < 0", M, M, M); break;
+        default: emit(out, "a->%s < b->%s", M, M); break;
+    }
+    emit(out, ";\n}\n");
+}
+
+static void emit_merge_sort(const SortKey *k) {
+    Emitter *out = k->out;
+    const char *P = k->rec->prefix, *T = k->rec->spelled, *M = k->member;
+    emit(out,
+        "static inline void %s_insertion_sort_by_%s(%s *items, size_t n) {\n"
+        "    for (size_t i = 1; i < n; ++i) {\n"
+        "        %s v = items[i];\n"
+        "        size_t j = i;\n"
+        "        for (; j > 0 && %s_less_by_%s(&v, &items[j - 1]); --j) items[j] = items[j - 1];\n"
+        "        items[j] = v;\n"
+        "    }\n"
+        "}\n", P, M, T, T, P, M);
+    emit(out,
+        "/* Stable merge sort by %s; returns 0 when out of memory (items unchanged). */\n"
+        "static inline int %s_merge_sort_by_%s(%s *items, size_t n) {\n"
+        "    if (n <= DSCONV_SORT_RUN) {\n"
+        "        %s_insertion_sort_by_%s(items, n);\n"
+        "        return 1;\n"
+        "    }\n"
+        "    %s *tmp = (%s*)malloc(n * sizeof(%s));\n"
+        "    if (!tmp) return 0;\n"
+        "    for (size_t lo = 0; lo < n; lo += DSCONV_SORT_RUN) {\n"
+        "        %s_insertion_sort_by_%s(items + lo, n - lo < DSCONV_SORT_RUN ? n - lo : DSCONV_SORT_RUN);\n"
+        "    }\n"
+        "    %s *src = items, *dst = tmp;\n"
+        "    for (size_t w = DSCONV_SORT_RUN; w < n; w *= 2) {\n"
+        "        for (size_t lo = 0; lo < n; lo += 2 * w) {\n"
+        "            size_t mid = lo + w < n ? lo + w : n, hi = lo + 2 * w < n ? lo + 2 * w : n;\n"
+        "            size_t i = lo, j = mid, o = lo;\n"
+        "            while (i < mid && j < hi) dst[o++] = %s_less_by_%s(&src[j], &src[i]) ? src[j++] : src[i++];\n"
+        "            while (i < mid) dst[o++] = src[i++];\n"
+        "            while (j < hi) dst[o++] = src[j++];\n"
+        "        }\n"
+        "        %s *t = src;\n"
+        "        src = dst;\n"
+        "        dst = t;\n"
+        "    }\n"
+        "    if (src != items) memcpy(items, src, n * sizeof(%s));\n"
+        "    free(tmp);\n"
+        "    return 1;\n"
+        "}\n", M, P, M, T, P, M, T, T, T, P, M, T, P, M, T, T);
+}
+
+/* The radix key of the entry at e: the member as an unsigned number that
+ * orders like the member (signed keys offset by half their range, enum
+ * keys by their smallest enumerator). */
+static void emit_radix_key(const SortKey *k) {
+    Emitter *out = k->out;
+    const char *P = k->rec->prefix, *T = k->rec->spelled, *M = k->member;
+    emit(out, "static inline uint64_t %s_radix_key_by_%s(const %s *e) {\n    return ", P, M, T);
+    switch (k->kind) {
+        case SORT_ENUM:
+            emit(out, "(uint64_t)(int64_t)e->%s - %lluULL", M, (unsigned long long)(uint64_t)k->min);
+            break;
+        case SORT_SIGNED:
+            emit(out, "(uint64_t)e->%s + ((uint64_t)1 << (8 * sizeof(e->%s) - 1))", M, M);
+            break;
+        case SORT_CHAR:
+            emit(out, "(uint64_t)e->%s + ((char)-1 < 0 ? 0x80 : 0)", M);
+            break;
+        default:
+            emit(out, "(uint64_t)e->%s", M);
+            break;
+    }
+    emit(out, ";\n}\n");
+}
+
+static void emit_radix_sort(const SortKey *k) {
+    Emitter *out = k->out;
+    const char *P = k->rec->prefix, *T = k->rec->spelled, *M = k->member;
+    emit_radix_key(k);
+    emit(out, "/* Stable LSD radix sort by %s; returns 0 when out of memory (items unchanged). */\n", M);
+    emit(out, "static inline int %s_sort_by_%s(%s *items, size_t n) {\n", P, M, T);
+    if (k->kind == SORT_ENUM) emit(out, "    enum { DIGITS = %d };\n", k->digits);
+    else emit(out, "    enum { DIGITS = sizeof(((%s*)0)->%s) };\n", T, M);
+    emit(out,
+        "    if (n <= DSCONV_SORT_RUN) {\n"
+        "        %s_insertion_sort_by_%s(items, n);\n"
+        "        return 1;\n"
+        "    }\n"
+        "    size_t counts[DIGITS][256];\n"
+        "    memset(counts, 0, sizeof(counts));\n"
+        "    for (size_t i = 0; i < n; ++i) {\n"
+        "        uint64_t key = %s_radix_key_by_%s(&items[i]);\n", P, M, P, M);
+    if (k->kind == SORT_ENUM) {
+        emit(out, "        if (key > %lluULL) return %s_merge_sort_by_%s(items, n); /* not an enumerator */\n",
+             (unsigned long long)k->range, P, M);
+    }
+    emit(out,
+        "        for (int d = 0; d < DIGITS; ++d) counts[d][(key >> (8 * d)) & 0xff]++;\n"
+        "    }\n"
+        "    %s *tmp = NULL, *src = items, *dst = NULL;\n"
+        "    for (int d = 0; d < DIGITS; ++d) {\n"
+        "        size_t *c = counts[d];\n"
+        "        if (c[(%s_radix_key_by_%s(&src[0]) >> (8 * d)) & 0xff] == n) continue; /* one digit for all */\n"
+        "        if (!tmp) {\n"
+        "            tmp = (%s*)malloc(n * sizeof(%s));\n"
+        "            if (!tmp) return 0;\n"
+        "            dst = tmp;\n"
+        "        }\n"
+        "        size_t sum = 0;\n"
+        "        for (int b = 0; b < 256; ++b) {\n"
+        "            size_t count = c[b];\n"
+        "            c[b] = sum;\n"
+        "            sum += count;\n"
+        "        }\n"
+        "        for (size_t i = 0; i < n; ++i) dst[c[(%s_radix_key_by_%s(&src[i]) >> (8 * d)) & 0xff]++] = src[i];\n"
+        "        %s *t = src;\n"
+        "        src = dst;\n"
+        "        dst = t;\n"
+        "    }\n"
+        "    if (src != items) memcpy(items, src, n * sizeof(%s));\n"
+        "    free(tmp);\n"
+        "    return 1;\n"
+        "}\n", T, P, M, T, T, P, M, T, T);
+}
+
+void gen_sort_prologue(Emitter *out, const Options *opts) {
+    if (opts->sort_spec_count == 0) return;
+    emit(out,
+        "#include <stddef.h>\n"
+        "#include <stdint.h>\n"
+        "#include <stdlib.h>\n"
+        "#include <string.h>\n"
+        "\n"
+        "#ifndef DSCONV_SORT_RUN\n"
+        "#define DSCONV_SORT_RUN 32 /* arrays and merge runs this short are insertion sorted */\n"
+        "#endif\n"
+        "\n");
+}
+
+void gen_sort_emit(Emitter *out, const TypeScope *scope, const FlatAST *fa, const FlatDecl *n, const Options *opts) {
+    RecordName rec;
+    if (opts->sort_spec_count == 0 || !codegen_record(fa, n, &rec) || rec.type->kind != TYPE_STRUCT) return;
+    const char *names[3] = { rec.prefix, rec.spelled, rec.tag };
+    for (int i = 0; i < opts->sort_spec_count; ++i) {
+        const char *spec = opts->sort_specs[i];
+        const char *colon = strchr(spec, ':');
+        size_t len = colon ? (size_t)(colon - spec) : 0;
+        int match = 0;
+        for (int j = 0; j < 3 && colon; ++j) {
+            if (names[j] && strlen(names[j]) == len && strncmp(spec, names[j], len) == 0) match = 1;
+        }
+        if (!match) continue;
+        SortKey k;
+        memset(&k, 0, sizeof(k));
+        k.out = out;
+        k.rec = &rec;
+        k.member = colon + 1;
+        if (gen_sort_check(scope, fa, &rec, k.member)) continue; /* reported by codegen_matches_report */
+        const char *why;
+        sort_kind(scope, fa, &fa->types[find_member(fa, rec.type, k.member)->type], &k, &why);
+        emit_less(&k);
+        emit_merge_sort(&k);
+        if (k.kind == SORT_FLOAT || k.kind == SORT_POINTER || k.kind == SORT_STRING || k.kind == SORT_CHARS) {
+            emit(out,
+                "static inline int %s_sort_by_%s(%s *items, size_t n) {\n"
+                "    return %s_merge_sort_by_%s(items, n);\n"
+                "}\n", rec.prefix, k.member, rec.spelled, rec.prefix, k.member);
+        } else {
+            emit_radix_sort(&k);
+        }
+    }
+}
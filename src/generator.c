@@ -1,10 +1,80 @@
 #include <stdio.h>
-#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
+#include <stdint.h>
+#include <stdatomic.h>
 #include "generator.h"
+#include "emitter.h"
 #include "ast.h"
+#include "flatast.h"
+#include "depgraph.h"
+#include "codegen.h"
+#include "memstat.h"
+#include "thread.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+static void emit_reserve(Emitter *e, size_t extra) {
+    if (e->len + extra <= e->cap) return;
+    while (e->len + extra > e->cap) e->cap = e->cap ? e->cap * 2 : 65536;
+    e->buf = (char*)ds_realloc(e->buf, e->cap);
+}
+
+void emit(Emitter *e, const char *fmt, ...) {
+    va_list ap; va_start(ap, fmt);
+    int n;
+    if (e->f) {
+        n = vfprintf(e->f, fmt, ap);
+    } else if (!e->write) {
+        va_list again;
+        va_copy(again, ap);
+        emit_reserve(e, 256);
+        n = vsnprintf(e->buf + e->len, e->cap - e->len, fmt, ap);
+        if (n >= 0 && (size_t)n >= e->cap - e->len) {
+            emit_reserve(e, (size_t)n + 1);
+            vsnprintf(e->buf + e->len, e->cap - e->len, fmt, again);
+        }
+        if (n > 0) e->len += (size_t)n;
+        va_end(again);
+    } else {
+        char local[256];
+        va_list again;
+        va_copy(again, ap);
+        n = vsnprintf(local, sizeof(local), fmt, ap);
+        if (n >= (int)sizeof(local)) {
+            char *big = (char*)malloc((size_t)n + 1);
+            vsnprintf(big, (size_t)n + 1, fmt, again);
+            e->write(big, (size_t)n, e->user);
+            free(big);
+        } else if (n > 0) {
+            e->write(local, (size_t)n, e->user);
+        }
+        va_end(again);
+    }
+    va_end(ap);
+    if (n > 0) e->bytes += (size_t)n;
+}
+
+void emit_bytes(Emitter *e, const char *data, size_t len) {
+    if (!len) return;
+    if (e->f) {
+        fwrite(data, 1, len, e->f);
+    } else if (!e->write) {
+        emit_reserve(e, len);
+        memcpy(e->buf + e->len, data, len);
+        e->len += len;
+    } else {
+        e->write(data, len, e->user);
+    }
+    e->bytes += len;
+}
 
 static void print_type(const Type *t, int indent);
 
@@ -40,132 +110,819 @@ static void print_type(const Type *t, int indent) {
     }
 }
 
-static void print_type_to_file(FILE *f, const Type *t, int indent) {
-    if (!t) { fprintf(f, "<null>"); return; }
+static char *str_wrap(const char *pre, char *mid, const char *post) {
+    size_t a = strlen(pre), b = strlen(mid), c = strlen(post);
+    char *s = (char*)malloc(a + b + c + 1);
+    memcpy(s, pre, a);
+    memcpy(s + a, mid, b);
+    memcpy(s + a + b, post, c + 1);
+    free(mid);
+    return s;
+}
+
+
+static void emit_indent(Emitter *f, int indent) {
+    for (int i = 0; i < indent; ++i) emit(f, " ");
+}
+
+static void emit_enum_body(Emitter *f, const FlatAST *fa, const FlatType *t) {
+    emit(f, " { ");
+    const FlatEnumValue *v = &fa->values[t->base];
+    for (int32_t i = 0; i < t->count; ++i, ++v) {
+        if (i) emit(f, ", ");
+        if (v->expr != FLAT_NONE) emit(f, "%s = %s", flat_str(fa, v->name), flat_str(fa, v->expr));
+        else if (f->literals && v->spelling != FLAT_NONE) emit(f, "%s = %s", flat_str(fa, v->name), flat_str(fa, v->spelling));
+        else emit(f, "%s = %lld", flat_str(fa, v->name), (long long)v->value);
+    }
+    emit(f, " }");
+}
+
+/* Type specifier; record bodies are written out when the type has members,
+ * nested records indented one more level. */
+static const char *quals_spelling(int quals) {
+    switch (quals & (QUAL_CONST | QUAL_VOLATILE)) {
+        case QUAL_CONST: return "const";
+        case QUAL_VOLATILE: return "volatile";
+        case QUAL_CONST | QUAL_VOLATILE: return "const volatile";
+        default: return "";
+    }
+}
+
+static void emit_specifier(Emitter *f, const FlatAST *fa, FlatRef ref, int indent) {
+    if (ref == FLAT_NONE) { emit(f, "<null>"); return; }
+    const FlatType *t = &fa->types[ref];
+    if (t->quals) emit(f, "%s ", quals_spelling(t->quals));
     switch (t->kind) {
-        case TYPE_BUILTIN: fprintf(f, "%s", t->u.builtin_name); break;
-        case TYPE_POINTER: fprintf(f, "*"); print_type_to_file(f, t->u.ptr.base, 0); break;
-        case TYPE_ARRAY: print_type_to_file(f, t->u.array.base, 0); fprintf(f, "[%d]", t->u.array.length); break;
-        case TYPE_FUNCTION: fprintf(f, "(*)("); // TODO: params
-            fprintf(f, ")"); print_type_to_file(f, t->u.func.ret, 0); break;
-        case TYPE_STRUCT: fprintf(f, "struct");
-            if (t->u.s.tag) fprintf(f, " %s", t->u.s.tag);
-            break;
-        case TYPE_UNION: fprintf(f, "union");
-            if (t->u.s.tag) fprintf(f, " %s", t->u.s.tag);
-            break;
-        case TYPE_ENUM: fprintf(f, "enum");
-            if (t->u.e) {
-                fprintf(f, " { ");
-                EnumValue *cur = t->u.e;
-                while (cur) {
-                    fprintf(f, "%s = %lld", cur->name, cur->value);
-                    cur = cur->next;
-                    if (cur) fprintf(f, ", ");
+        case TYPE_BUILTIN: emit(f, "%s", flat_str(fa, t->name)); break;
+        case TYPE_STRUCT:
+        case TYPE_UNION:
+            emit(f, t->kind == TYPE_STRUCT ? "struct" : "union");
+            if (t->name != FLAT_NONE) emit(f, " %s", flat_str(fa, t->name));
+            if (t->count) {
+                emit(f, " {\n");
+                const FlatMember *m = &fa->members[t->base];
+                for (int32_t i = 0; i < t->count; ++i, ++m) {
+                    emit_indent(f, indent + 1);
+                    emit_decl(f, fa, m->type, flat_str(fa, m->name), indent + 1);
+                    if (m->bits) emit(f, " : %d", m->bits);
+                    emit(f, ";\n");
                 }
-                fprintf(f, " }");
+                emit_indent(f, indent);
+                emit(f, "}");
             }
             break;
-        case TYPE_ALIAS: fprintf(f, "%s", t->u.alias_to); break;
-        default: fprintf(f, "<unknown>"); break;
+        case TYPE_ENUM:
+            emit(f, "enum");
+            if (t->name != FLAT_NONE) emit(f, " %s", flat_str(fa, t->name));
+            if (t->count) emit_enum_body(f, fa, t);
+            break;
+        case TYPE_ALIAS: emit(f, "%s", flat_str(fa, t->name)); break;
+        default: emit(f, "<unknown>"); break;
     }
 }
 
-static void print_members_to_file(FILE *f, const Member *m, int indent) {
-    const Member *cur = m;
-    while (cur) {
-        for (int i = 0; i < indent; ++i) fprintf(f, " ");
-        if (cur->type->kind == TYPE_ARRAY) {
-            print_type_to_file(f, cur->type->u.array.base, 0);
-            fprintf(f, " %s[%d];\n", cur->name ? cur->name : "(anon)", cur->type->u.array.length);
+/* The declarator is built inside-out from the name. */
+void emit_decl(Emitter *f, const FlatAST *fa, FlatRef t, const char *name, int indent) {
+    char *d = strdup(name ? name : "");
+    int after_ptr = 0;
+    while (t != FLAT_NONE && (fa->types[t].kind == TYPE_POINTER || fa->types[t].kind == TYPE_ARRAY || fa->types[t].kind == TYPE_FUNCTION)) {
+        const FlatType *ft = &fa->types[t];
+        if (ft->kind == TYPE_POINTER) {
+            if (ft->quals) { /* int *const p */
+                if (d[0]) d = str_wrap(" ", d, "");
+                d = str_wrap(quals_spelling(ft->quals), d, "");
+            }
+            d = str_wrap("*", d, "");
+            after_ptr = 1;
+            t = ft->base;
+            continue;
+        }
+        if (after_ptr) d = str_wrap("(", d, ")");
+        after_ptr = 0;
+        if (ft->kind == TYPE_ARRAY) {
+            char len[24] = "";
+            if (ft->count > 0) snprintf(len, sizeof(len), "%d", (int)ft->count);
+            d = str_wrap("", d, "[");
+            d = str_wrap("", d, ft->name != FLAT_NONE ? flat_str(fa, ft->name) : len);
+            d = str_wrap("", d, "]");
         } else {
-            print_type_to_file(f, cur->type, 0);
-            fprintf(f, " %s;\n", cur->name ? cur->name : "(anon)");
+            d = str_wrap("", d, "()");
         }
-        cur = cur->next;
+        t = ft->base;
+    }
+    emit_specifier(f, fa, t, indent);
+    if (d[0]) emit(f, " %s", d);
+    free(d);
+}
+
+static void emit_node(Emitter *out, const FlatAST *fa, const FlatDecl *n) {
+    const char *name = flat_str(fa, n->name);
+    if (n->is_typedef) {
+        emit(out, "typedef ");
+        emit_decl(out, fa, n->type, name, 0);
+        emit(out, ";\n");
+        return;
+    }
+    const FlatType *t = &fa->types[n->type];
+    if (t->kind == TYPE_STRUCT || t->kind == TYPE_UNION) {
+        if (t->name != FLAT_NONE || !name) {
+            emit_specifier(out, fa, n->type, 0);
+            emit(out, ";\n");
+            if (name) emit(out, "%s %s %s;\n", t->kind == TYPE_STRUCT ? "struct" : "union", flat_str(fa, t->name), name);
+        } else {
+            emit_decl(out, fa, n->type, name, 0);
+            emit(out, ";\n");
+        }
+    } else if (t->kind == TYPE_ENUM) {
+        emit_decl(out, fa, n->type, name, 0);
+        emit(out, ";\n");
+    }
+}
+
+struct Generator {
+    Emitter emitter;
+    const Options *opts;
+    const char *path; /* NULL for stdout */
+    char *tmp_path;   /* streaming output being written next to path */
+    TypeScope *scope; /* declarations written so far, for companion code */
+    const FlatAST *flat; /* the AST being generated */
+    FlatAST *stream;     /* owned copy of the declarations from generator_emit */
+    CodegenMatches *matches; /* requested record names seen so far */
+    int own_matches;     /* reported by generator_close */
+};
+
+/* ---- write-if-changed ---- */
+
+#define HASH_SEED 1469598103934665603ull
+
+static uint64_t hash_bytes(uint64_t h, const char *p, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        h ^= (unsigned char)p[i];
+        h *= 1099511628211ull;
     }
+    return h;
 }
 
-static void print_declaration_to_file(FILE *f, const Type *t, const char *name) {
-    if (!t) { fprintf(f, "<null>"); return; }
-    if (t->kind == TYPE_FUNCTION) {
-        // For function typedefs: return_type (*name)(params)
-        print_type_to_file(f, t->u.func.ret, 0);
-        fprintf(f, " (*%s)(", name ? name : "(anon)");
-        // TODO: print params
-        fprintf(f, ")");
-    } else if (t->kind == TYPE_ARRAY) {
-        print_declaration_to_file(f, t->u.array.base, name);
-        fprintf(f, "[%d]", t->u.array.length);
+/* Hashes the file at path as read back in text mode (the mode outputs are
+ * written in). Returns 0 when it is missing or its length is not size, so
+ * it cannot match. */
+static int hash_file(const char *path, size_t size, uint64_t *hash) {
+    FILE *f = fopen(path, "r");
+    if (!f) return 0;
+    char chunk[65536];
+    uint64_t h = HASH_SEED;
+    size_t got, total = 0;
+    while (total <= size && (got = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+        h = hash_bytes(h, chunk, got);
+        total += got;
+    }
+    fclose(f);
+    *hash = h;
+    return total == size;
+}
+
+static int replace_file(const char *from, const char *to) {
+#ifdef _WIN32
+    return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) ? 0 : -1;
+#else
+    return rename(from, to);
+#endif
+}
+
+/* "<path>.<pid>.<n>.tmp": unique per process and per call, so runs or
+ * manifest jobs writing the same output never share a temporary file. */
+static char *temp_path(const char *path) {
+    static atomic_uint counter;
+    unsigned n = atomic_fetch_add_explicit(&counter, 1, memory_order_relaxed);
+    size_t len = strlen(path) + 32;
+    char *tmp = (char*)ds_malloc(len);
+    snprintf(tmp, len, "%s.%lu.%u.tmp", path, (unsigned long)getpid(), n);
+    return tmp;
+}
+
+/* Outputs other than stdout and the console are compared with what is
+ * already on disk and only replaced when they differ, so unchanged headers
+ * keep their timestamp and do not trigger rebuilds. */
+static int write_if_changed(const char *path) {
+    return path && strcmp(path, "CON") != 0;
+}
+
+/* Replaces path with the buffered output unless it already holds the same
+ * bytes. Returns 1 if the file changed, 0 if not, -1 on error. */
+static int commit_buffer(const char *path, const char *data, size_t len) {
+    uint64_t old;
+    if (hash_file(path, len, &old) && old == hash_bytes(HASH_SEED, data, len)) return 0;
+    char *tmp = temp_path(path);
+    FILE *f = fopen(tmp, "w");
+    int ok = f && fwrite(data, 1, len, f) == len;
+    if (f && fclose(f) != 0) ok = 0;
+    if (ok && replace_file(tmp, path) != 0) ok = 0;
+    if (!ok) {
+        fprintf(stderr, "Failed to write output file: %s\n", path);
+        remove(tmp);
+    }
+    free(tmp);
+    return ok ? 1 : -1;
+}
+
+/* Same for streaming output already written to tmp. */
+static int commit_temp(const char *tmp, const char *path, size_t len) {
+    uint64_t old, now;
+    if (hash_file(path, len, &old) && hash_file(tmp, len, &now) && old == now) {
+        remove(tmp);
+        return 0;
+    }
+    if (replace_file(tmp, path) != 0) {
+        fprintf(stderr, "Failed to write output file: %s\n", path);
+        remove(tmp);
+        return -1;
+    }
+    return 1;
+}
+
+/* Output to a file is buffered in memory, or written to a temporary file
+ * next to it when streaming (to keep memory bounded), and committed by
+ * generator_close. */
+static Generator *generator_open_path(const Options *opts, const char *path) {
+    Generator *g = (Generator*)calloc(1, sizeof(Generator));
+    g->opts = opts;
+    g->path = path;
+    if (!write_if_changed(path)) {
+        g->emitter.f = path ? fopen(path, "w") : stdout;
+    } else if (opts->streaming) {
+        g->tmp_path = temp_path(path);
+        g->emitter.f = fopen(g->tmp_path, "w");
+    }
+    if (!g->emitter.f && (!write_if_changed(path) || g->tmp_path)) {
+        fprintf(stderr, "Failed to open output file: %s\n", g->tmp_path ? g->tmp_path : path);
+        free(g->tmp_path);
+        free(g);
+        return NULL;
+    }
+    g->emitter.literals = opts->enable_suffixes;
+    g->matches = codegen_matches_create(opts);
+    g->own_matches = 1;
+    codegen_prologue(&g->emitter, opts);
+    return g;
+}
+
+/* Declarations written by g come from flat. */
+static void generator_attach(Generator *g, const FlatAST *flat) {
+    g->flat = flat;
+    g->scope = scope_create(flat);
+}
+
+Generator *generator_open(const Options *opts) {
+    return generator_open_path(opts, opts->output_file);
+}
+
+Generator *generator_open_sink(const Options *opts, GenWriteFn write, void *user) {
+    Generator *g = (Generator*)calloc(1, sizeof(Generator));
+    g->emitter.write = write;
+    g->emitter.user = user;
+    g->opts = opts;
+    g->emitter.literals = opts->enable_suffixes;
+    g->matches = codegen_matches_create(opts);
+    g->own_matches = 1;
+    codegen_prologue(&g->emitter, opts);
+    return g;
+}
+
+/* The index-th declaration of g->flat. */
+static void generator_emit_flat(Generator *g, size_t index) {
+    const FlatDecl *n = &g->flat->decls[index];
+    if (g->scope) scope_add(g->scope, n);
+    codegen_matches_add(g->matches, g->scope, g->flat, n);
+    emit_node(&g->emitter, g->flat, n);
+    codegen_emit(&g->emitter, g->scope, g->flat, n, g->opts);
+}
+
+/* Streamed declarations arrive one at a time and are copied into a flat
+ * AST of the generator's own, so the caller may free n right away. Plain
+ * declarations only need their own copy, whose storage is reused from one
+ * to the next; companion code resolves names through everything written
+ * before, so with a companion generator on the copies are kept. */
+void generator_emit(Generator *g, const ASTNode *n) {
+    if (!g->stream) {
+        g->stream = flat_create();
+        g->flat = g->stream;
+        if (codegen_enabled(g->opts)) g->scope = scope_create(g->stream);
+    }
+    if (g->scope) flat_forget_types(g->stream);
+    else flat_clear(g->stream);
+    generator_emit_flat(g, flat_add(g->stream, n));
+}
+
+/* ---- companion code ---- */
+
+int codegen_enabled(const Options *opts) {
+    return opts->hash_functions || opts->pool_type_count || opts->enum_strings || opts->reflect_tables
+        || opts->handle_type_count || opts->map_spec_count || opts->sort_spec_count
+        || opts->output_lang == OUTPUT_CPP;
+}
+
+void codegen_prologue(Emitter *out, const Options *opts) {
+    gen_hash_prologue(out, opts);
+    gen_pool_prologue(out, opts);
+    gen_enum_prologue(out, opts);
+    gen_reflect_prologue(out, opts);
+    gen_handle_prologue(out, opts);
+    gen_map_prologue(out, opts);
+    gen_sort_prologue(out, opts);
+    gen_cpp_prologue(out, opts);
+}
+
+void codegen_emit(Emitter *out, const TypeScope *scope, const FlatAST *fa, const FlatDecl *n, const Options *opts) {
+    gen_hash_emit(out, scope, fa, n, opts);
+    gen_pool_emit(out, scope, fa, n, opts);
+    gen_enum_emit(out, scope, fa, n, opts);
+    gen_reflect_emit(out, scope, fa, n, opts);
+    gen_handle_emit(out, scope, fa, n, opts);
+    gen_map_emit(out, scope, fa, n, opts);
+    gen_sort_emit(out, scope, fa, n, opts);
+    gen_cpp_emit(out, scope, fa, n, opts);
+}
+
+int codegen_record(const FlatAST *fa, const FlatDecl *n, RecordName *out) {
+    const FlatType *t = &fa->types[n->type];
+    if ((t->kind != TYPE_STRUCT && t->kind != TYPE_UNION) || !t->count) return 0;
+    const char *name = flat_str(fa, n->name);
+    out->type = t;
+    out->tag = flat_str(fa, t->name);
+    if (n->is_typedef && name) {
+        snprintf(out->spelled, sizeof(out->spelled), "%s", name);
+        out->prefix = name;
+    } else if (out->tag) {
+        snprintf(out->spelled, sizeof(out->spelled), "%s %s", t->kind == TYPE_UNION ? "union" : "struct", out->tag);
+        out->prefix = out->tag;
     } else {
-        print_type_to_file(f, t, 0);
-        fprintf(f, " %s", name ? name : "(anon)");
+        return 0;
     }
+    return 1;
 }
 
-int generate_for_targets(const ASTRoot *ast, const Options *opts) {
-    if (!ast) return 1;
-    FILE *out = opts->output_file ? fopen(opts->output_file, "w") : stdout;
-    if (!out) {
-        fprintf(stderr, "Failed to open output file: %s\n", opts->output_file);
-        return 1;
+/* ---- requested record names ---- */
+
+/* Why a T:key spec cannot be generated for a record, or NULL. */
+typedef const char *(*KeyCheck)(const TypeScope *scope, const FlatAST *fa, const RecordName *rec, const char *key);
+
+typedef struct {
+    const char *flag;
+    const char *spec; /* as given */
+    size_t len;       /* of the record name at its start */
+    int any_record;   /* unions qualify as well */
+    KeyCheck check;   /* for T:key specs */
+    int state;        /* MATCH_* */
+    const char *why;  /* MATCH_BAD_KEY */
+} WantedName;
+
+enum { MATCH_NONE, MATCH_NOT_STRUCT, MATCH_BAD_KEY, MATCH_RECORD };
+
+struct CodegenMatches {
+    WantedName *names;
+    int count, cap;
+};
+
+static void want_names(CodegenMatches *m, const char *flag, const char **specs, int count, int any_record, KeyCheck check) {
+    for (int i = 0; i < count; ++i) {
+        if (strcmp(specs[i], "*") == 0) continue;
+        if (m->count == m->cap) {
+            m->cap = m->cap ? m->cap * 2 : 8;
+            m->names = (WantedName*)ds_realloc(m->names, (size_t)m->cap * sizeof(WantedName));
+        }
+        WantedName *w = &m->names[m->count++];
+        const char *colon = strchr(specs[i], ':');
+        w->flag = flag;
+        w->spec = specs[i];
+        w->len = colon ? (size_t)(colon - specs[i]) : strlen(specs[i]);
+        w->any_record = any_record;
+        w->check = check;
+        w->state = MATCH_NONE;
+        w->why = NULL;
     }
-    for (ASTNode *n = ast->first; n; n = n->next) {
-        if (n->is_typedef || n->type->kind == TYPE_STRUCT || n->type->kind == TYPE_UNION || n->type->kind == TYPE_ENUM) {
-            if (n->type->kind == TYPE_STRUCT) {
-                fprintf(out, "struct");
-                if (n->type->u.s.tag) fprintf(out, " %s", n->type->u.s.tag);
-                if (!n->type->u.s.is_forward) {
-                    fprintf(out, " {\n");
-                    print_members_to_file(out, n->type->u.s.members, 1);
-                    fprintf(out, "}");
-                }
-                fprintf(out, ";\n");
-                if (!n->is_typedef && n->name) {
-                    fprintf(out, "struct");
-                    if (n->type->u.s.tag) fprintf(out, " %s", n->type->u.s.tag);
-                    fprintf(out, " %s;\n", n->name);
-                }
-            } else if (n->type->kind == TYPE_UNION) {
-                fprintf(out, "union");
-                if (n->type->u.s.tag) fprintf(out, " %s", n->type->u.s.tag);
-                if (!n->type->u.s.is_forward) {
-                    fprintf(out, " {\n");
-                    print_members_to_file(out, n->type->u.s.members, 1);
-                    fprintf(out, "}");
-                }
-                fprintf(out, ";\n");
-                if (!n->is_typedef && n->name) {
-                    fprintf(out, "union");
-                    if (n->type->u.s.tag) fprintf(out, " %s", n->type->u.s.tag);
-                    fprintf(out, " %s;\n", n->name);
-                }
-            } else if (n->type->kind == TYPE_ENUM) {
-                fprintf(out, "enum");
-                if (n->type->u.e) {
-                    fprintf(out, " { ");
-                    EnumValue *cur = n->type->u.e;
-                    while (cur) {
-                        fprintf(out, "%s = %lld", cur->name, cur->value);
-                        cur = cur->next;
-                        if (cur) fprintf(out, ", ");
-                    }
-                    fprintf(out, " }");
-                }
-                if (n->is_typedef) {
-                    fprintf(out, " %s", n->name ? n->name : "(anon)");
-                }
-                fprintf(out, ";\n");
-            } else {
-                if (n->is_typedef) {
-                    fprintf(out, "typedef ");
-                }
-                print_declaration_to_file(out, n->type, n->name);
-                fprintf(out, ";\n");
+}
+
+CodegenMatches *codegen_matches_create(const Options *opts) {
+    CodegenMatches *m = (CodegenMatches*)ds_calloc(1, sizeof(CodegenMatches));
+    want_names(m, "-pool", opts->pool_types, opts->pool_type_count, 1, NULL);
+    want_names(m, "-handles", opts->handle_types, opts->handle_type_count, 0, NULL);
+    want_names(m, "-hashmap", opts->map_specs, opts->map_spec_count, 0, gen_map_check);
+    want_names(m, "-sort", opts->sort_specs, opts->sort_spec_count, 0, gen_sort_check);
+    if (m->count) return m;
+    codegen_matches_destroy(m);
+    return NULL;
+}
+
+void codegen_matches_destroy(CodegenMatches *m) {
+    if (!m) return;
+    free(m->names);
+    free(m);
+}
+
+void codegen_matches_add(CodegenMatches *m, const TypeScope *scope, const FlatAST *fa, const FlatDecl *n) {
+    RecordName rec;
+    if (!m || !codegen_record(fa, n, &rec)) return;
+    const char *names[3] = { rec.prefix, rec.spelled, rec.tag };
+    for (int i = 0; i < m->count; ++i) {
+        WantedName *w = &m->names[i];
+        if (w->state == MATCH_RECORD) continue;
+        for (int k = 0; k < 3; ++k) {
+            if (!names[k] || strlen(names[k]) != w->len || strncmp(names[k], w->spec, w->len) != 0) continue;
+            int state = MATCH_RECORD;
+            if (!w->any_record && rec.type->kind != TYPE_STRUCT) state = MATCH_NOT_STRUCT;
+            else if (w->check && (w->why = w->check(scope, fa, &rec, w->spec + w->len + 1)) != NULL) state = MATCH_BAD_KEY;
+            if (state > w->state) w->state = state;
+            break;
+        }
+    }
+}
+
+int codegen_matches_report(const CodegenMatches *m) {
+    int missing = 0;
+    for (int i = 0; m && i < m->count; ++i) {
+        const WantedName *w = &m->names[i];
+        if (w->state == MATCH_RECORD) continue;
+        if (w->state == MATCH_BAD_KEY) {
+            fprintf(stderr, "%s %s: %s.\n", w->flag, w->spec, w->why);
+        } else if (w->state == MATCH_NOT_STRUCT) {
+            fprintf(stderr, "%s %s: %.*s is a union, not a struct.\n", w->flag, w->spec, (int)w->len, w->spec);
+        } else {
+            fprintf(stderr, "%s %s: no %s %.*s in the output.\n", w->flag, w->spec,
+                    w->any_record ? "struct or union" : "struct", (int)w->len, w->spec);
+        }
+        missing++;
+    }
+    return missing;
+}
+
+int generator_close(Generator *g, Report *report) {
+    if (!g) return 1;
+    int changed = -1; /* unknown for stdout, the console and callbacks */
+    int rc = 0;
+    if (g->emitter.f == stdout) {
+        fflush(stdout);
+    } else if (g->tmp_path) {
+        if (fclose(g->emitter.f) != 0) {
+            fprintf(stderr, "Failed to write output file: %s\n", g->tmp_path);
+            remove(g->tmp_path);
+            rc = 1;
+        } else if ((changed = commit_temp(g->tmp_path, g->path, g->emitter.bytes)) < 0) {
+            rc = 1;
+        }
+        free(g->tmp_path);
+    } else if (g->emitter.f) {
+        fclose(g->emitter.f);
+    } else if (!g->emitter.write) {
+        if ((changed = commit_buffer(g->path, g->emitter.buf, g->emitter.len)) < 0) rc = 1;
+        free(g->emitter.buf);
+    }
+    if (changed == 0 && !g->opts->silent) printf("DSConv: %s unchanged\n", g->path);
+    report_add_output(report, g->opts->targets, g->path, g->emitter.bytes, changed);
+    if (g->own_matches) {
+        if (codegen_matches_report(g->matches)) rc = 1;
+        codegen_matches_destroy(g->matches);
+    }
+    scope_destroy(g->scope);
+    flat_destroy(g->stream);
+    free(g);
+    return rc;
+}
+
+static void emit_forward(Emitter *out, const FlatAST *fa, FlatRef record) {
+    const FlatType *t = &fa->types[record];
+    emit(out, "%s %s;\n", t->kind == TYPE_UNION ? "union" : "struct", flat_str(fa, t->name));
+}
+
+/* With -fwd every struct/union defined in the output is forward-declared
+ * up front, so the definitions below may refer to each other freely. */
+static void emit_forward_block(Emitter *out, const EmitPlan *plan, const FlatAST *fa) {
+    for (size_t i = 0; i < plan->count; ++i) {
+        if (plan->items[i].forward != FLAT_NONE) continue;
+        FlatRef rec = depgraph_flat_record(fa, fa->decls[plan->items[i].index].type);
+        if (rec != FLAT_NONE) emit_forward(out, fa, rec);
+    }
+    emit(out, "\n");
+}
+
+/* ---- parallel rendering ----
+ * Long declaration lists are cut into contiguous chunks that worker threads
+ * render into memory buffers, which are then written out in chunk order.
+ * The scope is filled for all declarations first; each worker resolves
+ * names through a view limited to the declarations before the one it is
+ * rendering, so the output is byte for byte the serial one. */
+
+#define GEN_MIN_PARALLEL 4096 /* declarations */
+#define GEN_CHUNKS_PER_WORKER 4
+
+typedef struct {
+    const PlanItem *items;
+    size_t count;
+    size_t chunks;
+    size_t *before;  /* declarations added to the scope before chunk k */
+    Emitter *out;    /* one per chunk */
+    const Generator *g;
+    int skip_forward;
+} RenderJob;
+
+static size_t chunk_begin(const RenderJob *job, size_t k) {
+    return job->count * k / job->chunks;
+}
+
+static void render_chunk(void *arg, int index) {
+    RenderJob *job = (RenderJob*)arg;
+    size_t k = (size_t)index;
+    Emitter *out = &job->out[k];
+    out->literals = job->g->emitter.literals;
+    TypeScope *view = scope_view(job->g->scope);
+    size_t seen = job->before[k];
+    for (size_t i = chunk_begin(job, k); i < chunk_begin(job, k + 1); ++i) {
+        const PlanItem *it = &job->items[i];
+        const FlatAST *fa = job->g->flat;
+        if (it->forward == FLAT_NONE) {
+            scope_view_limit(view, ++seen);
+            emit_node(out, fa, &fa->decls[it->index]);
+            codegen_emit(out, view, fa, &fa->decls[it->index], job->g->opts);
+        } else if (!job->skip_forward) {
+            emit_forward(out, fa, it->forward);
+        }
+    }
+    scope_destroy(view);
+}
+
+/* Writes items in order: declarations with their companion code, and
+ * forward declarations unless skip_forward is set. */
+static void generate_items(Generator *g, const PlanItem *items, size_t count, int skip_forward) {
+    const Options *opts = g->opts;
+    int workers = opts->jobs > 0 ? opts->jobs : cpu_count();
+    if (opts->jobs == 1 || workers < 2 || count < GEN_MIN_PARALLEL) {
+        for (size_t i = 0; i < count; ++i) {
+            if (items[i].forward == FLAT_NONE) generator_emit_flat(g, items[i].index);
+            else if (!skip_forward) emit_forward(&g->emitter, g->flat, items[i].forward);
+        }
+        return;
+    }
+    RenderJob job;
+    job.items = items;
+    job.count = count;
+    job.chunks = (size_t)workers * GEN_CHUNKS_PER_WORKER;
+    job.before = (size_t*)ds_malloc((job.chunks + 1) * sizeof(size_t));
+    job.out = (Emitter*)ds_calloc(job.chunks, sizeof(Emitter));
+    job.g = g;
+    job.skip_forward = skip_forward;
+    size_t declared = scope_declarations(g->scope);
+    for (size_t k = 0; k < job.chunks; ++k) {
+        job.before[k] = declared;
+        for (size_t i = chunk_begin(&job, k); i < chunk_begin(&job, k + 1); ++i) {
+            if (items[i].forward == FLAT_NONE) {
+                const FlatDecl *n = &g->flat->decls[items[i].index];
+                scope_add(g->scope, n);
+                codegen_matches_add(g->matches, g->scope, g->flat, n);
+                declared++;
             }
         }
     }
-    if (out != stdout) fclose(out);
-    return 0;
+    DS_TRACE("generate: %zu declarations in %zu chunks on %d workers\n", count, job.chunks, workers);
+    parallel_for((int)job.chunks, workers, render_chunk, &job);
+    for (size_t k = 0; k < job.chunks; ++k) {
+        emit_bytes(&g->emitter, job.out[k].buf, job.out[k].len);
+        free(job.out[k].buf);
+    }
+    free(job.out);
+    free(job.before);
+}
+
+/* "dir/out.h" -> "dir/out_<suffix>.h" (malloc'd). */
+static char *shard_path(const char *base, const char *suffix) {
+    const char *slash = strrchr(base, '/');
+    const char *bslash = strrchr(base, '\\');
+    if (bslash > slash) slash = bslash;
+    const char *dot = strrchr(base, '.');
+    size_t stem = (dot && (!slash || dot > slash)) ? (size_t)(dot - base) : strlen(base);
+    size_t n = strlen(base) + strlen(suffix) + 2;
+    char *p = (char*)malloc(n);
+    snprintf(p, n, "%.*s_%s%s", (int)stem, base, suffix, base + stem);
+    return p;
+}
+
+static const char *path_basename(const char *path) {
+    const char *slash = strrchr(path, '/');
+    const char *bslash = strrchr(path, '\\');
+    if (bslash > slash) slash = bslash;
+    return slash ? slash + 1 : path;
+}
+
+/* Rough output size of a declaration, used to balance shards. */
+static size_t type_weight(const FlatAST *fa, FlatRef t) {
+    size_t w = 1;
+    while (t != FLAT_NONE && (fa->types[t].kind == TYPE_POINTER || fa->types[t].kind == TYPE_ARRAY || fa->types[t].kind == TYPE_FUNCTION)) {
+        t = fa->types[t].base;
+    }
+    if (t == FLAT_NONE) return w;
+    const FlatType *ft = &fa->types[t];
+    if (ft->kind == TYPE_STRUCT || ft->kind == TYPE_UNION) {
+        for (int32_t i = 0; i < ft->count; ++i) w += type_weight(fa, fa->members[ft->base + (FlatRef)i].type);
+    } else if (ft->kind == TYPE_ENUM) {
+        w += (size_t)ft->count;
+    }
+    return w;
+}
+
+typedef struct {
+    size_t group;
+    size_t weight;
+} GroupWeight;
+
+/* Heaviest first; ties keep source order. */
+static int group_weight_cmp(const void *a, const void *b) {
+    const GroupWeight *x = (const GroupWeight*)a, *y = (const GroupWeight*)b;
+    if (x->weight != y->weight) return x->weight < y->weight ? 1 : -1;
+    return x->group < y->group ? -1 : (x->group > y->group);
+}
+
+/* Shards note the names they match in one set for the whole run. */
+static void share_matches(Generator *g, CodegenMatches *shared) {
+    if (g->own_matches) codegen_matches_destroy(g->matches);
+    g->matches = shared;
+    g->own_matches = 0;
+}
+
+/* -shards n: declarations are split into groups that do not refer to each
+ * other (dependency components), and the groups are spread over n files so
+ * each holds about the same amount of code. Every shard includes a shared
+ * header of struct/union forward declarations; the output file itself
+ * becomes an umbrella header that includes the rest. */
+static int generate_sharded(const FlatAST *flat, const Options *opts, Report *report) {
+    if (!opts->output_file) {
+        fprintf(stderr, "-shards needs an output file (-o).\n");
+        return 1;
+    }
+    size_t count = flat->decl_count, i;
+    unsigned char *selected = (unsigned char*)malloc(count + 1);
+    size_t *component = (size_t*)malloc((count + 1) * sizeof(size_t));
+    if (opts->root_count > 0) depgraph_select(flat, opts->roots, opts->root_count, selected);
+    else memset(selected, 1, count + 1);
+    size_t groups = depgraph_components(flat, component);
+
+    /* largest group first onto the lightest shard */
+    size_t *weight = (size_t*)calloc(groups + 1, sizeof(size_t));
+    GroupWeight *order = (GroupWeight*)malloc((groups + 1) * sizeof(GroupWeight));
+    for (i = 0; i < count; ++i) {
+        if (selected[i]) weight[component[i]] += type_weight(flat, flat->decls[i].type);
+    }
+    size_t used = 0;
+    for (size_t c = 0; c < groups; ++c) {
+        if (weight[c]) { order[used].group = c; order[used].weight = weight[c]; used++; }
+    }
+    qsort(order, used, sizeof(GroupWeight), group_weight_cmp);
+    int shards = opts->shards < (int)used ? opts->shards : (int)used;
+    if (shards < 1) shards = 1;
+    size_t *load = (size_t*)calloc((size_t)shards, sizeof(size_t));
+    int *shard_of = (int*)malloc((groups + 1) * sizeof(int));
+    for (size_t a = 0; a < used; ++a) {
+        int best = 0;
+        for (int k = 1; k < shards; ++k) {
+            if (load[k] < load[best]) best = k;
+        }
+        shard_of[order[a].group] = best;
+        load[best] += order[a].weight;
+    }
+
+    int rc = 0;
+    CodegenMatches *matches = codegen_matches_create(opts);
+    char *fwd_path = shard_path(opts->output_file, "fwd");
+    Generator *fwd = generator_open_path(opts, fwd_path);
+    if (!fwd) rc = 1;
+    else share_matches(fwd, NULL);
+    for (i = 0; fwd && i < count; ++i) {
+        FlatRef rec = selected[i] ? depgraph_flat_record(flat, flat->decls[i].type) : FLAT_NONE;
+        if (rec != FLAT_NONE) emit_forward(&fwd->emitter, flat, rec);
+    }
+    if (fwd && generator_close(fwd, report)) rc = 1;
+
+    unsigned char *in_shard = (unsigned char*)malloc(count + 1);
+    char **paths = (char**)calloc((size_t)shards, sizeof(char*));
+    for (int k = 0; k < shards && rc == 0; ++k) {
+        char suffix[16];
+        snprintf(suffix, sizeof(suffix), "%d", k + 1);
+        paths[k] = shard_path(opts->output_file, suffix);
+        for (i = 0; i < count; ++i) in_shard[i] = selected[i] && weight[component[i]] && shard_of[component[i]] == k;
+        EmitPlan plan;
+        depgraph_plan_set(flat, in_shard, &plan);
+        Generator *g = generator_open_path(opts, paths[k]);
+        if (!g) { rc = 1; emit_plan_free(&plan); break; }
+        generator_attach(g, flat);
+        share_matches(g, matches);
+        emit(&g->emitter, "#include \"%s\"\n\n", path_basename(fwd_path));
+        generate_items(g, plan.items, plan.count, 1);
+        emit_plan_free(&plan);
+        if (generator_close(g, report)) rc = 1;
+    }
+
+    Generator *umbrella = rc == 0 ? generator_open(opts) : NULL;
+    if (umbrella) {
+        share_matches(umbrella, NULL);
+        emit(&umbrella->emitter, "#include \"%s\"\n", path_basename(fwd_path));
+        for (int k = 0; k < shards; ++k) emit(&umbrella->emitter, "#include \"%s\"\n", path_basename(paths[k]));
+        if (generator_close(umbrella, report)) rc = 1;
+    } else {
+        rc = 1;
+    }
+    if (codegen_matches_report(matches)) rc = 1;
+    codegen_matches_destroy(matches);
+
+    for (int k = 0; k < shards; ++k) free(paths[k]);
+    free(paths);
+    free(in_shard);
+    free(fwd_path);
+    free(shard_of);
+    free(load);
+    free(order);
+    free(weight);
+    free(component);
+    free(selected);
+    return rc;
+}
+
+/* Writes the whole AST (or what -root selects) to an open generator. */
+static void generate_all(Generator *g, const FlatAST *flat, const Options *opts) {
+    EmitPlan plan;
+    generator_attach(g, flat);
+    if (opts->root_count > 0) {
+        depgraph_plan(flat, opts->roots, opts->root_count, &plan);
+    } else {
+        /* every declaration in source order */
+        memset(&plan, 0, sizeof(plan));
+        plan.cap = flat->decl_count;
+        plan.items = (PlanItem*)ds_malloc((plan.cap + 1) * sizeof(PlanItem));
+        for (; plan.count < flat->decl_count; plan.count++) {
+            plan.items[plan.count].index = plan.count;
+            plan.items[plan.count].forward = FLAT_NONE;
+        }
+    }
+    if (opts->forward_declarations) emit_forward_block(&g->emitter, &plan, flat);
+    generate_items(g, plan.items, plan.count, opts->forward_declarations);
+    emit_plan_free(&plan);
+}
+
+FlatAST *generate_prepare(const ASTRoot *ast, Report *report) {
+    if (!ast) return NULL;
+    FlatAST *flat = flat_build(ast);
+    if (report) report->flat = flat->stats;
+    return flat;
 }
 
+int generate_for_targets(const FlatAST *flat, const Options *opts, Report *report) {
+    if (!flat) return 1;
+    if (opts->shards > 1) return generate_sharded(flat, opts, report);
+    Generator *g = generator_open(opts);
+    if (g) generate_all(g, flat, opts);
+    return g ? generator_close(g, report) : 1;
+}
+
+/* Manifest jobs only read the flat AST; each records its outputs in a
+ * report of its own, merged in job order afterwards. */
+typedef struct {
+    const FlatAST *flat;
+    const Options *jobs;
+    Report **reports;
+    int *rc;
+} JobRun;
+
+static void run_job(void *arg, int index) {
+    JobRun *run = (JobRun*)arg;
+    run->rc[index] = generate_for_targets(run->flat, &run->jobs[index], run->reports ? run->reports[index] : NULL);
+}
+
+int generate_jobs(const FlatAST *flat, const Options *jobs, int count, int workers, Report *report) {
+    if (!flat) return count;
+    JobRun run;
+    run.flat = flat;
+    run.jobs = jobs;
+    run.reports = NULL;
+    run.rc = (int*)ds_calloc((size_t)count + 1, sizeof(int));
+    if (report) {
+        run.reports = (Report**)ds_calloc((size_t)count + 1, sizeof(Report*));
+        for (int i = 0; i < count; ++i) run.reports[i] = report_create();
+    }
+    if (workers <= 0) workers = cpu_count();
+    DS_TRACE("generate: %d jobs on %d workers\n", count, workers);
+    parallel_for(count, workers, run_job, &run);
+    int failed = 0;
+    for (int i = 0; i < count; ++i) {
+        if (run.rc[i]) failed++;
+        if (run.reports) {
+            report_take_outputs(report, run.reports[i]);
+            report_destroy(run.reports[i]);
+        }
+    }
+    free(run.reports);
+    free(run.rc);
+    return failed;
+}
+
+int generate_to_sink(const FlatAST *flat, const Options *opts, GenWriteFn write, void *user, Report *report) {
+    if (!flat) return 1;
+    Generator *g = generator_open_sink(opts, write, user);
+    generate_all(g, flat, opts);
+    return generator_close(g, report);
+}
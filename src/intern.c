@@ -0,0 +1,339 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "intern.h"
+#include "depgraph.h"
+#include "memstat.h"
+
+/* FNV-1a over the fields that make a node distinct. Children are already
+ * canonical, so they are hashed by address. */
+#define FNV_OFFSET 1469598103934665603ull
+#define FNV_PRIME 1099511628211ull
+
+static uint64_t hash_bytes(uint64_t h, const void *p, size_t n) {
+    const unsigned char *b = (const unsigned char*)p;
+    for (size_t i = 0; i < n; ++i) {
+        h ^= b[i];
+        h *= FNV_PRIME;
+    }
+    return h;
+}
+
+static uint64_t hash_str(uint64_t h, const char *s) {
+    if (!s) return hash_bytes(h, "\xff", 1);
+    return hash_bytes(h, s, strlen(s) + 1);
+}
+
+/* Word-at-a-time step for addresses and integers. */
+static uint64_t hash_word(uint64_t h, uint64_t v) {
+    h = (h ^ v) * FNV_PRIME;
+    return h ^ (h >> 29);
+}
+
+static uint64_t hash_ptr(uint64_t h, const void *p) {
+    return hash_word(h, (uint64_t)(uintptr_t)p);
+}
+
+static uint64_t type_hash(const Type *t) {
+    uint64_t h = hash_word(FNV_OFFSET, (uint64_t)t->kind);
+    h = hash_word(h, (uint64_t)t->quals);
+    switch (t->kind) {
+        case TYPE_BUILTIN: h = hash_str(h, t->u.builtin_name); break;
+        case TYPE_POINTER: h = hash_ptr(h, t->u.ptr.base); break;
+        case TYPE_ARRAY:
+            h = hash_ptr(h, t->u.array.base);
+            h = hash_word(h, (uint64_t)t->u.array.length);
+            h = hash_str(h, t->u.array.expr);
+            break;
+        case TYPE_FUNCTION: h = hash_ptr(h, t->u.func.ret); break;
+        case TYPE_STRUCT:
+        case TYPE_UNION:
+            h = hash_str(h, t->u.s.tag);
+            h = hash_word(h, (uint64_t)t->u.s.is_forward);
+            for (const Member *m = t->u.s.members; m; m = m->next) {
+                h = hash_str(h, m->name);
+                h = hash_ptr(h, m->type);
+                h = hash_word(h, (uint64_t)m->bits);
+            }
+            break;
+        case TYPE_ENUM:
+            h = hash_str(h, t->u.en.tag);
+            for (const EnumValue *e = t->u.en.values; e; e = e->next) {
+                h = hash_str(h, e->name);
+                h = hash_word(h, (uint64_t)e->value);
+                h = hash_str(h, e->spelling);
+                h = hash_str(h, e->expr);
+            }
+            break;
+        case TYPE_ALIAS: h = hash_str(h, t->u.alias_to); break;
+    }
+    return h;
+}
+
+static int str_eq(const char *a, const char *b) {
+    if (!a || !b) return a == b;
+    return strcmp(a, b) == 0;
+}
+
+/* Shallow equality; valid because children are canonical. */
+static int type_equal(const Type *a, const Type *b) {
+    if (a->kind != b->kind || a->quals != b->quals) return 0;
+    switch (a->kind) {
+        case TYPE_BUILTIN: return str_eq(a->u.builtin_name, b->u.builtin_name);
+        case TYPE_POINTER: return a->u.ptr.base == b->u.ptr.base;
+        case TYPE_ARRAY:
+            return a->u.array.base == b->u.array.base && a->u.array.length == b->u.array.length &&
+                   str_eq(a->u.array.expr, b->u.array.expr);
+        case TYPE_FUNCTION:
+            return a->u.func.ret == b->u.func.ret && !a->u.func.params && !b->u.func.params;
+        case TYPE_STRUCT:
+        case TYPE_UNION: {
+            if (!str_eq(a->u.s.tag, b->u.s.tag) || a->u.s.is_forward != b->u.s.is_forward) return 0;
+            const Member *x = a->u.s.members, *y = b->u.s.members;
+            for (; x && y; x = x->next, y = y->next) {
+                if (x->type != y->type || x->bits != y->bits || !str_eq(x->name, y->name)) return 0;
+            }
+            return !x && !y;
+        }
+        case TYPE_ENUM: {
+            if (!str_eq(a->u.en.tag, b->u.en.tag)) return 0;
+            const EnumValue *x = a->u.en.values, *y = b->u.en.values;
+            for (; x && y; x = x->next, y = y->next) {
+                if (x->value != y->value || !str_eq(x->name, y->name) || !str_eq(x->spelling, y->spelling) ||
+                    !str_eq(x->expr, y->expr)) return 0;
+            }
+            return !x && !y;
+        }
+        case TYPE_ALIAS: return str_eq(a->u.alias_to, b->u.alias_to);
+    }
+    return 0;
+}
+
+/* Declarations and tag definitions already merged, keyed by name
+ * ("struct T"/"union T" for tags). */
+typedef struct {
+    char *key;
+    uint64_t hash;
+    const ASTNode *node; /* NULL for tag entries */
+    Type *type;
+    const char *origin;
+} NameEntry;
+
+struct TypeTable {
+    Type **types; /* open addressing, capacity is a power of two */
+    uint64_t *hashes;
+    size_t type_cap, type_count;
+    NameEntry *names;
+    size_t name_cap, name_count;
+    char **origins; /* one copy per merged input, referenced by entries */
+    size_t origin_count;
+    MergeStats stats;
+};
+
+TypeTable *type_table_create(void) {
+    TypeTable *tt = (TypeTable*)ds_calloc(1, sizeof(TypeTable));
+    tt->type_cap = 1024;
+    tt->types = (Type**)ds_calloc(tt->type_cap, sizeof(Type*));
+    tt->hashes = (uint64_t*)ds_calloc(tt->type_cap, sizeof(uint64_t));
+    tt->name_cap = 1024;
+    tt->names = (NameEntry*)ds_calloc(tt->name_cap, sizeof(NameEntry));
+    return tt;
+}
+
+static void detach_children(Type *t) {
+    switch (t->kind) {
+        case TYPE_POINTER: t->u.ptr.base = NULL; break;
+        case TYPE_ARRAY: t->u.array.base = NULL; break;
+        case TYPE_FUNCTION: t->u.func.ret = NULL; break;
+        case TYPE_STRUCT:
+        case TYPE_UNION:
+            for (Member *m = t->u.s.members; m; m = m->next) m->type = NULL;
+            break;
+        default:
+            break;
+    }
+}
+
+void type_table_destroy(TypeTable *tt) {
+    if (!tt) return;
+    /* canonical children are released by their own slot, in no particular
+     * order, so unhook them before anything is freed */
+    for (size_t i = 0; i < tt->type_cap; ++i) {
+        if (tt->types[i]) detach_children(tt->types[i]);
+    }
+    for (size_t i = 0; i < tt->type_cap; ++i) {
+        if (tt->types[i]) type_release(tt->types[i]);
+    }
+    for (size_t i = 0; i < tt->name_cap; ++i) free(tt->names[i].key);
+    for (size_t i = 0; i < tt->origin_count; ++i) free(tt->origins[i]);
+    free(tt->types);
+    free(tt->hashes);
+    free(tt->names);
+    free(tt->origins);
+    free(tt);
+}
+
+static void types_grow(TypeTable *tt) {
+    size_t cap = tt->type_cap * 2;
+    Type **types = (Type**)ds_calloc(cap, sizeof(Type*));
+    uint64_t *hashes = (uint64_t*)ds_calloc(cap, sizeof(uint64_t));
+    for (size_t i = 0; i < tt->type_cap; ++i) {
+        if (!tt->types[i]) continue;
+        size_t j = tt->hashes[i] & (cap - 1);
+        while (types[j]) j = (j + 1) & (cap - 1);
+        types[j] = tt->types[i];
+        hashes[j] = tt->hashes[i];
+    }
+    free(tt->types);
+    free(tt->hashes);
+    tt->types = types;
+    tt->hashes = hashes;
+    tt->type_cap = cap;
+}
+
+Type *type_intern(TypeTable *tt, Type *t) {
+    if (!t || t->interned) return t;
+    switch (t->kind) {
+        case TYPE_POINTER: t->u.ptr.base = type_intern(tt, t->u.ptr.base); break;
+        case TYPE_ARRAY: t->u.array.base = type_intern(tt, t->u.array.base); break;
+        case TYPE_FUNCTION:
+            t->u.func.ret = type_intern(tt, t->u.func.ret);
+            /* parameter lists are chained through Type.next, which a shared
+             * node cannot carry, so such functions stay private */
+            if (t->u.func.params) return t;
+            break;
+        case TYPE_STRUCT:
+        case TYPE_UNION:
+            for (Member *m = t->u.s.members; m; m = m->next) m->type = type_intern(tt, m->type);
+            break;
+        default:
+            break;
+    }
+    tt->stats.types++;
+    if ((tt->type_count + 1) * 4 > tt->type_cap * 3) types_grow(tt);
+    uint64_t h = type_hash(t);
+    size_t i = h & (tt->type_cap - 1);
+    while (tt->types[i]) {
+        if (tt->hashes[i] == h && type_equal(tt->types[i], t)) {
+            type_free(t); /* children are interned and survive */
+            return tt->types[i];
+        }
+        i = (i + 1) & (tt->type_cap - 1);
+    }
+    t->interned = 1;
+    tt->types[i] = t;
+    tt->hashes[i] = h;
+    tt->type_count++;
+    tt->stats.unique_types++;
+    return t;
+}
+
+static void names_grow(TypeTable *tt) {
+    size_t cap = tt->name_cap * 2;
+    NameEntry *names = (NameEntry*)ds_calloc(cap, sizeof(NameEntry));
+    for (size_t i = 0; i < tt->name_cap; ++i) {
+        if (!tt->names[i].key) continue;
+        size_t j = tt->names[i].hash & (cap - 1);
+        while (names[j].key) j = (j + 1) & (cap - 1);
+        names[j] = tt->names[i];
+    }
+    free(tt->names);
+    tt->names = names;
+    tt->name_cap = cap;
+}
+
+/* Returns the entry for key, inserting an empty one (node and type NULL)
+ * if it is not there yet. */
+static NameEntry *name_lookup(TypeTable *tt, const char *key) {
+    if ((tt->name_count + 1) * 4 > tt->name_cap * 3) names_grow(tt);
+    uint64_t h = hash_str(FNV_OFFSET, key);
+    size_t i = h & (tt->name_cap - 1);
+    while (tt->names[i].key) {
+        if (tt->names[i].hash == h && strcmp(tt->names[i].key, key) == 0) return &tt->names[i];
+        i = (i + 1) & (tt->name_cap - 1);
+    }
+    NameEntry *e = &tt->names[i];
+    e->key = ds_strdup(key);
+    e->hash = h;
+    tt->name_count++;
+    return e;
+}
+
+static const char *origin_name(const char *origin) {
+    return origin ? origin : "<input>";
+}
+
+/* Checks a declaration against what was merged before. Returns 1 to keep
+ * the node, 0 to drop it. */
+static int merge_check(TypeTable *tt, const ASTNode *n, const char *origin) {
+    const Type *rec = depgraph_defined_record(n->type);
+    if (rec) {
+        char key[512];
+        snprintf(key, sizeof(key), "%s %s", rec->kind == TYPE_UNION ? "union" : "struct", rec->u.s.tag);
+        NameEntry *e = name_lookup(tt, key);
+        if (!e->type) {
+            e->type = (Type*)rec;
+            e->origin = origin;
+        } else if (e->type != rec) {
+            fprintf(stderr, "%s: conflicting definition of '%s' (first defined in %s), keeping the first\n",
+                    origin_name(origin), key, origin_name(e->origin));
+            tt->stats.conflicts++;
+            return 0;
+        }
+    }
+    if (!n->name) {
+        /* a bare definition such as "struct T { ... };" or an anonymous
+         * enum: identical ones share a canonical type */
+        char key[32];
+        snprintf(key, sizeof(key), "#%p", (void*)n->type);
+        NameEntry *e = name_lookup(tt, key);
+        if (e->type) {
+            tt->stats.duplicate_decls++;
+            return 0;
+        }
+        e->type = n->type;
+        e->origin = origin;
+        return 1;
+    }
+    NameEntry *e = name_lookup(tt, n->name);
+    if (!e->node) {
+        e->node = n;
+        e->type = n->type;
+        e->origin = origin;
+        return 1;
+    }
+    if (e->type == n->type && e->node->is_typedef == n->is_typedef) {
+        tt->stats.duplicate_decls++;
+        return 0;
+    }
+    fprintf(stderr, "%s: conflicting declaration of '%s' (first declared in %s), keeping the first\n",
+            origin_name(origin), n->name, origin_name(e->origin));
+    tt->stats.conflicts++;
+    return 0;
+}
+
+void type_table_merge(TypeTable *tt, ASTRoot *dst, ASTRoot *src, const char *origin) {
+    if (origin) {
+        tt->origins = (char**)ds_realloc(tt->origins, (tt->origin_count + 1) * sizeof(char*));
+        origin = tt->origins[tt->origin_count++] = ds_strdup(origin);
+    }
+    ASTNode *n = src->first;
+    while (n) {
+        ASTNode *next = n->next;
+        n->next = NULL;
+        n->type = type_intern(tt, n->type);
+        if (merge_check(tt, n, origin)) {
+            if (dst->last) dst->last->next = n; else dst->first = n;
+            dst->last = n;
+        } else {
+            ast_node_free(n);
+        }
+        n = next;
+    }
+    src->first = src->last = NULL;
+}
+
+const MergeStats *type_table_stats(const TypeTable *tt) {
+    return &tt->stats;
+}
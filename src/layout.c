@@ -0,0 +1,406 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <wchar.h>
+#include "layout.h"
+#include "memstat.h"
+
+/* ---- builtin types ---- */
+
+typedef struct {
+    const char *name;
+    size_t size, align;
+    int floating;
+} Builtin;
+
+#define BUILTIN(name, type, fl) { name, sizeof(type), _Alignof(type), fl }
+
+/* Canonical builtins first (classify_words returns their names), then
+ * standard typedefs that resolve to them when nothing redefines them. */
+static const Builtin builtins[] = {
+    BUILTIN("char", char, 0),
+    BUILTIN("short", short, 0),
+    BUILTIN("int", int, 0),
+    BUILTIN("long", long, 0),
+    BUILTIN("long long", long long, 0),
+    BUILTIN("float", float, 1),
+    BUILTIN("double", double, 1),
+    BUILTIN("long double", long double, 1),
+    BUILTIN("_Bool", _Bool, 0),
+    BUILTIN("bool", bool, 0),
+    BUILTIN("int8_t", int8_t, 0),
+    BUILTIN("int16_t", int16_t, 0),
+    BUILTIN("int32_t", int32_t, 0),
+    BUILTIN("int64_t", int64_t, 0),
+    BUILTIN("uint8_t", uint8_t, 0),
+    BUILTIN("uint16_t", uint16_t, 0),
+    BUILTIN("uint32_t", uint32_t, 0),
+    BUILTIN("uint64_t", uint64_t, 0),
+    BUILTIN("intptr_t", intptr_t, 0),
+    BUILTIN("uintptr_t", uintptr_t, 0),
+    BUILTIN("size_t", size_t, 0),
+    BUILTIN("ptrdiff_t", ptrdiff_t, 0),
+    BUILTIN("wchar_t", wchar_t, 0),
+};
+
+#define BUILTIN_COUNT (sizeof(builtins) / sizeof(builtins[0]))
+
+/* Builtin spellings are keyword sequences in any order ("long unsigned
+ * int"); signedness does not change size, so they reduce to one of the
+ * canonical names, or NULL for void. */
+static const char *classify_words(const char *name) {
+    int longs = 0, has_short = 0, has_char = 0, has_float = 0, has_double = 0, has_void = 0;
+    const char *p = name;
+    while (*p) {
+        while (*p == ' ') p++;
+        const char *w = p;
+        while (*p && *p != ' ') p++;
+        size_t n = (size_t)(p - w);
+        if (n == 4 && memcmp(w, "long", 4) == 0) longs++;
+        else if (n == 5 && memcmp(w, "short", 5) == 0) has_short = 1;
+        else if (n == 4 && memcmp(w, "char", 4) == 0) has_char = 1;
+        else if (n == 5 && memcmp(w, "float", 5) == 0) has_float = 1;
+        else if (n == 6 && memcmp(w, "double", 6) == 0) has_double = 1;
+        else if (n == 4 && memcmp(w, "void", 4) == 0) has_void = 1;
+    }
+    if (has_void) return NULL;
+    if (has_double) return longs ? "long double" : "double";
+    if (has_float) return "float";
+    if (has_char) return "char";
+    if (has_short) return "short";
+    if (longs >= 2) return "long long";
+    if (longs == 1) return "long";
+    return "int";
+}
+
+static const Builtin *builtin_named(const char *name) {
+    for (size_t i = 0; i < BUILTIN_COUNT; ++i) {
+        if (strcmp(builtins[i].name, name) == 0) return &builtins[i];
+    }
+    return NULL;
+}
+
+static const Builtin *builtin_info(const char *name) {
+    const Builtin *b = builtin_named(name);
+    if (b) return b;
+    const char *canon = classify_words(name);
+    return canon ? builtin_named(canon) : NULL;
+}
+
+int builtin_is_floating(const char *name) {
+    const Builtin *b = builtin_info(name);
+    return b && b->floating;
+}
+
+int builtin_is_unsigned(const char *name) {
+    return strstr(name, "unsigned") || strncmp(name, "uint", 4) == 0 || strcmp(name, "size_t") == 0
+        || strcmp(name, "_Bool") == 0 || strcmp(name, "bool") == 0;
+}
+
+/* Standard typedef names (and _Bool, which the lexer reads as a name)
+ * scope_resolve takes as the builtin of the same name (flatast.h). */
+static const char *const standard_names[] = {
+    "_Bool", "bool",
+    "int8_t", "int16_t", "int32_t", "int64_t",
+    "uint8_t", "uint16_t", "uint32_t", "uint64_t",
+    "intptr_t", "uintptr_t", "size_t", "ptrdiff_t",
+    "wchar_t",
+};
+
+int builtin_is_standard(const char *name) {
+    for (size_t i = 0; i < sizeof(standard_names) / sizeof(standard_names[0]); ++i) {
+        if (strcmp(standard_names[i], name) == 0) return 1;
+    }
+    return 0;
+}
+
+/* ---- scope ---- */
+
+typedef struct {
+    char *key; /* typedef name, or "struct T" / "union T" */
+    FlatRef type;
+    size_t seq; /* scope_add call that added it (0-based) */
+} ScopeEntry;
+
+struct TypeScope {
+    const FlatAST *fa;
+    ScopeEntry *entries;
+    size_t cap, count;
+    size_t added;   /* scope_add calls so far */
+    size_t visible; /* entries with seq >= visible are hidden (views) */
+    int view;       /* entries belong to another scope */
+};
+
+static uint64_t hash_key(const char *s) {
+    uint64_t h = 1469598103934665603ull;
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+static ScopeEntry *scope_slot(ScopeEntry *entries, size_t cap, const char *key) {
+    size_t i = hash_key(key) & (cap - 1);
+    while (entries[i].key && strcmp(entries[i].key, key) != 0) i = (i + 1) & (cap - 1);
+    return &entries[i];
+}
+
+TypeScope *scope_create(const FlatAST *fa) {
+    TypeScope *s = (TypeScope*)ds_calloc(1, sizeof(TypeScope));
+    s->fa = fa;
+    s->cap = 256;
+    s->entries = (ScopeEntry*)ds_calloc(s->cap, sizeof(ScopeEntry));
+    s->visible = SIZE_MAX;
+    return s;
+}
+
+TypeScope *scope_view(const TypeScope *s) {
+    TypeScope *v = (TypeScope*)ds_malloc(sizeof(TypeScope));
+    *v = *s;
+    v->view = 1;
+    v->visible = 0;
+    return v;
+}
+
+size_t scope_declarations(const TypeScope *s) {
+    return s->added;
+}
+
+void scope_view_limit(TypeScope *view, size_t declarations) {
+    view->visible = declarations;
+}
+
+void scope_destroy(TypeScope *s) {
+    if (!s) return;
+    if (s->view) {
+        free(s);
+        return;
+    }
+    for (size_t i = 0; i < s->cap; ++i) free(s->entries[i].key);
+    free(s->entries);
+    free(s);
+}
+
+/* First definition wins, like the merge in intern.c. key is consumed. */
+static void scope_put(TypeScope *s, char *key, FlatRef t) {
+    if ((s->count + 1) * 2 > s->cap) {
+        size_t cap = s->cap * 2;
+        ScopeEntry *entries = (ScopeEntry*)ds_calloc(cap, sizeof(ScopeEntry));
+        for (size_t i = 0; i < s->cap; ++i) {
+            if (s->entries[i].key) *scope_slot(entries, cap, s->entries[i].key) = s->entries[i];
+        }
+        free(s->entries);
+        s->entries = entries;
+        s->cap = cap;
+    }
+    ScopeEntry *e = scope_slot(s->entries, s->cap, key);
+    if (e->key) { free(key); return; }
+    e->key = key;
+    e->type = t;
+    e->seq = s->added;
+    s->count++;
+}
+
+static const FlatType *scope_get(const TypeScope *s, const char *key) {
+    const ScopeEntry *e = scope_slot(s->entries, s->cap, key);
+    return e->key && e->seq < s->visible ? &s->fa->types[e->type] : NULL;
+}
+
+static char *tag_key(const TypeScope *s, const FlatType *t) {
+    const char *tag = flat_str(s->fa, t->name);
+    size_t n = strlen(tag) + 8;
+    char *key = (char*)ds_malloc(n);
+    snprintf(key, n, "%s %s", t->kind == TYPE_UNION ? "union" : "struct", tag);
+    return key;
+}
+
+/* A struct or union mentioned by tag only, to be looked up. */
+static int is_tag_ref(const FlatType *t) {
+    return (t->kind == TYPE_STRUCT || t->kind == TYPE_UNION) && !t->count && t->name != FLAT_NONE;
+}
+
+/* Registers every tagged record defined in t, nested ones included. */
+static void add_tags(TypeScope *s, FlatRef ref) {
+    const FlatAST *fa = s->fa;
+    while (ref != FLAT_NONE) {
+        const FlatType *t = &fa->types[ref];
+        switch (t->kind) {
+            case TYPE_POINTER:
+            case TYPE_ARRAY:
+            case TYPE_FUNCTION:
+                ref = t->base;
+                continue;
+            case TYPE_STRUCT:
+            case TYPE_UNION:
+                if (!t->count) return;
+                if (t->name != FLAT_NONE) scope_put(s, tag_key(s, t), ref);
+                for (int32_t i = 0; i < t->count; ++i) add_tags(s, fa->members[t->base + (FlatRef)i].type);
+                return;
+            default:
+                return;
+        }
+    }
+}
+
+void scope_add(TypeScope *s, const FlatDecl *n) {
+    if (n->is_typedef && n->name != FLAT_NONE) scope_put(s, ds_strdup(flat_str(s->fa, n->name)), n->type);
+    add_tags(s, n->type);
+    s->added++;
+}
+
+const FlatType *scope_resolve(const TypeScope *s, const FlatType *t) {
+    for (int depth = 0; t && depth < 64; ++depth) {
+        const FlatType *next = NULL;
+        if (t->kind == TYPE_ALIAS) {
+            next = scope_get(s, flat_str(s->fa, t->name));
+            if (!next) next = flat_type(s->fa, t->base);
+        } else if (is_tag_ref(t)) {
+            char *key = tag_key(s, t);
+            next = scope_get(s, key);
+            free(key);
+        }
+        if (!next || next == t) return t;
+        t = next;
+    }
+    return t;
+}
+
+static int read_only_at(const TypeScope *s, const FlatType *t, int depth) {
+    const FlatAST *fa = s->fa;
+    for (; t && depth < 64; ++depth) {
+        if (t->quals & QUAL_CONST) return 1;
+        const FlatType *next = NULL;
+        if (t->kind == TYPE_ARRAY) {
+            next = flat_type(fa, t->base);
+        } else if (t->kind == TYPE_ALIAS) {
+            next = scope_get(s, flat_str(fa, t->name));
+        } else if (is_tag_ref(t)) {
+            char *key = tag_key(s, t);
+            next = scope_get(s, key);
+            free(key);
+        } else if (t->kind == TYPE_STRUCT || t->kind == TYPE_UNION) {
+            for (int32_t i = 0; i < t->count; ++i) {
+                if (read_only_at(s, flat_type(fa, fa->members[t->base + (FlatRef)i].type), depth + 1)) return 1;
+            }
+        }
+        if (!next || next == t) return 0;
+        t = next;
+    }
+    return 0;
+}
+
+int scope_read_only(const TypeScope *s, const FlatType *t) {
+    return read_only_at(s, t, 0);
+}
+
+const char *scope_record_name(const TypeScope *s, const FlatType *t, const FlatType **record) {
+    const char *name = NULL;
+    *record = NULL;
+    for (int depth = 0; t && depth < 64; ++depth) {
+        const FlatType *next = NULL;
+        if (t->kind == TYPE_ALIAS) {
+            name = flat_str(s->fa, t->name);
+            next = scope_get(s, name);
+        } else if (is_tag_ref(t)) {
+            char *key = tag_key(s, t);
+            next = scope_get(s, key);
+            free(key);
+        }
+        if (!next || next == t) break;
+        t = next;
+    }
+    if (!t || (t->kind != TYPE_STRUCT && t->kind != TYPE_UNION) || !t->count) return NULL;
+    *record = t;
+    return t->name != FLAT_NONE ? flat_str(s->fa, t->name) : name;
+}
+
+/* ---- layout ---- */
+
+static size_t align_up(size_t n, size_t a) {
+    return a > 1 ? (n + a - 1) / a * a : n;
+}
+
+/* Records being laid out, innermost first: one that turns up inside itself
+ * (which only invalid input does) has no layout. */
+typedef struct LayoutStack {
+    const FlatType *record;
+    const struct LayoutStack *outer;
+} LayoutStack;
+
+static int layout_at(const TypeScope *s, const FlatType *t, Layout *out, const LayoutStack *outer) {
+    const FlatAST *fa = s->fa;
+    memset(out, 0, sizeof(*out));
+    t = scope_resolve(s, t);
+    if (!t) return 0;
+    switch (t->kind) {
+        case TYPE_BUILTIN: {
+            const Builtin *b = builtin_info(flat_str(fa, t->name));
+            if (!b) return 0;
+            out->size = b->size;
+            out->align = b->align;
+            return 1;
+        }
+        case TYPE_POINTER:
+            out->size = sizeof(void*);
+            out->align = _Alignof(void*);
+            out->pointers = 1;
+            return 1;
+        case TYPE_ARRAY: {
+            Layout elem;
+            if (t->count <= 0 || !layout_at(s, flat_type(fa, t->base), &elem, outer)) return 0;
+            *out = elem;
+            out->size = elem.size * (size_t)t->count;
+            return 1;
+        }
+        case TYPE_ENUM: {
+            int wide = 0;
+            for (int32_t i = 0; i < t->count; ++i) {
+                const FlatEnumValue *e = &fa->values[t->base + (FlatRef)i];
+                if (e->expr != FLAT_NONE) return 0; /* range not known */
+                if (e->value > INT32_MAX || e->value < INT32_MIN) wide = 1;
+            }
+            out->size = wide ? sizeof(long long) : sizeof(int);
+            out->align = wide ? _Alignof(long long) : _Alignof(int);
+            return 1;
+        }
+        case TYPE_STRUCT:
+        case TYPE_UNION: {
+            if (!t->count) return 0;
+            for (const LayoutStack *o = outer; o; o = o->outer) {
+                if (o->record == t) return 0;
+            }
+            LayoutStack inner = { t, outer };
+            size_t offset = 0, size = 0, align = 1;
+            for (int32_t i = 0; i < t->count; ++i) {
+                const FlatMember *m = &fa->members[t->base + (FlatRef)i];
+                Layout ml;
+                if (m->bits || !layout_at(s, flat_type(fa, m->type), &ml, &inner)) return 0;
+                if (ml.align > align) align = ml.align;
+                out->padded |= ml.padded;
+                out->pointers |= ml.pointers;
+                if (t->kind == TYPE_UNION) {
+                    if (size && ml.size != size) out->padded = 1;
+                    if (ml.size > size) size = ml.size;
+                } else {
+                    size_t at = align_up(offset, ml.align);
+                    if (at != offset) out->padded = 1;
+                    offset = at + ml.size;
+                }
+            }
+            if (t->kind == TYPE_STRUCT) size = offset;
+            out->size = align_up(size, align);
+            out->align = align;
+            if (out->size != size) out->padded = 1;
+            return 1;
+        }
+        default:
+            return 0;
+    }
+}
+
+int layout_of(const TypeScope *s, const FlatType *t, Layout *out) {
+    return layout_at(s, t, out, NULL);
+}
@@ -0,0 +1,199 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "lazy.h"
+#include "parser.h"
+#include "depgraph.h"
+#include "report.h"
+#include "memstat.h"
+
+typedef struct {
+    char *path; /* origin for merge messages */
+    char *text; /* preprocessed source */
+    size_t len;
+} LazyInput;
+
+/* A skimmed declaration that defines a name or tag. */
+typedef struct {
+    size_t input;
+    size_t offset, length;
+    int line;
+    int wanted;   /* reached from the roots */
+    ASTRoot *ast; /* parsed on demand */
+} LazyDecl;
+
+/* Defined name -> declaration, keyed by kind: TYPE_ALIAS for typedef,
+ * object and function names, TYPE_STRUCT/UNION/ENUM for tags. */
+typedef struct {
+    char *name;
+    TypeKind kind;
+    size_t decl;
+} LazyName;
+
+struct LazySet {
+    const Options *opts;
+    LazyInput *inputs;
+    size_t input_count, input_cap;
+    LazyDecl *decls;
+    size_t decl_count, decl_cap;
+    LazyName *names;
+    size_t name_count, name_cap;
+    size_t *stack; /* declarations wanted but not parsed yet */
+    size_t stack_count;
+};
+
+static uint64_t hash_name(TypeKind kind, const char *s) {
+    uint64_t h = 1469598103934665603ull + (uint64_t)kind;
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+static LazyName *name_slot(LazyName *map, size_t cap, TypeKind kind, const char *name) {
+    size_t i = hash_name(kind, name) & (cap - 1);
+    while (map[i].name && (map[i].kind != kind || strcmp(map[i].name, name) != 0)) i = (i + 1) & (cap - 1);
+    return &map[i];
+}
+
+/* First definition wins, like the merge in intern.c. */
+static void name_put(LazySet *ls, TypeKind kind, const char *name, size_t decl) {
+    if ((ls->name_count + 1) * 2 > ls->name_cap) {
+        size_t old_cap = ls->name_cap;
+        LazyName *old = ls->names;
+        ls->name_cap = old_cap ? old_cap * 2 : 256;
+        ls->names = (LazyName*)ds_calloc(ls->name_cap, sizeof(LazyName));
+        for (size_t i = 0; i < old_cap; ++i) {
+            if (old[i].name) *name_slot(ls->names, ls->name_cap, old[i].kind, old[i].name) = old[i];
+        }
+        free(old);
+    }
+    LazyName *s = name_slot(ls->names, ls->name_cap, kind, name);
+    if (s->name) return;
+    s->name = ds_strdup(name);
+    s->kind = kind;
+    s->decl = decl;
+    ls->name_count++;
+}
+
+static const LazyName *name_get(const LazySet *ls, TypeKind kind, const char *name) {
+    if (!ls->names) return NULL;
+    const LazyName *s = name_slot(ls->names, ls->name_cap, kind, name);
+    return s->name ? s : NULL;
+}
+
+LazySet *lazy_create(const Options *opts) {
+    LazySet *ls = (LazySet*)ds_calloc(1, sizeof(LazySet));
+    ls->opts = opts;
+    return ls;
+}
+
+void lazy_destroy(LazySet *ls) {
+    if (!ls) return;
+    for (size_t i = 0; i < ls->input_count; ++i) {
+        free(ls->inputs[i].path);
+        free(ls->inputs[i].text);
+    }
+    for (size_t i = 0; i < ls->decl_count; ++i) ast_free(ls->decls[i].ast);
+    for (size_t i = 0; i < ls->name_cap; ++i) free(ls->names[i].name);
+    free(ls->inputs);
+    free(ls->decls);
+    free(ls->names);
+    free(ls->stack);
+    free(ls);
+}
+
+typedef struct {
+    LazySet *ls;
+    size_t input;
+} SkimInput;
+
+static void skim_sink(const SkimDecl *d, void *user) {
+    SkimInput *si = (SkimInput*)user;
+    LazySet *ls = si->ls;
+    if (ls->decl_count == ls->decl_cap) {
+        ls->decl_cap = ls->decl_cap ? ls->decl_cap * 2 : 256;
+        ls->decls = (LazyDecl*)ds_realloc(ls->decls, ls->decl_cap * sizeof(LazyDecl));
+    }
+    size_t index = ls->decl_count++;
+    LazyDecl *decl = &ls->decls[index];
+    memset(decl, 0, sizeof(*decl));
+    decl->input = si->input;
+    decl->offset = d->offset;
+    decl->length = d->length;
+    decl->line = d->line;
+    if (d->name) name_put(ls, TYPE_ALIAS, d->name, index);
+    if (d->tag) name_put(ls, d->tag_kind, d->tag, index);
+}
+
+int lazy_add(LazySet *ls, const char *path, char *data, size_t len, ParseStats *stats) {
+    char *text = parse_prepare(path, data, len, ls->opts, &len, stats);
+    if (!text) return 0;
+    if (ls->input_count == ls->input_cap) {
+        ls->input_cap = ls->input_cap ? ls->input_cap * 2 : 16;
+        ls->inputs = (LazyInput*)ds_realloc(ls->inputs, ls->input_cap * sizeof(LazyInput));
+    }
+    LazyInput *in = &ls->inputs[ls->input_count];
+    in->path = ds_strdup(path);
+    in->text = text;
+    in->len = len;
+    double wall0 = clock_wall(), cpu0 = clock_thread_cpu();
+    size_t decls = ls->decl_count;
+    SkimInput si = { ls, ls->input_count };
+    stats->tokens = parse_skim(text, len, skim_sink, &si);
+    ls->input_count++;
+    stats->source_bytes = len;
+    stats->decls = ls->decl_count - decls;
+    stats->parse_wall = clock_wall() - wall0;
+    stats->parse_cpu = clock_thread_cpu() - cpu0;
+    return 1;
+}
+
+static void want(LazySet *ls, const LazyName *n) {
+    if (!n || ls->decls[n->decl].wanted) return;
+    ls->decls[n->decl].wanted = 1;
+    ls->stack[ls->stack_count++] = n->decl;
+}
+
+static void want_mention(TypeKind kind, const char *name, void *user) {
+    LazySet *ls = (LazySet*)user;
+    want(ls, name_get(ls, kind, name));
+}
+
+/* The declaration a root names, looked up as depgraph's find_root does. */
+static const LazyName *find_root(const LazySet *ls, const char *root) {
+    const LazyName *n = name_get(ls, TYPE_ALIAS, root);
+    if (!n && strncmp(root, "struct ", 7) == 0) n = name_get(ls, TYPE_STRUCT, root + 7);
+    if (!n && strncmp(root, "union ", 6) == 0) n = name_get(ls, TYPE_UNION, root + 6);
+    if (!n && strncmp(root, "enum ", 5) == 0) n = name_get(ls, TYPE_ENUM, root + 5);
+    if (!n) n = name_get(ls, TYPE_STRUCT, root);
+    if (!n) n = name_get(ls, TYPE_UNION, root);
+    if (!n) n = name_get(ls, TYPE_ENUM, root);
+    return n;
+}
+
+size_t lazy_materialize(LazySet *ls, const char *const *roots, int root_count, TypeTable *types, ASTRoot *out) {
+    ls->stack = (size_t*)ds_realloc(ls->stack, (ls->decl_count + 1) * sizeof(size_t));
+    ls->stack_count = 0;
+    /* unmatched roots are reported when the plan is built */
+    for (int r = 0; r < root_count; ++r) want(ls, find_root(ls, roots[r]));
+    size_t parsed = 0;
+    while (ls->stack_count > 0) {
+        LazyDecl *d = &ls->decls[ls->stack[--ls->stack_count]];
+        const LazyInput *in = &ls->inputs[d->input];
+        d->ast = parse_range(in->text + d->offset, d->length, d->line, ls->opts, 0);
+        parsed++;
+        for (const ASTNode *n = d->ast->first; n; n = n->next) depgraph_mentions(n->type, want_mention, ls);
+    }
+    /* merge in source order so the first definition wins as in a full parse */
+    for (size_t i = 0; i < ls->decl_count; ++i) {
+        LazyDecl *d = &ls->decls[i];
+        if (!d->ast) continue;
+        type_table_merge(types, out, d->ast, ls->inputs[d->input].path);
+        free(d->ast);
+        d->ast = NULL;
+    }
+    return parsed;
+}
@@ -1,84 +1,192 @@
 #include "lexer.h"
+#include "memstat.h"
+#include "dsconv.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <stdint.h>
+#include "report.h"
 
 struct Lexer {
-    char *buf;
+    char *buf;      /* whole input, or the current window when streaming */
+    size_t len;     /* valid bytes in buf (buf[len] is always '\0') */
+    size_t cap;
     size_t pos;
+    size_t mark;    /* start of the token being scanned; kept on refill */
+    FILE *src;      /* refill source when streaming, else NULL */
+    int owns_src;
+    int owns_buf;
+    int bol;        /* only whitespace/comments seen since the last newline */
     int line;
     Token peeked;
     int has_peek;
+    size_t peek_pos; /* pos and line before the peeked token was scanned */
+    int peek_line;
+    int timing;
+    LexStats stats;
 };
 
-static const char *kw_names[] = {
-    "", "", "", "", "", "", "", "", "", "", "", "", "", "", "", "", ""
-};
+#define LEX_WINDOW 65536
 
 static Token make_token(TokenKind k, const char *txt, int line) {
     Token t;
+    memset(&t, 0, sizeof(t));
     t.kind = k;
-    if (txt) t.text = strdup(txt); else t.text = NULL;
+    if (txt) t.text = ds_strdup(txt); else t.text = NULL;
     t.line = line;
     return t;
 }
 
-Lexer *lexer_create_from_file(const char *path) {
+static Lexer *lexer_alloc(char *buf, size_t len) {
+    Lexer *lx = (Lexer*)ds_calloc(1, sizeof(Lexer));
+    lx->buf = buf;
+    lx->len = len;
+    lx->cap = len + 1;
+    lx->pos = 0;
+    lx->line = 1;
+    lx->bol = 1;
+    lx->has_peek = 0;
+    lx->peeked.text = NULL;
+    lx->owns_buf = 1;
+    lx->stats.bytes = len;
+    return lx;
+}
+
+char *lexer_load_file(const char *path, size_t *len_out) {
     FILE *f = fopen(path, "rb");
     if (!f) return NULL;
     fseek(f, 0, SEEK_END);
     long sz = ftell(f);
     fseek(f, 0, SEEK_SET);
-    char *buf = (char*)malloc(sz + 1);
+    if (sz < 0) sz = 0;
+    char *buf = (char*)ds_malloc(sz + 1);
     if (!buf) { fclose(f); return NULL; }
-    fread(buf, 1, sz, f);
-    buf[sz] = '\0';
+    size_t got = fread(buf, 1, sz, f);
+    buf[got] = '\0';
     fclose(f);
-    Lexer *lx = (Lexer*)calloc(1, sizeof(Lexer));
-    lx->buf = buf;
-    lx->pos = 0;
-    lx->line = 1;
-    lx->has_peek = 0;
-    lx->peeked.text = NULL;
+    *len_out = got;
+    return buf;
+}
+
+Lexer *lexer_create_from_file(const char *path) {
+    double wall0 = clock_wall(), cpu0 = clock_thread_cpu();
+    size_t got;
+    char *buf = lexer_load_file(path, &got);
+    if (!buf) return NULL;
+    Lexer *lx = lexer_alloc(buf, got);
+    lx->stats.read_wall = clock_wall() - wall0;
+    lx->stats.read_cpu = clock_thread_cpu() - cpu0;
     return lx;
 }
 
 Lexer *lexer_create_from_string(const char *str) {
     size_t sz = strlen(str);
-    char *buf = (char*)malloc(sz + 1);
+    char *buf = (char*)ds_malloc(sz + 1);
     if (!buf) return NULL;
     strcpy(buf, str);
-    Lexer *lx = (Lexer*)calloc(1, sizeof(Lexer));
-    lx->buf = buf;
-    lx->pos = 0;
-    lx->line = 1;
-    lx->has_peek = 0;
-    lx->peeked.text = NULL;
+    return lexer_alloc(buf, sz);
+}
+
+Lexer *lexer_create_from_buffer(char *buf, size_t len) {
+    return lexer_alloc(buf, len);
+}
+
+Lexer *lexer_create_from_range(const char *buf, size_t len, int first_line) {
+    Lexer *lx = lexer_alloc((char*)buf, len);
+    lx->owns_buf = 0;
+    lx->line = first_line;
     return lx;
 }
 
+Lexer *lexer_create_from_stream(FILE *f, int owns) {
+    char *buf = (char*)ds_malloc(LEX_WINDOW + 1);
+    if (!buf) return NULL;
+    buf[0] = '\0';
+    Lexer *lx = lexer_alloc(buf, 0);
+    lx->cap = LEX_WINDOW + 1;
+    lx->src = f;
+    lx->owns_src = owns;
+    return lx;
+}
+
+/* Streaming only: drops consumed bytes (everything before the token being
+ * scanned) and reads more input. Returns 0 at end of input. The window only
+ * grows when a single token does not fit. */
+static int refill(Lexer *lx) {
+    if (!lx->src) return 0;
+    size_t keep = lx->mark < lx->pos ? lx->mark : lx->pos;
+    if (keep > 0) {
+        memmove(lx->buf, lx->buf + keep, lx->len - keep);
+        lx->len -= keep;
+        lx->pos -= keep;
+        lx->mark -= keep;
+    }
+    if (lx->len + 1 >= lx->cap) {
+        lx->cap *= 2;
+        lx->buf = (char*)ds_realloc(lx->buf, lx->cap);
+    }
+    double wall0 = clock_wall(), cpu0 = clock_thread_cpu();
+    size_t got = fread(lx->buf + lx->len, 1, lx->cap - 1 - lx->len, lx->src);
+    lx->stats.read_wall += clock_wall() - wall0;
+    lx->stats.read_cpu += clock_thread_cpu() - cpu0;
+    lx->len += got;
+    lx->buf[lx->len] = '\0';
+    lx->stats.bytes += got;
+    return got > 0;
+}
+
+/* Byte at pos+off, refilling the window as needed; '\0' at end of input. */
+static inline char peekc(Lexer *lx, size_t off) {
+    while (lx->pos + off >= lx->len) {
+        if (!refill(lx)) return '\0';
+    }
+    return lx->buf[lx->pos + off];
+}
+
+/* Skips a preprocessor directive line. Line markers left by the built-in
+ * preprocessor (# <line> "file") reset the line counter. */
+static void skip_directive(Lexer *lx) {
+    lx->pos++;
+    while (peekc(lx, 0) == ' ' || peekc(lx, 0) == '\t') lx->pos++;
+    if (isdigit((unsigned char)peekc(lx, 0))) {
+        int n = 0;
+        while (isdigit((unsigned char)peekc(lx, 0))) n = n * 10 + (lx->buf[lx->pos++] - '0');
+        while (peekc(lx, 0) && peekc(lx, 0) != '\n') lx->pos++;
+        lx->line = n - 1; /* the newline ending the marker brings us to n */
+        return;
+    }
+    char c;
+    while ((c = peekc(lx, 0)) && c != '\n') {
+        if (c == '\\' && peekc(lx, 1) == '\n') { lx->pos += 2; lx->line++; continue; }
+        lx->pos++;
+    }
+}
+
 static void skip_space(Lexer *lx) {
-    char *b = lx->buf;
-    while (b[lx->pos]) {
-        char c = b[lx->pos];
+    char c;
+    while ((lx->mark = lx->pos, c = peekc(lx, 0))) {
+        if (c == '#' && lx->bol) {
+            skip_directive(lx);
+            continue;
+        }
         if (c == '/') {
-            if (b[lx->pos+1] == '/') { /* line comment */
+            if (peekc(lx, 1) == '/') { /* line comment */
                 lx->pos += 2;
-                while (b[lx->pos] && b[lx->pos] != '\n') lx->pos++;
+                while (peekc(lx, 0) && peekc(lx, 0) != '\n') lx->pos++;
                 continue;
-            } else if (b[lx->pos+1] == '*') { /* block comment */
+            } else if (peekc(lx, 1) == '*') { /* block comment */
                 lx->pos += 2;
-                while (b[lx->pos] && !(b[lx->pos]=='*' && b[lx->pos+1]=='/')) {
-                    if (b[lx->pos] == '\n') lx->line++;
+                while (peekc(lx, 0) && !(peekc(lx, 0)=='*' && peekc(lx, 1)=='/')) {
+                    if (lx->buf[lx->pos] == '\n') lx->line++;
                     lx->pos++;
                 }
-                if (b[lx->pos]) lx->pos += 2;
+                if (peekc(lx, 0)) lx->pos += 2;
                 continue;
             }
         }
         if (isspace((unsigned char)c)) {
-            if (c == '\n') lx->line++;
+            if (c == '\n') { lx->line++; lx->bol = 1; }
             lx->pos++;
             continue;
         }
@@ -86,6 +194,15 @@ static void skip_space(Lexer *lx) {
     }
 }
 
+/* Copies buf[mark..pos) into a fresh string. */
+static char *take_text(Lexer *lx) {
+    size_t len = lx->pos - lx->mark;
+    char *s = (char*)ds_malloc(len+1);
+    memcpy(s, lx->buf + lx->mark, len);
+    s[len] = '\0';
+    return s;
+}
+
 static int is_ident_start(char c) { return isalpha((unsigned char)c) || c=='_'; }
 static int is_ident_cont(char c) { return isalnum((unsigned char)c) || c=='_'; }
 
@@ -108,102 +225,570 @@ static Token keyword_or_ident(const char *s, int line) {
     return make_token(TOK_IDENT, s, line);
 }
 
-Token lexer_next(Lexer *lx) {
+static Token lex_token(Lexer *lx) {
+#ifdef DSCONV_TRACE
     {
-        int start = (int)lx->pos;
-        int len = 20;
         char temp[64];
         int i = 0;
-        for (int k = 0; k < len && lx->buf[start + k]; ++k) temp[i++] = lx->buf[start + k];
+        for (int k = 0; k < 20 && peekc(lx, k); ++k) temp[i++] = peekc(lx, k);
         temp[i] = '\0';
-        fprintf(stderr, "lexer_next: pos=%zu buf=""%s"" line=%d\n", lx->pos, temp, lx->line);
-    }
-    if (lx->has_peek) {
-        lx->has_peek = 0;
-        Token t = lx->peeked;
-        lx->peeked.text = NULL; /* ownership moved */
-        return t;
+        DS_TRACE("lexer_next: pos=%zu buf=""%s"" line=%d\n", lx->pos, temp, lx->line);
     }
+#endif
     skip_space(lx);
-    char *b = lx->buf;
     int line = lx->line;
-    char c = b[lx->pos];
+    char c = peekc(lx, 0);
     if (!c) return make_token(TOK_EOF, NULL, line);
+    lx->bol = 0;
+    lx->mark = lx->pos;
     if (is_ident_start(c)) {
-        size_t start = lx->pos;
         lx->pos++;
-        while (is_ident_cont(b[lx->pos])) lx->pos++;
-        size_t len = lx->pos - start;
-        char *s = (char*)malloc(len+1);
-        memcpy(s, b+start, len);
-        s[len] = '\0';
+        while (is_ident_cont(peekc(lx, 0))) lx->pos++;
+        char *s = take_text(lx);
         Token t = keyword_or_ident(s, line);
-        if (t.kind == TOK_IDENT) { /* keep text */ }
-        else { free(s); s = NULL; }
-        if (t.text == NULL && s) t.text = s; /* keyword tokens keep NULL text */
-        fprintf(stderr, "lexer_next: return ident/kw kind=%d text=%s pos=%zu\n", t.kind, t.text ? t.text : "(null)", lx->pos);
+        free(s); /* keyword tokens keep NULL text */
+        DS_TRACE("lexer_next: return ident/kw kind=%d text=%s pos=%zu\n", t.kind, t.text ? t.text : "(null)", lx->pos);
         return t;
     }
-    if (isdigit((unsigned char)c)) {
-        size_t start = lx->pos;
-        while (isdigit((unsigned char)b[lx->pos])) lx->pos++;
-        size_t len = lx->pos - start;
-        char *s = (char*)malloc(len+1);
-        memcpy(s, b+start, len);
-        s[len] = '\0';
-        Token t = make_token(TOK_NUMBER, s, line);
-        fprintf(stderr, "lexer_next: return number text=%s pos=%zu\n", t.text ? t.text : "(null)", lx->pos);
+    if (isdigit((unsigned char)c) || (c == '.' && isdigit((unsigned char)peekc(lx, 1)))) {
+        /* pp-number: digits, letters, '.', ' separators and signed exponents */
+        char prev = 0, d;
+        while ((d = peekc(lx, 0))) {
+            if (is_ident_cont(d) || d == '.' ||
+                ((d == '+' || d == '-') && (prev == 'e' || prev == 'E' || prev == 'p' || prev == 'P')) ||
+                (d == '\'' && isalnum((unsigned char)peekc(lx, 1)))) {
+                prev = d;
+                lx->pos++;
+                continue;
+            }
+            break;
+        }
+        Token t = make_token(TOK_NUMBER, NULL, line);
+        t.text = take_text(lx);
+        lexer_parse_number(t.text, lx->pos - lx->mark, &t.num);
+        DS_TRACE("lexer_next: return number text=%s pos=%zu\n", t.text ? t.text : "(null)", lx->pos);
         return t;
     }
     /* simple single-char tokens */
     lx->pos++;
     switch (c) {
-        case ';': { Token t = make_token(TOK_SEMI, NULL, line); fprintf(stderr, "lexer_next: return ; pos=%zu\n", lx->pos); return t; }
-        case ',': { Token t = make_token(TOK_COMMA, NULL, line); fprintf(stderr, "lexer_next: return , pos=%zu\n", lx->pos); return t; }
-        case '{': { Token t = make_token(TOK_LBRACE, NULL, line); fprintf(stderr, "lexer_next: return { pos=%zu\n", lx->pos); return t; }
-        case '}': { Token t = make_token(TOK_RBRACE, NULL, line); fprintf(stderr, "lexer_next: return } pos=%zu\n", lx->pos); return t; }
-        case '(': { Token t = make_token(TOK_LPAREN, NULL, line); fprintf(stderr, "lexer_next: return ( pos=%zu\n", lx->pos); return t; }
-        case ')': { Token t = make_token(TOK_RPAREN, NULL, line); fprintf(stderr, "lexer_next: return ) pos=%zu\n", lx->pos); return t; }
-        case '[': { Token t = make_token(TOK_LBRACK, NULL, line); fprintf(stderr, "lexer_next: return [ pos=%zu\n", lx->pos); return t; }
-        case ']': { Token t = make_token(TOK_RBRACK, NULL, line); fprintf(stderr, "lexer_next: return ] pos=%zu\n", lx->pos); return t; }
-        case ':': { Token t = make_token(TOK_COLON, NULL, line); fprintf(stderr, "lexer_next: return : pos=%zu\n", lx->pos); return t; }
-        case '*': { Token t = make_token(TOK_STAR, NULL, line); fprintf(stderr, "lexer_next: return * pos=%zu\n", lx->pos); return t; }
-        case '=': { Token t = make_token(TOK_EQ, NULL, line); fprintf(stderr, "lexer_next: return = pos=%zu\n", lx->pos); return t; }
+        case ';': { Token t = make_token(TOK_SEMI, NULL, line); DS_TRACE("lexer_next: return ; pos=%zu\n", lx->pos); return t; }
+        case ',': { Token t = make_token(TOK_COMMA, NULL, line); DS_TRACE("lexer_next: return , pos=%zu\n", lx->pos); return t; }
+        case '{': { Token t = make_token(TOK_LBRACE, NULL, line); DS_TRACE("lexer_next: return { pos=%zu\n", lx->pos); return t; }
+        case '}': { Token t = make_token(TOK_RBRACE, NULL, line); DS_TRACE("lexer_next: return } pos=%zu\n", lx->pos); return t; }
+        case '(': { Token t = make_token(TOK_LPAREN, NULL, line); DS_TRACE("lexer_next: return ( pos=%zu\n", lx->pos); return t; }
+        case ')': { Token t = make_token(TOK_RPAREN, NULL, line); DS_TRACE("lexer_next: return ) pos=%zu\n", lx->pos); return t; }
+        case '[': { Token t = make_token(TOK_LBRACK, NULL, line); DS_TRACE("lexer_next: return [ pos=%zu\n", lx->pos); return t; }
+        case ']': { Token t = make_token(TOK_RBRACK, NULL, line); DS_TRACE("lexer_next: return ] pos=%zu\n", lx->pos); return t; }
+        case ':': { Token t = make_token(TOK_COLON, NULL, line); DS_TRACE("lexer_next: return : pos=%zu\n", lx->pos); return t; }
+        case '*': { Token t = make_token(TOK_STAR, NULL, line); DS_TRACE("lexer_next: return * pos=%zu\n", lx->pos); return t; }
+        case '=': {
+            if (peekc(lx, 0) == '=') { /* "==" is an operator, not TOK_EQ twice */
+                lx->pos++;
+                Token t = make_token(TOK_OTHER, NULL, line);
+                t.op = LEX_OP2('=', '=');
+                return t;
+            }
+            Token t = make_token(TOK_EQ, NULL, line); DS_TRACE("lexer_next: return = pos=%zu\n", lx->pos); return t;
+        }
+        case '\'': {
+            /* a character constant is a number spelled as written */
+            char q;
+            while ((q = peekc(lx, 0)) && q != '\'' && q != '\n') {
+                if (q == '\\' && peekc(lx, 1)) lx->pos += 2; else lx->pos++;
+            }
+            if (peekc(lx, 0) == '\'') lx->pos++;
+            Token t = make_token(TOK_NUMBER, NULL, line);
+            t.text = take_text(lx);
+            lexer_parse_char(t.text, &t.num);
+            DS_TRACE("lexer_next: return char constant text=%s pos=%zu\n", t.text, lx->pos);
+            return t;
+        }
         case '"': {
-            size_t start = lx->pos;
-            while (b[lx->pos] && b[lx->pos] != '"') {
-                if (b[lx->pos] == '\\') lx->pos += 2; else lx->pos++;
+            lx->mark = lx->pos;
+            char q;
+            while ((q = peekc(lx, 0)) && q != '"') {
+                if (q == '\n') lx->line++;
+                if (q == '\\' && peekc(lx, 1)) lx->pos += 2; else lx->pos++;
             }
-            size_t len = lx->pos - start;
-            char *s = (char*)malloc(len+1);
-            memcpy(s, b+start, len);
-            s[len] = '\0';
-            if (b[lx->pos] == '"') lx->pos++;
-            Token t = make_token(TOK_STRING, s, line);
-            fprintf(stderr, "lexer_next: return string pos=%zu\n", lx->pos);
+            Token t = make_token(TOK_STRING, NULL, line);
+            t.text = take_text(lx);
+            if (peekc(lx, 0) == '"') lx->pos++;
+            DS_TRACE("lexer_next: return string pos=%zu\n", lx->pos);
+            return t;
+        }
+        default: {
+            Token t = make_token(TOK_OTHER, NULL, line);
+            t.op = (unsigned char)c;
+            char d = peekc(lx, 0);
+            if ((d == c && strchr("<>&|", c)) || (d == '=' && strchr("<>!", c))) {
+                t.op = LEX_OP2(c, d);
+                lx->pos++;
+            }
+            DS_TRACE("lexer_next: return other pos=%zu\n", lx->pos);
             return t;
         }
-        default: { Token t = make_token(TOK_OTHER, NULL, line); fprintf(stderr, "lexer_next: return other pos=%zu\n", lx->pos); return t; }
     }
 }
 
+Token lexer_next(Lexer *lx) {
+    if (lx->has_peek) {
+        lx->has_peek = 0;
+        Token t = lx->peeked;
+        lx->peeked.text = NULL; /* ownership moved */
+        return t;
+    }
+    if (!lx->timing) {
+        lx->stats.tokens++;
+        return lex_token(lx);
+    }
+    double wall0 = clock_wall(), cpu0 = clock_thread_cpu();
+    double read_wall0 = lx->stats.read_wall, read_cpu0 = lx->stats.read_cpu;
+    Token t = lex_token(lx);
+    /* window refills are accounted as read time */
+    lx->stats.lex_wall += clock_wall() - wall0 - (lx->stats.read_wall - read_wall0);
+    lx->stats.lex_cpu += clock_thread_cpu() - cpu0 - (lx->stats.read_cpu - read_cpu0);
+    lx->stats.tokens++;
+    return t;
+}
+
 Token lexer_peek(Lexer *lx) {
     if (!lx->has_peek) {
+        lx->peek_pos = lx->pos;
+        lx->peek_line = lx->line;
         lx->peeked = lexer_next(lx);
         lx->has_peek = 1;
     }
     return lx->peeked;
 }
 
+size_t lexer_offset(const Lexer *lx) {
+    return lx->has_peek ? lx->peek_pos : lx->pos;
+}
+
+int lexer_line(const Lexer *lx) {
+    return lx->has_peek ? lx->peek_line : lx->line;
+}
+
+/* ---- raw block skipping ----
+ * Function bodies are skipped without producing tokens: the scanner looks at
+ * 8 bytes at a time and only drops to byte-wise handling when a word holds a
+ * brace, quote or slash. Newlines in skipped words are counted with popcount
+ * so line numbers stay right. */
+
+#define SWAR_ONES 0x0101010101010101ULL
+#define SWAR_LOW7 0x7F7F7F7F7F7F7F7FULL
+
+/* High bit set in every byte of w equal to c (exact, no false positives). */
+static inline uint64_t swar_eq(uint64_t w, unsigned char c) {
+    uint64_t x = w ^ (SWAR_ONES * c);
+    uint64_t t = (x & SWAR_LOW7) + SWAR_LOW7;
+    return ~(t | x | SWAR_LOW7);
+}
+
+#if defined(__GNUC__)
+#define swar_popcount(x) __builtin_popcountll(x)
+#define swar_ctz(x) __builtin_ctzll(x)
+#else
+static int swar_popcount(uint64_t x) { int n = 0; while (x) { x &= x - 1; n++; } return n; }
+static int swar_ctz(uint64_t x) { int n = 0; while (!(x & 1)) { x >>= 1; n++; } return n; }
+#endif
+
+static uint64_t swar_load(const char *p) {
+    uint64_t w;
+    memcpy(&w, p, 8);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    w = __builtin_bswap64(w);
+#endif
+    return w;
+}
+
+static int count_newlines(const char *p, size_t n) {
+    int lines = 0;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) lines += swar_popcount(swar_eq(swar_load(p + i), '\n'));
+    for (; i < n; ++i) lines += (p[i] == '\n');
+    return lines;
+}
+
+/* Skips bytes up to (not including) the next newline. */
+static void skip_line_raw(Lexer *lx) {
+    while (1) {
+        const char *nl = (const char*)memchr(lx->buf + lx->pos, '\n', lx->len - lx->pos);
+        if (nl) { lx->pos = (size_t)(nl - lx->buf); return; }
+        lx->pos = lx->mark = lx->len;
+        if (!peekc(lx, 0)) return;
+    }
+}
+
+/* Skips a block comment; pos is just after the opening slash-star. */
+static void skip_block_comment_raw(Lexer *lx) {
+    while (1) {
+        size_t avail = lx->len - lx->pos;
+        const char *star = (const char*)memchr(lx->buf + lx->pos, '*', avail);
+        size_t upto = star ? (size_t)(star - lx->buf) : lx->len;
+        lx->line += count_newlines(lx->buf + lx->pos, upto - lx->pos);
+        lx->pos = lx->mark = upto;
+        if (!star) {
+            if (!peekc(lx, 0)) return;
+            continue;
+        }
+        if (peekc(lx, 1) == '/') { lx->pos += 2; return; }
+        if (!peekc(lx, 1)) { lx->pos++; return; }
+        lx->pos++;
+    }
+}
+
+/* Skips a string or character literal; pos is on the opening quote. */
+static void skip_literal_raw(Lexer *lx, char q) {
+    lx->pos++;
+    char c;
+    while ((c = peekc(lx, 0)) && c != q) {
+        if (c == '\n') return; /* unterminated: give up at end of line */
+        if (c == '\\' && peekc(lx, 1)) {
+            if (lx->buf[lx->pos + 1] == '\n') lx->line++;
+            lx->pos += 2;
+            continue;
+        }
+        lx->pos++;
+    }
+    if (c == q) lx->pos++;
+}
+
+int lexer_skip_block(Lexer *lx) {
+    if (lx->has_peek) {
+        if (lx->peeked.kind != TOK_LBRACE) return 0;
+        lx->has_peek = 0; /* the lexer already stands right after '{' */
+    } else {
+        skip_space(lx);
+        if (peekc(lx, 0) != '{') return 0;
+        lx->pos++;
+    }
+    int depth = 1;
+    while (depth > 0) {
+        lx->mark = lx->pos;
+        if (lx->pos + 8 <= lx->len || (peekc(lx, 7) && lx->pos + 8 <= lx->len)) {
+            uint64_t w = swar_load(lx->buf + lx->pos);
+            uint64_t special = swar_eq(w, '{') | swar_eq(w, '}') | swar_eq(w, '"') |
+                               swar_eq(w, '\'') | swar_eq(w, '/');
+            uint64_t nl = swar_eq(w, '\n');
+            if (!special) {
+                lx->line += swar_popcount(nl);
+                lx->pos += 8;
+                continue;
+            }
+            int k = swar_ctz(special) / 8;
+            if (k > 0) {
+                lx->line += swar_popcount(nl & ((1ULL << (8 * k)) - 1));
+                lx->pos += (size_t)k;
+            }
+        }
+        char c = peekc(lx, 0);
+        if (!c) break;
+        switch (c) {
+            case '{': depth++; lx->pos++; break;
+            case '}': depth--; lx->pos++; break;
+            case '"':
+            case '\'': skip_literal_raw(lx, c); break;
+            case '/':
+                if (peekc(lx, 1) == '/') { skip_line_raw(lx); break; }
+                if (peekc(lx, 1) == '*') { lx->pos += 2; skip_block_comment_raw(lx); break; }
+                lx->pos++;
+                break;
+            case '\n': lx->line++; lx->pos++; break;
+            default: lx->pos++; break;
+        }
+    }
+    lx->bol = 0;
+    return depth == 0;
+}
+
+/* ---- numeric literals ----
+ * Decimal and hex digits are converted eight at a time: one word load, a
+ * range check on all eight bytes and a few multiply/shift steps, instead of
+ * a multiply-add per digit. Tails, octal, binary and digit separators go
+ * byte by byte; floating literals are left to strtod. */
+
+#define SWAR_HIGH 0x8080808080808080ULL
+
+/* High bit set in every byte of w within [lo, hi]; bytes must be ASCII. */
+static inline uint64_t swar_in_range(uint64_t w, unsigned char lo, unsigned char hi) {
+    return (w + SWAR_ONES * (unsigned char)(0x80 - lo)) & ~(w + SWAR_ONES * (unsigned char)(0x7F - hi)) & SWAR_HIGH;
+}
+
+static inline int swar_all_decimal(uint64_t w) {
+    return !(w & SWAR_HIGH) && swar_in_range(w, '0', '9') == SWAR_HIGH;
+}
+
+static inline int swar_all_hex(uint64_t w) {
+    return !(w & SWAR_HIGH) &&
+           (swar_in_range(w, '0', '9') | swar_in_range(w | (SWAR_ONES * 0x20), 'a', 'f')) == SWAR_HIGH;
+}
+
+/* Eight decimal digits, first digit in the lowest byte. */
+static inline uint32_t swar_decimal8(uint64_t w) {
+    w -= SWAR_ONES * '0';
+    w = (w * 10) + (w >> 8); /* adjacent pairs */
+    w = (((w & 0x000000FF000000FFULL) * (100 + (1000000ULL << 32))) +
+         (((w >> 16) & 0x000000FF000000FFULL) * (1 + (10000ULL << 32)))) >> 32;
+    return (uint32_t)w;
+}
+
+/* Eight hex digits, first digit in the lowest byte. */
+static inline uint32_t swar_hex8(uint64_t w) {
+    /* '0'-'9' keep their low nibble; letters have bit 6 set and need +9 */
+    uint64_t v = (w & 0x0F0F0F0F0F0F0F0FULL) + ((w >> 6) & SWAR_ONES) * 9;
+    v = ((v << 4) | (v >> 8)) & 0x00FF00FF00FF00FFULL;
+    v = ((v << 8) | (v >> 16)) & 0x0000FFFF0000FFFFULL;
+    return (uint32_t)(((v << 16) | (v >> 32)) & 0xFFFFFFFFULL);
+}
+
+static int digit_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return 99;
+}
+
+/* Digits of s[i..n) in base; returns where they end. */
+static size_t convert_digits(const char *s, size_t n, size_t i, int base, NumLit *out) {
+    uint64_t v = 0;
+    int overflow = 0;
+    if (base == 10) {
+        for (; n - i >= 8 && swar_all_decimal(swar_load(s + i)); i += 8) {
+            uint32_t d = swar_decimal8(swar_load(s + i));
+            if (v > (UINT64_MAX - d) / 100000000u) overflow = 1;
+            v = v * 100000000u + d;
+        }
+    } else if (base == 16) {
+        for (; n - i >= 8 && swar_all_hex(swar_load(s + i)); i += 8) {
+            if (v >> 32) overflow = 1;
+            v = (v << 32) | swar_hex8(swar_load(s + i));
+        }
+    }
+    for (; i < n; ++i) {
+        if (s[i] == '\'') continue;
+        int d = digit_value(s[i]);
+        if (d >= base) break;
+        if (v > (UINT64_MAX - (unsigned)d) / (unsigned)base) overflow = 1;
+        v = v * (unsigned)base + (unsigned)d;
+    }
+    out->value = v;
+    out->overflow = (unsigned char)overflow;
+    return i;
+}
+
+static int parse_floating(const char *s, size_t n, NumLit *out) {
+    char local[64];
+    char *copy = n < sizeof(local) ? local : (char*)ds_malloc(n + 1);
+    size_t k = 0;
+    for (size_t i = 0; i < n; ++i) {
+        if (s[i] != '\'') copy[k++] = s[i];
+    }
+    copy[k] = '\0';
+    char *end;
+    out->is_float = 1;
+    out->fvalue = strtod(copy, &end);
+    out->valid = end != copy && (!end[0] || (!end[1] && strchr("fFlL", end[0])));
+    if (copy != local) free(copy);
+    return out->valid;
+}
+
+int lexer_parse_number(const char *s, size_t n, NumLit *out) {
+    memset(out, 0, sizeof(*out));
+    if (n == 0) return 0;
+    int base = 10;
+    size_t i = 0;
+    if (n >= 2 && s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) { base = 16; i = 2; }
+    else if (n >= 2 && s[0] == '0' && (s[1] == 'b' || s[1] == 'B')) { base = 2; i = 2; }
+    else if (s[0] == '0') base = 8;
+    for (size_t k = i; k < n; ++k) {
+        char c = s[k];
+        if (c == '.' || (base == 16 && (c == 'p' || c == 'P')) ||
+            ((base == 10 || base == 8) && (c == 'e' || c == 'E'))) {
+            return parse_floating(s, n, out);
+        }
+    }
+    size_t end = convert_digits(s, n, i, base, out);
+    if (end == i && base != 8) return 0; /* "0x" without digits */
+    int has_u = 0, has_l = 0;
+    for (i = end; i < n; ++i) { /* suffix: u, l, ll in either order and case */
+        char c = s[i];
+        if ((c == 'u' || c == 'U') && !has_u) {
+            has_u = 1;
+        } else if ((c == 'l' || c == 'L') && !has_l) {
+            has_l = 1;
+            if (i + 1 < n && s[i + 1] == c) i++;
+        } else {
+            return 0;
+        }
+    }
+    out->valid = 1;
+    return 1;
+}
+
+int lexer_parse_char(const char *s, NumLit *out) {
+    memset(out, 0, sizeof(*out));
+    const char *p = s + 1;
+    unsigned long v = (unsigned char)*p;
+    if (*p == '\\') {
+        p++;
+        switch (*p) {
+            case 'n': v = '\n'; p++; break;
+            case 't': v = '\t'; p++; break;
+            case 'r': v = '\r'; p++; break;
+            case 'a': v = '\a'; p++; break;
+            case 'b': v = '\b'; p++; break;
+            case 'f': v = '\f'; p++; break;
+            case 'v': v = '\v'; p++; break;
+            case 'x':
+                v = 0;
+                for (p++; digit_value(*p) < 16 && v <= 0xff; ++p) v = v * 16 + (unsigned)digit_value(*p);
+                break;
+            default:
+                if (*p >= '0' && *p <= '7') {
+                    v = 0;
+                    for (int k = 0; k < 3 && *p >= '0' && *p <= '7'; ++k, ++p) v = v * 8 + (unsigned)(*p - '0');
+                } else {
+                    v = (unsigned char)*p++; /* \\, \', \", \? */
+                }
+                break;
+        }
+    } else if (*p) {
+        p++;
+    }
+    /* plain char may be signed: only ASCII values are the same everywhere */
+    out->value = v;
+    out->valid = p > s + 1 && p[0] == '\'' && !p[1] && v < 0x80;
+    return out->valid;
+}
+
+/* ---- split points for chunked parsing ---- */
+
+static size_t skip_literal_at(const char *buf, size_t len, size_t i, int *line) {
+    char q = buf[i++];
+    while (i < len && buf[i] != q && buf[i] != '\n') {
+        if (buf[i] == '\\' && i + 1 < len) {
+            if (buf[i + 1] == '\n') (*line)++;
+            i++;
+        }
+        i++;
+    }
+    return (i < len && buf[i] == q) ? i + 1 : i;
+}
+
+size_t lexer_find_splits(const char *buf, size_t len, size_t chunk_bytes, LexSplit **out) {
+    size_t count = 1, cap = 16;
+    LexSplit *splits = (LexSplit*)ds_malloc(cap * sizeof(LexSplit));
+    splits[0].offset = 0;
+    splits[0].line = 1;
+    int depth = 0, paren = 0, line = 1, bol = 1;
+    int body = 0, split = 0; /* the open top-level brace is a function body */
+    char prev = 0;
+    size_t last = 0;
+    size_t i = 0;
+    while (i < len) {
+        char c = buf[i];
+        switch (c) {
+            case '\n':
+                line++;
+                bol = 1;
+                i++;
+                continue;
+            case ' ': case '\t': case '\r': case '\f': case '\v':
+                i++;
+                continue;
+            case '#':
+                if (bol) {
+                    size_t j = i + 1;
+                    while (j < len && (buf[j] == ' ' || buf[j] == '\t')) j++;
+                    int marker = (j < len && isdigit((unsigned char)buf[j]));
+                    int n = 0;
+                    while (marker && j < len && isdigit((unsigned char)buf[j])) n = n * 10 + (buf[j++] - '0');
+                    while (j < len && buf[j] != '\n') {
+                        if (buf[j] == '\\' && j + 1 < len && buf[j + 1] == '\n') { line++; j++; }
+                        j++;
+                    }
+                    if (marker) line = n - 1;
+                    i = j;
+                    continue;
+                }
+                break;
+            case '"':
+            case '\'':
+                i = skip_literal_at(buf, len, i, &line);
+                bol = 0;
+                prev = c;
+                continue;
+            case '/':
+                if (i + 1 < len && buf[i + 1] == '/') {
+                    while (i < len && buf[i] != '\n') i++;
+                    continue;
+                }
+                if (i + 1 < len && buf[i + 1] == '*') {
+                    i += 2;
+                    while (i < len && !(buf[i] == '*' && i + 1 < len && buf[i + 1] == '/')) {
+                        if (buf[i] == '\n') line++;
+                        i++;
+                    }
+                    i = (i < len) ? i + 2 : len;
+                    continue;
+                }
+                break;
+            case '{':
+                if (depth++ == 0) body = (prev == ')');
+                break;
+            case '}':
+                if (depth > 0) depth--;
+                /* a declarator may still follow the '}' of a struct, union or
+                 * enum, but nothing follows the '}' of a function body */
+                split = (depth == 0 && paren == 0 && body);
+                break;
+            case '(': paren++; break;
+            case ')': if (paren > 0) paren--; break;
+            case ';':
+                split = (depth == 0 && paren == 0);
+                break;
+            default:
+                break;
+        }
+        if (split && i + 1 - last >= chunk_bytes && i + 1 < len) {
+            if (count == cap) {
+                cap *= 2;
+                splits = (LexSplit*)ds_realloc(splits, cap * sizeof(LexSplit));
+            }
+            splits[count].offset = i + 1;
+            splits[count].line = line;
+            count++;
+            last = i + 1;
+        }
+        split = 0;
+        bol = 0;
+        prev = c;
+        i++;
+    }
+    *out = splits;
+    return count;
+}
+
 int token_is_ident(const Token *t, const char *s) {
     if (!t) return 0;
     if (t->kind != TOK_IDENT) return 0;
     return strcmp(t->text, s) == 0;
 }
 
+void lexer_set_timing(Lexer *lx, int on) {
+    lx->timing = on;
+}
+
+void lexer_get_stats(const Lexer *lx, LexStats *out) {
+    *out = lx->stats;
+}
+
 void lexer_destroy(Lexer *lx) {
     if (!lx) return;
     if (lx->peeked.text) free(lx->peeked.text);
-    free(lx->buf);
+    if (lx->src && lx->owns_src) fclose(lx->src);
+    if (lx->owns_buf) free(lx->buf);
     free(lx);
 }
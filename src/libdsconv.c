@@ -0,0 +1,138 @@
+#include <stdlib.h>
+#include <string.h>
+#include "libdsconv.h"
+#include "parser.h"
+#include "generator.h"
+#include "preproc.h"
+#include "intern.h"
+#include "memstat.h"
+
+struct DSConvContext {
+    Options opts;
+    PPContext *pp;
+    TypeTable *types;
+    ASTRoot *ast;
+    char **roots; /* owned copies, exposed through opts.roots */
+};
+
+DSConvContext *dsconv_create(void) {
+    DSConvContext *ctx = (DSConvContext*)ds_calloc(1, sizeof(DSConvContext));
+    ctx->opts.name_policy = NAME_POLICY_PRESERVE;
+    ctx->opts.assign_style = ASSIGN_BOTH;
+    ctx->opts.expand_mode = EXPAND_MEMBERS;
+    ctx->opts.silent = 1;
+    ctx->opts.preprocess = 1;
+    ctx->opts.jobs = 1;
+    ctx->pp = pp_create();
+    ctx->opts.pp = ctx->pp;
+    ctx->types = type_table_create();
+    ctx->ast = (ASTRoot*)ds_calloc(1, sizeof(ASTRoot));
+    return ctx;
+}
+
+void dsconv_destroy(DSConvContext *ctx) {
+    if (!ctx) return;
+    ast_free(ctx->ast);
+    type_table_destroy(ctx->types);
+    pp_destroy(ctx->pp);
+    for (int i = 0; i < ctx->opts.root_count; ++i) free(ctx->roots[i]);
+    free(ctx->roots);
+    free(ctx);
+}
+
+Options *dsconv_options(DSConvContext *ctx) {
+    return &ctx->opts;
+}
+
+void dsconv_add_include_path(DSConvContext *ctx, const char *dir) {
+    pp_add_include_path(ctx->pp, dir);
+}
+
+void dsconv_define(DSConvContext *ctx, const char *def) {
+    pp_define(ctx->pp, def);
+}
+
+void dsconv_add_root(DSConvContext *ctx, const char *name) {
+    ctx->roots = (char**)ds_realloc(ctx->roots, (ctx->opts.root_count + 1) * sizeof(char*));
+    ctx->roots[ctx->opts.root_count++] = ds_strdup(name);
+    ctx->opts.roots = (const char**)ctx->roots;
+}
+
+ASTRoot *dsconv_parse(DSConvContext *ctx, const char *data, size_t len) {
+    return parse_memory(data, len, &ctx->opts);
+}
+
+ASTRoot *dsconv_parse_file(DSConvContext *ctx, const char *path) {
+    return parse_file(path, &ctx->opts);
+}
+
+void dsconv_merge(DSConvContext *ctx, ASTRoot *ast, const char *origin) {
+    if (!ast) return;
+    type_table_merge(ctx->types, ctx->ast, ast, origin);
+    free(ast);
+}
+
+const ASTRoot *dsconv_ast(const DSConvContext *ctx) {
+    return ctx->ast;
+}
+
+const MergeStats *dsconv_merge_stats(const DSConvContext *ctx) {
+    return type_table_stats(ctx->types);
+}
+
+/* The context keeps its linked AST, which later dsconv_merge calls extend
+ * and dsconv_ast exposes; each generation works from a flat copy. */
+int dsconv_generate(DSConvContext *ctx, DSConvWriteFn write, void *user) {
+    FlatAST *flat = generate_prepare(ctx->ast, NULL);
+    int rc = generate_to_sink(flat, &ctx->opts, write, user, NULL);
+    flat_destroy(flat);
+    return rc;
+}
+
+typedef struct {
+    char *buf;
+    size_t cap, len;
+} FixedSink;
+
+static void fixed_write(const char *data, size_t len, void *user) {
+    FixedSink *s = (FixedSink*)user;
+    if (s->len + 1 < s->cap) {
+        size_t room = s->cap - 1 - s->len;
+        memcpy(s->buf + s->len, data, len < room ? len : room);
+    }
+    s->len += len;
+}
+
+size_t dsconv_generate_into(DSConvContext *ctx, char *buf, size_t cap) {
+    FixedSink s = { buf, cap, 0 };
+    dsconv_generate(ctx, fixed_write, &s);
+    if (cap > 0) buf[s.len < cap ? s.len : cap - 1] = '\0';
+    return s.len;
+}
+
+typedef struct {
+    char *buf;
+    size_t cap, len;
+} GrowSink;
+
+static void grow_write(const char *data, size_t len, void *user) {
+    GrowSink *s = (GrowSink*)user;
+    if (s->len + len + 1 > s->cap) {
+        while (s->len + len + 1 > s->cap) s->cap = s->cap ? s->cap * 2 : 4096;
+        s->buf = (char*)ds_realloc(s->buf, s->cap);
+    }
+    memcpy(s->buf + s->len, data, len);
+    s->len += len;
+}
+
+char *dsconv_generate_alloc(DSConvContext *ctx, size_t *len_out) {
+    GrowSink s = { NULL, 0, 0 };
+    grow_write("", 0, &s);
+    if (dsconv_generate(ctx, grow_write, &s) != 0) {
+        free(s.buf);
+        return NULL;
+    }
+    s.buf[s.len] = '\0';
+    if (len_out) *len_out = s.len;
+    return s.buf;
+}
@@ -0,0 +1,42 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "memstat.h"
+
+static atomic_size_t alloc_count;
+static atomic_size_t alloc_bytes;
+
+static void note_alloc(size_t n) {
+    atomic_fetch_add_explicit(&alloc_count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&alloc_bytes, n, memory_order_relaxed);
+}
+
+void *ds_malloc(size_t n) {
+    note_alloc(n);
+    return malloc(n);
+}
+
+void *ds_calloc(size_t count, size_t size) {
+    note_alloc(count * size);
+    return calloc(count, size);
+}
+
+void *ds_realloc(void *p, size_t n) {
+    note_alloc(n);
+    return realloc(p, n);
+}
+
+char *ds_strdup(const char *s) {
+    size_t n = strlen(s) + 1;
+    char *d = (char*)ds_malloc(n);
+    if (d) memcpy(d, s, n);
+    return d;
+}
+
+size_t memstat_alloc_count(void) {
+    return atomic_load_explicit(&alloc_count, memory_order_relaxed);
+}
+
+size_t memstat_alloc_bytes(void) {
+    return atomic_load_explicit(&alloc_bytes, memory_order_relaxed);
+}
@@ -1,196 +1,623 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include "dsconv.h"
 #include "parser.h"
 #include "lexer.h"
 #include "ast.h"
-
-/* Simple symbol/typedef table for aliases */
-typedef struct Alias {
-    char *name;
-    Type *type;
-    struct Alias *next;
-} Alias;
-
-static Alias *alias_table = NULL;
-
-static void alias_add(const char *name, Type *t) {
-    Alias *a = (Alias*)malloc(sizeof(Alias));
-    a->name = strdup(name);
-    a->type = t;
-    a->next = alias_table;
-    alias_table = a;
-}
+#include "memstat.h"
+#include "report.h"
+#include "preproc.h"
+#include "thread.h"
 
 static Type *type_make_builtin(const char *name) {
-    Type *t = (Type*)calloc(1, sizeof(Type));
+    Type *t = (Type*)ds_calloc(1, sizeof(Type));
     t->kind = TYPE_BUILTIN;
-    t->u.builtin_name = strdup(name);
+    t->u.builtin_name = ds_strdup(name);
     return t;
 }
 
 static Type *type_make_ptr(Type *base) {
-    Type *t = (Type*)calloc(1, sizeof(Type));
+    Type *t = (Type*)ds_calloc(1, sizeof(Type));
     t->kind = TYPE_POINTER;
     t->u.ptr.base = base;
     return t;
 }
 
 static Type *type_make_array(Type *base, int len) {
-    Type *t = (Type*)calloc(1, sizeof(Type));
+    Type *t = (Type*)ds_calloc(1, sizeof(Type));
     t->kind = TYPE_ARRAY;
     t->u.array.base = base;
     t->u.array.length = len;
     return t;
 }
 
+/* Whether t is a struct, union or enum definition (as opposed to a mere
+ * reference to a tag). */
+static int defines_body(const Type *t) {
+    if (t->kind == TYPE_STRUCT || t->kind == TYPE_UNION) return t->u.s.members != NULL;
+    return t->kind == TYPE_ENUM && t->u.en.values != NULL;
+}
+
 static void ast_add_node(ASTRoot *root, Type *t, const char *name, int is_typedef) {
-    ASTNode *n = (ASTNode*)calloc(1, sizeof(ASTNode));
+    ASTNode *n = (ASTNode*)ds_calloc(1, sizeof(ASTNode));
     n->type = t;
-    if (name) n->name = strdup(name);
+    if (name) n->name = ds_strdup(name);
     n->is_typedef = is_typedef;
-    n->next = root->first;
-    root->first = n;
+    if (root->last) root->last->next = n; else root->first = n;
+    root->last = n;
 }
 
-/*
-static void skip_braces(Lexer *lx) {
-    int depth = 1;
-    while (depth > 0) {
+/* Skips an initializer after '=': a braced list is skipped raw, anything
+ * else up to the ',' or ';' that ends it (outside parentheses). Only a '{'
+ * right after ')' starts a compound literal ((struct S){ ... }). */
+static void skip_initializer(Lexer *lx) {
+    if (lexer_peek(lx).kind == TOK_LBRACE) {
+        lexer_skip_block(lx);
+        return;
+    }
+    int depth = 0;
+    while (1) {
+        Token t = lexer_peek(lx);
+        if (t.kind == TOK_EOF) return;
+        if (depth == 0 && (t.kind == TOK_SEMI || t.kind == TOK_COMMA)) return;
+        if (t.kind == TOK_LPAREN || t.kind == TOK_LBRACK) depth++;
+        else if ((t.kind == TOK_RPAREN || t.kind == TOK_RBRACK) && depth > 0) depth--;
+        t = lexer_next(lx);
+        if (t.text) free(t.text);
+        if (t.kind == TOK_RPAREN && lexer_peek(lx).kind == TOK_LBRACE) lexer_skip_block(lx);
+    }
+}
+
+/* Skips the rest of a declaration up to and including its ';'. */
+static void skip_to_semi(Lexer *lx) {
+    while (1) {
         Token t = lexer_next(lx);
-        if (t.kind == TOK_LBRACE) depth++;
-        else if (t.kind == TOK_RBRACE) depth--;
+        TokenKind k = t.kind;
         if (t.text) free(t.text);
-        if (t.kind == TOK_EOF) break;
+        if (k == TOK_SEMI || k == TOK_EOF) return;
+        if (k == TOK_EQ) skip_initializer(lx);
+        else if (lexer_peek(lx).kind == TOK_LBRACE) lexer_skip_block(lx);
+    }
+}
+
+/* Spelling of a builtin type keyword, NULL for any other token. Keyword
+ * tokens carry no text, so the parser spells them itself. */
+static const char *builtin_keyword(TokenKind k) {
+    switch (k) {
+        case TOK_UNSIGNED: return "unsigned";
+        case TOK_SIGNED: return "signed";
+        case TOK_SHORT: return "short";
+        case TOK_LONG: return "long";
+        case TOK_INT: return "int";
+        case TOK_CHAR: return "char";
+        case TOK_VOID: return "void";
+        case TOK_FLOAT: return "float";
+        case TOK_DOUBLE: return "double";
+        default: return NULL;
+    }
+}
+
+/* ---- enumerator scope ----
+ * The enumerators parsed so far, by name, so array sizes can use them.
+ * First definition wins, like the merge in intern.c. */
+
+typedef struct {
+    char *name;
+    int64_t value;
+} EnumName;
+
+typedef struct {
+    EnumName *slots;
+    size_t cap, count;
+    int quiet; /* sizes and enumerator values not understood are left to
+                * parse_chunked to report */
+} EnumScope;
+
+static uint64_t enum_hash(const char *s) {
+    uint64_t h = 1469598103934665603ull;
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+static EnumName *enum_slot(EnumName *slots, size_t cap, const char *name) {
+    size_t i = enum_hash(name) & (cap - 1);
+    while (slots[i].name && strcmp(slots[i].name, name) != 0) i = (i + 1) & (cap - 1);
+    return &slots[i];
+}
+
+static void enum_scope_add(EnumScope *sc, const char *name, int64_t value) {
+    if ((sc->count + 1) * 2 > sc->cap) {
+        size_t cap = sc->cap ? sc->cap * 2 : 64;
+        EnumName *slots = (EnumName*)ds_calloc(cap, sizeof(EnumName));
+        for (size_t i = 0; i < sc->cap; ++i) {
+            if (sc->slots[i].name) *enum_slot(slots, cap, sc->slots[i].name) = sc->slots[i];
+        }
+        free(sc->slots);
+        sc->slots = slots;
+        sc->cap = cap;
+    }
+    EnumName *e = enum_slot(sc->slots, sc->cap, name);
+    if (e->name) return;
+    e->name = ds_strdup(name);
+    e->value = value;
+    sc->count++;
+}
+
+static const EnumName *enum_scope_find(const EnumScope *sc, const char *name) {
+    if (!sc || !sc->count) return NULL;
+    const EnumName *e = enum_slot(sc->slots, sc->cap, name);
+    return e->name ? e : NULL;
+}
+
+static void enum_scope_free(EnumScope *sc) {
+    for (size_t i = 0; i < sc->cap; ++i) free(sc->slots[i].name);
+    free(sc->slots);
+}
+
+static Type *parse_declarator(Lexer *lx, EnumScope *sc, Type *base, char **name_out);
+
+/* ---- constant expressions ----
+ * Enumerator values and array sizes. The tokens are collected first and
+ * then evaluated in 64 bits, with the operators and precedence of #if
+ * expressions (preproc.c): integer literals and character constants,
+ * enumerators defined earlier (in the same enum or before it),
+ * parentheses and casts (which are ignored). */
+
+typedef struct {
+    Token *toks;
+    size_t count, cap, pos;
+    const EnumValue *names; /* enumerators usable as operands, or NULL */
+    const EnumScope *scope; /* more of them, or NULL */
+    int ok;                 /* cleared by anything not understood */
+} ConstExpr;
+
+/* Collects tokens up to (not including) end1 or end2 outside parentheses
+ * and brackets, or a ';'. */
+static void cx_collect(Lexer *lx, TokenKind end1, TokenKind end2, ConstExpr *x) {
+    memset(x, 0, sizeof(*x));
+    int depth = 0;
+    while (1) {
+        Token t = lexer_peek(lx);
+        if (t.kind == TOK_EOF || t.kind == TOK_SEMI) break;
+        if (depth == 0 && (t.kind == end1 || t.kind == end2)) break;
+        if (t.kind == TOK_LPAREN || t.kind == TOK_LBRACK) depth++;
+        else if ((t.kind == TOK_RPAREN || t.kind == TOK_RBRACK) && depth > 0) depth--;
+        if (x->count == x->cap) {
+            x->cap = x->cap ? x->cap * 2 : 8;
+            x->toks = (Token*)ds_realloc(x->toks, x->cap * sizeof(Token));
+        }
+        x->toks[x->count++] = lexer_next(lx);
+    }
+}
+
+static void cx_free(ConstExpr *x) {
+    for (size_t i = 0; i < x->count; ++i) free(x->toks[i].text);
+    free(x->toks);
+}
+
+static int cx_find(const ConstExpr *x, const char *name, int64_t *value) {
+    for (const EnumValue *e = x->names; e; e = e->next) {
+        /* one kept as written has no value to use */
+        if (strcmp(e->name, name) == 0) { *value = e->value; return !e->expr; }
+    }
+    const EnumName *e = enum_scope_find(x->scope, name);
+    if (e) *value = e->value;
+    return e != NULL;
+}
+
+/* Operator spelled by the next token, or 0. */
+static int cx_op(const ConstExpr *x) {
+    if (x->pos >= x->count) return 0;
+    const Token *t = &x->toks[x->pos];
+    if (t->kind == TOK_STAR) return '*';
+    if (t->kind == TOK_COLON) return ':';
+    return t->kind == TOK_OTHER ? t->op : 0;
+}
+
+static int cx_accept(ConstExpr *x, int op) {
+    if (cx_op(x) != op) return 0;
+    x->pos++;
+    return 1;
+}
+
+/* Whether the '(' at pos starts a cast: type keywords, names that are not
+ * enumerators and '*', then ')'. Returns the index of the ')'. */
+static size_t cx_cast_end(const ConstExpr *x) {
+    size_t i = x->pos + 1;
+    int64_t v;
+    while (i < x->count) {
+        const Token *t = &x->toks[i];
+        if (builtin_keyword(t->kind) || t->kind == TOK_CONST || t->kind == TOK_VOLATILE || t->kind == TOK_STAR ||
+            (t->kind == TOK_IDENT && !cx_find(x, t->text, &v))) {
+            i++;
+            continue;
+        }
+        break;
+    }
+    return (i > x->pos + 1 && i < x->count && x->toks[i].kind == TOK_RPAREN) ? i : 0;
+}
+
+static int64_t cx_cond(ConstExpr *x);
+
+static int64_t cx_unary(ConstExpr *x) {
+    if (cx_accept(x, '-')) return (int64_t)(0 - (uint64_t)cx_unary(x));
+    if (cx_accept(x, '+')) return cx_unary(x);
+    if (cx_accept(x, '~')) return ~cx_unary(x);
+    if (cx_accept(x, '!')) return !cx_unary(x);
+    if (x->pos >= x->count) { x->ok = 0; return 0; }
+    const Token *t = &x->toks[x->pos];
+    if (t->kind == TOK_LPAREN) {
+        size_t cast = cx_cast_end(x);
+        if (cast) {
+            x->pos = cast + 1;
+            return cx_unary(x);
+        }
+        x->pos++;
+        int64_t v = cx_cond(x);
+        if (x->pos < x->count && x->toks[x->pos].kind == TOK_RPAREN) x->pos++;
+        else x->ok = 0;
+        return v;
+    }
+    x->pos++;
+    if (t->kind == TOK_NUMBER && t->num.valid && !t->num.is_float && !t->num.overflow) return (int64_t)t->num.value;
+    int64_t v;
+    if (t->kind == TOK_IDENT && cx_find(x, t->text, &v)) return v;
+    x->ok = 0;
+    return 0;
+}
+
+static int64_t cx_mul(ConstExpr *x) {
+    int64_t v = cx_unary(x);
+    while (1) {
+        int op = cx_op(x);
+        if (op != '*' && op != '/' && op != '%') return v;
+        x->pos++;
+        int64_t r = cx_unary(x);
+        if (op == '*') { v = (int64_t)((uint64_t)v * (uint64_t)r); continue; }
+        if (r == 0) { x->ok = 0; return 0; }
+        if (r == -1) v = op == '/' ? (int64_t)(0 - (uint64_t)v) : 0; /* INT64_MIN / -1 */
+        else v = op == '/' ? v / r : v % r;
+    }
+}
+
+static int64_t cx_add(ConstExpr *x) {
+    int64_t v = cx_mul(x);
+    while (1) {
+        if (cx_accept(x, '+')) v = (int64_t)((uint64_t)v + (uint64_t)cx_mul(x));
+        else if (cx_accept(x, '-')) v = (int64_t)((uint64_t)v - (uint64_t)cx_mul(x));
+        else return v;
+    }
+}
+
+static int64_t cx_shift(ConstExpr *x) {
+    int64_t v = cx_add(x);
+    while (1) {
+        int left = cx_accept(x, LEX_OP2('<', '<'));
+        if (!left && !cx_accept(x, LEX_OP2('>', '>'))) return v;
+        int64_t r = cx_add(x);
+        if (r < 0 || r > 63) { x->ok = 0; return 0; }
+        v = left ? (int64_t)((uint64_t)v << r) : v >> r;
     }
 }
-*/
 
-/* Parse a simple type specifier (builtin or struct/union/enum tag) */
-static Type *parse_type_specifier(Lexer *lx) {
+static int64_t cx_rel(ConstExpr *x) {
+    int64_t v = cx_shift(x);
+    while (1) {
+        if (cx_accept(x, LEX_OP2('<', '='))) v = v <= cx_shift(x);
+        else if (cx_accept(x, LEX_OP2('>', '='))) v = v >= cx_shift(x);
+        else if (cx_accept(x, '<')) v = v < cx_shift(x);
+        else if (cx_accept(x, '>')) v = v > cx_shift(x);
+        else return v;
+    }
+}
+
+static int64_t cx_eq(ConstExpr *x) {
+    int64_t v = cx_rel(x);
+    while (1) {
+        if (cx_accept(x, LEX_OP2('=', '='))) v = v == cx_rel(x);
+        else if (cx_accept(x, LEX_OP2('!', '='))) v = v != cx_rel(x);
+        else return v;
+    }
+}
+
+static int64_t cx_band(ConstExpr *x) {
+    int64_t v = cx_eq(x);
+    while (cx_accept(x, '&')) v &= cx_eq(x);
+    return v;
+}
+
+static int64_t cx_bxor(ConstExpr *x) {
+    int64_t v = cx_band(x);
+    while (cx_accept(x, '^')) v ^= cx_band(x);
+    return v;
+}
+
+static int64_t cx_bor(ConstExpr *x) {
+    int64_t v = cx_bxor(x);
+    while (cx_accept(x, '|')) v |= cx_bxor(x);
+    return v;
+}
+
+static int64_t cx_land(ConstExpr *x) {
+    int64_t v = cx_bor(x);
+    while (cx_accept(x, LEX_OP2('&', '&'))) { int64_t r = cx_bor(x); v = v && r; }
+    return v;
+}
+
+static int64_t cx_lor(ConstExpr *x) {
+    int64_t v = cx_land(x);
+    while (cx_accept(x, LEX_OP2('|', '|'))) { int64_t r = cx_land(x); v = v || r; }
+    return v;
+}
+
+static int64_t cx_cond(ConstExpr *x) {
+    int64_t v = cx_lor(x);
+    if (cx_accept(x, '?')) {
+        int64_t a = cx_cond(x);
+        if (!cx_accept(x, ':')) x->ok = 0;
+        int64_t b = cx_cond(x);
+        return v ? a : b;
+    }
+    return v;
+}
+
+/* Evaluates the collected tokens. Returns 0 unless they form exactly one
+ * constant expression. */
+static int cx_eval(ConstExpr *x, int64_t *value) {
+    x->pos = 0;
+    x->ok = x->count > 0;
+    int64_t v = cx_cond(x);
+    if (!x->ok || x->pos != x->count) return 0;
+    *value = v;
+    return 1;
+}
+
+/* The literal as written when the expression is just one (possibly
+ * negated) number, for -sf; NULL otherwise. */
+static char *cx_spelling(const ConstExpr *x) {
+    const Token *t = x->toks;
+    int neg = x->count == 2 && t[0].kind == TOK_OTHER && t[0].op == '-';
+    if (x->count != (size_t)(1 + neg) || t[neg].kind != TOK_NUMBER) return NULL;
+    size_t n = strlen(t[neg].text) + 2;
+    char *s = (char*)ds_malloc(n);
+    snprintf(s, n, "%s%s", neg ? "-" : "", t[neg].text);
+    return s;
+}
+
+/* Spelling of t; simple tokens and keywords carry no text. buf holds an
+ * operator's. */
+static const char *cx_token_spelling(const Token *t, char buf[3]) {
+    switch (t->kind) {
+        case TOK_SEMI: return ";";
+        case TOK_COMMA: return ",";
+        case TOK_LBRACE: return "{";
+        case TOK_RBRACE: return "}";
+        case TOK_LPAREN: return "(";
+        case TOK_RPAREN: return ")";
+        case TOK_LBRACK: return "[";
+        case TOK_RBRACK: return "]";
+        case TOK_COLON: return ":";
+        case TOK_STAR: return "*";
+        case TOK_EQ: return "=";
+        case TOK_STRUCT: return "struct";
+        case TOK_UNION: return "union";
+        case TOK_ENUM: return "enum";
+        case TOK_TYPEDEF: return "typedef";
+        case TOK_CONST: return "const";
+        case TOK_VOLATILE: return "volatile";
+        case TOK_OTHER:
+            if (t->op > 0xff) {
+                buf[0] = (char)(t->op >> 8);
+                buf[1] = (char)(t->op & 0xff);
+                buf[2] = '\0';
+            } else {
+                buf[0] = (char)t->op;
+                buf[1] = '\0';
+            }
+            return buf;
+        default: {
+            const char *kw = builtin_keyword(t->kind);
+            return kw ? kw : t->text ? t->text : "";
+        }
+    }
+}
+
+static int cx_is_operator(const Token *t) {
+    return t->kind == TOK_OTHER || t->kind == TOK_STAR;
+}
+
+/* The collected tokens as text, for a size or value that is kept as
+ * written: a space between tokens except inside brackets, before ',' and
+ * after a unary operator. */
+static char *cx_text(const ConstExpr *x) {
+    size_t len = 1;
+    for (size_t i = 0; i < x->count; ++i) len += (x->toks[i].text ? strlen(x->toks[i].text) : 8) + 3;
+    char *s = (char*)ds_malloc(len);
+    size_t n = 0;
+    for (size_t i = 0; i < x->count; ++i) {
+        const Token *t = &x->toks[i], *p = i ? &x->toks[i - 1] : NULL;
+        int glued = !p || p->kind == TOK_LPAREN || p->kind == TOK_LBRACK ||
+                    t->kind == TOK_RPAREN || t->kind == TOK_RBRACK || t->kind == TOK_COMMA ||
+                    (t->kind == TOK_LPAREN && p->kind == TOK_IDENT);
+        if (!glued && cx_is_operator(p)) {
+            /* unary when it starts the expression or follows an operator */
+            const Token *pp = i > 1 ? &x->toks[i - 2] : NULL;
+            glued = !pp || cx_is_operator(pp) || pp->kind == TOK_LPAREN || pp->kind == TOK_LBRACK || pp->kind == TOK_COMMA;
+        }
+        if (!glued) s[n++] = ' ';
+        char buf[3];
+        const char *sp = cx_token_spelling(t, buf);
+        if (t->kind == TOK_STRING) s[n++] = '"';
+        memcpy(s + n, sp, strlen(sp));
+        n += strlen(sp);
+        if (t->kind == TOK_STRING) s[n++] = '"';
+    }
+    s[n] = '\0';
+    return s;
+}
+
+/* Parses enumerators after the '{' up to and including the '}', adding
+ * them to sc. A value that is not a constant expression (an unexpanded
+ * macro, sizeof) is kept as written, and so are the enumerators after it,
+ * as "prev + 1"; those are not added. */
+static void parse_enum_body(Lexer *lx, EnumScope *sc, Type *ten) {
+    EnumValue *last = NULL;
+    int64_t val = 0;
+    while (1) {
+        Token ev = lexer_next(lx);
+        if (ev.kind == TOK_EOF || ev.kind == TOK_RBRACE) { if (ev.text) free(ev.text); break; }
+        if (ev.kind != TOK_IDENT) { if (ev.text) free(ev.text); continue; }
+        EnumValue *e = (EnumValue*)ds_calloc(1, sizeof(EnumValue));
+        e->name = ev.text;
+        e->value = val;
+        if (lexer_peek(lx).kind == TOK_EQ) {
+            lexer_next(lx);
+            ConstExpr x;
+            cx_collect(lx, TOK_COMMA, TOK_RBRACE, &x);
+            x.names = ten->u.en.values;
+            x.scope = sc;
+            if (cx_eval(&x, &e->value)) {
+                e->spelling = cx_spelling(&x);
+            } else if (x.count) {
+                e->value = 0;
+                e->line = x.toks[0].line;
+                e->expr = cx_text(&x);
+                if (!sc->quiet) {
+                    fprintf(stderr, "line %d: value of enumerator '%s' not understood, keeping %s\n", e->line, e->name, e->expr);
+                }
+            } else {
+                fprintf(stderr, "line %d: value of enumerator '%s' not understood, assuming %lld\n", ev.line, e->name, (long long)val);
+            }
+            cx_free(&x);
+        } else if (last && last->expr) {
+            size_t n = strlen(last->name) + 5;
+            e->value = 0;
+            e->expr = (char*)ds_malloc(n);
+            snprintf(e->expr, n, "%s + 1", last->name);
+        }
+        val = e->value + 1;
+        if (!e->expr) enum_scope_add(sc, e->name, e->value);
+        if (last) last->next = e; else ten->u.en.values = e;
+        last = e;
+    }
+}
+
+/* The qualifier a token spells, or 0. */
+static int token_qual(TokenKind k) {
+    return k == TOK_CONST ? QUAL_CONST : k == TOK_VOLATILE ? QUAL_VOLATILE : 0;
+}
+
+/* Parse a simple type specifier (builtin or struct/union/enum tag). The
+ * qualifiers before it are kept on the type; those after a tag or typedef
+ * name are left to parse_declarator. */
+static Type *parse_type_specifier(Lexer *lx, EnumScope *sc) {
     Token t = lexer_peek(lx);
+    int quals = 0;
+    while (token_qual(t.kind)) {
+        quals |= token_qual(t.kind);
+        lexer_next(lx);
+        t = lexer_peek(lx);
+    }
     if (t.kind == TOK_STRUCT || t.kind == TOK_UNION) {
         Token consumed_kw = lexer_next(lx); if (consumed_kw.text) free(consumed_kw.text);
         int is_struct = (t.kind == TOK_STRUCT);
         Token next = lexer_peek(lx);
         char *tag = NULL;
-        if (next.kind == TOK_IDENT) { next = lexer_next(lx); tag = strdup(next.text); free(next.text); }
+        if (next.kind == TOK_IDENT) { next = lexer_next(lx); tag = ds_strdup(next.text); free(next.text); }
         Token p = lexer_peek(lx);
         if (p.kind == TOK_LBRACE) {
             /* definition */
             lexer_next(lx); /* consume { */
-            Type *tst = (Type*)calloc(1, sizeof(Type));
+            Type *tst = (Type*)ds_calloc(1, sizeof(Type));
             tst->kind = is_struct ? TYPE_STRUCT : TYPE_UNION;
             tst->u.s.tag = tag ? tag : NULL;
             Member *last = NULL;
             while (1) {
                 Token q = lexer_peek(lx);
                 if (q.kind == TOK_RBRACE) { Token tmp = lexer_next(lx); if (tmp.text) free(tmp.text); break; }
-                /* parse member declaration: very simple: <builtin> <ident> [array]; */
-                Token spec = lexer_next(lx);
-                if (spec.kind == TOK_IDENT || spec.kind == TOK_INT || spec.kind == TOK_CHAR ||
-                    spec.kind == TOK_VOID || spec.kind == TOK_FLOAT || spec.kind == TOK_DOUBLE ||
-                    spec.kind == TOK_UNSIGNED || spec.kind == TOK_SIGNED) {
-                    char *typename = spec.text ? spec.text : NULL;
-                    Token name = lexer_next(lx);
-                    if (name.kind == TOK_IDENT) {
-                        Member *m = (Member*)calloc(1, sizeof(Member));
-                        m->name = strdup(name.text);
-                        Type *mt = type_make_builtin(typename ? typename : "int");
-                        m->type = mt;
-                        // Check for array
-                        Token peek = lexer_peek(lx);
-                        if (peek.kind == TOK_LBRACK) {
-                            lexer_next(lx); // consume [
-                            Token num = lexer_next(lx);
-                            if (num.kind == TOK_NUMBER) {
-                                int len = atoi(num.text);
-                                m->type = type_make_array(m->type, len);
-                                lexer_next(lx); // ]
-                            }
-                            if (num.text) free(num.text);
-                        }
-                        if (last) last->next = m; else tst->u.s.members = m;
-                        last = m;
-                        if (name.text) free(name.text);
-                    } else {
-                        if (name.text) free(name.text);
+                if (q.kind == TOK_EOF) break;
+                /* member declaration: <specifier> <declarator> {, <declarator>} ; */
+                Type *spec = parse_type_specifier(lx, sc);
+                if (!spec) continue; /* unknown token was skipped */
+                int first = 1;
+                while (1) {
+                    char *mname = NULL;
+                    Type *mt = parse_declarator(lx, sc, first ? spec : type_copy(spec), &mname);
+                    first = 0;
+                    Member *m = (Member*)ds_calloc(1, sizeof(Member));
+                    m->name = mname;
+                    m->type = mt;
+                    if (last) last->next = m; else tst->u.s.members = m;
+                    last = m;
+                    Token z = lexer_next(lx);
+                    if (z.kind == TOK_COLON) { /* bit-field width */
+                        if (z.text) free(z.text);
+                        z = lexer_next(lx);
+                        if (z.kind == TOK_NUMBER) m->bits = (int)z.num.value;
+                        if (z.text) free(z.text);
+                        z = lexer_next(lx);
                     }
-                    /* consume until semicolon */
-                    while (1) { Token z = lexer_next(lx); if (z.kind==TOK_SEMI) { if (z.text) free(z.text); break; } if (z.text) free(z.text); }
-                    if (spec.text) free(spec.text);
-                } else {
-                    if (spec.text) free(spec.text);
-                    /* skip token to avoid infinite loop */
-                    Token skip = lexer_next(lx); if (skip.text) free(skip.text);
+                    TokenKind zk = z.kind;
+                    if (z.text) free(z.text);
+                    if (zk == TOK_COMMA) continue;
+                    if (zk != TOK_SEMI) skip_to_semi(lx);
+                    break;
                 }
             }
+            tst->quals = quals;
             return tst;
         } else {
             /* reference to tag */
-            Type *tref = (Type*)calloc(1, sizeof(Type));
-            tref->kind = TYPE_STRUCT;
+            Type *tref = (Type*)ds_calloc(1, sizeof(Type));
+            tref->kind = is_struct ? TYPE_STRUCT : TYPE_UNION;
             tref->u.s.tag = tag ? tag : NULL;
+            tref->quals = quals;
             return tref;
         }
     } else if (t.kind == TOK_ENUM) {
         lexer_next(lx);
         Token next = lexer_peek(lx);
         char *tag = NULL;
-        if (next.kind == TOK_IDENT) { next = lexer_next(lx); tag = strdup(next.text); free(next.text); }
-        Token p = lexer_peek(lx);
-        if (p.kind == TOK_LBRACE) {
+        if (next.kind == TOK_IDENT) { next = lexer_next(lx); tag = ds_strdup(next.text); free(next.text); }
+        Type *ten = (Type*)ds_calloc(1, sizeof(Type));
+        ten->kind = TYPE_ENUM;
+        ten->u.en.tag = tag;
+        if (lexer_peek(lx).kind == TOK_LBRACE) {
             lexer_next(lx);
-            Type *ten = (Type*)calloc(1, sizeof(Type));
-            ten->kind = TYPE_ENUM;
-            EnumValue *last = NULL;
-            int64_t val = 0;
-            while (1) {
-                Token ev = lexer_next(lx);
-                if (ev.kind == TOK_IDENT) {
-                    EnumValue *e = (EnumValue*)calloc(1, sizeof(EnumValue));
-                    e->name = strdup(ev.text);
-                    free(ev.text);
-                    Token maybe_eq = lexer_peek(lx);
-                    if (maybe_eq.kind == TOK_EQ) {
-                        lexer_next(lx);
-                        Token num = lexer_next(lx);
-                        if (num.kind == TOK_NUMBER) { e->value = strtoll(num.text, NULL, 10); free(num.text); }
-                        Token semi_or_comma = lexer_peek(lx);
-                    } else {
-                        e->value = val++;
-                    }
-                    val = e->value + 1;
-                    if (last) last->next = e; else ten->u.e = e;
-                    last = e;
-                    Token sep = lexer_next(lx);
-                    if (sep.kind == TOK_COMMA) { if (sep.text) free(sep.text); continue; }
-                    if (sep.kind == TOK_RBRACE) { if (sep.text) free(sep.text); break; }
-                } else if (ev.kind == TOK_RBRACE) { if (ev.text) free(ev.text); break; }
-                if (ev.text) free(ev.text);
+            parse_enum_body(lx, sc, ten);
+        }
+        ten->quals = quals;
+        return ten;
+    } else if (builtin_keyword(t.kind)) {
+        /* keyword sequence such as "unsigned long long int" */
+        char name[64] = "";
+        while (1) {
+            Token p = lexer_peek(lx);
+            const char *kw = builtin_keyword(p.kind);
+            if (!kw && !token_qual(p.kind)) break;
+            quals |= token_qual(p.kind);
+            lexer_next(lx);
+            if (kw && strlen(name) + strlen(kw) + 2 < sizeof(name)) {
+                if (name[0]) strcat(name, " ");
+                strcat(name, kw);
             }
-            return ten;
-        } else {
-            /* reference */
-            Type *ten = (Type*)calloc(1, sizeof(Type));
-            ten->kind = TYPE_ENUM;
-            return ten;
         }
-    } else if (t.kind == TOK_INT || t.kind == TOK_CHAR || t.kind == TOK_VOID ||
-               t.kind == TOK_FLOAT || t.kind == TOK_DOUBLE || t.kind == TOK_UNSIGNED || t.kind == TOK_SIGNED) {
-        Token tok = lexer_next(lx);
-        char *nm = tok.text ? tok.text : strdup("int");
-        Type *tb = type_make_builtin(nm);
-        if (tok.text) free(tok.text);
+        Type *tb = type_make_builtin(name);
+        tb->quals = quals;
         return tb;
     } else if (t.kind == TOK_IDENT) {
         Token tok = lexer_next(lx);
         /* could be typedef name */
-        Type *ta = (Type*)calloc(1, sizeof(Type));
+        Type *ta = (Type*)ds_calloc(1, sizeof(Type));
         ta->kind = TYPE_ALIAS;
-        ta->u.alias_to = strdup(tok.text);
+        ta->u.alias_to = ds_strdup(tok.text);
         free(tok.text);
+        ta->quals = quals;
         return ta;
     }
     /* unknown */
@@ -199,18 +626,77 @@ static Type *parse_type_specifier(Lexer *lx) {
     return NULL;
 }
 
+/* Applies declarator suffixes to base: a parameter list (skipped, the
+ * parameters are not recorded yet) or any number of array dimensions.
+ * name is the declarator's, for warnings. */
+static Type *parse_declarator_suffixes(Lexer *lx, EnumScope *sc, Type *base, const char *name) {
+    Token f = lexer_peek(lx);
+    if (f.kind == TOK_LPAREN) {
+        lexer_next(lx); if (f.text) free(f.text);
+        Type *ft = (Type*)ds_calloc(1, sizeof(Type));
+        ft->kind = TYPE_FUNCTION;
+        ft->u.func.ret = base;
+        ft->u.func.params = NULL; // TODO: parse params
+        // consume until the matching )
+        int depth = 1;
+        while (depth > 0) {
+            Token z = lexer_next(lx);
+            if (z.kind == TOK_LPAREN) depth++;
+            else if (z.kind == TOK_RPAREN || z.kind == TOK_EOF) depth--;
+            if (z.text) free(z.text);
+        }
+        return ft;
+    }
+    /* int a[2][3] is an array of 2 arrays of 3: each dimension goes
+     * inside the ones before it */
+    Type **inner = &base;
+    while (1) {
+        Token a = lexer_peek(lx);
+        if (a.kind != TOK_LBRACK) break;
+        lexer_next(lx); if (a.text) free(a.text);
+        /* a size that is not a constant expression (an unexpanded macro,
+         * sizeof) is kept as written */
+        ConstExpr x;
+        cx_collect(lx, TOK_RBRACK, TOK_RBRACK, &x);
+        x.scope = sc;
+        int64_t v;
+        int known = cx_eval(&x, &v);
+        Type *at = type_make_array(*inner, known && v > 0 && v <= INT_MAX ? (int)v : 0);
+        if (!known && x.count) {
+            at->u.array.line = x.toks[0].line;
+            at->u.array.expr = cx_text(&x);
+            if (!sc->quiet) {
+                fprintf(stderr, "line %d: size of array '%s' not understood, keeping [%s]\n", at->u.array.line, name ? name : "", at->u.array.expr);
+            }
+        }
+        cx_free(&x);
+        Token r = lexer_next(lx);
+        if (r.kind != TOK_RBRACK) {
+            fprintf(stderr, "expected ]\n");
+        }
+        if (r.text) free(r.text);
+        *inner = at;
+        inner = &(*inner)->u.array.base;
+    }
+    return base;
+}
+
 /* Parse a declarator, returning the full type and setting name_out */
-static Type *parse_declarator(Lexer *lx, Type *base, char **name_out) {
+static Type *parse_declarator(Lexer *lx, EnumScope *sc, Type *base, char **name_out) {
     *name_out = NULL;
     // pointers
     while (1) {
         Token p = lexer_peek(lx);
         if (p.kind == TOK_STAR) {
             lexer_next(lx); if (p.text) free(p.text);
-            Type *pt = (Type*)calloc(1, sizeof(Type));
+            Type *pt = (Type*)ds_calloc(1, sizeof(Type));
             pt->kind = TYPE_POINTER;
             pt->u.ptr.base = base;
             base = pt;
+        } else if (token_qual(p.kind)) {
+            /* qualifies the pointer before it, or the specifier */
+            base->quals |= token_qual(p.kind);
+            lexer_next(lx);
         } else {
             break;
         }
@@ -219,207 +705,598 @@ static Type *parse_declarator(Lexer *lx, Type *base, char **name_out) {
     Token d = lexer_peek(lx);
     if (d.kind == TOK_IDENT) {
         Token n = lexer_next(lx);
-        *name_out = strdup(n.text);
+        *name_out = ds_strdup(n.text);
         if (n.text) free(n.text);
-        // function?
-        Token f = lexer_peek(lx);
-        if (f.kind == TOK_LPAREN) {
-            lexer_next(lx); if (f.text) free(f.text);
-            Type *ft = (Type*)calloc(1, sizeof(Type));
-            ft->kind = TYPE_FUNCTION;
-            ft->u.func.ret = base;
-            ft->u.func.params = NULL; // TODO: parse params
-            // consume until )
-            while (1) {
-                Token z = lexer_next(lx);
-                if (z.kind == TOK_RPAREN) { if (z.text) free(z.text); break; }
-                if (z.text) free(z.text);
-            }
-            base = ft;
-        }
-        // array?
-        while (1) {
-            Token a = lexer_peek(lx);
-            if (a.kind == TOK_LBRACK) {
-                lexer_next(lx); if (a.text) free(a.text);
-                Token num = lexer_next(lx);
-                int len = 0;
-                if (num.kind == TOK_NUMBER) {
-                    len = atoi(num.text);
-                }
-                if (num.text) free(num.text);
-                Token r = lexer_next(lx);
-                if (r.kind != TOK_RBRACK) {
-                    fprintf(stderr, "expected ]\n");
-                }
-                if (r.text) free(r.text);
-                Type *arr = (Type*)calloc(1, sizeof(Type));
-                arr->kind = TYPE_ARRAY;
-                arr->u.array.base = base;
-                arr->u.array.length = len;
-                base = arr;
-            } else {
-                break;
-            }
-        }
+        base = parse_declarator_suffixes(lx, sc, base, *name_out);
     } else if (d.kind == TOK_LPAREN) {
+        /* "(*name)(...)": the suffixes after ')' bind to base first and the
+         * inner declarator wraps the result, so the inner part is parsed
+         * against a placeholder that is patched afterwards */
         lexer_next(lx); if (d.text) free(d.text);
-        base = parse_declarator(lx, base, name_out);
+        Type *hole = (Type*)ds_calloc(1, sizeof(Type));
+        Type *inner = parse_declarator(lx, sc, hole, name_out);
         Token rp = lexer_next(lx);
         if (rp.kind != TOK_RPAREN) {
             fprintf(stderr, "expected )\n");
         }
         if (rp.text) free(rp.text);
-        // function?
-        Token f = lexer_peek(lx);
-        if (f.kind == TOK_LPAREN) {
-            lexer_next(lx); if (f.text) free(f.text);
-            Type *ft = (Type*)calloc(1, sizeof(Type));
-            ft->kind = TYPE_FUNCTION;
-            ft->u.func.ret = base;
-            ft->u.func.params = NULL;
+        base = parse_declarator_suffixes(lx, sc, base, *name_out);
+        if (inner == hole) {
+            inner = base;
+        } else {
+            Type *t = inner;
             while (1) {
-                Token z = lexer_next(lx);
-                if (z.kind == TOK_RPAREN) { if (z.text) free(z.text); break; }
-                if (z.text) free(z.text);
+                Type **child = t->kind == TYPE_POINTER ? &t->u.ptr.base :
+                               t->kind == TYPE_ARRAY ? &t->u.array.base : &t->u.func.ret;
+                if (*child == hole) { *child = base; break; }
+                t = *child;
             }
-            base = ft;
         }
+        free(hole);
+        base = inner;
     } else {
         // abstract or error
     }
     return base;
 }
 
-ASTRoot *parse_string(const char *code, const Options *opts) {
-    (void)opts;
-    fprintf(stderr, "parse_string: starting\n");
-    Lexer *lx = lexer_create_from_string(code);
-    if (!lx) { fprintf(stderr, "failed to create lexer from string\n"); return NULL; }
-    ASTRoot *root = (ASTRoot*)calloc(1, sizeof(ASTRoot));
-
-    fprintf(stderr, "parse_string: starting token loop\n");
-
-    while (1) {
-        Token t = lexer_peek(lx);
-        fprintf(stderr, "token peek: kind=%d text=%s line=%d\n", t.kind, t.text ? t.text : "(null)", t.line);
-        if (t.kind == TOK_EOF) { break; }
-        if (t.kind == TOK_TYPEDEF) {
-            fprintf(stderr, "parse: found TYPEDEF\n");
-            Token consumed = lexer_next(lx); if (consumed.text) free(consumed.text);
-            Type *spec = parse_type_specifier(lx);
-            fprintf(stderr, "parse: typedef spec parsed: %p\n", (void*)spec);
-            fprintf(stderr, "parse: about to parse declarator\n");
+/* Parses one top-level declaration into root. Returns 0 at end of input.
+ * Typedef names are not tracked here: the only state kept between calls is
+ * the enumerators in sc, and later passes find typedefs in the AST. */
+static int parse_top_level(Lexer *lx, EnumScope *sc, ASTRoot *root) {
+    Token t = lexer_peek(lx);
+    DS_TRACE("token peek: kind=%d text=%s line=%d\n", t.kind, t.text ? t.text : "(null)", t.line);
+    if (t.kind == TOK_EOF) { return 0; }
+    if (t.kind == TOK_TYPEDEF) {
+        DS_TRACE("parse: found TYPEDEF\n");
+        Token consumed = lexer_next(lx); if (consumed.text) free(consumed.text);
+        Type *spec = parse_type_specifier(lx, sc);
+        DS_TRACE("parse: typedef spec parsed: %p\n", (void*)spec);
+        DS_TRACE("parse: about to parse declarator\n");
+        char *name;
+        Type *full_type = parse_declarator(lx, sc, spec, &name);
+        DS_TRACE("parse: declarator parsed, name=%s\n", name ? name : "null");
+        if (name) {
+            ast_add_node(root, full_type, name, 1); // typedef
+            free(name);
+        }
+        Token semi = lexer_next(lx);
+        if (semi.kind != TOK_SEMI) {
+            fprintf(stderr, "expected ; after typedef\n");
+        }
+        if (semi.text) free(semi.text);
+        DS_TRACE("parse: typedef done\n");
+    } else {
+        // attempt to parse a declaration
+        Type *spec = parse_type_specifier(lx, sc);
+        if (spec) {
             char *name;
-            Type *full_type = parse_declarator(lx, spec, &name);
-            fprintf(stderr, "parse: declarator parsed, name=%s\n", name ? name : "null");
+            Type *full_type = parse_declarator(lx, sc, spec, &name);
             if (name) {
-                alias_add(name, full_type);
-                ast_add_node(root, full_type, name, 1); // typedef
-            }
-            Token semi = lexer_next(lx);
-            if (semi.kind != TOK_SEMI) {
-                fprintf(stderr, "expected ; after typedef\n");
+                ast_add_node(root, full_type, name, 0); // not typedef
+                free(name);
+            } else if (defines_body(full_type)) {
+                ast_add_node(root, full_type, NULL, 0); // struct T { ... };
+            } else {
+                type_free(full_type);
             }
-            if (semi.text) free(semi.text);
-            fprintf(stderr, "parse: typedef done\n");
-        } else {
-            // attempt to parse a declaration
-            Type *spec = parse_type_specifier(lx);
-            if (spec) {
-                char *name;
-                Type *full_type = parse_declarator(lx, spec, &name);
-                if (name) {
-                    ast_add_node(root, full_type, name, 0); // not typedef
-                    free(name);
+            Token next = lexer_peek(lx);
+            if (next.kind == TOK_LBRACE) {
+                // function definition, skip body without tokenizing it
+                lexer_skip_block(lx);
+            } else {
+                if (next.kind == TOK_EQ) {
+                    Token eq = lexer_next(lx); if (eq.text) free(eq.text);
+                    skip_initializer(lx);
                 }
-                Token next = lexer_peek(lx);
-                if (next.kind == TOK_LBRACE) {
-                    // function definition, skip body
-                    // skip_braces(lx);
-                } else {
-                    Token semi = lexer_next(lx);
-                    if (semi.kind != TOK_SEMI) {
-                        fprintf(stderr, "expected ; after declaration\n");
-                    }
-                    if (semi.text) free(semi.text);
+                Token semi = lexer_next(lx);
+                if (semi.kind == TOK_COMMA) {
+                    // further declarators of the same declaration
+                    skip_to_semi(lx);
+                } else if (semi.kind != TOK_SEMI) {
+                    fprintf(stderr, "expected ; after declaration\n");
                 }
-            } else {
-                /* skip token */
-                Token sk = lexer_next(lx); if (sk.text) free(sk.text);
+                if (semi.text) free(semi.text);
             }
+        } else {
+            /* skip token */
+            Token sk = lexer_next(lx); if (sk.text) free(sk.text);
         }
-        fprintf(stderr, "parse: iteration end\n");
     }
+    DS_TRACE("parse: iteration end\n");
+    return 1;
+}
 
-    lexer_destroy(lx);
-    fprintf(stderr, "parse_string: finished, returning AST\n");
-    return root;
+/* ---- skimming ----
+ * The grammar of parse_type_specifier, parse_declarator and
+ * parse_top_level reduced to consuming tokens: no types are built, record
+ * and enum bodies are skipped raw (brace matching agrees with the member
+ * parser on any body it accepts), and only the names a declaration defines
+ * are kept. Error recovery is followed token for token, so a skim cuts the
+ * input where a parse would and finds the same names. */
+
+static void skip_token(Lexer *lx) {
+    Token t = lexer_next(lx);
+    if (t.text) free(t.text);
 }
 
-ASTRoot *parse_file(const char *path, const Options *opts) {
-    (void)opts;
-    fprintf(stderr, "parse_file: opening '%s'\n", path);
-    Lexer *lx = lexer_create_from_file(path);
-    if (!lx) { fprintf(stderr, "failed to open: %s\n", path); return NULL; }
-    ASTRoot *root = (ASTRoot*)calloc(1, sizeof(ASTRoot));
+/* Returns 0 where parse_type_specifier returns NULL. The tag of a struct,
+ * union or enum defined with a body goes to decl (caller frees). */
+static int skim_type_specifier(Lexer *lx, SkimDecl *decl) {
+    Token t = lexer_peek(lx);
+    while (t.kind == TOK_CONST || t.kind == TOK_VOLATILE) {
+        lexer_next(lx);
+        t = lexer_peek(lx);
+    }
+    if (t.kind == TOK_STRUCT || t.kind == TOK_UNION || t.kind == TOK_ENUM) {
+        lexer_next(lx);
+        char *tag = NULL;
+        if (lexer_peek(lx).kind == TOK_IDENT) tag = lexer_next(lx).text;
+        if (lexer_peek(lx).kind == TOK_LBRACE) {
+            lexer_skip_block(lx);
+            decl->tag = tag;
+            decl->tag_kind = t.kind == TOK_STRUCT ? TYPE_STRUCT : t.kind == TOK_UNION ? TYPE_UNION : TYPE_ENUM;
+        } else {
+            free(tag);
+        }
+        return 1;
+    }
+    if (builtin_keyword(t.kind)) {
+        while (1) {
+            TokenKind k = lexer_peek(lx).kind;
+            if (!builtin_keyword(k) && k != TOK_CONST && k != TOK_VOLATILE) break;
+            lexer_next(lx);
+        }
+        return 1;
+    }
+    skip_token(lx);
+    return t.kind == TOK_IDENT;
+}
 
-    fprintf(stderr, "parse_file: starting token loop\n");
+static void skim_declarator_suffixes(Lexer *lx) {
+    if (lexer_peek(lx).kind == TOK_LPAREN) {
+        skip_token(lx);
+        int depth = 1;
+        while (depth > 0) {
+            Token z = lexer_next(lx);
+            if (z.kind == TOK_LPAREN) depth++;
+            else if (z.kind == TOK_RPAREN || z.kind == TOK_EOF) depth--;
+            if (z.text) free(z.text);
+        }
+        return;
+    }
+    while (lexer_peek(lx).kind == TOK_LBRACK) {
+        skip_token(lx);
+        /* the extent cx_collect gives an array size */
+        int depth = 0;
+        while (1) {
+            TokenKind k = lexer_peek(lx).kind;
+            if (k == TOK_EOF || k == TOK_SEMI || (depth == 0 && k == TOK_RBRACK)) break;
+            if (k == TOK_LPAREN || k == TOK_LBRACK) depth++;
+            else if ((k == TOK_RPAREN || k == TOK_RBRACK) && depth > 0) depth--;
+            skip_token(lx);
+        }
+        skip_token(lx);
+    }
+}
 
+static void skim_declarator(Lexer *lx, char **name_out) {
+    *name_out = NULL;
     while (1) {
-        Token t = lexer_peek(lx);
-        fprintf(stderr, "token peek: kind=%d text=%s line=%d\n", t.kind, t.text ? t.text : "(null)", t.line);
-        if (t.kind == TOK_EOF) { break; }
-        if (t.kind == TOK_TYPEDEF) {
-            fprintf(stderr, "parse: found TYPEDEF\n");
-            Token consumed = lexer_next(lx); if (consumed.text) free(consumed.text);
-            Type *spec = parse_type_specifier(lx);
-            fprintf(stderr, "parse: typedef spec parsed: %p\n", (void*)spec);
-            fprintf(stderr, "parse: about to parse declarator\n");
-            char *name;
-            Type *full_type = parse_declarator(lx, spec, &name);
-            fprintf(stderr, "parse: declarator parsed, name=%s\n", name ? name : "null");
-            if (name) {
-                alias_add(name, full_type);
-                ast_add_node(root, full_type, name, 1); // typedef
+        TokenKind k = lexer_peek(lx).kind;
+        if (k != TOK_STAR && k != TOK_CONST && k != TOK_VOLATILE) break;
+        lexer_next(lx);
+    }
+    TokenKind k = lexer_peek(lx).kind;
+    if (k == TOK_IDENT) {
+        *name_out = lexer_next(lx).text;
+        skim_declarator_suffixes(lx);
+    } else if (k == TOK_LPAREN) {
+        skip_token(lx);
+        skim_declarator(lx, name_out);
+        skip_token(lx);
+        skim_declarator_suffixes(lx);
+    }
+}
+
+/* parse_top_level without the AST: reports the declaration's extent and
+ * what it defines to sink. Returns 0 at end of input. */
+static int skim_top_level(Lexer *lx, SkimSink sink, void *user) {
+    SkimDecl decl;
+    memset(&decl, 0, sizeof(decl));
+    decl.offset = lexer_offset(lx);
+    decl.line = lexer_line(lx);
+    Token t = lexer_peek(lx);
+    if (t.kind == TOK_EOF) return 0;
+    if (t.kind == TOK_TYPEDEF) {
+        skip_token(lx);
+        skim_type_specifier(lx, &decl);
+        skim_declarator(lx, &decl.name);
+        /* a typedef without a name adds no node, so defines no tag */
+        if (!decl.name) {
+            free(decl.tag);
+            decl.tag = NULL;
+        }
+        skip_token(lx);
+    } else if (skim_type_specifier(lx, &decl)) {
+        skim_declarator(lx, &decl.name);
+        TokenKind next = lexer_peek(lx).kind;
+        if (next == TOK_LBRACE) {
+            lexer_skip_block(lx);
+        } else {
+            if (next == TOK_EQ) {
+                lexer_next(lx);
+                skip_initializer(lx);
             }
             Token semi = lexer_next(lx);
-            if (semi.kind != TOK_SEMI) {
-                fprintf(stderr, "expected ; after typedef\n");
-            }
+            if (semi.kind == TOK_COMMA) skip_to_semi(lx);
             if (semi.text) free(semi.text);
-            fprintf(stderr, "parse: typedef done\n");
-        } else {
-            // attempt to parse a declaration
-            Type *spec = parse_type_specifier(lx);
-            if (spec) {
-                char *name;
-                Type *full_type = parse_declarator(lx, spec, &name);
-                if (name) {
-                    ast_add_node(root, full_type, name, 0); // not typedef
-                    free(name);
-                }
-                Token next = lexer_peek(lx);
-                if (next.kind == TOK_LBRACE) {
-                    // function definition, skip body
-                    // skip_braces(lx);
-                } else {
-                    Token semi = lexer_next(lx);
-                    if (semi.kind != TOK_SEMI) {
-                        fprintf(stderr, "expected ; after declaration\n");
-                    }
-                    if (semi.text) free(semi.text);
-                }
-            } else {
-                /* skip token */
-                Token sk = lexer_next(lx); if (sk.text) free(sk.text);
-            }
         }
-        fprintf(stderr, "parse: iteration end\n");
+    } else {
+        /* parse_top_level skips a token after the one the specifier did */
+        skip_token(lx);
+    }
+    if (decl.name || decl.tag) {
+        decl.length = lexer_offset(lx) - decl.offset;
+        sink(&decl, user);
     }
+    free(decl.name);
+    free(decl.tag);
+    return 1;
+}
 
+size_t parse_skim(const char *buf, size_t len, SkimSink sink, void *user) {
+    Lexer *lx = lexer_create_from_range(buf, len, 1);
+    while (skim_top_level(lx, sink, user)) {}
+    LexStats ls;
+    lexer_get_stats(lx, &ls);
     lexer_destroy(lx);
-    fprintf(stderr, "parse_file: finished, returning AST\n");
+    return ls.tokens;
+}
+
+typedef struct {
+    double wall0, cpu0;
+    LexStats lex0; /* lexer counters when timing started */
+} ParseTimer;
+
+static void parse_timing_begin(Lexer *lx, const Options *opts, ParseTimer *pt) {
+    memset(pt, 0, sizeof(*pt));
+    if (!opts->metadata_file) return;
+    lexer_set_timing(lx, 1);
+    lexer_get_stats(lx, &pt->lex0);
+    pt->wall0 = clock_wall();
+    pt->cpu0 = clock_thread_cpu();
+}
+
+static void parse_timing_end(Lexer *lx, const Options *opts, const ParseTimer *pt, ParseStats *stats) {
+    LexStats ls;
+    lexer_get_stats(lx, &ls);
+    stats->source_bytes = ls.bytes;
+    stats->tokens = ls.tokens;
+    stats->read_wall = ls.read_wall;
+    stats->read_cpu = ls.read_cpu;
+    stats->lex_wall = ls.lex_wall;
+    stats->lex_cpu = ls.lex_cpu;
+    if (opts->metadata_file) {
+        /* reads done while parsing (streaming refills) are not parse time */
+        stats->parse_wall = clock_wall() - pt->wall0 - ls.lex_wall - (ls.read_wall - pt->lex0.read_wall);
+        stats->parse_cpu = clock_thread_cpu() - pt->cpu0 - ls.lex_cpu - (ls.read_cpu - pt->lex0.read_cpu);
+    }
+}
+
+/* Top-level declaration loop shared by parse_string and parse_file.
+ * quiet leaves array sizes that are not understood unreported. */
+static ASTRoot *parse_tokens(Lexer *lx, const Options *opts, int quiet) {
+    ASTRoot *root = (ASTRoot*)ds_calloc(1, sizeof(ASTRoot));
+    ParseTimer pt;
+    parse_timing_begin(lx, opts, &pt);
+    EnumScope sc;
+    memset(&sc, 0, sizeof(sc));
+    sc.quiet = quiet;
+
+    DS_TRACE("parse: starting token loop\n");
+    while (parse_top_level(lx, &sc, root)) {}
+    enum_scope_free(&sc);
+
+    parse_timing_end(lx, opts, &pt, &root->stats);
+    for (ASTNode *n = root->first; n; n = n->next) root->stats.decls++;
     return root;
 }
 
+int parse_stream(FILE *f, const Options *opts, DeclSink sink, void *user, ParseStats *stats) {
+    Lexer *lx = lexer_create_from_stream(f, 0);
+    if (!lx) return 1;
+    ASTRoot root;
+    memset(&root, 0, sizeof(root));
+    ParseTimer pt;
+    parse_timing_begin(lx, opts, &pt);
+    EnumScope sc;
+    memset(&sc, 0, sizeof(sc));
+    while (parse_top_level(lx, &sc, &root)) {
+        ASTNode *n = root.first;
+        root.first = root.last = NULL;
+        while (n) {
+            ASTNode *next = n->next;
+            n->next = NULL;
+            root.stats.decls++;
+            sink(n, user);
+            n = next;
+        }
+    }
+    enum_scope_free(&sc);
+    parse_timing_end(lx, opts, &pt, &root.stats);
+    if (stats) *stats = root.stats;
+    lexer_destroy(lx);
+    return 0;
+}
+
+ASTRoot *parse_range(const char *buf, size_t len, int first_line, const Options *opts, int quiet) {
+    Lexer *lx = lexer_create_from_range(buf, len, first_line);
+    ASTRoot *root = parse_tokens(lx, opts, quiet);
+    lexer_destroy(lx);
+    return root;
+}
+
+/* Smallest input worth splitting, and the chunk size aimed for per worker
+ * (several chunks per worker so uneven chunks still balance). */
+#define CHUNK_MIN_INPUT (4u << 20)
+#define CHUNKS_PER_WORKER 4
+
+typedef struct {
+    const char *text;
+    size_t len;
+    const LexSplit *splits;
+    size_t count;
+    const Options *opts;
+    ASTRoot **roots;
+} ChunkJob;
+
+static void parse_chunk(void *arg, int index) {
+    ChunkJob *job = (ChunkJob*)arg;
+    size_t begin = job->splits[index].offset;
+    size_t end = (size_t)index + 1 < job->count ? job->splits[index + 1].offset : job->len;
+    Lexer *lx = lexer_create_from_range(job->text + begin, end - begin, job->splits[index].line);
+    job->roots[index] = parse_tokens(lx, job->opts, 1);
+    lexer_destroy(lx);
+}
+
+/* Evaluates an array size a chunk kept as written again, now that the
+ * enumerators of earlier chunks are known. */
+static void resolve_size(const EnumScope *sc, Type *t, const char *name) {
+    const char *expr = t->u.array.expr;
+    Lexer *lx = lexer_create_from_range(expr, strlen(expr), t->u.array.line);
+    ConstExpr x;
+    cx_collect(lx, TOK_EOF, TOK_EOF, &x);
+    lexer_destroy(lx);
+    x.scope = sc;
+    int64_t v;
+    if (cx_eval(&x, &v)) {
+        t->u.array.length = v > 0 && v <= INT_MAX ? (int)v : 0;
+        free(t->u.array.expr);
+        t->u.array.expr = NULL;
+    } else {
+        fprintf(stderr, "line %d: size of array '%s' not understood, keeping [%s]\n", t->u.array.line, name ? name : "", expr);
+    }
+    cx_free(&x);
+}
+
+/* Evaluates an enumerator's value a chunk kept as written again; ten is
+ * its enum. */
+static void resolve_enumerator(const EnumScope *sc, const Type *ten, EnumValue *e) {
+    Lexer *lx = lexer_create_from_range(e->expr, strlen(e->expr), e->line);
+    ConstExpr x;
+    cx_collect(lx, TOK_EOF, TOK_EOF, &x);
+    lexer_destroy(lx);
+    x.names = ten->u.en.values;
+    x.scope = sc;
+    if (cx_eval(&x, &e->value)) {
+        if (e->line) e->spelling = cx_spelling(&x); /* not for "prev + 1" */
+        free(e->expr);
+        e->expr = NULL;
+    } else if (e->line) {
+        fprintf(stderr, "line %d: value of enumerator '%s' not understood, keeping %s\n", e->line, e->name, e->expr);
+    }
+    cx_free(&x);
+}
+
+/* Walks a stitched tree in source order, collecting enumerators the way a
+ * serial parse does, and settles the array sizes and enumerator values the
+ * chunks left open. */
+static void resolve_sizes(EnumScope *sc, Type *t, const char *name) {
+    if (!t) return;
+    switch (t->kind) {
+        case TYPE_POINTER: resolve_sizes(sc, t->u.ptr.base, name); break;
+        case TYPE_FUNCTION: resolve_sizes(sc, t->u.func.ret, name); break;
+        case TYPE_ARRAY:
+            resolve_sizes(sc, t->u.array.base, name);
+            if (t->u.array.expr) resolve_size(sc, t, name);
+            break;
+        case TYPE_STRUCT:
+        case TYPE_UNION:
+            for (Member *m = t->u.s.members; m; m = m->next) resolve_sizes(sc, m->type, m->name);
+            break;
+        case TYPE_ENUM:
+            for (EnumValue *e = t->u.en.values; e; e = e->next) {
+                if (e->expr) resolve_enumerator(sc, t, e);
+                if (!e->expr) enum_scope_add(sc, e->name, e->value);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+/* Parses one large buffer by cutting it at top-level ';' boundaries and
+ * parsing the pieces on worker threads. The per-chunk trees are stitched
+ * back together in chunk order and array sizes that need enumerators from
+ * an earlier chunk are settled afterwards, so the result matches a serial
+ * parse. */
+static ASTRoot *parse_chunked(const char *text, size_t len, const Options *opts, int workers) {
+    double wall0 = clock_wall();
+    LexSplit *splits = NULL;
+    size_t chunk_bytes = len / ((size_t)workers * CHUNKS_PER_WORKER) + 1;
+    size_t count = lexer_find_splits(text, len, chunk_bytes, &splits);
+    DS_TRACE("parse: %zu chunks on %d workers\n", count, workers);
+    ChunkJob job;
+    job.text = text;
+    job.len = len;
+    job.splits = splits;
+    job.count = count;
+    job.opts = opts;
+    job.roots = (ASTRoot**)ds_calloc(count, sizeof(ASTRoot*));
+    parallel_for((int)count, workers, parse_chunk, &job);
+
+    ASTRoot *root = (ASTRoot*)ds_calloc(1, sizeof(ASTRoot));
+    double busy_wall = 0.0;
+    for (size_t i = 0; i < count; ++i) {
+        ASTRoot *part = job.roots[i];
+        ast_append(root, part);
+        root->stats.tokens += part->stats.tokens;
+        root->stats.decls += part->stats.decls;
+        root->stats.lex_cpu += part->stats.lex_cpu;
+        root->stats.parse_cpu += part->stats.parse_cpu;
+        root->stats.lex_wall += part->stats.lex_wall;
+        busy_wall += part->stats.lex_wall + part->stats.parse_wall;
+        free(part);
+    }
+    EnumScope sc;
+    memset(&sc, 0, sizeof(sc));
+    for (ASTNode *n = root->first; n; n = n->next) resolve_sizes(&sc, n->type, n->name);
+    enum_scope_free(&sc);
+    root->stats.source_bytes = len;
+    if (opts->metadata_file && busy_wall > 0.0) {
+        /* split the elapsed time between lexing and parsing in the same
+         * proportion as the workers spent it */
+        double elapsed = clock_wall() - wall0;
+        root->stats.lex_wall = elapsed * (root->stats.lex_wall / busy_wall);
+        root->stats.parse_wall = elapsed - root->stats.lex_wall;
+    }
+    free(job.roots);
+    free(splits);
+    return root;
+}
+
+/* Parses an in-memory source buffer, in chunks when it is large enough and
+ * more than one job was requested. Takes ownership of text. */
+static ASTRoot *parse_buffer(char *text, size_t len, const Options *opts) {
+    int workers = opts->jobs > 0 ? opts->jobs : cpu_count();
+    ASTRoot *root;
+    if (opts->jobs != 1 && len >= CHUNK_MIN_INPUT) {
+        root = parse_chunked(text, len, opts, workers);
+        free(text);
+    } else {
+        Lexer *lx = lexer_create_from_buffer(text, len);
+        root = parse_tokens(lx, opts, 0);
+        lexer_destroy(lx);
+    }
+    return root;
+}
+
+/* Loads a file (path) or string (code), running the built-in preprocessor
+ * when enabled, and records read/preprocess times in stats. */
+static char *load_source(const char *path, const char *code, const Options *opts, size_t *len, ParseStats *stats) {
+    double wall0 = clock_wall(), cpu0 = clock_thread_cpu();
+    if (!opts->preprocess || !opts->pp) {
+        char *text;
+        if (path) {
+            text = lexer_load_file(path, len);
+        } else {
+            *len = strlen(code);
+            text = ds_strdup(code);
+        }
+        stats->read_wall = clock_wall() - wall0;
+        stats->read_cpu = clock_thread_cpu() - cpu0;
+        return text;
+    }
+    PPStats pps;
+    memset(&pps, 0, sizeof(pps));
+    char *text = path ? pp_process_file(opts->pp, path, len, &pps) : pp_process_string(opts->pp, code, len, &pps);
+    stats->read_wall = pps.read_wall;
+    stats->read_cpu = pps.read_cpu;
+    stats->pp_wall = clock_wall() - wall0 - pps.read_wall;
+    stats->pp_cpu = clock_thread_cpu() - cpu0 - pps.read_cpu;
+    stats->pp_files = pps.files_read;
+    stats->pp_cache_hits = pps.cache_hits;
+    stats->pp_guard_skips = pps.guard_skips;
+    return text;
+}
+
+static ASTRoot *parse_source(const char *path, const char *code, const Options *opts) {
+    ParseStats pre;
+    memset(&pre, 0, sizeof(pre));
+    size_t len = 0;
+    char *text = load_source(path, code, opts, &len, &pre);
+    if (!text) return NULL;
+    ASTRoot *root = parse_buffer(text, len, opts);
+    root->stats.read_wall = pre.read_wall;
+    root->stats.read_cpu = pre.read_cpu;
+    root->stats.pp_wall = pre.pp_wall;
+    root->stats.pp_cpu = pre.pp_cpu;
+    root->stats.pp_files = pre.pp_files;
+    root->stats.pp_cache_hits = pre.pp_cache_hits;
+    root->stats.pp_guard_skips = pre.pp_guard_skips;
+    return root;
+}
+
+ASTRoot *parse_string(const char *code, const Options *opts) {
+    DS_TRACE("parse_string: starting\n");
+    ASTRoot *root = parse_source(NULL, code, opts);
+    if (!root) { fprintf(stderr, "failed to create lexer from string\n"); return NULL; }
+    DS_TRACE("parse_string: finished, returning AST\n");
+    return root;
+}
+
+ASTRoot *parse_memory(const char *data, size_t len, const Options *opts) {
+    char *code = (char*)ds_malloc(len + 1);
+    memcpy(code, data, len);
+    code[len] = '\0';
+    ASTRoot *root = parse_source(NULL, code, opts);
+    free(code);
+    return root;
+}
+
+char *parse_prepare(const char *path, char *data, size_t len, const Options *opts, size_t *len_out, ParseStats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    if (!data) return load_source(NULL, path, opts, len_out, stats); /* path is code */
+    if (!opts->preprocess || !opts->pp) {
+        *len_out = len;
+        return data;
+    }
+    double wall0 = clock_wall(), cpu0 = clock_thread_cpu();
+    PPStats pps;
+    memset(&pps, 0, sizeof(pps));
+    char *text = pp_process_buffer(opts->pp, path, data, len, len_out, &pps);
+    if (!text) { fprintf(stderr, "failed to open: %s\n", path); return NULL; }
+    stats->read_wall = pps.read_wall;
+    stats->read_cpu = pps.read_cpu;
+    stats->pp_wall = clock_wall() - wall0 - pps.read_wall;
+    stats->pp_cpu = clock_thread_cpu() - cpu0 - pps.read_cpu;
+    stats->pp_files = pps.files_read;
+    stats->pp_cache_hits = pps.cache_hits;
+    stats->pp_guard_skips = pps.guard_skips;
+    return text;
+}
+
+ASTRoot *parse_loaded(const char *path, char *data, size_t len, const Options *opts) {
+    DS_TRACE("parse_loaded: '%s' (%zu bytes)\n", path, len);
+    ParseStats pre;
+    char *text = parse_prepare(path, data, len, opts, &len, &pre);
+    if (!text) return NULL;
+    ASTRoot *root = parse_buffer(text, len, opts);
+    root->stats.read_wall = pre.read_wall;
+    root->stats.read_cpu = pre.read_cpu;
+    root->stats.pp_wall = pre.pp_wall;
+    root->stats.pp_cpu = pre.pp_cpu;
+    root->stats.pp_files = pre.pp_files;
+    root->stats.pp_cache_hits = pre.pp_cache_hits;
+    root->stats.pp_guard_skips = pre.pp_guard_skips;
+    return root;
+}
+
+ASTRoot *parse_file(const char *path, const Options *opts) {
+    DS_TRACE("parse_file: opening '%s'\n", path);
+    ASTRoot *root = parse_source(path, NULL, opts);
+    if (!root) { fprintf(stderr, "failed to open: %s\n", path); return NULL; }
+    DS_TRACE("parse_file: finished, returning AST\n");
+    return root;
+}
@@ -0,0 +1,93 @@
+#include <stdlib.h>
+#include "prefetch.h"
+#include "lexer.h"
+#include "thread.h"
+#include "report.h"
+#include "memstat.h"
+
+typedef struct {
+    char *data; /* NULL when unreadable */
+    size_t len;
+    int ready;
+} Slot;
+
+struct Prefetcher {
+    const char *const *paths;
+    int count;
+    int ahead;
+    Slot *slots;
+    int taken;  /* files handed to the consumer */
+    int stop;
+    DsMonitor *mon;
+    DsThread *thread;
+};
+
+static void loader(void *arg) {
+    Prefetcher *p = (Prefetcher*)arg;
+    for (int i = 0; i < p->count; ++i) {
+        monitor_lock(p->mon);
+        while (!p->stop && i >= p->taken + p->ahead) monitor_wait(p->mon);
+        int stop = p->stop;
+        monitor_unlock(p->mon);
+        if (stop) return;
+        size_t len = 0;
+        char *data = lexer_load_file(p->paths[i], &len);
+        monitor_lock(p->mon);
+        p->slots[i].data = data;
+        p->slots[i].len = len;
+        p->slots[i].ready = 1;
+        monitor_broadcast(p->mon);
+        monitor_unlock(p->mon);
+    }
+}
+
+Prefetcher *prefetch_start(const char *const *paths, int count, int ahead) {
+    Prefetcher *p = (Prefetcher*)ds_calloc(1, sizeof(Prefetcher));
+    p->paths = paths;
+    p->count = count;
+    p->ahead = ahead > 0 ? ahead : 1;
+    p->slots = (Slot*)ds_calloc((size_t)count + 1, sizeof(Slot));
+    p->mon = monitor_create();
+    p->thread = p->mon ? thread_start(loader, p) : NULL;
+    return p;
+}
+
+char *prefetch_take(Prefetcher *p, int index, size_t *len, double *wait_wall) {
+    double wall0 = clock_wall();
+    Slot *s = &p->slots[index];
+    if (!p->thread) {
+        /* no loader thread: read inline */
+        s->data = lexer_load_file(p->paths[index], &s->len);
+        s->ready = 1;
+    } else {
+        monitor_lock(p->mon);
+        while (!s->ready) monitor_wait(p->mon);
+        monitor_unlock(p->mon);
+    }
+    if (wait_wall) *wait_wall = clock_wall() - wall0;
+    char *data = s->data;
+    *len = s->len;
+    s->data = NULL;
+    if (p->thread) {
+        monitor_lock(p->mon);
+        p->taken = index + 1;
+        monitor_broadcast(p->mon);
+        monitor_unlock(p->mon);
+    }
+    return data;
+}
+
+void prefetch_stop(Prefetcher *p) {
+    if (!p) return;
+    if (p->thread) {
+        monitor_lock(p->mon);
+        p->stop = 1;
+        monitor_broadcast(p->mon);
+        monitor_unlock(p->mon);
+        thread_join(p->thread);
+    }
+    for (int i = 0; i < p->count; ++i) free(p->slots[i].data);
+    free(p->slots);
+    monitor_destroy(p->mon);
+    free(p);
+}
@@ -0,0 +1,1090 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "preproc.h"
+#include "lexer.h"
+#include "memstat.h"
+#include "report.h"
+
+#define PP_BUCKETS 4096
+#define PP_MAX_INCLUDE_DEPTH 200
+#define PP_MAX_EXPANSION_DEPTH 256
+#define PP_MAX_COND_DEPTH 256
+
+/* Growable output buffer, always NUL-terminated */
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} Buf;
+
+static void buf_reserve(Buf *b, size_t extra) {
+    if (b->len + extra + 1 <= b->cap) return;
+    size_t cap = b->cap ? b->cap : 256;
+    while (cap < b->len + extra + 1) cap *= 2;
+    b->data = (char*)ds_realloc(b->data, cap);
+    b->cap = cap;
+}
+
+static void buf_append(Buf *b, const char *s, size_t n) {
+    buf_reserve(b, n);
+    memcpy(b->data + b->len, s, n);
+    b->len += n;
+    b->data[b->len] = '\0';
+}
+
+static void buf_putc(Buf *b, char c) {
+    buf_append(b, &c, 1);
+}
+
+static void buf_clear(Buf *b) {
+    b->len = 0;
+    if (b->data) b->data[0] = '\0';
+}
+
+static unsigned hash_str(const char *s, size_t n) {
+    unsigned h = 2166136261u;
+    for (size_t i = 0; i < n; ++i) { h ^= (unsigned char)s[i]; h *= 16777619u; }
+    return h;
+}
+
+static int is_ident_start(char c) { return isalpha((unsigned char)c) || c == '_'; }
+static int is_ident_cont(char c) { return isalnum((unsigned char)c) || c == '_'; }
+
+/* ---- macros ---- */
+
+typedef struct Macro {
+    char *name;
+    char *body;
+    char **params;
+    int nparams;
+    int is_func;
+    int variadic;
+    int disabled; /* set while the macro's own expansion is rescanned */
+    struct Macro *next;
+} Macro;
+
+typedef struct PPFile PPFile;
+
+/* All preprocessor state. Contexts are independent of each other, so
+ * separate contexts may be used from separate threads. */
+struct PPContext {
+    Macro *macros[PP_BUCKETS];
+    PPFile *files[PP_BUCKETS];
+    char **include_paths;
+    int include_path_count;
+};
+
+static Macro *macro_find(PPContext *ctx, const char *name, size_t n) {
+    for (Macro *m = ctx->macros[hash_str(name, n) % PP_BUCKETS]; m; m = m->next) {
+        if (strlen(m->name) == n && memcmp(m->name, name, n) == 0) return m;
+    }
+    return NULL;
+}
+
+static void macro_free(Macro *m) {
+    for (int i = 0; i < m->nparams; ++i) free(m->params[i]);
+    free(m->params);
+    free(m->name);
+    free(m->body);
+    free(m);
+}
+
+static void macro_undef(PPContext *ctx, const char *name, size_t n) {
+    Macro **pp = &ctx->macros[hash_str(name, n) % PP_BUCKETS];
+    while (*pp) {
+        Macro *m = *pp;
+        if (strlen(m->name) == n && memcmp(m->name, name, n) == 0) {
+            *pp = m->next;
+            macro_free(m);
+            return;
+        }
+        pp = &m->next;
+    }
+}
+
+static char *dup_range(const char *s, size_t n) {
+    char *d = (char*)ds_malloc(n + 1);
+    memcpy(d, s, n);
+    d[n] = '\0';
+    return d;
+}
+
+static char *dup_trimmed(const char *s, size_t n) {
+    while (n > 0 && isspace((unsigned char)*s)) { s++; n--; }
+    while (n > 0 && isspace((unsigned char)s[n - 1])) n--;
+    return dup_range(s, n);
+}
+
+/* Parses the text following #define: NAME body | NAME(params) body */
+static void macro_define_line(PPContext *ctx, const char *s) {
+    while (isspace((unsigned char)*s)) s++;
+    if (!is_ident_start(*s)) return;
+    const char *name = s;
+    while (is_ident_cont(*s)) s++;
+    size_t name_len = (size_t)(s - name);
+    macro_undef(ctx, name, name_len);
+    Macro *m = (Macro*)ds_calloc(1, sizeof(Macro));
+    m->name = dup_range(name, name_len);
+    if (*s == '(') {
+        /* function-like only when '(' directly follows the name */
+        m->is_func = 1;
+        s++;
+        while (1) {
+            while (isspace((unsigned char)*s)) s++;
+            if (*s == ')') { s++; break; }
+            if (!*s) break;
+            const char *p = s;
+            if (strncmp(s, "...", 3) == 0) {
+                m->variadic = 1;
+                s += 3;
+                p = "__VA_ARGS__";
+                m->params = (char**)ds_realloc(m->params, (m->nparams + 1) * sizeof(char*));
+                m->params[m->nparams++] = dup_range(p, strlen(p));
+            } else {
+                while (is_ident_cont(*s)) s++;
+                if (s == p) { s++; continue; }
+                m->params = (char**)ds_realloc(m->params, (m->nparams + 1) * sizeof(char*));
+                m->params[m->nparams++] = dup_range(p, (size_t)(s - p));
+            }
+            while (isspace((unsigned char)*s)) s++;
+            if (*s == ',') s++;
+        }
+    }
+    m->body = dup_trimmed(s, strlen(s));
+    unsigned h = hash_str(m->name, name_len) % PP_BUCKETS;
+    m->next = ctx->macros[h];
+    ctx->macros[h] = m;
+}
+
+/* ---- file cache ---- */
+
+struct PPFile {
+    char *path; /* canonical */
+    char *data;
+    size_t len;
+    char *guard; /* controlling macro of an include guard, or NULL */
+    int once;    /* #pragma once seen */
+    int entered; /* expanded at least once */
+    struct PPFile *next;
+};
+
+
+static char *canonical_path(const char *path) {
+#ifdef _WIN32
+    return _fullpath(NULL, path, 0);
+#else
+    return realpath(path, NULL);
+#endif
+}
+
+static void scan_guard(PPFile *f);
+
+static PPFile *file_find(PPContext *ctx, const char *canon, unsigned h) {
+    for (PPFile *f = ctx->files[h]; f; f = f->next) {
+        if (strcmp(f->path, canon) == 0) return f;
+    }
+    return NULL;
+}
+
+/* Adds data (ds_malloc'd, NUL-terminated, now owned by the cache) under the
+ * canonical path canon. */
+static PPFile *file_insert(PPContext *ctx, const char *canon, unsigned h, char *data, size_t len) {
+    PPFile *f = (PPFile*)ds_calloc(1, sizeof(PPFile));
+    f->path = ds_strdup(canon);
+    f->data = data;
+    f->len = len;
+    scan_guard(f);
+    f->next = ctx->files[h];
+    ctx->files[h] = f;
+    return f;
+}
+
+static PPFile *file_load(PPContext *ctx, const char *path, PPStats *stats) {
+    char *canon = canonical_path(path);
+    if (!canon) return NULL;
+    unsigned h = hash_str(canon, strlen(canon)) % PP_BUCKETS;
+    PPFile *f = file_find(ctx, canon, h);
+    if (f) {
+        free(canon);
+        if (stats) stats->cache_hits++;
+        return f;
+    }
+    double wall0 = clock_wall(), cpu0 = clock_thread_cpu();
+    FILE *fp = fopen(canon, "rb");
+    if (!fp) { free(canon); return NULL; }
+    fseek(fp, 0, SEEK_END);
+    long sz = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    if (sz < 0) sz = 0;
+    char *data = (char*)ds_malloc((size_t)sz + 1);
+    size_t len = fread(data, 1, (size_t)sz, fp);
+    data[len] = '\0';
+    fclose(fp);
+    if (stats) {
+        stats->files_read++;
+        stats->read_wall += clock_wall() - wall0;
+        stats->read_cpu += clock_thread_cpu() - cpu0;
+    }
+    f = file_insert(ctx, canon, h, data, len);
+    free(canon);
+    return f;
+}
+
+/* Like file_load for contents the caller already read. */
+static PPFile *file_adopt(PPContext *ctx, const char *path, char *data, size_t len, PPStats *stats) {
+    char *canon = canonical_path(path);
+    if (!canon) { free(data); return NULL; }
+    unsigned h = hash_str(canon, strlen(canon)) % PP_BUCKETS;
+    PPFile *f = file_find(ctx, canon, h);
+    if (f) {
+        free(data);
+        if (stats) stats->cache_hits++;
+    } else {
+        if (stats) stats->files_read++;
+        f = file_insert(ctx, canon, h, data, len);
+    }
+    free(canon);
+    return f;
+}
+
+/* ---- logical lines ---- */
+
+typedef struct {
+    const char *p;
+    const char *end;
+} Cursor;
+
+/* Reads one logical line into out: comments become a single space and
+ * backslash-newlines are joined. Returns the number of physical lines
+ * consumed (0 at end of input). */
+static int read_logical_line(Cursor *c, Buf *out) {
+    buf_clear(out);
+    if (c->p >= c->end) return 0;
+    int lines = 1;
+    char quote = 0;
+    while (c->p < c->end) {
+        char ch = *c->p;
+        if (ch == '\\' && c->p + 1 < c->end &&
+            (c->p[1] == '\n' || (c->p[1] == '\r' && c->p + 2 < c->end && c->p[2] == '\n'))) {
+            c->p += (c->p[1] == '\r') ? 3 : 2;
+            lines++;
+            continue;
+        }
+        if (ch == '\n') { c->p++; return lines; }
+        if (ch == '\r') { c->p++; continue; }
+        if (quote) {
+            buf_putc(out, ch);
+            c->p++;
+            if (ch == '\\' && c->p < c->end && *c->p != '\n') { buf_putc(out, *c->p); c->p++; }
+            else if (ch == quote) quote = 0;
+            continue;
+        }
+        if (ch == '"' || ch == '\'') { quote = ch; buf_putc(out, ch); c->p++; continue; }
+        if (ch == '/' && c->p + 1 < c->end) {
+            if (c->p[1] == '/') {
+                while (c->p < c->end && *c->p != '\n') c->p++;
+                continue;
+            }
+            if (c->p[1] == '*') {
+                c->p += 2;
+                while (c->p < c->end && !(c->p[0] == '*' && c->p + 1 < c->end && c->p[1] == '/')) {
+                    if (*c->p == '\n') lines++;
+                    c->p++;
+                }
+                if (c->p < c->end) c->p += 2;
+                buf_putc(out, ' ');
+                continue;
+            }
+        }
+        buf_putc(out, ch);
+        c->p++;
+    }
+    return lines;
+}
+
+/* If s is a directive, returns a pointer to its name and sets *rest to the
+ * text after the name; otherwise NULL. */
+static const char *directive_name(const char *s, size_t *name_len, const char **rest) {
+    while (*s == ' ' || *s == '\t') s++;
+    if (*s != '#') return NULL;
+    s++;
+    while (*s == ' ' || *s == '\t') s++;
+    const char *name = s;
+    while (is_ident_cont(*s)) s++;
+    *name_len = (size_t)(s - name);
+    while (*s == ' ' || *s == '\t') s++;
+    *rest = s;
+    return name;
+}
+
+static int directive_is(const char *name, size_t n, const char *what) {
+    return strlen(what) == n && memcmp(name, what, n) == 0;
+}
+
+/* Reads `NAME`, `!defined NAME` or `!defined(NAME)` into a fresh string. */
+static char *read_ident(const char *s) {
+    while (isspace((unsigned char)*s)) s++;
+    const char *p = s;
+    while (is_ident_cont(*s)) s++;
+    if (s == p) return NULL;
+    return dup_range(p, (size_t)(s - p));
+}
+
+static char *guard_macro(const char *dname, size_t dlen, const char *rest) {
+    if (directive_is(dname, dlen, "ifndef")) return read_ident(rest);
+    if (!directive_is(dname, dlen, "if")) return NULL;
+    const char *s = rest;
+    while (isspace((unsigned char)*s)) s++;
+    if (*s != '!') return NULL;
+    s++;
+    while (isspace((unsigned char)*s)) s++;
+    if (strncmp(s, "defined", 7) != 0) return NULL;
+    s += 7;
+    while (isspace((unsigned char)*s)) s++;
+    int paren = (*s == '(');
+    if (paren) s++;
+    char *name = read_ident(s);
+    return name;
+}
+
+static int line_is_blank(const char *s) {
+    while (isspace((unsigned char)*s)) s++;
+    return *s == '\0';
+}
+
+/* Multiple-include optimization: detects a file whose whole content is
+ * wrapped in #ifndef X ... #endif (or #if !defined(X)). */
+static void scan_guard(PPFile *f) {
+    Cursor c = { f->data, f->data + f->len };
+    Buf line = { 0 };
+    char *guard = NULL;
+    int depth = 0;
+    int closed = 0;
+    int ok = 1;
+    while (ok && read_logical_line(&c, &line)) {
+        if (line_is_blank(line.data)) continue;
+        if (closed) { ok = 0; break; }
+        size_t dlen;
+        const char *rest;
+        const char *dname = directive_name(line.data, &dlen, &rest);
+        if (!guard) {
+            if (!dname || !(guard = guard_macro(dname, dlen, rest))) ok = 0;
+            depth = 1;
+            continue;
+        }
+        if (!dname) continue;
+        if (directive_is(dname, dlen, "if") || directive_is(dname, dlen, "ifdef") ||
+            directive_is(dname, dlen, "ifndef")) {
+            depth++;
+        } else if (directive_is(dname, dlen, "endif")) {
+            if (--depth == 0) closed = 1;
+        } else if (depth == 1 && (directive_is(dname, dlen, "else") || directive_is(dname, dlen, "elif"))) {
+            ok = 0;
+        }
+    }
+    free(line.data);
+    if (ok && closed && guard) f->guard = guard;
+    else free(guard);
+}
+
+/* ---- macro expansion ---- */
+
+typedef struct {
+    const char *s;
+    size_t len;
+} Arg;
+
+static size_t expand_text(PPContext *ctx, const char *s, size_t n, Buf *out, int allow_incomplete, int depth);
+
+static size_t skip_literal(const char *s, size_t n, size_t i) {
+    char q = s[i++];
+    while (i < n && s[i] != q) {
+        if (s[i] == '\\' && i + 1 < n) i++;
+        i++;
+    }
+    return i < n ? i + 1 : n;
+}
+
+static size_t skip_pp_number(const char *s, size_t n, size_t i) {
+    while (i < n) {
+        char c = s[i];
+        if ((c == '+' || c == '-') && i > 0 && (s[i - 1] == 'e' || s[i - 1] == 'E' ||
+                                               s[i - 1] == 'p' || s[i - 1] == 'P')) { i++; continue; }
+        if (is_ident_cont(c) || c == '.') { i++; continue; }
+        break;
+    }
+    return i;
+}
+
+static int param_index(const Macro *m, const char *s, size_t n) {
+    for (int k = 0; k < m->nparams; ++k) {
+        if (strlen(m->params[k]) == n && memcmp(m->params[k], s, n) == 0) return k;
+    }
+    return -1;
+}
+
+static void trim_arg(Arg *a) {
+    while (a->len > 0 && isspace((unsigned char)a->s[0])) { a->s++; a->len--; }
+    while (a->len > 0 && isspace((unsigned char)a->s[a->len - 1])) a->len--;
+}
+
+static void stringify(const Arg *a, Buf *out) {
+    buf_putc(out, '"');
+    int space = 0;
+    for (size_t i = 0; i < a->len; ++i) {
+        char c = a->s[i];
+        if (isspace((unsigned char)c)) { space = 1; continue; }
+        if (space) { buf_putc(out, ' '); space = 0; }
+        if (c == '"' || c == '\\') buf_putc(out, '\\');
+        buf_putc(out, c);
+    }
+    buf_putc(out, '"');
+}
+
+static void substitute(PPContext *ctx, const Macro *m, const Arg *args, int nargs, Buf *out, int depth) {
+    const char *b = m->body;
+    size_t n = strlen(b);
+    size_t i = 0;
+    int paste_next = 0; /* previous token was ## */
+    while (i < n) {
+        char c = b[i];
+        if (c == '#' && i + 1 < n && b[i + 1] == '#') {
+            while (out->len > 0 && isspace((unsigned char)out->data[out->len - 1])) out->len--;
+            out->data[out->len] = '\0';
+            i += 2;
+            while (i < n && isspace((unsigned char)b[i])) i++;
+            paste_next = 1;
+            continue;
+        }
+        if (c == '#') {
+            size_t j = i + 1;
+            while (j < n && isspace((unsigned char)b[j])) j++;
+            size_t st = j;
+            while (j < n && is_ident_cont(b[j])) j++;
+            int k = param_index(m, b + st, j - st);
+            if (k >= 0) {
+                if (k < nargs) stringify(&args[k], out); else buf_append(out, "\"\"", 2);
+                i = j;
+                paste_next = 0;
+                continue;
+            }
+        }
+        if (c == '"' || c == '\'') {
+            size_t j = skip_literal(b, n, i);
+            buf_append(out, b + i, j - i);
+            i = j;
+            paste_next = 0;
+            continue;
+        }
+        if (is_ident_start(c)) {
+            size_t st = i;
+            while (i < n && is_ident_cont(b[i])) i++;
+            int k = param_index(m, b + st, i - st);
+            if (k < 0) { buf_append(out, b + st, i - st); paste_next = 0; continue; }
+            size_t j = i;
+            while (j < n && isspace((unsigned char)b[j])) j++;
+            int before_paste = (j + 1 < n && b[j] == '#' && b[j + 1] == '#');
+            if (k < nargs) {
+                if (paste_next || before_paste) buf_append(out, args[k].s, args[k].len);
+                else expand_text(ctx, args[k].s, args[k].len, out, 0, depth + 1);
+            }
+            paste_next = 0;
+            continue;
+        }
+        if (!isspace((unsigned char)c)) paste_next = 0;
+        buf_putc(out, c);
+        i++;
+    }
+}
+
+/* Collects the arguments of a function-like invocation starting at s[i]
+ * == '('. Returns the index after ')' or 0 if the list is not closed. */
+static size_t collect_args(const Macro *m, const char *s, size_t n, size_t i, Arg **args_out, int *nargs_out) {
+    Arg *args = NULL;
+    int nargs = 0;
+    int depth = 0;
+    size_t start = ++i;
+    while (i < n) {
+        char c = s[i];
+        if (c == '"' || c == '\'') { i = skip_literal(s, n, i); continue; }
+        if (c == '(') depth++;
+        else if (c == ')' && depth > 0) depth--;
+        else if ((c == ',' && depth == 0 && !(m->variadic && nargs == m->nparams - 1)) ||
+                 (c == ')' && depth == 0)) {
+            args = (Arg*)ds_realloc(args, (nargs + 1) * sizeof(Arg));
+            args[nargs].s = s + start;
+            args[nargs].len = i - start;
+            trim_arg(&args[nargs]);
+            nargs++;
+            start = i + 1;
+            if (c == ')') {
+                *args_out = args;
+                *nargs_out = nargs;
+                return i + 1;
+            }
+        }
+        i++;
+    }
+    free(args);
+    return 0;
+}
+
+/* Expands macros in s[0..n) into out. With allow_incomplete set, stops at a
+ * function-like invocation whose argument list continues past the end and
+ * returns its offset; otherwise returns n. */
+static size_t expand_text(PPContext *ctx, const char *s, size_t n, Buf *out, int allow_incomplete, int depth) {
+    size_t i = 0;
+    while (i < n) {
+        char c = s[i];
+        if (c == '"' || c == '\'') {
+            size_t j = skip_literal(s, n, i);
+            buf_append(out, s + i, j - i);
+            i = j;
+            continue;
+        }
+        if (isdigit((unsigned char)c)) {
+            size_t j = skip_pp_number(s, n, i);
+            buf_append(out, s + i, j - i);
+            i = j;
+            continue;
+        }
+        if (!is_ident_start(c)) {
+            buf_putc(out, c);
+            i++;
+            continue;
+        }
+        size_t st = i;
+        while (i < n && is_ident_cont(s[i])) i++;
+        Macro *m = macro_find(ctx, s + st, i - st);
+        if (!m || m->disabled || depth > PP_MAX_EXPANSION_DEPTH) {
+            buf_append(out, s + st, i - st);
+            continue;
+        }
+        if (!m->is_func) {
+            m->disabled = 1;
+            expand_text(ctx, m->body, strlen(m->body), out, 0, depth + 1);
+            m->disabled = 0;
+            continue;
+        }
+        size_t j = i;
+        while (j < n && isspace((unsigned char)s[j])) j++;
+        if (j >= n && allow_incomplete) return st;
+        if (j >= n || s[j] != '(') {
+            buf_append(out, s + st, i - st);
+            continue;
+        }
+        Arg *args = NULL;
+        int nargs = 0;
+        size_t end = collect_args(m, s, n, j, &args, &nargs);
+        if (!end) {
+            if (allow_incomplete) return st;
+            buf_append(out, s + st, i - st);
+            continue;
+        }
+        Buf body = { 0 };
+        substitute(ctx, m, args, nargs, &body, depth);
+        free(args);
+        m->disabled = 1;
+        if (body.len) expand_text(ctx, body.data, body.len, out, 0, depth + 1);
+        m->disabled = 0;
+        free(body.data);
+        i = end;
+    }
+    return n;
+}
+
+/* ---- #if expressions ---- */
+
+typedef struct {
+    const char *p;
+} Expr;
+
+static long long eval_cond(Expr *e);
+
+static void expr_ws(Expr *e) {
+    while (isspace((unsigned char)*e->p)) e->p++;
+}
+
+static int expr_accept(Expr *e, const char *op) {
+    expr_ws(e);
+    size_t n = strlen(op);
+    if (strncmp(e->p, op, n) != 0) return 0;
+    /* don't take "<" from "<<"/"<=" or "&" from "&&" */
+    if (n == 1 && strchr("<>&|", op[0]) && (e->p[1] == op[0] || e->p[1] == '=')) return 0;
+    e->p += n;
+    return 1;
+}
+
+static long long eval_primary(Expr *e) {
+    expr_ws(e);
+    char c = *e->p;
+    if (c == '(') {
+        e->p++;
+        long long v = eval_cond(e);
+        expr_accept(e, ")");
+        return v;
+    }
+    if (c == '!') { e->p++; return !eval_primary(e); }
+    if (c == '~') { e->p++; return ~eval_primary(e); }
+    if (c == '-') { e->p++; return -eval_primary(e); }
+    if (c == '+') { e->p++; return eval_primary(e); }
+    if (isdigit((unsigned char)c)) {
+        size_t n = skip_pp_number(e->p, strlen(e->p), 0);
+        NumLit lit;
+        lexer_parse_number(e->p, n, &lit);
+        e->p += n;
+        return (long long)lit.value;
+    }
+    if (c == '\'') {
+        e->p++;
+        long long v = (unsigned char)*e->p;
+        if (*e->p == '\\') {
+            e->p++;
+            switch (*e->p) {
+                case 'n': v = '\n'; break;
+                case 't': v = '\t'; break;
+                case '0': v = 0; break;
+                default: v = (unsigned char)*e->p; break;
+            }
+        }
+        while (*e->p && *e->p != '\'') e->p++;
+        if (*e->p) e->p++;
+        return v;
+    }
+    if (is_ident_start(c)) {
+        /* identifiers left after expansion evaluate to 0 */
+        while (is_ident_cont(*e->p)) e->p++;
+        return 0;
+    }
+    if (c) e->p++;
+    return 0;
+}
+
+static long long eval_mul(Expr *e) {
+    long long v = eval_primary(e);
+    while (1) {
+        if (expr_accept(e, "*")) v *= eval_primary(e);
+        else if (expr_accept(e, "/")) { long long r = eval_primary(e); v = r ? v / r : 0; }
+        else if (expr_accept(e, "%")) { long long r = eval_primary(e); v = r ? v % r : 0; }
+        else return v;
+    }
+}
+
+static long long eval_add(Expr *e) {
+    long long v = eval_mul(e);
+    while (1) {
+        if (expr_accept(e, "+")) v += eval_mul(e);
+        else if (expr_accept(e, "-")) v -= eval_mul(e);
+        else return v;
+    }
+}
+
+static long long eval_shift(Expr *e) {
+    long long v = eval_add(e);
+    while (1) {
+        if (expr_accept(e, "<<")) v <<= eval_add(e);
+        else if (expr_accept(e, ">>")) v >>= eval_add(e);
+        else return v;
+    }
+}
+
+static long long eval_rel(Expr *e) {
+    long long v = eval_shift(e);
+    while (1) {
+        if (expr_accept(e, "<=")) v = v <= eval_shift(e);
+        else if (expr_accept(e, ">=")) v = v >= eval_shift(e);
+        else if (expr_accept(e, "<")) v = v < eval_shift(e);
+        else if (expr_accept(e, ">")) v = v > eval_shift(e);
+        else return v;
+    }
+}
+
+static long long eval_eq(Expr *e) {
+    long long v = eval_rel(e);
+    while (1) {
+        if (expr_accept(e, "==")) v = v == eval_rel(e);
+        else if (expr_accept(e, "!=")) v = v != eval_rel(e);
+        else return v;
+    }
+}
+
+static long long eval_band(Expr *e) {
+    long long v = eval_eq(e);
+    while (expr_accept(e, "&")) v &= eval_eq(e);
+    return v;
+}
+
+static long long eval_bxor(Expr *e) {
+    long long v = eval_band(e);
+    while (expr_accept(e, "^")) v ^= eval_band(e);
+    return v;
+}
+
+static long long eval_bor(Expr *e) {
+    long long v = eval_bxor(e);
+    while (expr_accept(e, "|")) v |= eval_bxor(e);
+    return v;
+}
+
+static long long eval_land(Expr *e) {
+    long long v = eval_bor(e);
+    while (expr_accept(e, "&&")) { long long r = eval_bor(e); v = v && r; }
+    return v;
+}
+
+static long long eval_lor(Expr *e) {
+    long long v = eval_land(e);
+    while (expr_accept(e, "||")) { long long r = eval_land(e); v = v || r; }
+    return v;
+}
+
+static long long eval_cond(Expr *e) {
+    long long v = eval_lor(e);
+    if (expr_accept(e, "?")) {
+        long long a = eval_cond(e);
+        expr_accept(e, ":");
+        long long b = eval_cond(e);
+        return v ? a : b;
+    }
+    return v;
+}
+
+/* Evaluates the controlling expression of #if/#elif. */
+static int eval_if(PPContext *ctx, const char *s) {
+    Buf pre = { 0 };
+    size_t n = strlen(s);
+    size_t i = 0;
+    while (i < n) {
+        if (is_ident_start(s[i])) {
+            size_t st = i;
+            while (i < n && is_ident_cont(s[i])) i++;
+            if (i - st == 7 && memcmp(s + st, "defined", 7) == 0) {
+                while (i < n && isspace((unsigned char)s[i])) i++;
+                int paren = (i < n && s[i] == '(');
+                if (paren) i++;
+                while (i < n && isspace((unsigned char)s[i])) i++;
+                size_t ns = i;
+                while (i < n && is_ident_cont(s[i])) i++;
+                int def = macro_find(ctx, s + ns, i - ns) != NULL;
+                if (paren) {
+                    while (i < n && s[i] != ')') i++;
+                    if (i < n) i++;
+                }
+                buf_putc(&pre, def ? '1' : '0');
+            } else {
+                buf_append(&pre, s + st, i - st);
+            }
+            continue;
+        }
+        buf_putc(&pre, s[i++]);
+    }
+    Buf exp = { 0 };
+    if (pre.len) expand_text(ctx, pre.data, pre.len, &exp, 0, 0);
+    Expr e = { exp.data ? exp.data : "" };
+    long long v = eval_cond(&e);
+    free(pre.data);
+    free(exp.data);
+    return v != 0;
+}
+
+/* ---- driver ---- */
+
+typedef struct {
+    int active;        /* lines in this branch are emitted */
+    int taken;         /* some branch of this group was taken */
+    int parent_active; /* enclosing group was active */
+} Cond;
+
+static void emit_marker(Buf *out, int line, const char *path) {
+    char tmp[32];
+    snprintf(tmp, sizeof(tmp), "# %d \"", line);
+    buf_append(out, tmp, strlen(tmp));
+    for (const char *p = path; *p; ++p) {
+        if (*p == '"' || *p == '\\') buf_putc(out, '\\');
+        buf_putc(out, *p);
+    }
+    buf_append(out, "\"\n", 2);
+}
+
+static void emit_newlines(Buf *out, int n) {
+    while (n-- > 0) buf_putc(out, '\n');
+}
+
+static char *dir_of(const char *path) {
+    const char *slash = strrchr(path, '/');
+    const char *bslash = strrchr(path, '\\');
+    if (bslash > slash) slash = bslash;
+    if (!slash) return ds_strdup("");
+    return dup_range(path, (size_t)(slash - path + 1));
+}
+
+static char *join_path(const char *dir, const char *name) {
+    size_t dl = strlen(dir);
+    int need_sep = dl > 0 && dir[dl - 1] != '/' && dir[dl - 1] != '\\';
+    char *p = (char*)ds_malloc(dl + need_sep + strlen(name) + 1);
+    strcpy(p, dir);
+    if (need_sep) strcat(p, "/");
+    strcat(p, name);
+    return p;
+}
+
+static PPFile *resolve_include(PPContext *ctx, const char *name, int angled, const char *cur_path, PPStats *stats) {
+    PPFile *f = NULL;
+    if (!angled) {
+        char *dir = dir_of(cur_path);
+        char *full = join_path(dir, name);
+        f = file_load(ctx, full, stats);
+        free(full);
+        free(dir);
+    }
+    for (int i = 0; !f && i < ctx->include_path_count; ++i) {
+        char *full = join_path(ctx->include_paths[i], name);
+        f = file_load(ctx, full, stats);
+        free(full);
+    }
+    return f;
+}
+
+static void pp_text(PPContext *ctx, const char *text, size_t len, const char *path, PPFile *self,
+                    Buf *out, int depth, PPStats *stats);
+
+static void do_include(PPContext *ctx, const char *rest, const char *cur_path, int line, Buf *out, int depth, PPStats *stats) {
+    Buf expanded = { 0 };
+    const char *s = rest;
+    if (*s != '"' && *s != '<') {
+        /* #include MACRO */
+        expand_text(ctx, rest, strlen(rest), &expanded, 0, 0);
+        s = expanded.data ? expanded.data : "";
+        while (isspace((unsigned char)*s)) s++;
+    }
+    char close = (*s == '<') ? '>' : '"';
+    if (*s != '"' && *s != '<') { free(expanded.data); return; }
+    const char *name = s + 1;
+    const char *end = strchr(name, close);
+    if (!end) { free(expanded.data); return; }
+    char *fname = dup_range(name, (size_t)(end - name));
+    free(expanded.data);
+    PPFile *f = resolve_include(ctx, fname, close == '>', cur_path, stats);
+    if (!f) {
+        /* system headers outside the search path are silently skipped */
+        if (close == '"') fprintf(stderr, "%s:%d: include not found: %s\n", cur_path, line, fname);
+        free(fname);
+        return;
+    }
+    free(fname);
+    if ((f->once && f->entered) || (f->guard && macro_find(ctx, f->guard, strlen(f->guard)))) {
+        if (stats) stats->guard_skips++;
+        return;
+    }
+    if (depth >= PP_MAX_INCLUDE_DEPTH) {
+        fprintf(stderr, "%s:%d: #include nested too deeply\n", cur_path, line);
+        return;
+    }
+    emit_marker(out, 1, f->path);
+    pp_text(ctx, f->data, f->len, f->path, f, out, depth + 1, stats);
+    if (out->len > 0 && out->data[out->len - 1] != '\n') buf_putc(out, '\n');
+}
+
+static void pp_text(PPContext *ctx, const char *text, size_t len, const char *path, PPFile *self,
+                    Buf *out, int depth, PPStats *stats) {
+    if (self) self->entered = 1;
+    Cursor c = { text, text + len };
+    Buf line = { 0 };
+    Buf pending = { 0 }; /* unfinished macro invocation carried to the next line */
+    int pending_lines = 0;
+    Cond conds[PP_MAX_COND_DEPTH];
+    int ncond = 0;
+    int lineno = 1;
+    int lines;
+    while ((lines = read_logical_line(&c, &line)) > 0) {
+        int active = ncond == 0 || conds[ncond - 1].active;
+        size_t dlen;
+        const char *rest;
+        const char *dname = directive_name(line.data ? line.data : "", &dlen, &rest);
+        if (dname) {
+            if (directive_is(dname, dlen, "if") || directive_is(dname, dlen, "ifdef") ||
+                directive_is(dname, dlen, "ifndef")) {
+                int v = 0;
+                if (active) {
+                    if (directive_is(dname, dlen, "ifdef")) v = macro_find(ctx, rest, strcspn(rest, " \t")) != NULL;
+                    else if (directive_is(dname, dlen, "ifndef")) v = macro_find(ctx, rest, strcspn(rest, " \t")) == NULL;
+                    else v = eval_if(ctx, rest);
+                }
+                if (ncond < PP_MAX_COND_DEPTH) {
+                    conds[ncond].parent_active = active;
+                    conds[ncond].active = active && v;
+                    conds[ncond].taken = active && v;
+                    ncond++;
+                }
+            } else if (directive_is(dname, dlen, "elif")) {
+                if (ncond > 0) {
+                    Cond *cd = &conds[ncond - 1];
+                    if (cd->parent_active && !cd->taken) {
+                        cd->active = eval_if(ctx, rest);
+                        cd->taken = cd->active;
+                    } else {
+                        cd->active = 0;
+                    }
+                }
+            } else if (directive_is(dname, dlen, "else")) {
+                if (ncond > 0) {
+                    Cond *cd = &conds[ncond - 1];
+                    cd->active = cd->parent_active && !cd->taken;
+                    cd->taken = 1;
+                }
+            } else if (directive_is(dname, dlen, "endif")) {
+                if (ncond > 0) ncond--;
+            } else if (active) {
+                if (directive_is(dname, dlen, "define")) {
+                    macro_define_line(ctx, rest);
+                } else if (directive_is(dname, dlen, "undef")) {
+                    macro_undef(ctx, rest, strcspn(rest, " \t"));
+                } else if (directive_is(dname, dlen, "include")) {
+                    do_include(ctx, rest, path, lineno, out, depth, stats);
+                    lineno += lines;
+                    emit_marker(out, lineno, path);
+                    continue;
+                } else if (directive_is(dname, dlen, "pragma")) {
+                    if (strncmp(rest, "once", 4) == 0 && self) self->once = 1;
+                } else if (directive_is(dname, dlen, "error")) {
+                    fprintf(stderr, "%s:%d: #error %s\n", path, lineno, rest);
+                }
+            }
+            emit_newlines(out, lines);
+            lineno += lines;
+            continue;
+        }
+        lineno += lines;
+        if (!active) {
+            emit_newlines(out, lines);
+            continue;
+        }
+        const char *src = line.data ? line.data : "";
+        size_t src_len = line.len;
+        if (pending.len) {
+            buf_putc(&pending, ' ');
+            buf_append(&pending, src, src_len);
+            src = pending.data;
+            src_len = pending.len;
+            lines += pending_lines;
+        }
+        size_t done = expand_text(ctx, src, src_len, out, 1, 0);
+        if (done < src_len) {
+            /* keep the unfinished invocation and retry with the next line */
+            Buf keep = { 0 };
+            buf_append(&keep, src + done, src_len - done);
+            free(pending.data);
+            pending = keep;
+            pending_lines = lines;
+            continue;
+        }
+        buf_clear(&pending);
+        pending_lines = 0;
+        emit_newlines(out, lines);
+    }
+    if (pending.len) {
+        expand_text(ctx, pending.data, pending.len, out, 0, 0);
+        emit_newlines(out, pending_lines);
+    }
+    free(pending.data);
+    free(line.data);
+}
+
+PPContext *pp_create(void) {
+    return (PPContext*)ds_calloc(1, sizeof(PPContext));
+}
+
+PPContext *pp_copy(const PPContext *ctx) {
+    PPContext *c = pp_create();
+    for (int i = 0; i < ctx->include_path_count; ++i) pp_add_include_path(c, ctx->include_paths[i]);
+    for (int i = 0; i < PP_BUCKETS; ++i) {
+        Macro **tail = &c->macros[i];
+        for (const Macro *m = ctx->macros[i]; m; m = m->next) {
+            Macro *d = (Macro*)ds_calloc(1, sizeof(Macro));
+            d->name = ds_strdup(m->name);
+            d->body = ds_strdup(m->body);
+            d->nparams = m->nparams;
+            d->is_func = m->is_func;
+            d->variadic = m->variadic;
+            if (m->nparams) d->params = (char**)ds_malloc(m->nparams * sizeof(char*));
+            for (int k = 0; k < m->nparams; ++k) d->params[k] = ds_strdup(m->params[k]);
+            *tail = d;
+            tail = &d->next;
+        }
+    }
+    return c;
+}
+
+void pp_add_include_path(PPContext *ctx, const char *dir) {
+    ctx->include_paths = (char**)ds_realloc(ctx->include_paths, (ctx->include_path_count + 1) * sizeof(char*));
+    ctx->include_paths[ctx->include_path_count++] = ds_strdup(dir);
+}
+
+void pp_define(PPContext *ctx, const char *def) {
+    Buf line = { 0 };
+    const char *eq = strchr(def, '=');
+    if (eq) {
+        buf_append(&line, def, (size_t)(eq - def));
+        buf_putc(&line, ' ');
+        buf_append(&line, eq + 1, strlen(eq + 1));
+    } else {
+        buf_append(&line, def, strlen(def));
+        buf_append(&line, " 1", 2);
+    }
+    macro_define_line(ctx, line.data);
+    free(line.data);
+}
+
+static char *process_cached(PPContext *ctx, PPFile *f, size_t *len_out, PPStats *stats) {
+    Buf out = { 0 };
+    buf_reserve(&out, f->len + f->len / 4);
+    if (!((f->once && f->entered) || (f->guard && macro_find(ctx, f->guard, strlen(f->guard))))) {
+        pp_text(ctx, f->data, f->len, f->path, f, &out, 0, stats);
+    } else if (stats) {
+        stats->guard_skips++;
+    }
+    if (len_out) *len_out = out.len;
+    return out.data;
+}
+
+char *pp_process_file(PPContext *ctx, const char *path, size_t *len_out, PPStats *stats) {
+    PPFile *f = file_load(ctx, path, stats);
+    return f ? process_cached(ctx, f, len_out, stats) : NULL;
+}
+
+char *pp_process_buffer(PPContext *ctx, const char *path, char *data, size_t len, size_t *len_out, PPStats *stats) {
+    PPFile *f = file_adopt(ctx, path, data, len, stats);
+    return f ? process_cached(ctx, f, len_out, stats) : NULL;
+}
+
+char *pp_process_string(PPContext *ctx, const char *code, size_t *len_out, PPStats *stats) {
+    Buf out = { 0 };
+    buf_reserve(&out, strlen(code));
+    pp_text(ctx, code, strlen(code), "<string>", NULL, &out, 0, stats);
+    if (len_out) *len_out = out.len;
+    return out.data;
+}
+
+void pp_destroy(PPContext *ctx) {
+    if (!ctx) return;
+    for (int i = 0; i < PP_BUCKETS; ++i) {
+        while (ctx->macros[i]) {
+            Macro *m = ctx->macros[i];
+            ctx->macros[i] = m->next;
+            macro_free(m);
+        }
+        while (ctx->files[i]) {
+            PPFile *f = ctx->files[i];
+            ctx->files[i] = f->next;
+            free(f->path);
+            free(f->data);
+            free(f->guard);
+            free(f);
+        }
+    }
+    for (int i = 0; i < ctx->include_path_count; ++i) free(ctx->include_paths[i]);
+    free(ctx->include_paths);
+    free(ctx);
+}
@@ -0,0 +1,215 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "report.h"
+#include "memstat.h"
+
+#ifdef _WIN32
+#define PSAPI_VERSION 2 /* K32GetProcessMemoryInfo lives in kernel32 */
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/time.h>
+#include <sys/resource.h>
+#endif
+
+#ifdef _WIN32
+static double filetime_seconds(FILETIME ft) {
+    ULARGE_INTEGER u;
+    u.LowPart = ft.dwLowDateTime;
+    u.HighPart = ft.dwHighDateTime;
+    return (double)u.QuadPart * 1e-7;
+}
+#endif
+
+double clock_wall(void) {
+#ifdef _WIN32
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+    if (!freq.QuadPart) QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (double)now.QuadPart / (double)freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#endif
+}
+
+double clock_cpu(void) {
+#ifdef _WIN32
+    FILETIME created, exited, kernel, user;
+    if (!GetProcessTimes(GetCurrentProcess(), &created, &exited, &kernel, &user)) return 0.0;
+    return filetime_seconds(kernel) + filetime_seconds(user);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#endif
+}
+
+double clock_thread_cpu(void) {
+#ifdef _WIN32
+    FILETIME created, exited, kernel, user;
+    if (!GetThreadTimes(GetCurrentThread(), &created, &exited, &kernel, &user)) return 0.0;
+    return filetime_seconds(kernel) + filetime_seconds(user);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#endif
+}
+
+size_t report_peak_rss(void) {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) return 0;
+    return (size_t)pmc.PeakWorkingSetSize;
+#else
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) != 0) return 0;
+#ifdef __APPLE__
+    return (size_t)ru.ru_maxrss; /* bytes */
+#else
+    return (size_t)ru.ru_maxrss * 1024; /* kilobytes */
+#endif
+#endif
+}
+
+Report *report_create(void) {
+    Report *r = (Report*)calloc(1, sizeof(Report));
+    return r;
+}
+
+void report_destroy(Report *r) {
+    if (!r) return;
+    InputReport *in = r->inputs;
+    while (in) {
+        InputReport *next = in->next;
+        free(in->name);
+        free(in);
+        in = next;
+    }
+    OutputReport *out = r->outputs;
+    while (out) {
+        OutputReport *next = out->next;
+        free(out->target);
+        free(out->path);
+        free(out);
+        out = next;
+    }
+    free(r);
+}
+
+void report_phase_add(Report *r, Phase p, double wall, double cpu) {
+    if (!r) return;
+    r->phases[p].wall += wall;
+    r->phases[p].cpu += cpu;
+}
+
+void report_add_input(Report *r, const char *name, const ParseStats *stats) {
+    if (!r) return;
+    InputReport *in = (InputReport*)calloc(1, sizeof(InputReport));
+    in->name = strdup(name ? name : "<string>");
+    in->stats = *stats;
+    if (r->inputs_last) r->inputs_last->next = in; else r->inputs = in;
+    r->inputs_last = in;
+    report_phase_add(r, PHASE_READ, stats->read_wall, stats->read_cpu);
+    report_phase_add(r, PHASE_PREPROCESS, stats->pp_wall, stats->pp_cpu);
+    report_phase_add(r, PHASE_LEX, stats->lex_wall, stats->lex_cpu);
+    report_phase_add(r, PHASE_PARSE, stats->parse_wall, stats->parse_cpu);
+}
+
+void report_add_output(Report *r, const char *target, const char *path, size_t bytes, int changed) {
+    if (!r) return;
+    OutputReport *out = (OutputReport*)calloc(1, sizeof(OutputReport));
+    out->target = strdup(target ? target : "c");
+    out->path = path ? strdup(path) : NULL;
+    out->bytes = bytes;
+    out->changed = changed;
+    if (r->outputs_last) r->outputs_last->next = out; else r->outputs = out;
+    r->outputs_last = out;
+}
+
+void report_take_outputs(Report *r, Report *from) {
+    if (!r || !from || !from->outputs) return;
+    if (r->outputs_last) r->outputs_last->next = from->outputs; else r->outputs = from->outputs;
+    r->outputs_last = from->outputs_last;
+    from->outputs = from->outputs_last = NULL;
+}
+
+static void json_string(FILE *f, const char *s) {
+    fputc('"', f);
+    for (; *s; ++s) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') fprintf(f, "\\%c", c);
+        else if (c == '\n') fprintf(f, "\\n");
+        else if (c == '\t') fprintf(f, "\\t");
+        else if (c < 0x20) fprintf(f, "\\u%04x", c);
+        else fputc(c, f);
+    }
+    fputc('"', f);
+}
+
+static const char *phase_names[PHASE_COUNT] = {
+    "read", "preprocess", "lex", "parse", "merge", "generate"
+};
+
+int report_write_json(const Report *r, const char *path) {
+    if (!r || !path) return 1;
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        fprintf(stderr, "Failed to open metadata file: %s\n", path);
+        return 1;
+    }
+    /* the preprocessor's file counters go with its phase */
+    size_t pp_files = 0, pp_cache_hits = 0, pp_guard_skips = 0;
+    for (const InputReport *in = r->inputs; in; in = in->next) {
+        pp_files += in->stats.pp_files;
+        pp_cache_hits += in->stats.pp_cache_hits;
+        pp_guard_skips += in->stats.pp_guard_skips;
+    }
+    fprintf(f, "{\n  \"phases\": {\n");
+    for (int p = 0; p < PHASE_COUNT; ++p) {
+        fprintf(f, "    \"%s\": { \"wall\": %.6f, \"cpu\": %.6f", phase_names[p], r->phases[p].wall, r->phases[p].cpu);
+        if (p == PHASE_PREPROCESS) {
+            fprintf(f, ", \"files_read\": %zu, \"cache_hits\": %zu, \"guard_skips\": %zu",
+                    pp_files, pp_cache_hits, pp_guard_skips);
+        }
+        fprintf(f, " }%s\n", p + 1 < PHASE_COUNT ? "," : "");
+    }
+    fprintf(f, "  },\n");
+    fprintf(f, "  \"total\": { \"wall\": %.6f, \"cpu\": %.6f },\n", r->total_wall, r->total_cpu);
+    fprintf(f, "  \"inputs\": [");
+    for (const InputReport *in = r->inputs; in; in = in->next) {
+        fprintf(f, "%s\n    { \"name\": ", in == r->inputs ? "" : ",");
+        json_string(f, in->name);
+        fprintf(f, ", \"bytes\": %zu, \"tokens\": %zu, \"declarations\": %zu, "
+                   "\"parse_wall\": %.6f, \"parse_cpu\": %.6f }",
+                in->stats.source_bytes, in->stats.tokens, in->stats.decls,
+                in->stats.lex_wall + in->stats.parse_wall, in->stats.lex_cpu + in->stats.parse_cpu);
+    }
+    fprintf(f, "%s],\n", r->inputs ? "\n  " : "");
+    fprintf(f, "  \"merge\": { \"types\": %zu, \"unique_types\": %zu, \"duplicate_decls\": %zu, \"conflicts\": %zu },\n",
+            r->merge.types, r->merge.unique_types, r->merge.duplicate_decls, r->merge.conflicts);
+    fprintf(f, "  \"ast\": { \"types\": %zu, \"members\": %zu, \"enumerators\": %zu, \"declarations\": %zu, "
+               "\"strings\": %zu, \"linked_bytes\": %zu, \"flat_bytes\": %zu },\n",
+            r->flat.types, r->flat.members, r->flat.values, r->flat.decls, r->flat.strings,
+            r->flat.linked_bytes, r->flat.flat_bytes);
+    fprintf(f, "  \"allocations\": { \"count\": %zu, \"bytes\": %zu },\n",
+            memstat_alloc_count(), memstat_alloc_bytes());
+    fprintf(f, "  \"peak_rss\": %zu,\n", report_peak_rss());
+    fprintf(f, "  \"outputs\": [");
+    for (const OutputReport *out = r->outputs; out; out = out->next) {
+        fprintf(f, "%s\n    { \"target\": ", out == r->outputs ? "" : ",");
+        json_string(f, out->target);
+        fprintf(f, ", \"path\": ");
+        if (out->path) json_string(f, out->path); else fprintf(f, "null");
+        fprintf(f, ", \"bytes\": %zu, \"changed\": %s }", out->bytes,
+                out->changed < 0 ? "null" : out->changed ? "true" : "false");
+    }
+    fprintf(f, "%s]\n}\n", r->outputs ? "\n  " : "");
+    fclose(f);
+    return 0;
+}
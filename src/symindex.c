@@ -0,0 +1,704 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include "symindex.h"
+#include "lexer.h"
+#include "parser.h"
+#include "preproc.h"
+#include "depgraph.h"
+#include "layout.h"
+#include "memstat.h"
+
+#define INDEX_MAGIC "dsconv-index 1"
+
+enum { KIND_TYPEDEF = 0, KIND_STRUCT, KIND_UNION, KIND_ENUM };
+static const char kind_letters[] = "tsue";
+
+typedef struct {
+    char *name;
+    int kind;
+    size_t file;          /* into SymIndex.files */
+    size_t offset, length; /* region of the file */
+    int line;             /* line of the region's first byte */
+    uint64_t hash;        /* of the region's bytes */
+} SymEntry;
+
+typedef struct {
+    char *path;
+    long long size, mtime;
+    uint64_t hash;        /* of the whole file */
+    size_t entries;       /* entries pointing at this file */
+    int dropped;          /* no longer exists; left out when saving */
+    int checked;          /* compared with the disk during this run */
+    int opened;           /* read by the current query */
+} SymFile;
+
+struct SymIndex {
+    SymFile *files;
+    size_t file_count, file_cap;
+    SymEntry *entries;
+    size_t entry_count, entry_cap;
+    size_t *names;  /* (kind, name) -> entry index + 1, open addressing */
+    size_t *paths;  /* path -> file index + 1 */
+    size_t name_cap, path_cap;
+    int names_valid, paths_valid;
+    int preprocessed; /* regions are cut from preprocessed text (P line) */
+    int dirty;
+    SymIndexStats stats;
+};
+
+static uint64_t fnv64(const void *data, size_t len, uint64_t h) {
+    const unsigned char *p = (const unsigned char*)data;
+    for (size_t i = 0; i < len; ++i) {
+        h ^= p[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+#define FNV_SEED 1469598103934665603ull
+
+static uint64_t name_key(int kind, const char *name) {
+    return fnv64(name, strlen(name), FNV_SEED + (uint64_t)kind);
+}
+
+/* Size and modification time of path; 0 if it does not exist. */
+static int file_stat(const char *path, long long *size, long long *mtime) {
+    struct stat st;
+    if (stat(path, &st) != 0) return 0;
+    *size = (long long)st.st_size;
+    *mtime = (long long)st.st_mtime;
+    return 1;
+}
+
+/* ---- lookup tables ---- */
+
+static size_t table_cap(size_t count) {
+    size_t cap = 64;
+    while (cap < count * 2) cap *= 2;
+    return cap;
+}
+
+/* First entry wins, so a name defined in several files resolves to the
+ * earliest one, like the merge in intern.c. */
+static void build_names(SymIndex *ix) {
+    free(ix->names);
+    ix->name_cap = table_cap(ix->entry_count);
+    ix->names = (size_t*)ds_calloc(ix->name_cap, sizeof(size_t));
+    for (size_t i = 0; i < ix->entry_count; ++i) {
+        const SymEntry *e = &ix->entries[i];
+        if (ix->files[e->file].dropped) continue;
+        size_t s = name_key(e->kind, e->name) & (ix->name_cap - 1);
+        int seen = 0;
+        while (ix->names[s]) {
+            const SymEntry *o = &ix->entries[ix->names[s] - 1];
+            if (o->kind == e->kind && strcmp(o->name, e->name) == 0) { seen = 1; break; }
+            s = (s + 1) & (ix->name_cap - 1);
+        }
+        if (!seen) ix->names[s] = i + 1;
+    }
+    ix->names_valid = 1;
+}
+
+static const SymEntry *find_name(SymIndex *ix, int kind, const char *name) {
+    if (!ix->names_valid) build_names(ix);
+    size_t s = name_key(kind, name) & (ix->name_cap - 1);
+    while (ix->names[s]) {
+        const SymEntry *e = &ix->entries[ix->names[s] - 1];
+        if (e->kind == kind && strcmp(e->name, name) == 0) return e;
+        s = (s + 1) & (ix->name_cap - 1);
+    }
+    return NULL;
+}
+
+static void build_paths(SymIndex *ix) {
+    free(ix->paths);
+    ix->path_cap = table_cap(ix->file_count);
+    ix->paths = (size_t*)ds_calloc(ix->path_cap, sizeof(size_t));
+    for (size_t i = 0; i < ix->file_count; ++i) {
+        const char *path = ix->files[i].path;
+        size_t s = fnv64(path, strlen(path), FNV_SEED) & (ix->path_cap - 1);
+        while (ix->paths[s]) s = (s + 1) & (ix->path_cap - 1);
+        ix->paths[s] = i + 1;
+    }
+    ix->paths_valid = 1;
+}
+
+/* Index of path in files, adding it when new. */
+static size_t find_file(SymIndex *ix, const char *path) {
+    if (!ix->paths_valid) build_paths(ix);
+    size_t s = fnv64(path, strlen(path), FNV_SEED) & (ix->path_cap - 1);
+    while (ix->paths[s]) {
+        size_t i = ix->paths[s] - 1;
+        if (strcmp(ix->files[i].path, path) == 0) return i;
+        s = (s + 1) & (ix->path_cap - 1);
+    }
+    if (ix->file_count == ix->file_cap) {
+        ix->file_cap = ix->file_cap ? ix->file_cap * 2 : 64;
+        ix->files = (SymFile*)ds_realloc(ix->files, ix->file_cap * sizeof(SymFile));
+    }
+    SymFile *f = &ix->files[ix->file_count];
+    memset(f, 0, sizeof(*f));
+    f->path = ds_strdup(path);
+    f->size = f->mtime = -1;
+    if ((ix->file_count + 1) * 2 > ix->path_cap) {
+        ix->file_count++;
+        build_paths(ix);
+    } else {
+        ix->paths[s] = ++ix->file_count;
+    }
+    return ix->file_count - 1;
+}
+
+static void add_entry(SymIndex *ix, int kind, const char *name, size_t file,
+                      size_t offset, size_t length, int line, uint64_t hash) {
+    if (ix->entry_count == ix->entry_cap) {
+        ix->entry_cap = ix->entry_cap ? ix->entry_cap * 2 : 256;
+        ix->entries = (SymEntry*)ds_realloc(ix->entries, ix->entry_cap * sizeof(SymEntry));
+    }
+    SymEntry *e = &ix->entries[ix->entry_count++];
+    e->name = ds_strdup(name);
+    e->kind = kind;
+    e->file = file;
+    e->offset = offset;
+    e->length = length;
+    e->line = line;
+    e->hash = hash;
+    ix->files[file].entries++;
+    ix->names_valid = 0;
+}
+
+static void remove_entries(SymIndex *ix, size_t file) {
+    if (ix->files[file].entries == 0) return;
+    size_t kept = 0;
+    for (size_t i = 0; i < ix->entry_count; ++i) {
+        if (ix->entries[i].file == file) {
+            free(ix->entries[i].name);
+            continue;
+        }
+        ix->entries[kept++] = ix->entries[i];
+    }
+    ix->entry_count = kept;
+    ix->files[file].entries = 0;
+    ix->names_valid = 0;
+}
+
+/* ---- indexing ---- */
+
+/* The tag a declaration defines (possibly under pointers, arrays or a
+ * function), as an index kind; -1 if it defines none. */
+static int defined_tag(const Type *t, const char **tag) {
+    while (t) {
+        switch (t->kind) {
+            case TYPE_POINTER: t = t->u.ptr.base; break;
+            case TYPE_ARRAY: t = t->u.array.base; break;
+            case TYPE_FUNCTION: t = t->u.func.ret; break;
+            case TYPE_STRUCT:
+            case TYPE_UNION:
+                if (!t->u.s.tag || !t->u.s.members) return -1;
+                *tag = t->u.s.tag;
+                return t->kind == TYPE_UNION ? KIND_UNION : KIND_STRUCT;
+            case TYPE_ENUM:
+                if (!t->u.en.tag || !t->u.en.values) return -1;
+                *tag = t->u.en.tag;
+                return KIND_ENUM;
+            default:
+                return -1;
+        }
+    }
+    return -1;
+}
+
+/* The text regions are cut from: the file as read or, with the
+ * preprocessor on, the file preprocessed on its own (only the -I paths and
+ * -D macros carried over), so that it does not depend on which files were
+ * indexed before it. Takes ownership of data; NULL on failure. */
+static char *index_text(const char *path, char *data, size_t len, const Options *opts, size_t *len_out) {
+    if (!opts->preprocess || !opts->pp) {
+        *len_out = len;
+        return data;
+    }
+    Options own = *opts;
+    own.pp = pp_copy(opts->pp);
+    ParseStats stats;
+    char *text = parse_prepare(path, data, len, &own, len_out, &stats);
+    pp_destroy(own.pp);
+    return text;
+}
+
+/* Cuts text into top-level declarations and records the names each one
+ * defines. Replaces whatever the index held for file. The regions are
+ * parsed again when queried, so nothing is reported here. */
+static void index_regions(SymIndex *ix, size_t file, const char *data, size_t len, const Options *opts) {
+    remove_entries(ix, file);
+    LexSplit *splits = NULL;
+    size_t count = lexer_find_splits(data, len, 1, &splits);
+    for (size_t k = 0; k < count; ++k) {
+        size_t begin = splits[k].offset;
+        size_t end = k + 1 < count ? splits[k + 1].offset : len;
+        ASTRoot *part = parse_range(data + begin, end - begin, splits[k].line, opts, 1);
+        uint64_t hash = fnv64(data + begin, end - begin, FNV_SEED);
+        for (const ASTNode *n = part->first; n; n = n->next) {
+            const char *tag;
+            int kind = defined_tag(n->type, &tag);
+            if (kind >= 0) add_entry(ix, kind, tag, file, begin, end - begin, splits[k].line, hash);
+            if (n->is_typedef && n->name) add_entry(ix, KIND_TYPEDEF, n->name, file, begin, end - begin, splits[k].line, hash);
+        }
+        ast_free(part);
+    }
+    free(splits);
+    ix->stats.files_indexed++;
+}
+
+/* Compares file with the disk once per run: a missing file is dropped, a
+ * changed one re-indexed unless its content hash is the same. */
+static void refresh_file(SymIndex *ix, size_t file, const Options *opts) {
+    SymFile *f = &ix->files[file];
+    if (f->checked) return;
+    f->checked = 1;
+    long long size, mtime;
+    if (!file_stat(f->path, &size, &mtime)) {
+        if (!f->dropped) {
+            f->dropped = 1;
+            ix->names_valid = 0;
+            ix->dirty = 1;
+            ix->stats.files_dropped++;
+        }
+        return;
+    }
+    if (!f->dropped && size == f->size && mtime == f->mtime) {
+        ix->stats.files_kept++;
+        return;
+    }
+    size_t len;
+    char *data = lexer_load_file(f->path, &len);
+    if (!data) {
+        fprintf(stderr, "failed to open: %s\n", f->path);
+        return;
+    }
+    uint64_t hash = fnv64(data, len, FNV_SEED);
+    if (f->dropped || hash != f->hash || f->entries == 0) {
+        size_t text_len;
+        char *text = index_text(f->path, data, len, opts, &text_len);
+        if (text) index_regions(ix, file, text, text_len, opts);
+        free(text);
+    } else {
+        ix->stats.files_kept++;
+        free(data);
+    }
+    f = &ix->files[file];
+    f->dropped = 0;
+    f->size = size;
+    f->mtime = mtime;
+    f->hash = hash;
+    ix->names_valid = 0;
+    ix->dirty = 1;
+}
+
+/* An index holds regions of either the raw or the preprocessed text; one
+ * built the other way than this run reads files is indexed again. */
+static void match_mode(SymIndex *ix, const Options *opts) {
+    int preprocessed = opts->preprocess && opts->pp;
+    if (ix->preprocessed == preprocessed) return;
+    ix->preprocessed = preprocessed;
+    ix->dirty = 1;
+    for (size_t i = 0; i < ix->file_count; ++i) {
+        remove_entries(ix, i);
+        ix->files[i].checked = 0;
+        ix->files[i].size = ix->files[i].mtime = -1;
+    }
+    for (size_t i = 0; i < ix->file_count; ++i) {
+        if (!ix->files[i].dropped) refresh_file(ix, i, opts);
+    }
+}
+
+int symindex_update(SymIndex *ix, const char *const *files, int count, const Options *opts) {
+    long long size, mtime;
+    match_mode(ix, opts);
+    for (int i = 0; i < count; ++i) {
+        if (!file_stat(files[i], &size, &mtime)) {
+            fprintf(stderr, "failed to open: %s\n", files[i]);
+            return 1;
+        }
+        refresh_file(ix, find_file(ix, files[i]), opts);
+    }
+    /* files indexed in earlier runs: drop the ones that are gone (a query
+     * alone only notices the files it reads) */
+    for (size_t i = 0; count > 0 && i < ix->file_count; ++i) {
+        SymFile *f = &ix->files[i];
+        if (!f->checked && !f->dropped && !file_stat(f->path, &size, &mtime)) refresh_file(ix, i, opts);
+    }
+    return 0;
+}
+
+/* ---- persistence ---- */
+
+static SymIndex *index_create(void) {
+    return (SymIndex*)ds_calloc(1, sizeof(SymIndex));
+}
+
+void symindex_destroy(SymIndex *ix) {
+    if (!ix) return;
+    for (size_t i = 0; i < ix->entry_count; ++i) free(ix->entries[i].name);
+    for (size_t i = 0; i < ix->file_count; ++i) free(ix->files[i].path);
+    free(ix->entries);
+    free(ix->files);
+    free(ix->names);
+    free(ix->paths);
+    free(ix);
+}
+
+/* Reads an unsigned number (base 10 or 16) and the space after it. */
+static int read_field(char **p, int base, unsigned long long *out) {
+    char *end;
+    *out = strtoull(*p, &end, base);
+    if (end == *p || (*end != ' ' && *end != '\0')) return 0;
+    *p = *end ? end + 1 : end;
+    return 1;
+}
+
+SymIndex *symindex_load(const char *path) {
+    SymIndex *ix = index_create();
+    size_t len;
+    char *text = lexer_load_file(path, &len);
+    if (!text) return ix;
+    size_t file = (size_t)-1;
+    int line_no = 0, ok = 1;
+    char *p = text, *end = text + len;
+    while (ok && p < end) {
+        char *eol = (char*)memchr(p, '\n', (size_t)(end - p));
+        if (!eol) eol = end;
+        *eol = '\0';
+        if (eol > p && eol[-1] == '\r') eol[-1] = '\0';
+        char *line = p;
+        p = eol + 1;
+        line_no++;
+        if (line_no == 1) {
+            ok = strcmp(line, INDEX_MAGIC) == 0;
+            continue;
+        }
+        if (line_no == 2 && strcmp(line, "P") == 0) {
+            ix->preprocessed = 1;
+            continue;
+        }
+        unsigned long long size, mtime, hash, offset, length, first;
+        char *q = line + 2;
+        if (line[0] == 'F' && line[1] == ' ') {
+            ok = read_field(&q, 10, &size) && read_field(&q, 10, &mtime) && read_field(&q, 16, &hash) && *q;
+            if (!ok) break;
+            file = find_file(ix, q);
+            ix->files[file].size = (long long)size;
+            ix->files[file].mtime = (long long)mtime;
+            ix->files[file].hash = hash;
+        } else if (line[0] == 'D' && line[1] == ' ' && file != (size_t)-1) {
+            ok = read_field(&q, 10, &offset) && read_field(&q, 10, &length) && read_field(&q, 10, &first) &&
+                 read_field(&q, 16, &hash) && q[0] && strchr(kind_letters, q[0]) && q[1] == ' ' && q[2];
+            if (!ok) break;
+            add_entry(ix, (int)(strchr(kind_letters, q[0]) - kind_letters), q + 2, file,
+                      (size_t)offset, (size_t)length, (int)first, hash);
+        } else if (line[0] != '\0') {
+            ok = 0;
+        }
+    }
+    free(text);
+    if (!ok) {
+        fprintf(stderr, "%s:%d: not a valid symbol index\n", path, line_no);
+        symindex_destroy(ix);
+        return NULL;
+    }
+    return ix;
+}
+
+int symindex_save(const SymIndex *ix, const char *path) {
+    size_t n = strlen(path);
+    char *tmp = (char*)ds_malloc(n + 5);
+    memcpy(tmp, path, n);
+    memcpy(tmp + n, ".tmp", 5);
+    FILE *out = fopen(tmp, "wb");
+    if (!out) {
+        fprintf(stderr, "failed to write: %s\n", tmp);
+        free(tmp);
+        return 1;
+    }
+    /* group entries by file, keeping their order within a file */
+    size_t *start = (size_t*)ds_calloc(ix->file_count + 1, sizeof(size_t));
+    size_t *order = (size_t*)ds_malloc((ix->entry_count + 1) * sizeof(size_t));
+    for (size_t i = 0; i < ix->entry_count; ++i) start[ix->entries[i].file + 1]++;
+    for (size_t f = 0; f < ix->file_count; ++f) start[f + 1] += start[f];
+    for (size_t i = 0; i < ix->entry_count; ++i) order[start[ix->entries[i].file]++] = i;
+    fprintf(out, "%s\n", INDEX_MAGIC);
+    if (ix->preprocessed) fprintf(out, "P\n");
+    size_t k = 0;
+    for (size_t f = 0; f < ix->file_count; ++f) {
+        const SymFile *sf = &ix->files[f];
+        size_t stop = start[f];
+        if (sf->dropped) {
+            k = stop;
+            continue;
+        }
+        fprintf(out, "F %lld %lld %016llx %s\n", sf->size, sf->mtime, (unsigned long long)sf->hash, sf->path);
+        for (; k < stop; ++k) {
+            const SymEntry *e = &ix->entries[order[k]];
+            fprintf(out, "D %llu %llu %d %016llx %c %s\n", (unsigned long long)e->offset,
+                    (unsigned long long)e->length, e->line, (unsigned long long)e->hash,
+                    kind_letters[e->kind], e->name);
+        }
+    }
+    free(order);
+    free(start);
+    int failed = ferror(out);
+    failed |= fclose(out) != 0;
+    if (!failed) {
+        remove(path);
+        failed = rename(tmp, path) != 0;
+    }
+    if (failed) {
+        fprintf(stderr, "failed to write: %s\n", path);
+        remove(tmp);
+    }
+    free(tmp);
+    return failed;
+}
+
+int symindex_dirty(const SymIndex *ix) {
+    return ix->dirty;
+}
+
+const SymIndexStats *symindex_stats(const SymIndex *ix) {
+    return &ix->stats;
+}
+
+/* ---- queries ---- */
+
+typedef struct {
+    int kind;
+    char *name;
+} Want;
+
+typedef struct {
+    char *data;    /* preprocessed text of the file, or NULL */
+    size_t len;
+    int read;      /* data was made */
+    int reindexed; /* the file was indexed again by this query */
+} QueryText;
+
+typedef struct {
+    SymIndex *ix;
+    const Options *opts;
+    QueryText *texts; /* per file, with the preprocessor on */
+    Want *wants;
+    size_t want_count, want_cap, want_head;
+    size_t *loaded; /* regions parsed, as (file, offset) pairs; open addressing */
+    size_t loaded_cap, loaded_count;
+} Query;
+
+static void want(Query *q, int kind, const char *name) {
+    if (q->want_count == q->want_cap) {
+        q->want_cap = q->want_cap ? q->want_cap * 2 : 64;
+        q->wants = (Want*)ds_realloc(q->wants, q->want_cap * sizeof(Want));
+    }
+    q->wants[q->want_count].kind = kind;
+    q->wants[q->want_count].name = ds_strdup(name);
+    q->want_count++;
+}
+
+static void want_mention(TypeKind kind, const char *name, void *user) {
+    want((Query*)user, kind == TYPE_ALIAS ? KIND_TYPEDEF : kind == TYPE_UNION ? KIND_UNION :
+                       kind == TYPE_ENUM ? KIND_ENUM : KIND_STRUCT, name);
+}
+
+/* Marks the region (file, offset) as loaded; returns 0 if it already was. */
+static int mark_loaded(Query *q, size_t file, size_t offset) {
+    if ((q->loaded_count + 1) * 2 > q->loaded_cap) {
+        size_t old_cap = q->loaded_cap;
+        size_t *old = q->loaded;
+        q->loaded_cap = old_cap ? old_cap * 2 : 64;
+        q->loaded = (size_t*)ds_calloc(q->loaded_cap * 2, sizeof(size_t));
+        q->loaded_count = 0;
+        for (size_t i = 0; i < old_cap; ++i) {
+            if (old[i * 2]) mark_loaded(q, old[i * 2] - 1, old[i * 2 + 1]);
+        }
+        free(old);
+    }
+    uint64_t key[2] = { file, offset };
+    size_t s = fnv64(key, sizeof(key), FNV_SEED) & (q->loaded_cap - 1);
+    while (q->loaded[s * 2]) {
+        if (q->loaded[s * 2] == file + 1 && q->loaded[s * 2 + 1] == offset) return 0;
+        s = (s + 1) & (q->loaded_cap - 1);
+    }
+    q->loaded[s * 2] = file + 1;
+    q->loaded[s * 2 + 1] = offset;
+    q->loaded_count++;
+    return 1;
+}
+
+/* Finds (kind, name), first bringing its file up to date. */
+static const SymEntry *resolve(Query *q, int kind, const char *name) {
+    const SymEntry *e = find_name(q->ix, kind, name);
+    if (e && !q->ix->files[e->file].checked) {
+        refresh_file(q->ix, e->file, q->opts);
+        e = find_name(q->ix, kind, name);
+    }
+    return e;
+}
+
+/* The bytes of e's region: read from its file or, with the preprocessor
+ * on, cut from the file's preprocessed text (made once per query). */
+static char *region_bytes(Query *q, const SymEntry *e, size_t *got) {
+    SymFile *f = &q->ix->files[e->file];
+    char *buf = (char*)ds_malloc(e->length + 1);
+    *got = 0;
+    if (q->ix->preprocessed) {
+        QueryText *t = &q->texts[e->file];
+        if (!t->read) {
+            t->read = 1;
+            size_t len;
+            char *data = lexer_load_file(f->path, &len);
+            if (data) t->data = index_text(f->path, data, len, q->opts, &t->len);
+        }
+        if (t->data && e->offset + e->length <= t->len) {
+            memcpy(buf, t->data + e->offset, e->length);
+            *got = e->length;
+        }
+    } else {
+        FILE *in = fopen(f->path, "rb");
+        if (in && fseek(in, (long)e->offset, SEEK_SET) == 0) *got = fread(buf, 1, e->length, in);
+        if (in) fclose(in);
+    }
+    buf[*got] = '\0';
+    if (!f->opened) {
+        f->opened = 1;
+        q->ix->stats.files_read++;
+    }
+    return buf;
+}
+
+/* Reads and parses the region of e, queues what it mentions and merges it.
+ * Returns 0 if the region no longer matches its file. With the preprocessor
+ * on, the file is then indexed again, once per query, since an included
+ * header or a -D may have changed what it preprocesses to; that returns -1
+ * and e is no longer valid. */
+static int load_region(Query *q, const SymEntry *e, TypeTable *types, ASTRoot *out) {
+    SymFile *f = &q->ix->files[e->file];
+    size_t got;
+    char *buf = region_bytes(q, e, &got);
+    if (got != e->length || fnv64(buf, got, FNV_SEED) != e->hash) {
+        free(buf);
+        QueryText *t = q->ix->preprocessed ? &q->texts[e->file] : NULL;
+        if (t && t->data && !t->reindexed) {
+            t->reindexed = 1;
+            index_regions(q->ix, e->file, t->data, t->len, q->opts);
+            q->ix->dirty = 1;
+            return -1;
+        }
+        fprintf(stderr, "%s changed while being queried; '%s' skipped\n", f->path, e->name);
+        return 0;
+    }
+    q->ix->stats.regions++;
+    q->ix->stats.bytes += got;
+    ASTRoot *part = parse_range(buf, got, e->line, q->opts, 0);
+    free(buf);
+    for (const ASTNode *n = part->first; n; n = n->next) depgraph_mentions(n->type, want_mention, q);
+    type_table_merge(types, out, part, f->path);
+    free(part);
+    return 1;
+}
+
+static int want_cmp(const void *a, const void *b) {
+    const Want *x = (const Want*)a, *y = (const Want*)b;
+    int c = strcmp(x->name, y->name);
+    return c ? c : x->kind - y->kind;
+}
+
+/* Warns once about each name the queried declarations mention that no
+ * indexed file defines (standard typedefs such as size_t aside). */
+static void report_unresolved(Want *unresolved, size_t count) {
+    static const char *const kind_words[] = { "", "struct ", "union ", "enum " };
+    if (count) qsort(unresolved, count, sizeof(Want), want_cmp);
+    for (size_t i = 0; i < count; ++i) {
+        const Want *w = &unresolved[i];
+        if (i > 0 && want_cmp(&unresolved[i - 1], &unresolved[i]) == 0) continue;
+        if (w->kind == KIND_TYPEDEF && builtin_is_standard(w->name)) continue;
+        fprintf(stderr, "'%s%s' is needed by the query but not in the index; it is left undefined\n",
+                kind_words[w->kind], w->name);
+    }
+}
+
+/* Splits an optional "struct "/"union "/"enum " prefix off a query name;
+ * returns the kind, or -1 for a bare name. */
+static int name_prefix(const char **name) {
+    static const struct { const char *prefix; int kind; } prefixes[] = {
+        { "struct ", KIND_STRUCT }, { "union ", KIND_UNION }, { "enum ", KIND_ENUM }
+    };
+    for (size_t i = 0; i < sizeof(prefixes) / sizeof(prefixes[0]); ++i) {
+        size_t n = strlen(prefixes[i].prefix);
+        if (strncmp(*name, prefixes[i].prefix, n) == 0) {
+            *name += n;
+            return prefixes[i].kind;
+        }
+    }
+    return -1;
+}
+
+size_t symindex_query(SymIndex *ix, const char *const *names, int count, const Options *opts, TypeTable *types, ASTRoot *out) {
+    Query q;
+    memset(&q, 0, sizeof(q));
+    q.ix = ix;
+    q.opts = opts;
+    match_mode(ix, opts);
+    q.texts = (QueryText*)ds_calloc(ix->file_count + 1, sizeof(QueryText));
+    for (size_t i = 0; i < ix->file_count; ++i) ix->files[i].opened = 0;
+    size_t missing = 0;
+    for (int r = 0; r < count; ++r) {
+        const char *name = names[r];
+        int kind = name_prefix(&name);
+        const SymEntry *e = NULL;
+        if (kind >= 0) {
+            e = resolve(&q, kind, name);
+        } else {
+            /* a typedef name first, then tags, like depgraph's roots */
+            for (int k = KIND_TYPEDEF; k <= KIND_ENUM && !e; ++k) e = resolve(&q, k, name);
+        }
+        if (!e) {
+            fprintf(stderr, "'%s' is not in the index\n", names[r]);
+            missing++;
+            continue;
+        }
+        want(&q, e->kind, e->name);
+    }
+    /* names defined outside the indexed files (or not at all) are skipped
+     * and reported afterwards */
+    Want *unresolved = NULL;
+    size_t unresolved_count = 0, unresolved_cap = 0;
+    while (q.want_head < q.want_count) {
+        Want w = q.wants[q.want_head++];
+        const SymEntry *e = resolve(&q, w.kind, w.name);
+        if (e && mark_loaded(&q, e->file, e->offset)) {
+            size_t file = e->file, offset = e->offset;
+            if (load_region(&q, e, types, out) < 0) {
+                /* indexed again: load the region that defines it now */
+                e = resolve(&q, w.kind, w.name);
+                if (e && (mark_loaded(&q, e->file, e->offset) || (e->file == file && e->offset == offset))) {
+                    load_region(&q, e, types, out);
+                }
+            }
+        }
+        if (!e) {
+            if (unresolved_count == unresolved_cap) {
+                unresolved_cap = unresolved_cap ? unresolved_cap * 2 : 16;
+                unresolved = (Want*)ds_realloc(unresolved, unresolved_cap * sizeof(Want));
+            }
+            unresolved[unresolved_count++] = w;
+        }
+    }
+    report_unresolved(unresolved, unresolved_count);
+    free(unresolved);
+    for (size_t i = 0; i < ix->file_count; ++i) free(q.texts[i].data);
+    free(q.texts);
+    for (size_t i = 0; i < q.want_count; ++i) free(q.wants[i].name);
+    free(q.wants);
+    free(q.loaded);
+    return missing;
+}
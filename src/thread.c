@@ -0,0 +1,167 @@
+#include <stdlib.h>
+#include <stdatomic.h>
+#include "thread.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+struct DsThread {
+#ifdef _WIN32
+    HANDLE handle;
+#else
+    pthread_t handle;
+#endif
+    ThreadFn fn;
+    void *arg;
+};
+
+#ifdef _WIN32
+static DWORD WINAPI thread_main(LPVOID p) {
+    DsThread *t = (DsThread*)p;
+    t->fn(t->arg);
+    return 0;
+}
+#else
+static void *thread_main(void *p) {
+    DsThread *t = (DsThread*)p;
+    t->fn(t->arg);
+    return NULL;
+}
+#endif
+
+DsThread *thread_start(ThreadFn fn, void *arg) {
+    DsThread *t = (DsThread*)calloc(1, sizeof(DsThread));
+    if (!t) return NULL;
+    t->fn = fn;
+    t->arg = arg;
+#ifdef _WIN32
+    t->handle = CreateThread(NULL, 0, thread_main, t, 0, NULL);
+    if (!t->handle) { free(t); return NULL; }
+#else
+    if (pthread_create(&t->handle, NULL, thread_main, t) != 0) { free(t); return NULL; }
+#endif
+    return t;
+}
+
+void thread_join(DsThread *t) {
+    if (!t) return;
+#ifdef _WIN32
+    WaitForSingleObject(t->handle, INFINITE);
+    CloseHandle(t->handle);
+#else
+    pthread_join(t->handle, NULL);
+#endif
+    free(t);
+}
+
+int cpu_count(void) {
+#ifdef _WIN32
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return si.dwNumberOfProcessors > 0 ? (int)si.dwNumberOfProcessors : 1;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+#endif
+}
+
+typedef struct {
+    ParallelFn fn;
+    void *arg;
+    int count;
+    atomic_int next;
+} ParallelJob;
+
+static void parallel_worker(void *p) {
+    ParallelJob *job = (ParallelJob*)p;
+    int i;
+    while ((i = atomic_fetch_add(&job->next, 1)) < job->count) {
+        job->fn(job->arg, i);
+    }
+}
+
+void parallel_for(int count, int workers, ParallelFn fn, void *arg) {
+    if (count <= 0) return;
+    if (workers > count) workers = count;
+    if (workers < 1) workers = 1;
+    ParallelJob job;
+    job.fn = fn;
+    job.arg = arg;
+    job.count = count;
+    atomic_init(&job.next, 0);
+    DsThread **threads = (DsThread**)calloc((size_t)workers, sizeof(DsThread*));
+    for (int w = 1; w < workers; ++w) threads[w] = thread_start(parallel_worker, &job);
+    parallel_worker(&job);
+    for (int w = 1; w < workers; ++w) thread_join(threads[w]);
+    free(threads);
+}
+
+struct DsMonitor {
+#ifdef _WIN32
+    CRITICAL_SECTION lock;
+    CONDITION_VARIABLE cond;
+#else
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+#endif
+};
+
+DsMonitor *monitor_create(void) {
+    DsMonitor *m = (DsMonitor*)calloc(1, sizeof(DsMonitor));
+    if (!m) return NULL;
+#ifdef _WIN32
+    InitializeCriticalSection(&m->lock);
+    InitializeConditionVariable(&m->cond);
+#else
+    pthread_mutex_init(&m->lock, NULL);
+    pthread_cond_init(&m->cond, NULL);
+#endif
+    return m;
+}
+
+void monitor_destroy(DsMonitor *m) {
+    if (!m) return;
+#ifdef _WIN32
+    DeleteCriticalSection(&m->lock);
+#else
+    pthread_cond_destroy(&m->cond);
+    pthread_mutex_destroy(&m->lock);
+#endif
+    free(m);
+}
+
+void monitor_lock(DsMonitor *m) {
+#ifdef _WIN32
+    EnterCriticalSection(&m->lock);
+#else
+    pthread_mutex_lock(&m->lock);
+#endif
+}
+
+void monitor_unlock(DsMonitor *m) {
+#ifdef _WIN32
+    LeaveCriticalSection(&m->lock);
+#else
+    pthread_mutex_unlock(&m->lock);
+#endif
+}
+
+void monitor_wait(DsMonitor *m) {
+#ifdef _WIN32
+    SleepConditionVariableCS(&m->cond, &m->lock, INFINITE);
+#else
+    pthread_cond_wait(&m->cond, &m->lock);
+#endif
+}
+
+void monitor_broadcast(DsMonitor *m) {
+#ifdef _WIN32
+    WakeAllConditionVariable(&m->cond);
+#else
+    pthread_cond_broadcast(&m->cond);
+#endif
+}